@@ -10,6 +10,7 @@
 //
 
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include "support/BROSCompat.h"
 #include "support/BRBIP39WordsEn.h"
@@ -85,14 +86,37 @@ runSyncMany (BREthereumNetwork newtork,
 int main(int argc, const char * argv[]) {
     BRCryptoSyncMode mode = CRYPTO_SYNC_MODE_API_WITH_P2P_SEND;
 
-    const char *paperKey = (argc > 1 ? argv[1] : "0xa9de3dbd7d561e67527bc1ecb025c59d53b9f7ef");
+    const char *paperKey = "0xa9de3dbd7d561e67527bc1ecb025c59d53b9f7ef";
+    int math = 0, txPeerMap = 0, paymentProtocol = 0, transactionSign = 0, simPeerSync = 0, selected = 0, failed = 0;
+
+    // '--math', '--tx-peer-map', '--payment-protocol', '--transaction-sign' and '--sim-peer-sync' select the perf
+    // suites to run; with none selected, every suite but the (long) simulated peer sync runs. The simulated peer sync
+    // needs the test override of the proof-of-work limit in the core library, so an optimized build must define it for
+    // every target, e.g. 'swift build -c release -Xcc -DBITCOIN_TEST_MAX_PROOF_OF_WORK', or the suite fails
+    for (int i = 1; i < argc; i++) {
+        if      (0 == strcmp (argv[i], "--math"))             math            = selected = 1;
+        else if (0 == strcmp (argv[i], "--tx-peer-map"))      txPeerMap       = selected = 1;
+        else if (0 == strcmp (argv[i], "--payment-protocol")) paymentProtocol = selected = 1;
+        else if (0 == strcmp (argv[i], "--transaction-sign")) transactionSign = selected = 1;
+        else if (0 == strcmp (argv[i], "--sim-peer-sync"))    simPeerSync     = selected = 1;
+        else paperKey = argv[i];
+    }
+
+    if (!selected) math = txPeerMap = paymentProtocol = transactionSign = 1;
+
     BREthereumAccount account = ethAccountCreate (paperKey);
     BREthereumTimestamp timestamp = 1539330275; // ETHEREUM_TIMESTAMP_UNKNOWN;
     const char *path = "core";
 
+    if (math)            runPerfTestsMath (100000);
+    if (txPeerMap)       BRRunPerfTestsTxPeerMap (100000);
+    if (paymentProtocol) BRRunPerfTestsPaymentProtocol (10000);
+    if (transactionSign) BRRunPerfTestsTransactionSign (1000);
+    if (simPeerSync)     failed |= ! BRRunPerfTestsSimPeerSync (20000, 0.01);
+
 #if defined (NEVER_EWM)
     runSyncTest (ethNetworkMainnet,  account, mode, timestamp,  5 * 60, path);
 //    runSyncMany(ethereumMainnet, mode, 10 * 60, 1000);
 #endif
-    return 0;
+    return failed;
 }
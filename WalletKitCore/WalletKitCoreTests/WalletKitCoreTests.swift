@@ -245,6 +245,14 @@ final class WalletKitCoreTests: XCTestCase {
         BRRunTestsSync (paperKey, bitcoinChain, (isMainnet ? 1 : 0));
     }
 
+    func testBitcoinSyncSimPeer () {
+        XCTAssert(1 == BRRunTestsSimPeerSync (2000, 0.05))
+    }
+
+    func testBitcoinSyncSimPeerRestart () {
+        XCTAssert(1 == BRRunTestsSimPeerRestart (2000, 0.05))
+    }
+
     func runBitcoinSyncMany (_ count: Int) {
         let group = DispatchGroup.init()
         for i in 1...count {
@@ -320,6 +328,12 @@ final class WalletKitCoreTests: XCTestCase {
         }
     }
 
+    func XtestPerformanceMath() {
+        self.measure {
+            runPerfTestsMath (10_000);
+        }
+    }
+
     private func createBitcoinNetwork(isMainnet: Bool, blockHeight: UInt64) -> BRCryptoNetwork {
         let uids = "bitcoin-" + (isMainnet ? "mainnet" : "testnet")
         let network = cryptoNetworkFindBuiltin(uids, isMainnet);
@@ -41,13 +41,19 @@
 
 #include "bitcoin/BRBloomFilter.h"
 #include "bitcoin/BRMerkleBlock.h"
+#include "bitcoin/BRBlockValidator.h"
+#include "bitcoin/BRCompactFilter.h"
 #include "bitcoin/BRWallet.h"
 #include "bitcoin/BRBIP38Key.h"
 #include "bitcoin/BRPeer.h"
 #include "bitcoin/BRPeerManager.h"
 #include "bitcoin/BRChainParams.h"
+#include "bitcoin/BRHeaderChain.h"
+#include "bitcoin/BRHeaderStore.h"
 #include "bitcoin/BRPaymentProtocol.h"
 #include "bitcoin/BRTransaction.h"
+#include "bitcoin/BRTxPeerMap.h"
+#include "bitcoin/BRPeerScores.h"
 
 #include "test.h"
 
@@ -57,6 +63,7 @@
 #include <inttypes.h>
 #include <errno.h>
 #include <time.h>
+#include <sys/time.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <pthread.h>
@@ -714,6 +721,14 @@ int BRHashTests()
     
     if (BRMurmur3_32("\x00", 1, 0) != 0x514e28b7)
         r = 0, fprintf(stderr, "***FAILED*** %s: BRMurmur3_32() test 4\n", __func__);
+
+    uint32_t seeds[] = { 0, 0x5082edee, 0xfba4c795, 0xfffffffe, 0x12345 }, hashes[5];
+    
+    BRMurmur3_32Seeds(hashes, "\x21\x43\x65\x87\x00", 5, seeds, 5);
+    for (size_t i = 0; i < 5; i++) {
+        if (hashes[i] != BRMurmur3_32("\x21\x43\x65\x87\x00", 5, seeds[i]))
+            r = 0, fprintf(stderr, "***FAILED*** %s: BRMurmur3_32Seeds() test %zu\n", __func__, i + 1);
+    }
     
     // test sipHash-64
 
@@ -789,6 +804,27 @@ int BRMacTests()
                "\xb1\xa3\x4d\x4a\x6b\x4b\x63\x6e\x07\x0a\x38\xbc\xe7\x37", mac, 64) != 0)
         r = 0, fprintf(stderr, "***FAILED*** %s: BRHMAC() sha512 test 2\n", __func__);
     
+    // test pbkdf2
+
+    uint8_t dk[100], pw[200];
+    
+    BRPBKDF2(dk, 64, BRSHA512, 512/8, "password", strlen("password"), "salt", strlen("salt"), 2);
+    if (memcmp("\xe1\xd9\xc1\x6a\xa6\x81\x70\x8a\x45\xf5\xc7\xc4\xe2\x15\xce\xb6\x6e\x01\x1a\x2e\x9f\x00\x40\x71\x3f"
+               "\x18\xae\xfd\xb8\x66\xd5\x3c\xf7\x6c\xab\x28\x68\xa3\x9b\x9f\x78\x40\xed\xce\x4f\xef\x5a\x82\xbe\x67"
+               "\x33\x5c\x77\xa6\x06\x8e\x04\x11\x27\x54\xf2\x7c\xcf\x4e", dk, 64) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPBKDF2() sha512 test 1\n", __func__);
+    
+    for (size_t i = 0; i < sizeof(pw); i++) pw[i] = i; // key longer than the sha512 block size
+    char salt2[] = "saltsaltsaltsaltsaltsaltsaltsaltsaltsaltsaltsaltsaltsaltsaltsaltsaltsaltsalt"
+                   "saltsaltsaltsaltsaltsaltsaltsaltsaltsaltsaltsaltsaltsaltsaltsaltsaltsaltsalt";
+    
+    BRPBKDF2(dk, sizeof(dk), BRSHA512, 512/8, pw, sizeof(pw), salt2, sizeof(salt2) - 1, 3);
+    if (memcmp("\x17\xfb\xb3\x12\x8c\x47\xa1\x3e\x2a\xc8\x54\x71\xee\xdf\x67\x21\x2f\x04\xfd\x32\xaa\x69\x1a\xa9\xd2"
+               "\x21\x22\x75\x93\x70\x0d\xf4\x68\x57\xa3\xaa\x56\xbf\x8a\x09\xec\x9e\xc1\x09\xc2\x87\x10\x40\x26\x37"
+               "\xbc\xd2\x9c\x21\x7b\x5e\x34\xae\xb6\x85\x5a\x24\xa2\xdc\xb3\xb1\xb1\xb1\x7a\x4b\x50\x06\x87\x51\xbc"
+               "\x3a\x1f\x28\x70\x16\x45\x43\x40\x21\x6c\x3f\x38\x92\x1e\x68\xaa\x63\x99\xd4\x1d\x2d\x01\xf1\x19\xc3", dk, sizeof(dk)) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPBKDF2() sha512 test 2\n", __func__);
+    
     // test poly1305
 
     const char key1[] = "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0",
@@ -1175,6 +1211,49 @@ int BRAuthEncryptTests()
     if (len != sizeof(cipher2) - 1 || memcmp(cipher2, out2, len) != 0)
         r = 0, fprintf(stderr, "***FAILED*** %s: BRChacha20Poly1305AEADEncrypt() cipher test 2\n", __func__);
 
+    // streaming, in place, in pieces that don't line up with chacha20 or poly1305 blocks
+    BRChacha20Poly1305Stream stream;
+    uint8_t buf3[sizeof(msg2) - 1], mac3[16];
+    size_t pieces[] = { 1, 15, 64, 100, 3, sizeof(buf3) };
+    
+    memcpy(buf3, msg2, sizeof(buf3));
+    BRChacha20Poly1305StreamInit(&stream, key2, nonce2, ad2, sizeof(ad2) - 1);
+    
+    for (size_t i = 0, j = 0; i < sizeof(buf3); i += len, j++) {
+        len = (pieces[j] < sizeof(buf3) - i) ? pieces[j] : sizeof(buf3) - i;
+        BRChacha20Poly1305StreamEncrypt(&stream, &buf3[i], len);
+    }
+    
+    BRChacha20Poly1305StreamFinal(&stream, mac3);
+    if (memcmp(cipher2, buf3, sizeof(buf3)) != 0 || memcmp(&cipher2[sizeof(buf3)], mac3, sizeof(mac3)) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRChacha20Poly1305StreamEncrypt() test\n", __func__);
+
+    BRChacha20Poly1305StreamInit(&stream, key2, nonce2, ad2, sizeof(ad2) - 1);
+    
+    for (size_t i = 0, j = 0; i < sizeof(buf3); i += len, j++) {
+        len = (pieces[j] < sizeof(buf3) - i) ? pieces[j] : sizeof(buf3) - i;
+        BRChacha20Poly1305StreamDecrypt(&stream, &buf3[i], len);
+    }
+    
+    if (! BRChacha20Poly1305StreamVerify(&stream, mac3) || memcmp(msg2, buf3, sizeof(buf3)) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRChacha20Poly1305StreamDecrypt() test\n", __func__);
+
+    // long enough for the multi-block chacha20 path, in place
+    uint8_t msg4[4099], buf4[sizeof(msg4) + 16], mac4[16];
+
+    for (size_t i = 0; i < sizeof(msg4); i++) msg4[i] = (uint8_t)(i*7);
+    len = BRChacha20Poly1305AEADEncrypt(buf4, sizeof(buf4), key1, nonce1, msg4, sizeof(msg4), ad1, sizeof(ad1) - 1);
+    BRChacha20Poly1305StreamInit(&stream, key1, nonce1, ad1, sizeof(ad1) - 1);
+    BRChacha20Poly1305StreamEncrypt(&stream, msg4, 1000);
+    BRChacha20Poly1305StreamEncrypt(&stream, &msg4[1000], sizeof(msg4) - 1000);
+    BRChacha20Poly1305StreamFinal(&stream, mac4);
+    if (len != sizeof(buf4) || memcmp(buf4, msg4, sizeof(msg4)) != 0 || memcmp(&buf4[sizeof(msg4)], mac4, 16) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRChacha20Poly1305StreamEncrypt() test 2\n", __func__);
+
+    len = BRChacha20Poly1305AEADDecrypt(buf4, sizeof(buf4), key1, nonce1, buf4, sizeof(buf4), ad1, sizeof(ad1) - 1);
+    if (len != sizeof(msg4) || buf4[4098] != (uint8_t)(4098*7) || buf4[513] != (uint8_t)(513*7))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRChacha20Poly1305AEADDecrypt() in place test\n", __func__);
+
     return r;
 }
 
@@ -1743,6 +1822,19 @@ int BRBIP38KeyTests()
 
     printf("privKey:%s\n", privKey);
 
+    // batch decrypt, the last key uses a different passphrase
+    const char *bip38Keys[] = { "6PRVWUbkzzsbcVac2qwfssoUJAN1Xhrg6bNk8J7Nzm5H7kxEbn2Nh2ZoGg",
+                                "6PYNKZ1EAgYgmQfmNVamxyXVWHzK5s6DGhwP4J5o44cvXdoY7sRzhtpUeo",
+                                "6PYLtMnXvfG3oJde97zRyLYFZCYizPU5T3LwgdYJz1fRhh16bU7u6PPmY7" };
+    BRKey keys[3];
+    int results[3];
+    
+    if (BRKeySetBIP38Keys(keys, results, bip38Keys, 3, "TestingOneTwoThree", BRMainNetParams->addrParams) != 2 ||
+        ! results[0] || ! results[1] || results[2] ||
+        ! BRKeyPrivKey(&keys[1], privKey, sizeof(privKey), BRMainNetParams->addrParams) ||
+        strncmp(privKey, "L44B5gGEpqEDRS9vVPz7QT35jcBG2r3CZwSwQ4fCewXAhAhqGVpP", sizeof(privKey)) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRKeySetBIP38Keys() test\n", __func__);
+
     // EC multiplied, uncompressed, no lot/sequence number
     if (! BRKeySetBIP38Key(&key, "6PfQu77ygVyJLZjfvMLyhLMQbYnu5uguoJJ4kMCLqWwPEdfpwANVS76gTX", "TestingOneTwoThree", BRMainNetParams->addrParams) ||
         ! BRKeyPrivKey(&key, privKey, sizeof(privKey), BRMainNetParams->addrParams) ||
@@ -2035,6 +2127,17 @@ int BRBIP39MnemonicTests()
                     "\xf4\x76\xc4\x5c\x88\x25\x32\x76\xd9\xfd\x0d\xf6\xef\x48\x60\x9e\x8b\xb7\xdc\xa8"))
         r = 0, fprintf(stderr, "***FAILED*** %s: BRBIP39DeriveKey() test 8\n", __func__);
 
+    const char *phrases[] = { phrase, phrase2, phrase3, phrase4, phrase5, phrase6, phrase7 };
+    uint8_t keys[sizeof(phrases)/sizeof(*phrases)][64];
+    
+    BRBIP39DeriveKeys(keys, phrases, "TREZOR", sizeof(phrases)/sizeof(*phrases));
+    
+    for (size_t i = 0; i < sizeof(phrases)/sizeof(*phrases); i++) {
+        BRBIP39DeriveKey(key.u8, phrases[i], "TREZOR");
+        if (memcmp(keys[i], key.u8, sizeof(key)) != 0)
+            r = 0, fprintf(stderr, "***FAILED*** %s: BRBIP39DeriveKeys() test %zu\n", __func__, i + 1);
+    }
+
     return r;
 }
 
@@ -2339,6 +2442,58 @@ int BRTransactionTests()
     if (len8 != sizeof(buf9) - 1 || memcmp(buf8, buf9, len8))
         r = 0, fprintf(stderr, "\n***FAILED*** %s: BRTransactionSign() test 4", __func__);
 
+    BRKeySetSecret(&k[1], &secret, 1); // k[0] still has the key from test 4
+    BRKeyLegacyAddr(&k[0], addr.s, sizeof(addr), BRMainNetParams->addrParams);
+    BRKeyAddress(&k[1], address.s, sizeof(address), BRMainNetParams->addrParams);
+
+    uint8_t script5[BRAddressScriptPubKey(NULL, 0, BRMainNetParams->addrParams, addr.s)],
+            script6[BRAddressScriptPubKey(NULL, 0, BRMainNetParams->addrParams, address.s)];
+    size_t script5Len = BRAddressScriptPubKey(script5, sizeof(script5), BRMainNetParams->addrParams, addr.s),
+           script6Len = BRAddressScriptPubKey(script6, sizeof(script6), BRMainNetParams->addrParams, address.s);
+    uint8_t script7[sizeof(script5)]; // pay-to-pubkey-hash script for a key that isn't passed in
+
+    memcpy(script7, script5, sizeof(script5));
+    script7[5] ^= 0xff;
+
+    for (int forkId = 0; forkId <= 0x40; forkId += 0x40) { // signing on one or several threads gives the same tx
+        // double-sha256 of the serialization that the sequential signer before BRTransactionSignParallel() gave
+        UInt256 expected = (forkId) ? uint256("872f09639b35652cd209e54190d94b6e4508be6e594abbca32348994ca96eca1") :
+                                      uint256("75b2dd6dd43444415ba606fae9334fced2dff65d998bf8545ab65a2373c3d952");
+        UInt256 md10, md11;
+        BRTransaction *tx2;
+
+        tx = BRTransactionNew();
+
+        for (uint32_t i = 0; i < 60; i++) {
+            UInt256 hash = inHash;
+
+            hash.u32[0] = i;
+            BRTransactionAddInput(tx, hash, i, 100000 + i, (i % 10 == 9) ? script7 : (i % 2) ? script6 : script5,
+                                  (i % 10 == 9) ? sizeof(script7) : (i % 2) ? script6Len : script5Len,
+                                  NULL, 0, NULL, 0, TXIN_SEQUENCE);
+        }
+
+        BRTransactionAddOutput(tx, 4000000, script5, script5Len);
+        tx2 = BRTransactionCopy(tx);
+        BRTransactionSign(tx, forkId, k, 2);
+        BRTransactionSignParallel(tx2, forkId, k, 2, 4);
+
+        uint8_t buf10[BRTransactionSerialize(tx, NULL, 0)], buf11[BRTransactionSerialize(tx2, NULL, 0)];
+        size_t len10 = BRTransactionSerialize(tx, buf10, sizeof(buf10)),
+               len11 = BRTransactionSerialize(tx2, buf11, sizeof(buf11));
+
+        BRSHA256_2(&md10, buf10, len10);
+        BRSHA256_2(&md11, buf11, len11);
+
+        if (! UInt256Eq(md10, expected) || ! UInt256Eq(md11, expected) || tx2->inputs[0].sigLen == 0 ||
+            tx2->inputs[1].witLen == 0 || tx2->inputs[9].sigLen != 0 || tx2->inputs[9].witLen != 0)
+            r = 0, fprintf(stderr, "\n***FAILED*** %s: BRTransactionSignParallel() test %d", __func__,
+                           (forkId) ? 2 : 1);
+
+        BRTransactionFree(tx);
+        BRTransactionFree(tx2);
+    }
+
     char buf0[] = "\x01\x00\x00\x00\x00\x01\x01\x7b\x03\x2f\x6a\x65\x1c\x7d\xcb\xcf\xb7\x8d\x81\x7b\x30\x3b\xe8\xd2\x0a"
     "\xfa\x22\x90\x16\x18\xb5\x17\xf2\x17\x55\xa7\xcd\x8d\x48\x01\x00\x00\x00\x23\x22\x00\x20\xe0\x62\x7b\x64\x74\x59"
     "\x05\x64\x6f\x27\x6f\x35\x55\x02\xa4\x05\x30\x58\xb6\x4e\xdb\xf2\x77\x11\x92\x49\x61\x1c\x98\xda\x41\x69\xff\xff"
@@ -2386,6 +2541,15 @@ int BRTransactionTests()
     tgt = BRTransactionCopy(src);
     if (! BRTransactionEqual(tgt, src))
         r = 0, fprintf(stderr, "\n***FAILED*** %s: BRTransactionCopy() test 3", __func__);
+    BRTransactionFree(src);
+
+    src = BRTransactionCopy(tgt); // copy of a compact tx
+    BRTransactionAddOutput(tgt, 1000000, script, scriptLen); // moves the compact tx inputs and outputs to new arrays
+    tgt->outCount--;
+    if (! BRTransactionEqual(tgt, src) || tgt->outputs[tgt->outCount].amount != 1000000 || tgt->compact ||
+        ! src->compact)
+        r = 0, fprintf(stderr, "\n***FAILED*** %s: BRTransactionCopy() test 4", __func__);
+    tgt->outCount++;
     BRTransactionFree(tgt);
     BRTransactionFree(src);
     
@@ -2540,7 +2704,65 @@ int BRWalletTests()
 
     if (tx && BRWalletTransactionIsPending(w, tx))
         r = 0, fprintf(stderr, "***FAILED*** %s: BRWalletTransactionIsPending() test 2\n", __func__);
-    
+
+    if (tx) { // wallet built from transactions out of order should sort them and match
+        BRTransaction *txs[] = { BRTransactionCopy(tx), BRTransactionCopy(BRWalletTransactionForHash(w, hash)) }, *t[2];
+        BRWallet *w2 = BRWalletNew(BRMainNetParams->addrParams, txs, 2, mpk);
+
+        if (BRWalletBalance(w2) != BRWalletBalance(w) || BRWalletTransactions(w2, t, 2) != 2 ||
+            ! UInt256Eq(t[0]->txHash, hash) || ! UInt256Eq(t[1]->txHash, tx->txHash))
+            r = 0, fprintf(stderr, "***FAILED*** %s: BRWalletNew() test 2\n", __func__);
+
+        BRWalletFree(w2);
+    }
+
+    if (tx) { // wallet restored from a snapshot should match, and a stale snapshot should be ignored
+        size_t snapshotLen = BRWalletSnapshot(w, NULL, 0);
+        uint8_t snapshot[snapshotLen];
+        BRTransaction *txs[] = { BRTransactionCopy(tx), BRTransactionCopy(BRWalletTransactionForHash(w, hash)) }, *t[2];
+        BRWallet *w2;
+
+        if (BRWalletSnapshot(w, snapshot, snapshotLen) != snapshotLen)
+            r = 0, fprintf(stderr, "***FAILED*** %s: BRWalletSnapshot() test\n", __func__);
+
+        w2 = BRWalletNewWithSnapshot(BRMainNetParams->addrParams, txs, 2, mpk, snapshot, snapshotLen);
+        if (! BRWalletIsRestoredFromSnapshot(w2) || BRWalletBalance(w2) != BRWalletBalance(w) ||
+            BRWalletTransactions(w2, t, 2) != 2 ||
+            ! UInt256Eq(t[0]->txHash, hash) || ! UInt256Eq(t[1]->txHash, tx->txHash) ||
+            ! BRAddressEq(BRWalletReceiveAddress(w2).s, BRWalletReceiveAddress(w).s))
+            r = 0, fprintf(stderr, "***FAILED*** %s: BRWalletNewWithSnapshot() test 1\n", __func__);
+
+        BRWalletFree(w2);
+        txs[0] = BRTransactionCopy(tx), txs[1] = BRTransactionCopy(BRWalletTransactionForHash(w, hash));
+        txs[0]->blockHeight = 1; // a tx at another height than in the snapshot means the wallet is rebuilt
+        w2 = BRWalletNewWithSnapshot(BRMainNetParams->addrParams, txs, 2, mpk, snapshot, snapshotLen);
+        t[0] = BRTransactionCopy(tx), t[1] = BRTransactionCopy(BRWalletTransactionForHash(w, hash));
+        t[0]->blockHeight = 1;
+
+        BRWallet *w3 = BRWalletNew(BRMainNetParams->addrParams, t, 2, mpk);
+
+        if (BRWalletIsRestoredFromSnapshot(w2) || BRWalletBalance(w2) != BRWalletBalance(w3) ||
+            BRWalletTransactions(w2, t, 2) != 2 || ! UInt256Eq(t[0]->txHash, tx->txHash))
+            r = 0, fprintf(stderr, "***FAILED*** %s: BRWalletNewWithSnapshot() test 2\n", __func__);
+
+        BRWalletFree(w2);
+        BRWalletFree(w3);
+
+        for (int i = 0; i < 2; i++) { // a truncated, then a corrupted snapshot means the wallet is rebuilt
+            txs[0] = BRTransactionCopy(tx), txs[1] = BRTransactionCopy(BRWalletTransactionForHash(w, hash));
+            if (i == 1) snapshot[snapshotLen - 1] ^= 0xff;
+            w2 = BRWalletNewWithSnapshot(BRMainNetParams->addrParams, txs, 2, mpk, snapshot, snapshotLen - 1 + i);
+
+            if (BRWalletIsRestoredFromSnapshot(w2) || BRWalletBalance(w2) != BRWalletBalance(w) ||
+                BRWalletTransactions(w2, t, 2) != 2 || ! UInt256Eq(t[0]->txHash, hash) ||
+                ! UInt256Eq(t[1]->txHash, tx->txHash) ||
+                ! BRAddressEq(BRWalletReceiveAddress(w2).s, BRWalletReceiveAddress(w).s))
+                r = 0, fprintf(stderr, "***FAILED*** %s: BRWalletNewWithSnapshot() test %d\n", __func__, 3 + i);
+
+            BRWalletFree(w2);
+        }
+    }
+
     BRWalletRemoveTransaction(w, hash); // removing first tx should recursively remove second, leaving none
     if (BRWalletTransactions(w, NULL, 0) != 0)
         r = 0, fprintf(stderr, "***FAILED*** %s: BRWalletRemoveTransaction() test\n", __func__);
@@ -2670,6 +2892,41 @@ int BRBloomFilterTests()
     if (len2 != sizeof(d2) - 1 || memcmp(buf2, d2, len2) != 0)
         r = 0, fprintf(stderr, "***FAILED*** %s: BRBloomFilterSerialize() test 2\n", __func__);
     
+    // 11 of 24 bits set with 5 hash functions
+    if (f->bitCount != 11 || BRBloomFilterFalsePositiveRate(f) < 0.0202 || BRBloomFilterFalsePositiveRate(f) > 0.0204)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRBloomFilterFalsePositiveRate() test 1\n", __func__);
+    
+    BRBloomFilterFree(f);
+    f = BRBloomFilterParse(buf2, len2);
+    
+    if (! f || f->bitCount != 11)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRBloomFilterParse() test 1\n", __func__);
+    
+    if (f) BRBloomFilterFree(f);
+    f = BRBloomFilterNewLocal(0.01, 1000);
+    
+    UInt160 pkh = UINT160_ZERO;
+    size_t fp = 0;
+    
+    for (uint32_t i = 0; i < 1000; i++) {
+        UInt32SetLE(pkh.u8, i), BRBloomFilterInsertData(f, pkh.u8, sizeof(pkh));
+    }
+    
+    for (uint32_t i = 0; i < 1000; i++) {
+        UInt32SetLE(pkh.u8, i);
+        if (! BRBloomFilterContainsData(f, pkh.u8, sizeof(pkh)))
+            r = 0, fprintf(stderr, "***FAILED*** %s: BRBloomFilterNewLocal() test 1\n", __func__);
+    }
+    
+    for (uint32_t i = 1000; i < 11000; i++) {
+        UInt32SetLE(pkh.u8, i);
+        if (BRBloomFilterContainsData(f, pkh.u8, sizeof(pkh))) fp++;
+    }
+    
+    // about 1% of 10,000 non-members should match
+    if (fp > 200 || BRBloomFilterSerialize(f, NULL, 0) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRBloomFilterNewLocal() test 2\n", __func__);
+    
     BRBloomFilterFree(f);
     return r;
 }
@@ -2720,6 +2977,53 @@ int BRMerkleBlockTests()
     if (! BRMerkleBlockIsValid(b, (uint32_t)time(NULL)))
         r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockParse() test\n", __func__);
     
+    UInt256 blockHash;
+    
+    if (! BRMerkleBlockIsValidData((uint8_t *)block, sizeof(block) - 1, (uint32_t)time(NULL), &blockHash) ||
+        ! UInt256Eq(blockHash, b->blockHash))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockIsValidData() test 1\n", __func__);
+    
+    BRMerkleBlock *b2 = BRMerkleBlockParseValid((uint8_t *)block, sizeof(block) - 1, blockHash);
+    
+    if (! b2 || ! UInt256Eq(b2->blockHash, b->blockHash) || b2->hashesCount != b->hashesCount ||
+        memcmp(b2->hashes, b->hashes, b->hashesCount*sizeof(UInt256)) != 0 || b2->flagsLen != b->flagsLen ||
+        memcmp(b2->flags, b->flags, b->flagsLen) != 0 || ! UInt256Eq(b2->merkleRoot, b->merkleRoot) ||
+        b2->totalTx != b->totalTx || b2->nonce != b->nonce)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockParseValid() test\n", __func__);
+    
+    if (b2) BRMerkleBlockFree(b2);
+    
+    memcpy(block2, block, sizeof(block2));
+    block2[sizeof(block2) - 40] ^= 0x01; // corrupt a tx hash, merkle root no longer matches
+    
+    if (BRMerkleBlockIsValidData(block2, sizeof(block2), (uint32_t)time(NULL), &blockHash) ||
+        ! UInt256Eq(blockHash, b->blockHash))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockIsValidData() test 2\n", __func__);
+    
+    if (BRMerkleBlockIsValidData(block2, sizeof(block2) - 2, (uint32_t)time(NULL), &blockHash) ||
+        ! UInt256IsZero(blockHash))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockIsValidData() test 3\n", __func__);
+    
+    BRBlockCheck checks[100];
+    
+    for (size_t i = 0; i < 100; i++) { // a window large enough to be split across the worker threads
+        checks[i] = (BRBlockCheck) { (i % 7) ? (uint8_t *)block : block2, sizeof(block2), UINT256_ZERO, 0 };
+    }
+    
+    BRBlockValidatorRun(checks, 100, (uint32_t)time(NULL));
+    
+    for (size_t i = 0; i < 100; i++) {
+        if (checks[i].valid == ((i % 7) != 0) && UInt256Eq(checks[i].blockHash, b->blockHash)) continue;
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRBlockValidatorRun() test 1\n", __func__);
+        break;
+    }
+
+    memcpy(block2, block, sizeof(block2));
+    block2[75] = 0xff; // target size byte far out of range
+
+    if (BRMerkleBlockIsValidData(block2, 80, (uint32_t)time(NULL), &blockHash) || UInt256IsZero(blockHash))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockIsValidData() test 4\n", __func__);
+
     if (BRMerkleBlockSerialize(b, block2, sizeof(block2)) != sizeof(block2) ||
         memcmp(block, block2, sizeof(block2)) != 0)
         r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockSerialize() test\n", __func__);
@@ -2768,6 +3072,82 @@ int BRMerkleBlockTests()
     return r;
 }
 
+int BRCompactFilterTests()
+{
+    int r = 1;
+    // testnet genesis block coinbase output script, from the BIP158 test vectors
+    uint8_t script[] = "\x41\x04\x67\x8a\xfd\xb0\xfe\x55\x48\x27\x19\x67\xf1\xa6\x71\x30\xb7\x10\x5c\xd6\xa8\x28\xe0\x39"
+    "\x09\xa6\x79\x62\xe0\xea\x1f\x61\xde\xb6\x49\xf6\xbc\x3f\x4c\xef\x38\xc4\xf3\x55\x04\xe5\x1e\xc1\x12\xde\x5c\x38"
+    "\x4d\xf7\xba\x0b\x8d\x57\x8a\x4c\x70\x2b\x6b\xf1\x1d\x5f\xac";
+    UInt256 blockHash = UInt256Reverse(uint256("000000000933ea01ad0ee984209779baaec3ced90fa3f408719526f8d77f4943"));
+    size_t len, lens[] = { sizeof(script) - 1 };
+    uint8_t filter[16];
+
+    len = BRCompactFilterBuild(filter, sizeof(filter), blockHash, script, lens, 1);
+    
+    if (len != 4 || memcmp(filter, "\x01\x9d\xfc\xa8", 4) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRCompactFilterBuild() test 1\n", __func__);
+    
+    if (! UInt256Eq(UInt256Reverse(BRCompactFilterHeader(BRCompactFilterHash(filter, len), UINT256_ZERO)),
+                    uint256("21584579b7eb08997773e5aeff3a7f932700042d0ed2a6129012b7d7ae81b750")))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRCompactFilterHeader() test 1\n", __func__);
+    
+    if (! BRCompactFilterMatchAny(filter, len, blockHash, script, lens, 1))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRCompactFilterMatchAny() test 1\n", __func__);
+
+    script[1] ^= 0x01;
+    
+    if (BRCompactFilterMatchAny(filter, len, blockHash, script, lens, 1))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRCompactFilterMatchAny() test 2\n", __func__);
+    
+    if (! BRCompactFilterMatchAny((const uint8_t *)"\xfd\x01", 2, blockHash, script, lens, 1)) // truncated count
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRCompactFilterMatchAny() test 3\n", __func__);
+    
+    return r;
+}
+
+// returns true if a view of the serialized request in buf has the same fields, certificates and digest as req
+static int _BRPaymentProtocolRequestViewMatches(BRPaymentProtocolRequest *req, const uint8_t *buf, size_t bufLen)
+{
+    BRPaymentProtocolRequestView view;
+    BRPaymentProtocolDetailsView details;
+    const uint8_t *cert, *script;
+    uint8_t md[32], viewMd[32];
+    size_t i, len, scriptLen;
+    uint64_t amount;
+    int r = BRPaymentProtocolRequestViewParse(&view, buf, bufLen) &&
+            BRPaymentProtocolDetailsViewParse(&details, view.details, view.detailsLen);
+    
+    if (r && (view.version != req->version || view.pkiTypeLen != strlen(req->pkiType) ||
+              strncmp(view.pkiType, req->pkiType, view.pkiTypeLen) != 0 || view.sigLen != req->sigLen ||
+              (view.sigLen > 0 && memcmp(view.signature, req->signature, view.sigLen) != 0))) r = 0;
+    
+    if (r && (details.outCount != req->details->outCount || details.time != req->details->time ||
+              details.expires != req->details->expires || details.networkLen != strlen(req->details->network) ||
+              strncmp(details.network, req->details->network, details.networkLen) != 0)) r = 0;
+    
+    for (i = 0; r && i < details.outCount; i++) {
+        if (! BRPaymentProtocolDetailsViewOutput(&details, i, &amount, &script, &scriptLen) ||
+            amount != req->details->outputs[i].amount || scriptLen != req->details->outputs[i].scriptLen ||
+            memcmp(script, req->details->outputs[i].script, scriptLen) != 0) r = 0;
+    }
+    
+    if (BRPaymentProtocolDetailsViewOutput(&details, i, &amount, &script, &scriptLen)) r = 0;
+    
+    for (i = 0; r && (len = BRPaymentProtocolRequestViewCert(&view, &cert, i)) > 0; i++) {
+        uint8_t reqCert[BRPaymentProtocolRequestCert(req, NULL, 0, i)];
+        
+        if (BRPaymentProtocolRequestCert(req, reqCert, sizeof(reqCert), i) != len || memcmp(cert, reqCert, len) != 0)
+            r = 0;
+    }
+    
+    if (r && BRPaymentProtocolRequestCert(req, NULL, 0, i) != 0) r = 0;
+    len = BRPaymentProtocolRequestDigest(req, md, sizeof(md));
+    if (r && (BRPaymentProtocolRequestViewDigest(&view, viewMd, sizeof(viewMd)) != len ||
+              memcmp(md, viewMd, len) != 0)) r = 0;
+    return r;
+}
+
 int BRPaymentProtocolTests()
 {
     int r = 1;
@@ -2951,6 +3331,9 @@ int BRPaymentProtocolTests()
     if (req->details->expires == 0 || req->details->expires >= time(NULL)) // check that request is expired
         r = 0, fprintf(stderr, "***FAILED*** %s: BRPaymentProtocolRequest->details->expires test 1\n", __func__);
     
+    if (! _BRPaymentProtocolRequestViewMatches(req, buf3, sizeof(buf3)))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPaymentProtocolRequestViewParse() test 1\n", __func__);
+    
     if (req) BRPaymentProtocolRequestFree(req);
 
     const char buf5[] = "\x0a\x00\x12\x5f\x54\x72\x61\x6e\x73\x61\x63\x74\x69\x6f\x6e\x20\x72\x65\x63\x65\x69\x76\x65"
@@ -3107,6 +3490,9 @@ int BRPaymentProtocolTests()
     if (req->details->expires == 0 || req->details->expires >= time(NULL)) // check that request is expired
         r = 0, fprintf(stderr, "***FAILED*** %s: BRPaymentProtocolRequest->details->expires test 2\n", __func__);
     
+    if (! _BRPaymentProtocolRequestViewMatches(req, (const uint8_t *)buf7, sizeof(buf7) - 1))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPaymentProtocolRequestViewParse() test 2\n", __func__);
+    
     if (req) BRPaymentProtocolRequestFree(req);
     
     // test garbage input
@@ -3120,6 +3506,11 @@ int BRPaymentProtocolTests()
     if (len > 0)
         r = 0, fprintf(stderr, "***FAILED*** %s: BRPaymentProtocolRequestParse/Serialize() test 3\n", __func__);
     
+    BRPaymentProtocolRequestView view;
+    
+    if (BRPaymentProtocolRequestViewParse(&view, (const uint8_t *)buf9, sizeof(buf9) - 1))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPaymentProtocolRequestViewParse() test 3\n", __func__);
+    
     printf("                                    ");
     return r;
 }
@@ -3204,6 +3595,467 @@ int BRPaymentProtocolEncryptionTests()
     return r;
 }
 
+// the timestamp of the test header at height, about 600 seconds after the one before it, but not always in order
+#define TEST_HEADER_TIME(height) (1500000000 + (uint32_t)(height)*600 + ((uint32_t)(height)*7919) % 601 - 300)
+
+// sets the test headers from height from up to to in chain, with hashes derived from height, each one connected to the
+// one before it starting from the header in b, and leaves the last header set in b
+static void _BRTestHeaderChainFill(BRHeaderChain *chain, uint32_t from, uint32_t to, BRMerkleBlock *b)
+{
+    for (uint32_t i = from; i < to; i++) {
+        b->prevBlock = b->blockHash;
+        b->blockHash = UINT256_ZERO, b->blockHash.u32[0] = i, b->blockHash.u32[7] = 1;
+        b->version = 0x20000000, b->merkleRoot.u32[1] = i, b->timestamp = TEST_HEADER_TIME(i), b->target = 0x18034567;
+        b->nonce = i*7, b->height = i;
+        BRHeaderChainSet(chain, b);
+    }
+}
+
+int BRHeaderChainTests()
+{
+    int r = 1;
+    BRHeaderChain *chain = BRHeaderChainNew(100);
+    BRMerkleBlock b = BR_MERKLE_BLOCK_NONE, h;
+    UInt256 hash;
+    
+    // a chain of 5000 blocks, with hashes derived from height, starting at a difficulty transition
+    _BRTestHeaderChainFill(chain, 2016, 7016, &b);
+    
+    if (BRHeaderChainHeight(chain) != 7015 || ! BRHeaderChainGet(chain, 7015, &h) || ! BRMerkleBlockEq(&h, &b) ||
+        ! UInt256Eq(h.prevBlock, b.prevBlock) || ! UInt256Eq(h.merkleRoot, b.merkleRoot) || h.version != b.version ||
+        h.timestamp != b.timestamp || h.target != b.target || h.nonce != b.nonce || h.height != 7015)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRHeaderChainGet() test 1\n", __func__);
+    
+    // old headers are pruned, except for difficulty transitions
+    if (BRHeaderChainGet(chain, 6000, &h) || ! BRHeaderChainGet(chain, 6048, &h) || h.blockHash.u32[0] != 6048 ||
+        ! UInt256IsZero(BRHeaderChainHash(chain, 4033)) || BRHeaderChainHash(chain, 4032).u32[0] != 4032)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRHeaderChainGet() test 2\n", __func__);
+    
+    if (BRHeaderChainTransitionTime(chain, 6048) != TEST_HEADER_TIME(4032) ||
+        BRHeaderChainTransitionTime(chain, 7000) != TEST_HEADER_TIME(6048) || BRHeaderChainTransitionTime(chain, 2016))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRHeaderChainTransitionTime() test 1\n", __func__);
+    
+    uint32_t timestamps[3], targets[3];
+
+    if (! BRHeaderChainWindow(chain, 7015, b.blockHash, timestamps, targets, 3) ||
+        timestamps[0] != TEST_HEADER_TIME(7015) || timestamps[2] != TEST_HEADER_TIME(7013) || targets[1] != b.target ||
+        BRHeaderChainWindow(chain, 7015, b.prevBlock, timestamps, targets, 3) ||
+        BRHeaderChainWindow(chain, 7015, b.blockHash, timestamps, targets, 1000))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRHeaderChainWindow() test 1\n", __func__);
+    
+    // replacing a header drops the ones above it
+    hash = BRHeaderChainHash(chain, 7000);
+    BRHeaderChainGet(chain, 6990, &b);
+    b.nonce++, b.blockHash.u32[7] = 2;
+    BRHeaderChainSet(chain, &b);
+    
+    if (BRHeaderChainHeight(chain) != 6990 || ! UInt256IsZero(BRHeaderChainHash(chain, 7000)) ||
+        UInt256Eq(hash, BRHeaderChainHash(chain, 6990)) || BRHeaderChainHash(chain, 6989).u32[7] != 1)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRHeaderChainSet() test 1\n", __func__);
+    
+    // a header that doesn't connect restarts the chain
+    b.height = 9000;
+    BRHeaderChainSet(chain, &b);
+    
+    if (BRHeaderChainHeight(chain) != 9000 || BRHeaderChainGet(chain, 6989, &h) || ! BRHeaderChainGet(chain, 6048, &h))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRHeaderChainSet() test 2\n", __func__);
+    
+    // a header that restarts the chain below it drops the difficulty transitions above it
+    b.height = 5000;
+    BRHeaderChainSet(chain, &b);
+    
+    if (BRHeaderChainHeight(chain) != 5000 || BRHeaderChainGet(chain, 6048, &h) || ! BRHeaderChainGet(chain, 4032, &h) ||
+        BRHeaderChainTransitionTime(chain, 6049) != 0 ||
+        BRHeaderChainTransitionTime(chain, 5000) != TEST_HEADER_TIME(4032))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRHeaderChainSet() test 3\n", __func__);
+    
+    BRHeaderChainFree(chain);
+    
+    // bitcoin cash difficulty adjustment gives the same result reading ancestors from a header chain or a block set
+    BRMerkleBlock blocks[200];
+    BRSet *blockSet = BRSetNew(BRMerkleBlockHash, BRMerkleBlockEq, 200);
+    int pass = 0, same = 1, v;
+    
+    chain = BRHeaderChainNew(0);
+    b = BR_MERKLE_BLOCK_NONE;
+    
+    _BRTestHeaderChainFill(chain, 600000, 600200, &b);
+    
+    for (uint32_t i = 0; i < 200; i++) {
+        BRHeaderChainGet(chain, 600000 + i, &blocks[i]);
+        BRSetAdd(blockSet, &blocks[i]);
+    }
+    
+    b.prevBlock = b.blockHash;
+    b.blockHash.u32[0]++, b.timestamp += 600, b.height++;
+    
+    for (uint32_t t = 0x18034567 - 0x1000; t < 0x18034567 + 0x1000; t++) {
+        b.target = t;
+        v = BRBCashParams->verifyDifficulty(&b, blockSet, chain);
+        if (v != BRBCashParams->verifyDifficulty(&b, blockSet, NULL)) same = 0;
+        pass += v;
+    }
+    
+    if (! same || pass < 1 || pass > 2) r = 0, fprintf(stderr, "***FAILED*** %s: verifyDifficulty() test 1\n", __func__);
+    BRSetFree(blockSet);
+    BRHeaderChainFree(chain);
+    return r;
+}
+
+int BRHeaderStoreTests()
+{
+    int r = 1;
+    char path[] = "/tmp/BRHeaderStoreTestsXXXXXX";
+    int fd = mkstemp(path);
+    BRHeaderStore *store = (fd >= 0 && close(fd) == 0) ? BRHeaderStoreOpen(path) : NULL;
+    BRHeaderChain *chain = BRHeaderChainNew(100);
+    BRMerkleBlock b = BR_MERKLE_BLOCK_NONE, h;
+    FILE *f;
+    
+    if (! store || BRHeaderStoreHeight(store) != BLOCK_UNKNOWN_HEIGHT) {
+        fprintf(stderr, "***FAILED*** %s: BRHeaderStoreOpen() test 1\n", __func__);
+        if (store) BRHeaderStoreClose(store);
+        if (fd >= 0) unlink(path);
+        BRHeaderChainFree(chain);
+        return 0;
+    }
+    
+    // a chain of 5000 blocks written through a header chain, enough to grow the file
+    BRHeaderChainSetStore(chain, store);
+    
+    _BRTestHeaderChainFill(chain, 2016, 7016, &b);
+    
+    // headers pruned from the chain are paged in from the store
+    if (! BRHeaderChainGet(chain, 3000, &h) || h.blockHash.u32[0] != 3000 || h.timestamp != TEST_HEADER_TIME(3000) ||
+        BRHeaderChainHash(chain, 4033).u32[0] != 4033 ||
+        BRHeaderChainTransitionTime(chain, 4033) != TEST_HEADER_TIME(4032))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRHeaderStoreGet() test 1\n", __func__);
+    
+    // headers above the last block recorded were set ahead of their blocks
+    BRHeaderStoreSetLastBlockHeight(store, 5000);
+    BRHeaderChainFree(chain);
+    BRHeaderStoreClose(store);
+    store = BRHeaderStoreOpen(path);
+    
+    if (! store || BRHeaderStoreBaseHeight(store) != 2016 || BRHeaderStoreHeight(store) != 7015 ||
+        ! BRHeaderStoreGet(store, 7015, &h) || ! BRMerkleBlockEq(&h, &b) || ! UInt256Eq(h.prevBlock, b.prevBlock) ||
+        ! UInt256Eq(h.merkleRoot, b.merkleRoot) || h.version != b.version || h.timestamp != b.timestamp ||
+        h.target != b.target || h.nonce != b.nonce || h.height != 7015 || BRHeaderStoreGet(store, 2015, &h) ||
+        BRHeaderStoreLastBlockHeight(store) != 5000)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRHeaderStoreOpen() test 2\n", __func__);
+    
+    // replacing a header truncates the ones above it, setting the same header again doesn't
+    if (store) {
+        BRHeaderStoreGet(store, 6990, &b);
+        BRHeaderStoreSet(store, &b);
+        b.nonce++, b.blockHash.u32[7] = 2;
+        BRHeaderStoreSet(store, &b);
+    }
+    
+    if (! store || BRHeaderStoreHeight(store) != 6990 || BRHeaderStoreHash(store, 6990).u32[7] != 2 ||
+        BRHeaderStoreHash(store, 6989).u32[7] != 1 || ! UInt256IsZero(BRHeaderStoreHash(store, 6991)))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRHeaderStoreSet() test 1\n", __func__);
+    
+    // the last block recorded is never above the most recent record
+    if (store) BRHeaderStoreSetLastBlockHeight(store, 7010);
+    
+    if (! store || BRHeaderStoreLastBlockHeight(store) != 6990)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRHeaderStoreLastBlockHeight() test 1\n", __func__);
+    
+    if (store) BRHeaderStoreClose(store);
+    
+    // a torn write to the most recent record empties the store
+    f = fopen(path, "r+b");
+    if (f) fseek(f, 64 + (6990 - 2016)*(32 + 80) + 40, SEEK_SET), fputc(0xff, f), fclose(f);
+    store = BRHeaderStoreOpen(path);
+    
+    if (! store || BRHeaderStoreHeight(store) != BLOCK_UNKNOWN_HEIGHT || BRHeaderStoreGet(store, 3000, &h) ||
+        BRHeaderStoreLastBlockHeight(store) != BLOCK_UNKNOWN_HEIGHT)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRHeaderStoreOpen() test 3\n", __func__);
+    
+    if (store) BRHeaderStoreClose(store);
+    unlink(path);
+    return r;
+}
+
+static int _txPeerMapKeepTest(void *info, UInt256 txHash)
+{
+    return UInt256Eq(txHash, *(UInt256 *)info);
+}
+
+int BRTxPeerMapTests()
+{
+    int r = 1;
+    UInt256 h1 = UINT256_ZERO, h2 = UINT256_ZERO, h3 = UINT256_ZERO;
+    BRPeer p1 = BR_PEER_NONE, p2 = BR_PEER_NONE, p[TX_PEER_MAP_MAX_PEERS + 1];
+    BRTxPeerMap *map = BRTxPeerMapNew(TX_PEER_MAP_TTL, &h3, _txPeerMapKeepTest);
+    
+    h1.u8[0] = 1, h2.u8[0] = 2, h3.u8[0] = 3;
+    p1.address.u32[3] = 1, p2.address.u32[3] = 2, p1.port = p2.port = 8333;
+    
+    if (BRTxPeerMapAddPeer(map, h1, &p1) != 1 || BRTxPeerMapAddPeer(map, h1, &p2) != 2 ||
+        BRTxPeerMapAddPeer(map, h1, &p1) != 2 || BRTxPeerMapCount(map, h1) != 2)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRTxPeerMapAddPeer() test 1\n", __func__);
+    
+    if (! BRTxPeerMapHasPeer(map, h1, &p2) || BRTxPeerMapHasPeer(map, h2, &p2) || BRTxPeerMapCount(map, h2) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRTxPeerMapHasPeer() test 1\n", __func__);
+    
+    if (! BRTxPeerMapRemovePeer(map, h1, &p1) || BRTxPeerMapRemovePeer(map, h1, &p1) ||
+        BRTxPeerMapHasPeer(map, h1, &p1) || BRTxPeerMapCount(map, h1) != 1)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRTxPeerMapRemovePeer() test 1\n", __func__);
+    
+    BRTxPeerMapAddPeer(map, h2, &p2);
+    BRTxPeerMapRemovePeerAll(map, &p2);
+    
+    if (BRTxPeerMapTxCount(map) != 0 || BRTxPeerMapHasPeer(map, h2, &p2))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRTxPeerMapRemovePeerAll() test 1\n", __func__);
+    
+    // only the entry the keep callback asks for survives its ttl
+    BRTxPeerMapAddPeer(map, h1, &p1);
+    BRTxPeerMapAddPeer(map, h3, &p1);
+    
+    if (BRTxPeerMapExpire(map, time(NULL)) != 0 || BRTxPeerMapExpire(map, time(NULL) + TX_PEER_MAP_TTL + 1) != 1 ||
+        BRTxPeerMapCount(map, h1) != 0 || BRTxPeerMapCount(map, h3) != 1)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRTxPeerMapExpire() test 1\n", __func__);
+    
+    // once every slot is taken, the least recently used peer is dropped to make room
+    for (size_t i = 0; i < TX_PEER_MAP_MAX_PEERS + 1; i++) {
+        p[i] = BR_PEER_NONE, p[i].address.u32[3] = (uint32_t)(i + 10), p[i].port = 8333;
+        BRTxPeerMapAddPeer(map, h2, &p[i]);
+    }
+    
+    if (BRTxPeerMapCount(map, h2) != TX_PEER_MAP_MAX_PEERS || ! BRTxPeerMapHasPeer(map, h2, &p[TX_PEER_MAP_MAX_PEERS]))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRTxPeerMapAddPeer() test 2\n", __func__);
+    
+    BRTxPeerMapFree(map);
+    return r;
+}
+
+// feeds invCount inv announcements through the relay/request bookkeeping BRPeerManager does for each one, with every
+// tx announced by four of eight peers, and reports nanoseconds per announcement
+void BRRunPerfTestsTxPeerMap(size_t invCount)
+{
+    BRTxPeerMap *relays = BRTxPeerMapNew(TX_PEER_MAP_TTL, NULL, NULL),
+                *requests = BRTxPeerMapNew(TX_PEER_MAP_TTL, NULL, NULL);
+    BRPeer peers[8];
+    UInt256 n = UINT256_ZERO, txHash;
+    size_t sink = 0;
+    clock_t start;
+    
+    printf("==== TxPeerMap Perf: %zu inv announcements\n", invCount);
+    
+    for (size_t i = 0; i < 8; i++) {
+        peers[i] = BR_PEER_NONE, peers[i].address.u32[3] = (uint32_t)(i + 1), peers[i].port = 8333;
+    }
+    
+    start = clock();
+    
+    for (size_t i = 0; i < invCount; i++) {
+        BRPeer *peer = &peers[(i + i/4) % 8];
+        
+        UInt32SetLE(n.u8, (uint32_t)(i/4));
+        BRSHA256(&txHash, &n, sizeof(n));
+        
+        if (! BRTxPeerMapHasPeer(relays, txHash, peer) && ! BRTxPeerMapHasPeer(requests, txHash, peer)) {
+            BRTxPeerMapAddPeer(requests, txHash, peer); // getdata
+        }
+        
+        sink += BRTxPeerMapAddPeer(relays, txHash, peer); // tx received
+        BRTxPeerMapRemovePeer(requests, txHash, peer);
+    }
+    
+    printf("    Announce         : %8.1f ns\n", 1e9*(double)(clock() - start)/CLOCKS_PER_SEC/(double)invCount);
+    printf("    (tx: %zu, sink: %zu)\n", BRTxPeerMapTxCount(relays), sink);
+    BRTxPeerMapFree(relays);
+    BRTxPeerMapFree(requests);
+}
+
+int BRPeerScoresTests()
+{
+    int r = 1;
+    double now = 1600000000.0;
+    BRPeer p[4], sorted[4];
+    BRPeerStats stats;
+    BRPeerScores *scores = BRPeerScoresNew();
+    
+    for (size_t i = 0; i < 4; i++) {
+        p[i] = BR_PEER_NONE, p[i].address.u32[3] = (uint32_t)(i + 1), p[i].port = 8333;
+        p[i].timestamp = (uint64_t)now - 1000*(i + 1);
+    }
+    
+    if (BRPeerScoresGet(scores, &p[0], &stats) || BRPeerScoresCost(scores, &p[0]) != PEER_SCORE_DEFAULT_COST)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerScoresCost() test 1\n", __func__);
+    
+    // p[2] sends a throughput sample of 1000 blocks per second
+    BRPeerScoresAddPing(scores, &p[2], 0.1, now);
+    for (size_t i = 0; i <= PEER_SCORE_WINDOW; i++) BRPeerScoresAddBlock(scores, &p[2], now + i*0.001);
+    
+    if (! BRPeerScoresGet(scores, &p[2], &stats) || stats.blockCount != PEER_SCORE_WINDOW + 1 ||
+        stats.blockRate < 999.0 || stats.blockRate > 1001.0 || stats.pingTime != 0.1 ||
+        BRPeerScoresCost(scores, &p[2]) > 0.1 + PEER_SCORE_BATCH/999.0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerScoresAddBlock() test 1\n", __func__);
+    
+    // blocks more than PEER_SCORE_IDLE_TIME apart never make a throughput sample
+    for (size_t i = 0; i <= PEER_SCORE_WINDOW; i++) BRPeerScoresAddBlock(scores, &p[1], now + i*PEER_SCORE_IDLE_TIME*2);
+    
+    if (! BRPeerScoresGet(scores, &p[1], &stats) || stats.blockRate != 0 ||
+        BRPeerScoresCost(scores, &p[1]) != PEER_SCORE_DEFAULT_COST)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerScoresAddBlock() test 2\n", __func__);
+    
+    BRPeerScoresAddStall(scores, &p[0], now);
+    BRPeerScoresAddMisbehavin(scores, &p[3], now);
+    
+    if (BRPeerScoresCost(scores, &p[0]) != PEER_SCORE_DEFAULT_COST + PEER_SCORE_STALL_PENALTY ||
+        BRPeerScoresCost(scores, &p[3]) != PEER_SCORE_DEFAULT_COST + PEER_SCORE_BAD_PENALTY)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerScoresAddStall() test 1\n", __func__);
+    
+    // fast p[2] first, then typical p[1] by timestamp, then stalled p[0] ahead of misbehaving p[3] by timestamp
+    memcpy(sorted, p, sizeof(p));
+    BRPeerScoresSort(scores, sorted, 4);
+    
+    if (! BRPeerEq(&sorted[0], &p[2]) || ! BRPeerEq(&sorted[1], &p[1]) || ! BRPeerEq(&sorted[2], &p[0]) ||
+        ! BRPeerEq(&sorted[3], &p[3]))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerScoresSort() test 1\n", __func__);
+    
+    // the same order survives sorting by timestamp alone once timestamps are stamped
+    memcpy(sorted, p, sizeof(p));
+    BRPeerScoresStamp(scores, sorted, 4);
+    
+    if (sorted[2].timestamp <= sorted[1].timestamp || sorted[1].timestamp <= sorted[0].timestamp ||
+        sorted[0].timestamp <= sorted[3].timestamp || sorted[1].timestamp != p[1].timestamp ||
+        sorted[0].timestamp != p[0].timestamp - PEER_SCORE_TIMESTAMP_PENALTY)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerScoresStamp() test 1\n", __func__);
+    
+    // a completed throughput sample halves the stall count
+    for (size_t i = 0; i <= PEER_SCORE_WINDOW; i++) BRPeerScoresAddBlock(scores, &p[0], now + i*0.01);
+    
+    if (! BRPeerScoresGet(scores, &p[0], &stats) || stats.stallCount != 0 || stats.blockRate < 99.0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerScoresAddBlock() test 3\n", __func__);
+    
+    BRPeerScoresFree(scores);
+    return r;
+}
+
+// parses a signed request with a three certificate chain and two outputs count times, reading every certificate and
+// output, then hashes it count times, and reports nanoseconds per request for the copying parser and for views
+void BRRunPerfTestsPaymentProtocol(size_t count)
+{
+    const size_t certLens[] = { 1500, 1250, 1100 };
+    uint8_t pkiData[4096], script[25], merchantData[32], signature[256], md[32];
+    BRTxOutput outputs[2] = { BR_TX_OUTPUT_NONE, BR_TX_OUTPUT_NONE };
+    BRPaymentProtocolRequest *req;
+    BRPaymentProtocolRequestView view;
+    BRPaymentProtocolDetailsView details;
+    const uint8_t *cert, *data;
+    size_t i, j, off = 0, bufLen, dataLen, sink = 0;
+    uint64_t amount;
+    uint8_t *buf;
+    clock_t start;
+    
+    for (i = 0; i < sizeof(certLens)/sizeof(*certLens); i++) { // repeated certificate field of an X509Certificates
+        pkiData[off++] = 0x0a, pkiData[off++] = (certLens[i] & 0x7f) | 0x80, pkiData[off++] = certLens[i] >> 7;
+        for (j = 0; j < certLens[i]; j++) pkiData[off++] = (uint8_t)(j*31 + i);
+    }
+    
+    for (i = 0; i < sizeof(script); i++) script[i] = (uint8_t)(i*7);
+    for (i = 0; i < sizeof(merchantData); i++) merchantData[i] = (uint8_t)(i*13);
+    for (i = 0; i < sizeof(signature); i++) signature[i] = (uint8_t)(i*17);
+    outputs[0].script = outputs[1].script = script, outputs[0].scriptLen = outputs[1].scriptLen = sizeof(script);
+    outputs[0].amount = 1234567, outputs[1].amount = 7654;
+    req = BRPaymentProtocolRequestNew(1, "x509+sha256", pkiData, off,
+                                      BRPaymentProtocolDetailsNew("main", outputs, 2, 1500000000, 1500000900,
+                                                                  "Payment request for invoice 1234",
+                                                                  "https://example.com/i/1234", merchantData,
+                                                                  sizeof(merchantData)),
+                                      signature, sizeof(signature));
+    bufLen = BRPaymentProtocolRequestSerialize(req, NULL, 0);
+    buf = malloc(bufLen);
+    assert(buf != NULL);
+    bufLen = BRPaymentProtocolRequestSerialize(req, buf, bufLen);
+    BRPaymentProtocolRequestFree(req);
+    printf("==== PaymentProtocol Perf: %zu requests of %zu bytes\n", count, bufLen);
+    start = clock();
+    
+    for (i = 0; i < count; i++) {
+        req = BRPaymentProtocolRequestParse(buf, bufLen);
+        
+        for (j = 0; (dataLen = BRPaymentProtocolRequestCert(req, NULL, 0, j)) > 0; j++) {
+            uint8_t c[dataLen];
+            
+            sink += BRPaymentProtocolRequestCert(req, c, sizeof(c), j);
+        }
+        
+        sink += req->details->outCount;
+        BRPaymentProtocolRequestFree(req);
+    }
+    
+    printf("    Parse            : %8.1f ns\n", 1e9*(double)(clock() - start)/CLOCKS_PER_SEC/(double)count);
+    req = BRPaymentProtocolRequestParse(buf, bufLen);
+    start = clock();
+    for (i = 0; i < count; i++) sink += BRPaymentProtocolRequestDigest(req, md, sizeof(md)) + md[0];
+    printf("    Digest           : %8.1f ns\n", 1e9*(double)(clock() - start)/CLOCKS_PER_SEC/(double)count);
+    BRPaymentProtocolRequestFree(req);
+    start = clock();
+    
+    for (i = 0; i < count; i++) {
+        BRPaymentProtocolRequestViewParse(&view, buf, bufLen);
+        BRPaymentProtocolDetailsViewParse(&details, view.details, view.detailsLen);
+        for (j = 0; BRPaymentProtocolRequestViewCert(&view, &cert, j) > 0; j++) sink += cert[0];
+        for (j = 0; BRPaymentProtocolDetailsViewOutput(&details, j, &amount, &data, &dataLen); j++) sink += dataLen;
+    }
+    
+    printf("    View Parse       : %8.1f ns\n", 1e9*(double)(clock() - start)/CLOCKS_PER_SEC/(double)count);
+    start = clock();
+    for (i = 0; i < count; i++) sink += BRPaymentProtocolRequestViewDigest(&view, md, sizeof(md)) + md[0];
+    printf("    View Digest      : %8.1f ns\n", 1e9*(double)(clock() - start)/CLOCKS_PER_SEC/(double)count);
+    printf("    (sink: %zu)\n", sink);
+    free(buf);
+}
+
+// signs a tx spending inCount outputs, alternately pay-to-pubkey-hash and pay-to-witness-pubkey-hash, each to its own
+// key, on one thread and then on one thread per cpu, and reports the wall time of each
+void BRRunPerfTestsTransactionSign(size_t inCount)
+{
+    BRKey *keys = calloc(inCount, sizeof(*keys));
+    BRTransaction *tx = BRTransactionNew(), *tx2;
+    BRAddress addr;
+    UInt256 secret = UINT256_ZERO, hash = UINT256_ZERO;
+    uint8_t script[25]; // large enough for either kind of script
+    size_t i, scriptLen;
+    struct timeval start, end;
+
+    assert(keys != NULL);
+    printf("==== TransactionSign Perf: %zu inputs\n", inCount);
+
+    for (i = 0; i < inCount; i++) {
+        UInt32SetBE(&secret.u8[28], (uint32_t)(i + 1));
+        BRKeySetSecret(&keys[i], &secret, 1);
+        if (i % 2) BRKeyAddress(&keys[i], addr.s, sizeof(addr), BRMainNetParams->addrParams);
+        else BRKeyLegacyAddr(&keys[i], addr.s, sizeof(addr), BRMainNetParams->addrParams);
+        scriptLen = BRAddressScriptPubKey(script, sizeof(script), BRMainNetParams->addrParams, addr.s);
+        hash.u32[0] = (uint32_t)(i + 1);
+        BRTransactionAddInput(tx, hash, 0, 100000, script, scriptLen, NULL, 0, NULL, 0, TXIN_SEQUENCE);
+    }
+
+    BRTransactionAddOutput(tx, 100000*inCount/2, script, scriptLen);
+    tx2 = BRTransactionCopy(tx);
+    gettimeofday(&start, NULL);
+    BRTransactionSign(tx, 0, keys, inCount);
+    gettimeofday(&end, NULL);
+    printf("    Sign             : %8.1f ms\n",
+           1e3*(double)(end.tv_sec - start.tv_sec) + 1e-3*(double)(end.tv_usec - start.tv_usec));
+    gettimeofday(&start, NULL);
+    BRTransactionSignParallel(tx2, 0, keys, inCount, 0);
+    gettimeofday(&end, NULL);
+    printf("    Sign Parallel    : %8.1f ms\n",
+           1e3*(double)(end.tv_sec - start.tv_sec) + 1e-3*(double)(end.tv_usec - start.tv_usec));
+    printf("    (signed: %d, same: %d)\n", BRTransactionIsSigned(tx2), UInt256Eq(tx->wtxHash, tx2->wtxHash));
+    BRTransactionFree(tx);
+    BRTransactionFree(tx2);
+    for (i = 0; i < inCount; i++) BRKeyClean(&keys[i]);
+    free(keys);
+}
+
 void BRPeerAcceptMessageTest(BRPeer *peer, const uint8_t *msg, size_t len, const char *type);
 
 int BRPeerTests()
@@ -3268,10 +4120,20 @@ int BRRunTests()
     printf("%s\n", (BRBloomFilterTests()) ? "success" : (fail++, "***FAIL***"));
     printf("BRMerkleBlockTests...               ");
     printf("%s\n", (BRMerkleBlockTests()) ? "success" : (fail++, "***FAIL***"));
+    printf("BRCompactFilterTests...             ");
+    printf("%s\n", (BRCompactFilterTests()) ? "success" : (fail++, "***FAIL***"));
+    printf("BRHeaderChainTests...               ");
+    printf("%s\n", (BRHeaderChainTests()) ? "success" : (fail++, "***FAIL***"));
+    printf("BRHeaderStoreTests...               ");
+    printf("%s\n", (BRHeaderStoreTests()) ? "success" : (fail++, "***FAIL***"));
     printf("BRPaymentProtocolTests...           ");
     printf("%s\n", (BRPaymentProtocolTests()) ? "success" : (fail++, "***FAIL***"));
     printf("BRPaymentProtocolEncryptionTests... ");
     printf("%s\n", (BRPaymentProtocolEncryptionTests()) ? "success" : (fail++, "***FAIL***"));
+    printf("BRTxPeerMapTests...                 ");
+    printf("%s\n", (BRTxPeerMapTests()) ? "success" : (fail++, "***FAIL***"));
+    printf("BRPeerScoresTests...                ");
+    printf("%s\n", (BRPeerScoresTests()) ? "success" : (fail++, "***FAIL***"));
     printf("\n");
     
     if (fail > 0) printf("%d TEST FUNCTION(S) ***FAILED***\n", fail);
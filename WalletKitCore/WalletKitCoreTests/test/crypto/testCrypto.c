@@ -1503,6 +1503,163 @@ runCryptoWalletManagerLifecycleWithSetModeTest (BRCryptoAccount account,
     return success;
 }
 
+///
+/// Mark: Wallet Sweeper Tests
+///
+
+#define SWEEPER_BATCH_TEST_FUNDING_COUNT     (20)
+#define SWEEPER_BATCH_TEST_OUTPUT_COUNT      (100)
+#define SWEEPER_BATCH_TEST_SAT_PER_BYTE      (10)
+
+static int
+runCryptoWalletSweeperBatchTest (BRCryptoAccount account,
+                                 BRCryptoNetwork network,
+                                 BRCryptoAddressScheme scheme,
+                                 const char *storagePath) {
+    int success = 1;
+
+    printf("Testing BRCryptoWalletSweeper batch for network=\"%s (%s)\" and path=\"%s\"...\n",
+           cryptoNetworkGetName (network),
+           cryptoNetworkIsMainnet (network) ? "mainnet" : "testnet",
+           storagePath);
+
+    // Test setup
+    CWMEventRecordingState state = {0};
+    CWMEventRecordingStateNewDefault (&state);
+
+    BRCryptoWalletManager manager = BRCryptoWalletManagerSetupForLifecycleTest(&state, account, network, CRYPTO_SYNC_MODE_API_ONLY, scheme, storagePath);
+    BRCryptoWallet wallet = cryptoWalletManagerGetWallet (manager);
+
+    BRCryptoSecret secret;
+    for (size_t index = 0; index < sizeof (secret.data); index++) secret.data[index] = (uint8_t) (index + 1);
+    BRCryptoKey key = cryptoKeyCreateFromSecret (secret);
+    cryptoSecretClear (&secret);
+
+    BRCryptoWalletSweeper sweeper = cryptoWalletManagerCreateWalletSweeper (manager, wallet, key);
+
+    // Fund the sweeper's address with more UTXOs than fit in one transaction
+    BRCryptoAddress address = cryptoWalletSweeperGetAddress (sweeper);
+    char *addressString = cryptoAddressAsString (address);
+    uint8_t script[25];
+    size_t scriptLen = BRAddressScriptPubKey (script, sizeof (script),
+                                              cryptoNetworkAsBTC (network)->addrParams,
+                                              addressString);
+    assert (0 != scriptLen);
+
+    BRCryptoWalletSweeperStatus status;
+    uint64_t funded = 0;
+    for (size_t index = 0; index < SWEEPER_BATCH_TEST_FUNDING_COUNT; index++) {
+        BRTransaction *tid = BRTransactionNew ();
+        UInt256 prevHash = UINT256_ZERO;
+        uint8_t signature[] = { 0x01, 0x00 };
+
+        prevHash.u32[0] = (uint32_t) (index + 1);
+        BRTransactionAddInput (tid, prevHash, 0, 0, NULL, 0, signature, sizeof (signature), NULL, 0, TXIN_SEQUENCE);
+
+        for (size_t output = 0; output < SWEEPER_BATCH_TEST_OUTPUT_COUNT; output++) {
+            uint64_t amount = 10000 + index * SWEEPER_BATCH_TEST_OUTPUT_COUNT + output;
+            BRTransactionAddOutput (tid, amount, script, scriptLen);
+            funded += amount;
+        }
+
+        size_t   serializationCount = BRTransactionSerialize (tid, NULL, 0);
+        uint8_t *serialization      = malloc (serializationCount);
+        BRTransactionSerialize (tid, serialization, serializationCount);
+
+        BRCryptoClientTransactionBundle bundle = cryptoClientTransactionBundleCreate (CRYPTO_TRANSFER_STATE_INCLUDED,
+                                                                                      serialization,
+                                                                                      serializationCount,
+                                                                                      0,
+                                                                                      index + 1);
+        status  = cryptoWalletSweeperAddTransactionFromBundle (sweeper, bundle);
+        success = success && CRYPTO_WALLET_SWEEPER_SUCCESS == status;
+
+        cryptoClientTransactionBundleRelease (bundle);
+        free (serialization);
+        BRTransactionFree (tid);
+    }
+
+    BRCryptoBoolean overflow;
+    BRCryptoAmount balance = cryptoWalletSweeperGetBalance (sweeper);
+    success = success && funded == cryptoAmountGetIntegerRaw (balance, &overflow);
+
+    // Estimate, then create, the batch
+    BRCryptoCurrency currency = cryptoNetworkGetCurrency (network);
+    BRCryptoUnit unit = cryptoNetworkGetUnitAsBase (network, currency);
+    BRCryptoAmount pricePerByte = cryptoAmountCreateInteger (SWEEPER_BATCH_TEST_SAT_PER_BYTE, unit);
+    BRCryptoNetworkFee networkFee = cryptoNetworkFeeCreate (30000, pricePerByte, unit);
+
+    size_t transferCount = 0;
+    BRCryptoFeeBasis feeBasis = NULL;
+    status = cryptoWalletSweeperEstimateBatchForWalletSweep (sweeper, manager, wallet, networkFee,
+                                                             &transferCount, &feeBasis);
+    success = success && CRYPTO_WALLET_SWEEPER_SUCCESS == status && transferCount > 1;
+
+    BRCryptoTransfer *transfers = NULL;
+    size_t transfersCount = 0;
+    if (success)
+        status = cryptoWalletSweeperCreateTransfersForWalletSweep (sweeper, manager, wallet, feeBasis,
+                                                                  &transfers, &transfersCount);
+    success = success && CRYPTO_WALLET_SWEEPER_SUCCESS == status && transfersCount == transferCount;
+
+    // Every UTXO is swept, within the size limit, and the fees add up to the estimate
+    uint64_t totalInput = 0, totalOutput = 0, totalFee = 0;
+    size_t   totalInputCount = 0;
+    for (size_t index = 0; index < transfersCount; index++) {
+        BRTransaction *tid = cryptoTransferAsBTC (transfers[index]);
+        uint64_t input = 0;
+
+        for (size_t n = 0; n < tid->inCount; n++) input += tid->inputs[n].amount;
+
+        success = (success &&
+                   BRTransactionIsSigned (tid) &&
+                   BRTransactionVSize (tid) <= TX_MAX_SIZE &&
+                   1 == tid->outCount &&
+                   tid->outputs[0].amount < input);
+
+        totalInput      += input;
+        totalOutput     += tid->outputs[0].amount;
+        totalFee        += input - tid->outputs[0].amount;
+        totalInputCount += tid->inCount;
+
+        cryptoTransferGive (transfers[index]);
+    }
+    free (transfers);
+
+    if (NULL != feeBasis) {
+        BRCryptoAmount fee = cryptoFeeBasisGetFee (feeBasis);
+        success = success && totalFee == cryptoAmountGetIntegerRaw (fee, &overflow);
+        cryptoAmountGive (fee);
+    }
+
+    success = (success &&
+               SWEEPER_BATCH_TEST_FUNDING_COUNT * SWEEPER_BATCH_TEST_OUTPUT_COUNT == totalInputCount &&
+               funded == totalInput &&
+               funded == totalOutput + totalFee);
+
+    if (!success)
+        fprintf(stderr, "***FAILED*** %s:%d: batch of %zu transfers with fee %"PRIu64" for %zu inputs\n",
+                __func__, __LINE__, transfersCount, totalFee, totalInputCount);
+
+    // Test teardown
+    if (NULL != feeBasis) cryptoFeeBasisGive (feeBasis);
+    cryptoNetworkFeeGive (networkFee);
+    cryptoAmountGive (pricePerByte);
+    cryptoUnitGive (unit);
+    cryptoCurrencyGive (currency);
+    cryptoAmountGive (balance);
+    free (addressString);
+    cryptoAddressGive (address);
+    cryptoWalletSweeperRelease (sweeper);
+    cryptoKeyGive (key);
+    cryptoWalletManagerStop (manager);
+    cryptoWalletGive (wallet);
+    cryptoWalletManagerGive (manager);
+    CWMEventRecordingStateFree (&state);
+
+    return success;
+}
+
 ///
 /// Mark: Entrypoints
 ///
@@ -1584,6 +1741,15 @@ runCryptoTestsWithAccountAndNetwork (BRCryptoAccount account,
             fprintf(stderr, "***FAILED*** %s:%d: failed\n", __func__, __LINE__);
             return success;
         }
+
+        success = AS_CRYPTO_BOOLEAN(runCryptoWalletSweeperBatchTest (account,
+                                                                     network,
+                                                                     scheme,
+                                                                     storagePath));
+        if (!success) {
+            fprintf(stderr, "***FAILED*** %s:%d: failed\n", __func__, __LINE__);
+            return success;
+        }
     }
 
     if (isEth) {
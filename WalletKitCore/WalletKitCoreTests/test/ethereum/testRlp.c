@@ -175,8 +175,37 @@ void runRlpDecodeTest () {
     rlpCoderRelease(coder);
 }
 
+void runRlpPoolTest () {
+    printf ("         Pool\n");
+
+    // A coder returned to the pool is handed back out on this thread
+    BRRlpCoder coder = rlpCoderCreateFromPool();
+    rlpCoderSetFailed (coder);
+    rlpCoderReleaseToPool (coder);
+
+    BRRlpCoder other = rlpCoderCreateFromPool();
+    assert (coder == other);
+    assert (!rlpCoderHasFailed (other));
+
+    // ... and, with items freed, encodes and decodes as any coder
+    uint8_t l1b[] = RLP_L1_RES;
+    BRRlpItem l1i = rlpEncodeList2 (other,
+                                    rlpEncodeString (other, "cat"),
+                                    rlpEncodeString (other, "dog"));
+    rlpCheck (other, l1i, l1b, sizeof (l1b));
+    rlpItemRelease (other, l1i);
+
+    // Nested use gets a distinct coder
+    BRRlpCoder nested = rlpCoderCreateFromPool();
+    assert (nested != other);
+
+    rlpCoderReleaseToPool (nested);
+    rlpCoderReleaseToPool (other);
+}
+
 void runRlpTests (void) {
     printf ("==== RLP\n");
     runRlpEncodeTest ();
     runRlpDecodeTest ();
+    runRlpPoolTest ();
 }
@@ -12,8 +12,11 @@
 #include <string.h>
 #include <assert.h>
 #include <math.h>
+#include <time.h>
 #include "ethereum/util/BRUtil.h"
 
+#define AS_TEST_UINT64(x)   ((uint64_t) (x))
+
 //
 // Math Tests
 //
@@ -155,6 +158,25 @@ runMathMulTests () {
             && UINT32_MAX == z.u32[14]
             && UINT32_MAX == z.u32[15]);
 
+    int overflow;
+    UInt256 r = uint256Mul_Overflow (x7atOne, x2to32, &overflow);
+    assert (overflow && uint256EQL (r, UINT256_ZERO));
+
+    r = uint256Mul_Overflow (x0atMax, x0atMax, &overflow);
+    assert (!overflow && 1 == r.u32[0] && UINT32_MAX - 1 == r.u32[1] && 0 == r.u32[2]);
+
+    r = uint256Mul_Overflow (xMax, xOne, &overflow);
+    assert (!overflow && uint256EQL (r, xMax));
+
+    r = uint256Mul_Overflow (xMax, xTwo, &overflow);
+    assert (overflow);
+
+    // (2^32 - 1) * 2^32 + (2^32 - 1) = 2^64 - 1
+    r = uint256MulAdd_Small64 (x0atMax, AS_TEST_UINT64(1) << 32, UINT32_MAX, &overflow);
+    assert (!overflow && UINT64_MAX == r.u64[0] && 0 == r.u64[1]);
+
+    r = uint256MulAdd_Small64 (xMax, 1, 1, &overflow);
+    assert (overflow && uint256EQL (r, UINT256_ZERO));
 }
 
 static void
@@ -231,6 +253,22 @@ runMathDivTests () {
             && a.u64[1] == 0
             && a.u64[2] == 0
             && a.u64[3] == 0);
+
+    // 10^21 / 10^19
+    uint64_t rem64;
+    a = uint256Div_Small64(r, 10000000000000000000u, &rem64);
+    assert (0 == rem64
+            && a.u64[0] == 100
+            && a.u64[1] == 0);
+
+    // (2^256 - 1) / (2^64 - 1) = 2^192 + 2^128 + 2^64 + 1
+    UInt256 m = { .u64 = { UINT64_MAX, UINT64_MAX, UINT64_MAX, UINT64_MAX }};
+    a = uint256Div_Small64(m, UINT64_MAX, &rem64);
+    assert (0 == rem64
+            && a.u64[0] == 1 && a.u64[1] == 1 && a.u64[2] == 1 && a.u64[3] == 1);
+
+    a = uint256Div_Small64(m, 10, &rem64);
+    assert (5 == rem64);
 }
 
 static void
@@ -301,6 +339,7 @@ runMathParseTests () {
     BRCoreParseStatus status;
     UInt256 r = UINT256_ZERO;
     UInt256 a = UINT256_ZERO;
+    char *s;
 
     assert (CORE_PARSE_OK == stringParseIsInteger("0"));
     assert (CORE_PARSE_OK == stringParseIsInteger("0123456789"));
@@ -348,6 +387,14 @@ runMathParseTests () {
     a.u64[0] = a.u64[1] = a.u64[2] = a.u64[3] = UINT64_MAX;
     assert (CORE_PARSE_OK == status && uint256EQL(r, a));
 
+    // 2^256 overflows
+    r = uint256CreateParse("115792089237316195423570985008687907853269984665640564039457584007913129639936", 10, &status);
+    assert (CORE_PARSE_OVERFLOW == status && uint256EQL(r, UINT256_ZERO));
+
+    s = uint256CoerceString(a, 10);
+    assert (0 == strcmp ("115792089237316195423570985008687907853269984665640564039457584007913129639935", s));
+    free (s);
+
     r = uint256CreateParse("1000000000000000000000000000000", 10, &status); // 1 TETHER (10^30)
     assert (CORE_PARSE_OK == status
             && r.u64[0] == 5076944270305263616u
@@ -377,7 +424,6 @@ runMathParseTests () {
     assert (CORE_PARSE_OK == status && uint256EQL (r, UINT256_ZERO));
 
 
-    char *s;
     r = uint256CreateParse("425693205796080237694414176550132631862392541400559", 10, &status);
     s = uint256CoerceString(r, 10);
     assert (0 == strcmp("425693205796080237694414176550132631862392541400559", s));
@@ -475,6 +521,101 @@ runMathParseTests () {
     free (s);
 }
 
+//
+// Math Performance
+//
+static const char *perfMathDecimalStrings[] = {
+    "1000000000000000",
+    "1000000000000000000000",
+    "5968770000000000000000",
+    "1000000000000000000000000000000",
+    "425693205796080237694414176550132631862392541400559",
+    "115792089237316195423570985008687907853269984665640564039457584007913129639935"
+};
+
+static const char *perfMathHexStrings[] = {
+    "09184e72a000",
+    "0234c8a3397aab58",
+    "0123456789ABCDEFEDCBA98765432123456789ABCDEF",
+    "ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff"
+};
+
+#define PERF_MATH_DECIMAL_COUNT     (sizeof (perfMathDecimalStrings) / sizeof (char *))
+#define PERF_MATH_HEX_COUNT         (sizeof (perfMathHexStrings) / sizeof (char *))
+
+static double
+perfMathElapsed (clock_t start, size_t operations) {
+    return 1e9 * (double) (clock() - start) / CLOCKS_PER_SEC / (double) operations;
+}
+
+/**
+ * Time parse, coerce-to-string, multiply and divide over the `runUtilTests()` vectors; reports
+ * nanoseconds per operation.
+ */
+extern void
+runPerfTestsMath (int repeat) {
+    BRCoreParseStatus status;
+    UInt256 values [PERF_MATH_DECIMAL_COUNT];
+    clock_t start;
+
+    printf ("==== Math Perf: %d repeats\n", repeat);
+
+    start = clock();
+    for (int r = 0; r < repeat; r++)
+        for (size_t i = 0; i < PERF_MATH_DECIMAL_COUNT; i++) {
+            values[i] = uint256CreateParse (perfMathDecimalStrings[i], 10, &status);
+            assert (CORE_PARSE_OK == status);
+        }
+    printf ("    Parse   (base 10): %8.1f ns\n", perfMathElapsed (start, repeat * PERF_MATH_DECIMAL_COUNT));
+
+    start = clock();
+    for (int r = 0; r < repeat; r++)
+        for (size_t i = 0; i < PERF_MATH_HEX_COUNT; i++) {
+            uint256CreateParse (perfMathHexStrings[i], 16, &status);
+            assert (CORE_PARSE_OK == status);
+        }
+    printf ("    Parse   (base 16): %8.1f ns\n", perfMathElapsed (start, repeat * PERF_MATH_HEX_COUNT));
+
+    start = clock();
+    for (int r = 0; r < repeat; r++)
+        for (size_t i = 0; i < PERF_MATH_DECIMAL_COUNT; i++) {
+            char *string = uint256CoerceString (values[i], 10);
+            assert (0 == strcmp (string, perfMathDecimalStrings[i]));
+            free (string);
+        }
+    printf ("    Coerce  (base 10): %8.1f ns\n", perfMathElapsed (start, repeat * PERF_MATH_DECIMAL_COUNT));
+
+    start = clock();
+    for (int r = 0; r < repeat; r++)
+        for (size_t i = 0; i < PERF_MATH_DECIMAL_COUNT; i++) {
+            char *string = uint256CoerceStringDecimal (values[i], 18);
+            free (string);
+        }
+    printf ("    Coerce  (decimal): %8.1f ns\n", perfMathElapsed (start, repeat * PERF_MATH_DECIMAL_COUNT));
+
+    int overflow;
+    UInt256 sink = UINT256_ZERO;
+    start = clock();
+    for (int r = 0; r < repeat; r++)
+        for (size_t i = 0; i < PERF_MATH_DECIMAL_COUNT; i++)
+            for (size_t j = 0; j < PERF_MATH_DECIMAL_COUNT; j++) {
+                UInt256 product = uint256Mul_Overflow (values[i], values[j], &overflow);
+                sink.u64[0] ^= product.u64[0];
+            }
+    printf ("    Mul_Overflow     : %8.1f ns\n", perfMathElapsed (start, repeat * PERF_MATH_DECIMAL_COUNT * PERF_MATH_DECIMAL_COUNT));
+
+    uint32_t rem;
+    start = clock();
+    for (int r = 0; r < repeat; r++)
+        for (size_t i = 0; i < PERF_MATH_DECIMAL_COUNT; i++) {
+            UInt256 quotient = uint256Div_Small (values[i], 1000000, &rem);
+            sink.u64[1] ^= quotient.u64[0];
+        }
+    printf ("    Div_Small        : %8.1f ns\n", perfMathElapsed (start, repeat * PERF_MATH_DECIMAL_COUNT));
+
+    printf ("    (sink: %llu)\n", (unsigned long long) (sink.u64[0] ^ sink.u64[1]));
+}
+
 extern void
 runUtilTests (void) {
     runMathParseTests ();
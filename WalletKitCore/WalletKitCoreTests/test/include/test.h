@@ -25,6 +25,8 @@ extern "C" {
 // Util
 extern void runUtilTests (void);
 
+extern void runPerfTestsMath (int repeat);
+
 // RLP
 extern void runRlpTests (void);
 
@@ -91,6 +93,18 @@ extern int BRRunTestsSync (const char *paperKey,
                            BRBitcoinChain bitcoinChain,
                            int isMainnet);
 
+extern void BRRunPerfTestsTxPeerMap (size_t invCount);
+
+extern void BRRunPerfTestsPaymentProtocol (size_t count);
+
+extern void BRRunPerfTestsTransactionSign (size_t inCount);
+
+extern int BRRunTestsSimPeerSync (uint32_t blockCount, double walletHitRate);
+
+extern int BRRunTestsSimPeerRestart (uint32_t blockCount, double walletHitRate);
+
+extern int BRRunPerfTestsSimPeerSync (uint32_t blockCount, double walletHitRate);
+
 #if REFACTOR
 extern int BRRunTestWalletManagerSync (const char *paperKey,
                                        const char *storagePath,
@@ -58,6 +58,38 @@ extern "C" {
                                                      BRCryptoWallet wallet,
                                                      BRCryptoFeeBasis estimatedFeeBasis);
 
+    /**
+     * Estimate a sweep that is split into as many transactions as needed to keep each one within
+     * the network's size limit, for keys with more UTXOs than fit in a single transaction.  Fills
+     * in the number of transfers and a fee basis for their combined fee and size.  UTXOs that are
+     * worth less than the fee to spend them are left out.
+     *
+     * Returns CRYPTO_WALLET_SWEEPER_ILLEGAL_OPERATION if the sweeper's currency doesn't support
+     * batches.
+     */
+    extern BRCryptoWalletSweeperStatus
+    cryptoWalletSweeperEstimateBatchForWalletSweep (BRCryptoWalletSweeper sweeper,
+                                                    BRCryptoWalletManager manager,
+                                                    BRCryptoWallet wallet,
+                                                    BRCryptoNetworkFee fee,
+                                                    size_t *transferCount,
+                                                    BRCryptoFeeBasis *feeBasis);
+
+    /**
+     * Create the transfers of a batched sweep, in order, already signed with the sweeper's key.
+     * Each may be submitted with `cryptoWalletManagerSubmitSigned()`.
+     *
+     * On success, `transfers` is filled in with an array of `transfersCount` transfers, each
+     * 'taken', that the caller must give and free().
+     */
+    extern BRCryptoWalletSweeperStatus
+    cryptoWalletSweeperCreateTransfersForWalletSweep (BRCryptoWalletSweeper sweeper,
+                                                      BRCryptoWalletManager manager,
+                                                      BRCryptoWallet wallet,
+                                                      BRCryptoFeeBasis estimatedFeeBasis,
+                                                      BRCryptoTransfer **transfers,
+                                                      size_t *transfersCount);
+
     extern BRCryptoKey
     cryptoWalletSweeperGetKey (BRCryptoWalletSweeper sweeper);
 
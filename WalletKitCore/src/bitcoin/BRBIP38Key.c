@@ -30,6 +30,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #define BIP38_NOEC_PREFIX      0x0142
 #define BIP38_EC_PREFIX        0x0143
@@ -43,44 +45,49 @@
 #define BIP38_SCRYPT_EC_N      1024
 #define BIP38_SCRYPT_EC_R      1
 #define BIP38_SCRYPT_EC_P      1
+#define BIP38_BATCH_THREADS    4 // BRScrypt() also runs up to 4 threads per key, so keep the total near the cpu count
+#define BIP38_BATCH_MEMORY_MAX (128*1024*1024) // cap on scrypt scratch memory in use at once by BRKeySetBIP38Keys()
 
 // BIP38 is a method for encrypting private keys with a passphrase
 // https://github.com/bitcoin/bips/blob/master/bip-0038.mediawiki
 
-static UInt256 _BRBIP38DerivePassfactor(uint8_t flag, const uint8_t *entropy, const char *passphrase)
+// returns false if scrypt couldn't allocate its scratch memory
+static int _BRBIP38DerivePassfactor(UInt256 *passfactor, uint8_t flag, const uint8_t *entropy, const char *passphrase)
 {
     size_t len = strlen(passphrase);
-    UInt256 prefactor, passfactor;
+    UInt256 prefactor;
+    int r;
     
-    BRScrypt(&prefactor, sizeof(prefactor), passphrase, len, entropy, (flag & BIP38_LOTSEQUENCE_FLAG) ? 4 : 8,
-             BIP38_SCRYPT_N, BIP38_SCRYPT_R, BIP38_SCRYPT_P);
+    r = BRScrypt(&prefactor, sizeof(prefactor), passphrase, len, entropy, (flag & BIP38_LOTSEQUENCE_FLAG) ? 4 : 8,
+                 BIP38_SCRYPT_N, BIP38_SCRYPT_R, BIP38_SCRYPT_P);
     
     if (flag & BIP38_LOTSEQUENCE_FLAG) { // passfactor = SHA256(SHA256(prefactor + entropy))
         uint8_t d[sizeof(prefactor) + sizeof(uint64_t)];
 
         memcpy(d, &prefactor, sizeof(prefactor));
         memcpy(&d[sizeof(prefactor)], entropy, sizeof(uint64_t));
-        BRSHA256_2(&passfactor, d, sizeof(d));
+        BRSHA256_2(passfactor, d, sizeof(d));
         mem_clean(d, sizeof(d));
     }
-    else passfactor = prefactor;
+    else *passfactor = prefactor;
     
     var_clean(&len);
     var_clean(&prefactor);
-    return passfactor;
+    return r;
 }
 
-static UInt512 _BRBIP38DeriveKey(BRECPoint passpoint, const uint8_t *addresshash, const uint8_t *entropy)
+// returns false if scrypt couldn't allocate its scratch memory
+static int _BRBIP38DeriveKey(UInt512 *dk, BRECPoint passpoint, const uint8_t *addresshash, const uint8_t *entropy)
 {
-    UInt512 dk;
     uint8_t salt[sizeof(uint32_t) + sizeof(uint64_t)];
+    int r;
     
     memcpy(salt, addresshash, sizeof(uint32_t));
     memcpy(&salt[sizeof(uint32_t)], entropy, sizeof(uint64_t)); // salt = addresshash + entropy
-    BRScrypt(&dk, sizeof(dk), &passpoint, sizeof(passpoint), salt, sizeof(salt), BIP38_SCRYPT_EC_N, BIP38_SCRYPT_EC_R,
-             BIP38_SCRYPT_EC_P);
+    r = BRScrypt(dk, sizeof(*dk), &passpoint, sizeof(passpoint), salt, sizeof(salt), BIP38_SCRYPT_EC_N,
+                 BIP38_SCRYPT_EC_R, BIP38_SCRYPT_EC_P);
     mem_clean(salt, sizeof(salt));
-    return dk;
+    return r;
 }
 
 int BRBIP38KeyIsValid(const char *bip38Key)
@@ -104,7 +111,8 @@ int BRBIP38KeyIsValid(const char *bip38Key)
     else return 0; // invalid prefix
 }
 
-// decrypts a BIP38 key using the given passphrase and returns false if passphrase is incorrect
+// decrypts a BIP38 key using the given passphrase and returns false if passphrase is incorrect, or if there wasn't
+// enough memory for scrypt
 // passphrase must be unicode NFC normalized: http://www.unicode.org/reports/tr15/#Norm_Forms
 int BRKeySetBIP38Key(BRKey *key, const char *bip38Key, const char *passphrase, BRAddressParams params)
 {
@@ -129,8 +137,8 @@ int BRKeySetBIP38Key(BRKey *key, const char *bip38Key, const char *passphrase, B
         // data = prefix + flag + addresshash + encrypted1 + encrypted2
         UInt128 encrypted1 = UInt128Get(&data[7]), encrypted2 = UInt128Get(&data[23]);
 
-        BRScrypt(&derived, sizeof(derived), passphrase, pwLen, addresshash, sizeof(uint32_t),
-                 BIP38_SCRYPT_N, BIP38_SCRYPT_R, BIP38_SCRYPT_P);
+        if (! BRScrypt(&derived, sizeof(derived), passphrase, pwLen, addresshash, sizeof(uint32_t),
+                       BIP38_SCRYPT_N, BIP38_SCRYPT_R, BIP38_SCRYPT_P)) return 0;
         derived1 = *(UInt256 *)&derived, derived2 = *(UInt256 *)&derived.u8[sizeof(UInt256)];
         var_clean(&derived);
         
@@ -148,12 +156,18 @@ int BRKeySetBIP38Key(BRKey *key, const char *bip38Key, const char *passphrase, B
         // data = prefix + flag + addresshash + entropy + encrypted1[0...7] + encrypted2
         const uint8_t *entropy = &data[7];
         UInt128 encrypted1 = UINT128_ZERO, encrypted2 = UInt128Get(&data[23]);
-        UInt256 passfactor = _BRBIP38DerivePassfactor(flag, entropy, passphrase), factorb;
+        UInt256 passfactor, factorb;
         BRECPoint passpoint;
         uint64_t seedb[3];
         
+        if (! _BRBIP38DerivePassfactor(&passfactor, flag, entropy, passphrase)) return 0;
         BRSecp256k1PointGen(&passpoint, &passfactor); // passpoint = G*passfactor
-        derived = _BRBIP38DeriveKey(passpoint, addresshash, entropy);
+        
+        if (! _BRBIP38DeriveKey(&derived, passpoint, addresshash, entropy)) {
+            var_clean(&passpoint, &passfactor);
+            return 0;
+        }
+        
         var_clean(&passpoint);
         derived1 = *(UInt256 *)&derived, derived2 = *(UInt256 *)&derived.u8[sizeof(UInt256)];
         var_clean(&derived);
@@ -186,6 +200,77 @@ int BRKeySetBIP38Key(BRKey *key, const char *bip38Key, const char *passphrase, B
     return r;
 }
 
+typedef struct {
+    BRKey *keys;
+    int *results;
+    const char **bip38Keys;
+    const char *passphrase;
+    BRAddressParams params;
+    size_t count, next, decrypted;
+    pthread_mutex_t lock;
+} BRBIP38Batch;
+
+static void *_BRBIP38BatchThreadRoutine(void *arg)
+{
+    BRBIP38Batch *batch = arg;
+    size_t i;
+    int r;
+    
+    for (;;) {
+        pthread_mutex_lock(&batch->lock);
+        i = batch->next++;
+        pthread_mutex_unlock(&batch->lock);
+        if (i >= batch->count) break;
+        
+        r = BRKeySetBIP38Key(&batch->keys[i], batch->bip38Keys[i], batch->passphrase, batch->params);
+        if (batch->results) batch->results[i] = r;
+        
+        pthread_mutex_lock(&batch->lock);
+        if (r) batch->decrypted++;
+        pthread_mutex_unlock(&batch->lock);
+    }
+    
+    return NULL;
+}
+
+// decrypts count BIP38 keys that share a passphrase, spreading the keys over several threads
+// results may be NULL, otherwise results[i] is set to the BRKeySetBIP38Key() result for bip38Keys[i]
+// the number of keys decrypted at once is limited so their scrypt scratch memory stays under BIP38_BATCH_MEMORY_MAX
+// returns the number of keys decrypted
+size_t BRKeySetBIP38Keys(BRKey keys[], int results[], const char *bip38Keys[], size_t count, const char *passphrase,
+                         BRAddressParams params)
+{
+    BRBIP38Batch batch = { keys, results, bip38Keys, passphrase, params, count, 0, 0 };
+    pthread_t threads[BIP38_BATCH_THREADS];
+    pthread_attr_t attr;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t i, threadCount = (cpus > 0) ? (size_t)(cpus + BIP38_BATCH_THREADS - 1)/BIP38_BATCH_THREADS : 1, started = 0,
+           keyMemory = (size_t)128*BIP38_SCRYPT_R*BIP38_SCRYPT_N*((cpus > 0 && cpus < SCRYPT_THREADS_MAX) ?
+                                                                 (size_t)cpus : SCRYPT_THREADS_MAX);
+    
+    assert(keys != NULL || count == 0);
+    assert(bip38Keys != NULL || count == 0);
+    assert(passphrase != NULL);
+    
+    if (threadCount > BIP38_BATCH_THREADS) threadCount = BIP38_BATCH_THREADS;
+    // each key decrypting at once has up to keyMemory of scrypt scratch buffers, so limit the keys in flight
+    if (threadCount > BIP38_BATCH_MEMORY_MAX/keyMemory) threadCount = BIP38_BATCH_MEMORY_MAX/keyMemory;
+    if (threadCount == 0) threadCount = 1;
+    if (threadCount > count) threadCount = count;
+    pthread_mutex_init(&batch.lock, NULL);
+    
+    if (threadCount > 1 && pthread_attr_init(&attr) == 0) {
+        while (started + 1 < threadCount &&
+               pthread_create(&threads[started], &attr, _BRBIP38BatchThreadRoutine, &batch) == 0) started++;
+        pthread_attr_destroy(&attr);
+    }
+    
+    _BRBIP38BatchThreadRoutine(&batch); // calling thread decrypts keys as well
+    for (i = 0; i < started; i++) pthread_join(threads[i], NULL);
+    pthread_mutex_destroy(&batch.lock);
+    return batch.decrypted;
+}
+
 // generates an "intermediate code" for an EC multiply mode key
 // salt should be 64bits of random data
 // passphrase must be unicode NFC normalized
@@ -216,7 +301,8 @@ void BRKeySetBIP38ItermediateCode(BRKey *key, const char *code, const uint8_t *s
 
 // encrypts key with passphrase
 // passphrase must be unicode NFC normalized
-// returns number of bytes written to bip38Key including NULL terminator or total bip38KeyLen needed if bip38Key is NULL
+// returns number of bytes written to bip38Key including NULL terminator or total bip38KeyLen needed if bip38Key is NULL,
+// or 0 if there wasn't enough memory for scrypt
 size_t BRKeyBIP38Key(BRKey *key, char *bip38Key, size_t bip38KeyLen, const char *passphrase, BRAddressParams params)
 {
     uint16_t prefix = BIP38_NOEC_PREFIX;
@@ -238,8 +324,8 @@ size_t BRKeyBIP38Key(BRKey *key, char *bip38Key, size_t bip38KeyLen, const char
     BRSHA256_2(&hash, address.s, strlen(address.s));
     salt = hash.u32[0];
 
-    BRScrypt(&derived, sizeof(derived), passphrase, strlen(passphrase), &salt, sizeof(salt),
-             BIP38_SCRYPT_N, BIP38_SCRYPT_R, BIP38_SCRYPT_P);
+    if (! BRScrypt(&derived, sizeof(derived), passphrase, strlen(passphrase), &salt, sizeof(salt),
+                   BIP38_SCRYPT_N, BIP38_SCRYPT_R, BIP38_SCRYPT_P)) return 0;
     derived1 = *(UInt256 *)&derived, derived2 = *(UInt256 *)&derived.u8[sizeof(UInt256)];
     var_clean(&derived);
     
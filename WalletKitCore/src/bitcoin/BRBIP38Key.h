@@ -36,10 +36,17 @@ extern "C" {
 
 int BRBIP38KeyIsValid(const char *bip38Key);
 
-// decrypts a BIP38 key using the given passphrase and returns false if passphrase is incorrect
+// decrypts a BIP38 key using the given passphrase and returns false if passphrase is incorrect, or if there wasn't
+// enough memory for scrypt
 // passphrase must be unicode NFC normalized: http://www.unicode.org/reports/tr15/#Norm_Forms
 int BRKeySetBIP38Key(BRKey *key, const char *bip38Key, const char *passphrase, BRAddressParams params);
 
+// decrypts count BIP38 keys that share a passphrase using multiple threads, results may be NULL, otherwise results[i]
+// is set to the BRKeySetBIP38Key() result for bip38Keys[i], returns the number of keys decrypted
+// the number of keys decrypted at once is limited so their scrypt scratch memory stays under 128MB
+size_t BRKeySetBIP38Keys(BRKey keys[], int results[], const char *bip38Keys[], size_t count, const char *passphrase,
+                         BRAddressParams params);
+
 // generates an "intermediate code" for an EC multiply mode key
 // salt should be 64bits of random data
 // passphrase must be unicode NFC normalized
@@ -59,7 +66,8 @@ void BRKeySetBIP38ItermediateCode(BRKey *key, const char *code, const uint8_t *s
 
 // encrypts key with passphrase
 // passphrase must be unicode NFC normalized
-// returns number of bytes written to bip38Key including NULL terminator or total bip38KeyLen needed if bip38Key is NULL
+// returns number of bytes written to bip38Key including NULL terminator or total bip38KeyLen needed if bip38Key is NULL,
+// or 0 if there wasn't enough memory for scrypt
 size_t BRKeyBIP38Key(BRKey *key, char *bip38Key, size_t bip38KeyLen, const char *passphrase, BRAddressParams params);
 
 #ifdef __cplusplus
@@ -0,0 +1,138 @@
+//
+//  BRBlockValidator.c
+//
+//  Copyright (c) 2026 breadwallet LLC.
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+
+#include "BRBlockValidator.h"
+#include "support/BROSCompat.h"
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define PTHREAD_STACK_SIZE    (64 * 1024)
+#define BLOCK_VALIDATOR_CHUNK 32 // checks claimed at a time, so the lock is taken once per chunk rather than per block
+
+static struct {
+    pthread_once_t once;
+    pthread_mutex_t lock;
+    pthread_cond_t work, done;
+    size_t threadCount;
+    int busy; // true while a window is being validated
+    BRBlockCheck *checks; // the window being validated
+    size_t count, next, pending; // window size, first unclaimed check, and checks claimed or not that aren't finished
+    uint32_t currentTime;
+} _validator = { PTHREAD_ONCE_INIT, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER,
+                 0, 0, NULL, 0, 0, 0, 0 };
+
+static void _BRBlockValidatorCheck(BRBlockCheck checks[], size_t count, uint32_t currentTime)
+{
+    for (size_t i = 0; i < count; i++) {
+        checks[i].valid = BRMerkleBlockIsValidData(checks[i].buf, checks[i].bufLen, currentTime, &checks[i].blockHash);
+    }
+}
+
+// validates chunks of the current window until none are left to claim, _validator.lock must be held
+static void _BRBlockValidatorDrain(void)
+{
+    BRBlockCheck *checks;
+    size_t count;
+    uint32_t currentTime;
+
+    while (_validator.next < _validator.count) {
+        checks = &_validator.checks[_validator.next];
+        count = _validator.count - _validator.next;
+        if (count > BLOCK_VALIDATOR_CHUNK) count = BLOCK_VALIDATOR_CHUNK;
+        currentTime = _validator.currentTime;
+        _validator.next += count;
+        pthread_mutex_unlock(&_validator.lock);
+        _BRBlockValidatorCheck(checks, count, currentTime);
+        pthread_mutex_lock(&_validator.lock);
+        _validator.pending -= count;
+        if (_validator.pending == 0) pthread_cond_signal(&_validator.done);
+    }
+}
+
+static void *_BRBlockValidatorRoutine(void *arg)
+{
+    pthread_setname_brd(pthread_self(), "Core BTX Validator");
+    pthread_mutex_lock(&_validator.lock);
+
+    for (;;) {
+        while (_validator.next >= _validator.count) pthread_cond_wait(&_validator.work, &_validator.lock);
+        _BRBlockValidatorDrain();
+    }
+
+    return NULL; // detached threads don't need to return a value
+}
+
+static void _BRBlockValidatorInit(void)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t threadCount = (cpus > 1) ? (size_t)cpus - 1 : 0;
+    pthread_attr_t attr;
+    pthread_t thread;
+
+    if (threadCount > BLOCK_VALIDATOR_MAX_THREADS) threadCount = BLOCK_VALIDATOR_MAX_THREADS;
+    if (threadCount == 0 || pthread_attr_init(&attr) != 0) return;
+
+    if (pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) == 0 &&
+        pthread_attr_setstacksize(&attr, PTHREAD_STACK_SIZE) == 0) {
+        while (_validator.threadCount < threadCount &&
+               pthread_create(&thread, &attr, _BRBlockValidatorRoutine, NULL) == 0) _validator.threadCount++;
+    }
+
+    pthread_attr_destroy(&attr);
+}
+
+// sets blockHash and valid for each of count checks to the result of BRMerkleBlockIsValidData() for its buf
+// windows are validated one at a time, a window passed in while another is being validated runs on the calling thread
+void BRBlockValidatorRun(BRBlockCheck checks[], size_t count, uint32_t currentTime)
+{
+    int busy = 1;
+
+    assert(checks != NULL || count == 0);
+    if (count >= BLOCK_VALIDATOR_MIN_WINDOW) pthread_once(&_validator.once, _BRBlockValidatorInit);
+
+    if (count >= BLOCK_VALIDATOR_MIN_WINDOW && _validator.threadCount > 0) {
+        pthread_mutex_lock(&_validator.lock);
+        busy = _validator.busy;
+
+        if (! busy) {
+            _validator.busy = 1;
+            _validator.checks = checks;
+            _validator.count = _validator.pending = count;
+            _validator.next = 0;
+            _validator.currentTime = currentTime;
+            pthread_cond_broadcast(&_validator.work);
+            _BRBlockValidatorDrain();
+            while (_validator.pending > 0) pthread_cond_wait(&_validator.done, &_validator.lock);
+            _validator.checks = NULL;
+            _validator.count = _validator.next = 0;
+            _validator.busy = 0;
+        }
+
+        pthread_mutex_unlock(&_validator.lock);
+    }
+
+    if (busy) _BRBlockValidatorCheck(checks, count, currentTime);
+}
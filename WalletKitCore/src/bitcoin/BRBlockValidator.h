@@ -0,0 +1,59 @@
+//
+//  BRBlockValidator.h
+//
+//  Copyright (c) 2026 breadwallet LLC.
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+
+#ifndef BRBlockValidator_h
+#define BRBlockValidator_h
+
+#include "BRMerkleBlock.h"
+#include "support/BRInt.h"
+#include <stddef.h>
+#include <inttypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// the block validator checks the partial merkle tree, timestamp and proof-of-work of a window of received blocks at once
+// on a small pool of worker threads, with the calling thread working alongside them, and returns once the whole window
+// is done so the blocks can be handed on in the order they were received
+
+#define BLOCK_VALIDATOR_MAX_THREADS 3  // worker threads, in addition to the calling thread
+#define BLOCK_VALIDATOR_MIN_WINDOW  16 // smaller windows are validated on the calling thread
+
+typedef struct {
+    const uint8_t *buf; // a serialized merkleblock or header
+    size_t bufLen;
+    UInt256 blockHash; // set if buf is well formed, and left UINT256_ZERO otherwise
+    int valid;
+} BRBlockCheck;
+
+// sets blockHash and valid for each of count checks to the result of BRMerkleBlockIsValidData() for its buf
+// windows are validated one at a time, a window passed in while another is being validated runs on the calling thread
+void BRBlockValidatorRun(BRBlockCheck checks[], size_t count, uint32_t currentTime);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BRBlockValidator_h
@@ -34,10 +34,28 @@
 
 #define BLOOM_MAX_HASH_FUNCS 50
 
-inline static uint32_t _BRBloomFilterHash(const BRBloomFilter *filter, const uint8_t *data, size_t dataLen,
-                                          uint32_t hashNum)
+#define BLOOM_HASH_BATCH     4 // hashes computed per pass over the data when checking if data is matched
+#define BLOOM_LOCAL_SEED2    0x9e3779b9
+
+// sets idxs[i] to the filter bit index of data for hash function (first + i), for each of count hash functions
+inline static void _BRBloomFilterIndexes(const BRBloomFilter *filter, uint32_t idxs[], const uint8_t *data,
+                                         size_t dataLen, uint32_t first, uint32_t count)
 {
-    return BRMurmur3_32(data, dataLen, hashNum*0xfba4c795 + filter->tweak) % (filter->length*8);
+    uint32_t i, seeds[BLOOM_MAX_HASH_FUNCS], h[2];
+    
+    if (filter->local) { // kirsch-mitzenmacher: g_i(x) = h1(x) + i*h2(x) mod m
+        seeds[0] = filter->tweak, seeds[1] = filter->tweak ^ BLOOM_LOCAL_SEED2;
+        BRMurmur3_32Seeds(h, data, dataLen, seeds, 2);
+        
+        for (i = 0; i < count; i++) {
+            idxs[i] = (uint32_t)((h[0] + (uint64_t)(first + i)*h[1]) % (filter->length*8));
+        }
+    }
+    else { // BIP37: a separately seeded murmur3 hash for each hash function
+        for (i = 0; i < count; i++) seeds[i] = (first + i)*0xfba4c795 + filter->tweak;
+        BRMurmur3_32Seeds(idxs, data, dataLen, seeds, count);
+        for (i = 0; i < count; i++) idxs[i] %= filter->length*8;
+    }
 }
 
 // returns a newly allocated bloom filter struct that must be freed by calling BRBloomFilterFree()
@@ -65,6 +83,28 @@ BRBloomFilter *BRBloomFilterNew(double falsePositiveRate, size_t elemCount, uint
     return filter;
 }
 
+// returns a newly allocated bloom filter struct for local matching only, that must be freed by calling
+// BRBloomFilterFree()
+BRBloomFilter *BRBloomFilterNewLocal(double falsePositiveRate, size_t elemCount)
+{
+    BRBloomFilter *filter = calloc(1, sizeof(*filter));
+    
+    assert(filter != NULL);
+    assert(falsePositiveRate >= DBL_EPSILON);
+    if (elemCount < 1) elemCount = 1;
+    filter->length = (-1.0/(M_LN2*M_LN2))*elemCount*log(falsePositiveRate)/8.0;
+    if (filter->length < 1) filter->length = 1;
+    if (filter->length > UINT32_MAX/8) filter->length = UINT32_MAX/8;
+    filter->filter = calloc(filter->length, sizeof(*(filter->filter)));
+    assert(filter->filter != NULL);
+    filter->hashFuncs = ((filter->length*8.0)/elemCount)*M_LN2;
+    if (filter->hashFuncs < 1) filter->hashFuncs = 1;
+    if (filter->hashFuncs > BLOOM_MAX_HASH_FUNCS) filter->hashFuncs = BLOOM_MAX_HASH_FUNCS;
+    filter->flags = BLOOM_UPDATE_NONE;
+    filter->local = 1;
+    return filter;
+}
+
 // buf must contain a serialized filter
 // returns a bloom filter struct that must be freed by calling BRBloomFilterFree()
 BRBloomFilter *BRBloomFilterParse(const uint8_t *buf, size_t bufLen)
@@ -81,6 +121,11 @@ BRBloomFilter *BRBloomFilterParse(const uint8_t *buf, size_t bufLen)
         filter->filter = (filter->length <= BLOOM_MAX_FILTER_LENGTH && off + filter->length <= bufLen) ?
                          malloc(filter->length) : NULL;
         if (filter->filter) memcpy(filter->filter, &buf[off], filter->length);
+        
+        for (size_t i = 0; filter->filter && i < filter->length; i++) { // count set bits
+            for (uint8_t b = filter->filter[i]; b; b &= b - 1) filter->bitCount++;
+        }
+        
         off += filter->length;
         filter->hashFuncs = (off + sizeof(uint32_t) <= bufLen) ? UInt32GetLE(&buf[off]) : 0;
         off += sizeof(uint32_t);
@@ -106,6 +151,7 @@ size_t BRBloomFilterSerialize(const BRBloomFilter *filter, uint8_t *buf, size_t
     
     assert(filter != NULL);
     assert(buf != NULL || bufLen == 0);
+    if (filter->local) return 0;
     
     if (buf && len <= bufLen) {
         off += BRVarIntSet(&buf[off], (off <= bufLen ? bufLen - off : 0), filter->length);
@@ -125,14 +171,19 @@ size_t BRBloomFilterSerialize(const BRBloomFilter *filter, uint8_t *buf, size_t
 // true if data is matched by filter
 int BRBloomFilterContainsData(const BRBloomFilter *filter, const uint8_t *data, size_t dataLen)
 {
-    uint32_t i, idx;
+    uint32_t i, j, n, idxs[BLOOM_HASH_BATCH];
     
     assert(filter != NULL);
     assert(data != NULL || dataLen == 0);
     
-    for (i = 0; data && i < filter->hashFuncs; i++) {
-        idx = _BRBloomFilterHash(filter, data, dataLen, i);
-        if (! (filter->filter[idx >> 3] & (1 << (7 & idx)))) return 0;
+    // hash in small batches so a miss, the common case, returns without computing every hash
+    for (i = 0; data && i < filter->hashFuncs; i += n) {
+        n = (filter->hashFuncs - i < BLOOM_HASH_BATCH) ? filter->hashFuncs - i : BLOOM_HASH_BATCH;
+        _BRBloomFilterIndexes(filter, idxs, data, dataLen, i, n);
+        
+        for (j = 0; j < n; j++) {
+            if (! (filter->filter[idxs[j] >> 3] & (1 << (7 & idxs[j])))) return 0;
+        }
     }
     
     return (data) ? 1 : 0;
@@ -141,19 +192,34 @@ int BRBloomFilterContainsData(const BRBloomFilter *filter, const uint8_t *data,
 // add data to filter
 void BRBloomFilterInsertData(BRBloomFilter *filter, const uint8_t *data, size_t dataLen)
 {
-    uint32_t i, idx;
+    uint32_t i, j, n, idx, idxs[BLOOM_MAX_HASH_FUNCS];
     
     assert(filter != NULL);
     assert(data != NULL || dataLen == 0);
     
-    for (i = 0; data && i < filter->hashFuncs; i++) {
-        idx = _BRBloomFilterHash(filter, data, dataLen, i);
-        filter->filter[idx >> 3] |= (1 << (7 & idx));
+    // a parsed filter may have more than BLOOM_MAX_HASH_FUNCS hash functions
+    for (i = 0; data && i < filter->hashFuncs; i += n) {
+        n = (filter->hashFuncs - i < BLOOM_MAX_HASH_FUNCS) ? filter->hashFuncs - i : BLOOM_MAX_HASH_FUNCS;
+        _BRBloomFilterIndexes(filter, idxs, data, dataLen, i, n);
+        
+        for (j = 0; j < n; j++) {
+            idx = idxs[j];
+            if (! (filter->filter[idx >> 3] & (1 << (7 & idx)))) filter->bitCount++;
+            filter->filter[idx >> 3] |= (1 << (7 & idx));
+        }
     }
     
     if (data) filter->elemCount++;
 }
 
+// estimated false positive rate of filter given the fraction of its bits that are set, this goes up as data is
+// inserted, and a filter should be rebuilt with a larger size once it exceeds the rate the filter was created for
+double BRBloomFilterFalsePositiveRate(const BRBloomFilter *filter)
+{
+    assert(filter != NULL);
+    return pow((double)filter->bitCount/(filter->length*8), filter->hashFuncs);
+}
+
 // frees memory allocated for filter
 void BRBloomFilterFree(BRBloomFilter *filter)
 {
@@ -46,24 +46,33 @@ typedef struct {
     size_t length;
     uint32_t hashFuncs;
     size_t elemCount;
+    size_t bitCount; // number of bits set in filter, kept up to date as data is inserted
     uint32_t tweak;
     uint8_t flags;
+    uint8_t local; // bit positions are derived from two base hashes, which isn't BIP37 compatible (see below)
 } BRBloomFilter;
 
 // a bloom filter that matches everything is useful if a full node wants to use the filtered block protocol, which
 // doesn't send transactions with blocks if the receiving node already received the tx prior to its inclusion in the
 // block, allowing a full node to operate while using about half the network traffic
-#define BR_BLOOM_FILTER_FULL ((const BRBloomFilter) { &((struct { uint8_t u; }) { 0xff }).u, 1, 0, 0, 0,\
-                                                      BLOOM_UPDATE_NONE })
+#define BR_BLOOM_FILTER_FULL ((const BRBloomFilter) { &((struct { uint8_t u; }) { 0xff }).u, 1, 0, 0, 8, 0,\
+                                                      BLOOM_UPDATE_NONE, 0 })
 
 // returns a newly allocated bloom filter struct that must be freed by calling BRBloomFilterFree()
 BRBloomFilter *BRBloomFilterNew(double falsePositiveRate, size_t elemCount, uint32_t tweak, uint8_t flags);
 
+// returns a newly allocated bloom filter struct for local matching only, that must be freed by calling
+// BRBloomFilterFree()
+// the hashFuncs bit positions of an element are h1 + i*h2 for two base hashes h1 and h2 (kirsch-mitzenmacher double
+// hashing), so each lookup hashes the element only twice, and the filter length isn't limited to
+// BLOOM_MAX_FILTER_LENGTH - local filters can't be serialized and sent to peers
+BRBloomFilter *BRBloomFilterNewLocal(double falsePositiveRate, size_t elemCount);
+
 // buf must contain a serialized filter
 // returns a bloom filter struct that must be freed by calling BRBloomFilterFree()
 BRBloomFilter *BRBloomFilterParse(const uint8_t *buf, size_t bufLen);
 
-// returns number of bytes written to buf, or total bufLen needed if buf is NULL
+// returns number of bytes written to buf, or total bufLen needed if buf is NULL (0 for a local filter)
 size_t BRBloomFilterSerialize(const BRBloomFilter *filter, uint8_t *buf, size_t bufLen);
 
 // true if data is matched by filter
@@ -72,6 +81,10 @@ int BRBloomFilterContainsData(const BRBloomFilter *filter, const uint8_t *data,
 // add data to filter
 void BRBloomFilterInsertData(BRBloomFilter *filter, const uint8_t *data, size_t dataLen);
 
+// estimated false positive rate of filter given the fraction of its bits that are set, this goes up as data is
+// inserted, and a filter should be rebuilt with a larger size once it exceeds the rate the filter was created for
+double BRBloomFilterFalsePositiveRate(const BRBloomFilter *filter);
+
 // frees memory allocated for filter
 void BRBloomFilterFree(BRBloomFilter *filter);
 
@@ -100,26 +100,33 @@ static const BRCheckPoint BRTestNetCheckpoints[] = {
     // 2016000
 };
 
-static int BRMainNetVerifyDifficulty(const BRMerkleBlock *block, const BRSet *blockSet)
+static int BRMainNetVerifyDifficulty(const BRMerkleBlock *block, const BRSet *blockSet, const BRHeaderChain *chain)
 {
     const BRMerkleBlock *previous, *b = NULL;
-    uint32_t i;
+    uint32_t i, transitionTime = 0;
 
     assert(block != NULL);
     assert(blockSet != NULL);
+    previous = BRSetGet(blockSet, &block->prevBlock);
 
-    // check if we hit a difficulty transition, and find previous transition block
+    // check if we hit a difficulty transition, and find previous transition time
     if ((block->height % BLOCK_DIFFICULTY_INTERVAL) == 0) {
-        for (i = 0, b = block; b && i < BLOCK_DIFFICULTY_INTERVAL; i++) {
-            b = BRSetGet(blockSet, &b->prevBlock);
+        if (chain && previous && UInt256Eq(BRHeaderChainHash(chain, previous->height), previous->blockHash)) {
+            transitionTime = BRHeaderChainTransitionTime(chain, block->height);
+        }
+        else {
+            for (i = 0, b = block; b && i < BLOCK_DIFFICULTY_INTERVAL; i++) {
+                b = BRSetGet(blockSet, &b->prevBlock);
+            }
+
+            transitionTime = (b) ? b->timestamp : 0;
         }
     }
 
-    previous = BRSetGet(blockSet, &block->prevBlock);
-    return BRMerkleBlockVerifyDifficulty(block, previous, (b) ? b->timestamp : 0);
+    return BRMerkleBlockVerifyDifficulty(block, previous, transitionTime);
 }
 
-static int BRTestNetVerifyDifficulty(const BRMerkleBlock *block, const BRSet *blockSet)
+static int BRTestNetVerifyDifficulty(const BRMerkleBlock *block, const BRSet *blockSet, const BRHeaderChain *chain)
 {
     return 1; // XXX skip testnet difficulty check for now
 }
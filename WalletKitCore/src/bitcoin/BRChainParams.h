@@ -26,6 +26,7 @@
 #define BRChainParams_h
 
 #include "BRMerkleBlock.h"
+#include "BRHeaderChain.h"
 #include "BRPeer.h"
 #include "support/BRSet.h"
 #include "support/BRAddress.h"
@@ -49,7 +50,9 @@ typedef struct {
     uint16_t standardPort;
     uint32_t magicNumber;
     uint64_t services;
-    int (*verifyDifficulty)(const BRMerkleBlock *block, const BRSet *blockSet); // blockSet must have last 2016 blocks
+    // block's recent ancestors are read from chain if it's not NULL and they're on its main chain, otherwise blockSet
+    // must have the last 2016 blocks
+    int (*verifyDifficulty)(const BRMerkleBlock *block, const BRSet *blockSet, const BRHeaderChain *chain);
     const BRCheckPoint *checkpoints;
     size_t checkpointsCount;
     BRAddressParams addrParams;
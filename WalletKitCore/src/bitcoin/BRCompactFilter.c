@@ -0,0 +1,268 @@
+//
+//  BRCompactFilter.c
+//
+//  Copyright (c) 2026 breadwallet LLC.
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include "BRCompactFilter.h"
+#include "support/BRCrypto.h"
+#include "support/BRAddress.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define rol64(a, b) (((a) << (b)) | ((a) >> (64 - (b))))
+
+#define sipround(a, b, c, d) a += b, b = rol64(b, 13) ^ a, a = rol64(a, 32), c += d, d = rol64(d, 16) ^ c,\
+                             a += d, d = rol64(d, 21) ^ a, c += b, b = rol64(b, 17) ^ c, c = rol64(c, 32)
+
+#define SIP_LANES 4
+
+// returns the high 64 bits of the 128bit product a*b
+inline static uint64_t _BRMulHi64(uint64_t a, uint64_t b)
+{
+#if defined(__SIZEOF_INT128__)
+    return (uint64_t)(((unsigned __int128)a*b) >> 64);
+#else
+    uint64_t lo = (a & 0xffffffff)*(b & 0xffffffff), m1 = (a >> 32)*(b & 0xffffffff), m2 = (a & 0xffffffff)*(b >> 32),
+             m = (lo >> 32) + (m1 & 0xffffffff) + (m2 & 0xffffffff);
+
+    return (a >> 32)*(b >> 32) + (m1 >> 32) + (m2 >> 32) + (m >> 32);
+#endif
+}
+
+// sipHash-2-4 of laneCount consecutive elements of length len, each mapped to [0, range)
+// the lanes are independent, so their rounds are interleaved to keep the pipeline full
+static void _BRSipHashLanes(uint64_t *values, uint64_t range, uint64_t k0, uint64_t k1, const uint8_t *data, size_t len,
+                            size_t laneCount)
+{
+    uint64_t a[SIP_LANES], b[SIP_LANES], c[SIP_LANES], d[SIP_LANES], m[SIP_LANES];
+    size_t i, j, l;
+
+    assert(laneCount <= SIP_LANES);
+
+    for (l = 0; l < laneCount; l++) {
+        a[l] = k0 ^ 0x736f6d6570736575, b[l] = k1 ^ 0x646f72616e646f6d;
+        c[l] = k0 ^ 0x6c7967656e657261, d[l] = k1 ^ 0x7465646279746573;
+    }
+
+    for (i = 0; i + 7 < len; i += sizeof(uint64_t)) {
+        for (l = 0; l < laneCount; l++) m[l] = UInt64GetLE(&data[l*len + i]), d[l] ^= m[l];
+        for (j = 0; j < 2; j++) for (l = 0; l < laneCount; l++) sipround(a[l], b[l], c[l], d[l]);
+        for (l = 0; l < laneCount; l++) a[l] ^= m[l];
+    }
+
+    for (l = 0; l < laneCount; l++) {
+        m[l] = (uint64_t)len << 56;
+        for (j = 0; i + j < len; j++) m[l] |= (uint64_t)data[l*len + i + j] << j*8;
+        d[l] ^= m[l];
+    }
+
+    for (j = 0; j < 2; j++) for (l = 0; l < laneCount; l++) sipround(a[l], b[l], c[l], d[l]);
+    for (l = 0; l < laneCount; l++) a[l] ^= m[l], c[l] ^= 0xff;
+    for (j = 0; j < 4; j++) for (l = 0; l < laneCount; l++) sipround(a[l], b[l], c[l], d[l]);
+    for (l = 0; l < laneCount; l++) values[l] = _BRMulHi64(a[l] ^ b[l] ^ c[l] ^ d[l], range);
+}
+
+// hashes each element with the filter key for blockHash and maps it to [0, elemCount*M) as described in BIP158,
+// runs of equal length elements (wallet scripts are mostly the same type) are hashed several at a time
+static void _BRCompactFilterHashElems(uint64_t *values, uint64_t range, UInt256 blockHash, const uint8_t *elems,
+                                      const size_t elemLens[], size_t elemCount)
+{
+    uint64_t k0 = UInt64GetLE(&blockHash.u8[0]), k1 = UInt64GetLE(&blockHash.u8[sizeof(uint64_t)]);
+    size_t i = 0, l, off = 0;
+
+    while (i < elemCount) {
+        for (l = 1; l < SIP_LANES && i + l < elemCount && elemLens[i + l] == elemLens[i]; l++);
+        _BRSipHashLanes(&values[i], range, k0, k1, &elems[off], elemLens[i], l);
+        off += l*elemLens[i];
+        i += l;
+    }
+}
+
+static int _BRUInt64Compare(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return (x < y) ? -1 : (x > y) ? 1 : 0;
+}
+
+// returns the double-SHA256 hash of a serialized filter, as committed to by a filter header
+UInt256 BRCompactFilterHash(const uint8_t *filter, size_t filterLen)
+{
+    UInt256 hash;
+
+    assert(filter != NULL || filterLen == 0);
+    BRSHA256_2(&hash, filter, filterLen);
+    return hash;
+}
+
+// returns the filter header for a block, given its filter hash and the filter header of the previous block
+UInt256 BRCompactFilterHeader(UInt256 filterHash, UInt256 prevHeader)
+{
+    UInt256 hashes[2] = { filterHash, prevHeader }, header;
+
+    BRSHA256_2(&header, hashes, sizeof(hashes));
+    return header;
+}
+
+// elems is the concatenation of elemCount output scripts, elemLens[i] is the length of the i-th one, and each script
+// must only be given once
+// writes the serialized basic filter of elems for blockHash to buf
+// returns number of bytes written to buf, or total bufLen needed if buf is NULL
+size_t BRCompactFilterBuild(uint8_t *buf, size_t bufLen, UInt256 blockHash, const uint8_t *elems,
+                            const size_t elemLens[], size_t elemCount)
+{
+    uint64_t _values[128], *values = (elemCount <= 128) ? _values : malloc(elemCount*sizeof(*values)), last = 0, q;
+    size_t i, j, off = BRVarIntSize(elemCount), bits = 0, len;
+
+    assert(elems != NULL || elemCount == 0);
+    assert(elemLens != NULL || elemCount == 0);
+    assert(values != NULL);
+    _BRCompactFilterHashElems(values, (uint64_t)elemCount*COMPACT_FILTER_M, blockHash, elems, elemLens, elemCount);
+    qsort(values, elemCount, sizeof(*values), _BRUInt64Compare);
+
+    for (i = 0; i < elemCount; i++) { // quotient in unary followed by a 0 bit, then the P bit remainder
+        bits += ((values[i] - last) >> COMPACT_FILTER_P) + 1 + COMPACT_FILTER_P;
+        last = values[i];
+    }
+
+    len = off + (bits + 7)/8;
+
+    if (buf && len <= bufLen) {
+        memset(buf, 0, len);
+        BRVarIntSet(buf, len, elemCount);
+        bits = off*8;
+
+        for (i = 0, last = 0; i < elemCount; i++) { // bits are written most significant first
+            for (q = (values[i] - last) >> COMPACT_FILTER_P; q > 0; q--, bits++) buf[bits/8] |= 0x80 >> (bits % 8);
+            bits++;
+
+            for (j = COMPACT_FILTER_P; j > 0; j--, bits++) {
+                if ((values[i] - last) & (1ULL << (j - 1))) buf[bits/8] |= 0x80 >> (bits % 8);
+            }
+
+            last = values[i];
+        }
+    }
+
+    if (values != _values) free(values);
+    return (! buf || len <= bufLen) ? len : 0;
+}
+
+typedef struct {
+    const uint8_t *p, *end;
+    uint64_t bits; // buffered input, most significant bit first
+    unsigned count; // number of valid bits in the buffer
+} _BRBitReader;
+
+// tops up the buffer a byte at a time until it holds at least 57 bits or the input runs out
+inline static void _BRBitReaderFill(_BRBitReader *r)
+{
+    while (r->count <= 56 && r->p < r->end) r->bits |= (uint64_t)*r->p++ << (56 - r->count), r->count += 8;
+}
+
+inline static void _BRBitReaderSkip(_BRBitReader *r, unsigned n)
+{
+    r->bits = (n < 64) ? r->bits << n : 0;
+    r->count -= n;
+}
+
+// number of leading 1 bits in x
+inline static unsigned _BRLeadingOnes(uint64_t x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return (~x == 0) ? 64 : (unsigned)__builtin_clzll(~x);
+#else
+    unsigned n = 0;
+
+    while (n < 64 && (x & (0x8000000000000000ULL >> n))) n++;
+    return n;
+#endif
+}
+
+// reads the next golomb-rice coded delta, returns false at the end of input
+inline static int _BRBitReaderGolomb(_BRBitReader *r, uint64_t *delta)
+{
+    uint64_t q = 0;
+    unsigned n;
+
+    for (;;) { // unary quotient, scanned a word at a time instead of a bit at a time
+        _BRBitReaderFill(r);
+        if (r->count == 0) return 0;
+        n = _BRLeadingOnes(r->bits);
+
+        if (n < r->count) {
+            _BRBitReaderSkip(r, n + 1);
+            q += n;
+            break;
+        }
+
+        q += r->count;
+        _BRBitReaderSkip(r, r->count);
+    }
+
+    _BRBitReaderFill(r);
+    if (r->count < COMPACT_FILTER_P) return 0;
+    *delta = (q << COMPACT_FILTER_P) | (r->bits >> (64 - COMPACT_FILTER_P));
+    _BRBitReaderSkip(r, COMPACT_FILTER_P);
+    return 1;
+}
+
+// elems is the concatenation of elemCount output scripts, elemLens[i] is the length of the i-th one
+// true if any of elems is matched by the serialized basic filter for blockHash, or if the filter is malformed, so
+// that a block is only skipped when its filter rules out every element
+int BRCompactFilterMatchAny(const uint8_t *filter, size_t filterLen, UInt256 blockHash, const uint8_t *elems,
+                            const size_t elemLens[], size_t elemCount)
+{
+    size_t off = 0, n = (size_t)BRVarInt(filter, filterLen, &off), i, j = 0;
+    uint64_t _values[128], *values, value = 0, delta;
+    _BRBitReader r = { NULL, NULL, 0, 0 };
+    int match = 0;
+
+    assert(filter != NULL || filterLen == 0);
+    assert(elems != NULL || elemCount == 0);
+    assert(elemLens != NULL || elemCount == 0);
+    if (off > filterLen) return 1; // malformed, the element count is truncated
+    if (n == 0 || elemCount == 0) return 0;
+    if (n > (filterLen - off)*8/(COMPACT_FILTER_P + 1)) return 1; // more elements than could possibly be coded
+
+    // hash the elements once, sort them, then walk the sorted set and the sorted elements together
+    values = (elemCount <= 128) ? _values : malloc(elemCount*sizeof(*values));
+    assert(values != NULL);
+    _BRCompactFilterHashElems(values, (uint64_t)n*COMPACT_FILTER_M, blockHash, elems, elemLens, elemCount);
+    qsort(values, elemCount, sizeof(*values), _BRUInt64Compare);
+    r.p = &filter[off], r.end = &filter[filterLen];
+
+    for (i = 0; i < n && ! match; i++) {
+        if (! _BRBitReaderGolomb(&r, &delta)) {
+            match = 1; // malformed
+            break;
+        }
+
+        value += delta;
+        while (j < elemCount && values[j] < value) j++;
+        if (j == elemCount) break; // every element is smaller than the rest of the set
+        if (values[j] == value) match = 1;
+    }
+
+    if (values != _values) free(values);
+    return match;
+}
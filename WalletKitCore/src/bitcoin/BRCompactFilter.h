@@ -0,0 +1,65 @@
+//
+//  BRCompactFilter.h
+//
+//  Copyright (c) 2026 breadwallet LLC.
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#ifndef BRCompactFilter_h
+#define BRCompactFilter_h
+
+#include "support/BRInt.h"
+#include <stddef.h>
+#include <inttypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// compact block filters are explained in BIP158: https://github.com/bitcoin/bips/blob/master/bip-0158.mediawiki
+// a basic filter is a golomb-rice coded set of every output script in a block and every output script spent by it
+
+#define COMPACT_FILTER_BASIC 0x00   // filter type
+#define COMPACT_FILTER_P     19     // golomb-rice coding parameter
+#define COMPACT_FILTER_M     784931 // inverse of the false positive rate for a single element
+
+// returns the double-SHA256 hash of a serialized filter, as committed to by a filter header
+UInt256 BRCompactFilterHash(const uint8_t *filter, size_t filterLen);
+
+// returns the filter header for a block, given its filter hash and the filter header of the previous block
+UInt256 BRCompactFilterHeader(UInt256 filterHash, UInt256 prevHeader);
+
+// elems is the concatenation of elemCount output scripts, elemLens[i] is the length of the i-th one, and each script
+// must only be given once
+// writes the serialized basic filter of elems for blockHash to buf
+// returns number of bytes written to buf, or total bufLen needed if buf is NULL
+size_t BRCompactFilterBuild(uint8_t *buf, size_t bufLen, UInt256 blockHash, const uint8_t *elems,
+                            const size_t elemLens[], size_t elemCount);
+
+// elems is the concatenation of elemCount output scripts, elemLens[i] is the length of the i-th one
+// true if any of elems is matched by the serialized basic filter for blockHash, or if the filter is malformed, so
+// that a block is only skipped when its filter rules out every element
+int BRCompactFilterMatchAny(const uint8_t *filter, size_t filterLen, UInt256 blockHash, const uint8_t *elems,
+                            const size_t elemLens[], size_t elemCount);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BRCompactFilter_h
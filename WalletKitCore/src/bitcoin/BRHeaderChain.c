@@ -0,0 +1,261 @@
+//
+//  BRHeaderChain.c
+//
+//  Copyright (c) 2026 breadwallet LLC.
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include "BRHeaderChain.h"
+#include "support/BRArray.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define HEADER_LEN 80
+
+typedef struct {
+    UInt256 blockHash; // UINT256_ZERO if the header is unknown
+    uint8_t header[HEADER_LEN];
+} BRHeaderEntry;
+
+struct BRHeaderChainStruct {
+    uint32_t depth;
+    uint32_t base; // height of headers[0]
+    BRHeaderEntry *headers; // contiguous recent headers
+    BRHeaderEntry *transitions; // transitions[i] is the header at height i*BLOCK_DIFFICULTY_INTERVAL
+    BRHeaderStore *store; // optional backing store for headers that were pruned
+};
+
+static void _BRHeaderEntrySet(BRHeaderEntry *entry, const BRMerkleBlock *block)
+{
+    size_t off = 0;
+
+    entry->blockHash = block->blockHash;
+    UInt32SetLE(&entry->header[off], block->version);
+    off += sizeof(uint32_t);
+    UInt256Set(&entry->header[off], block->prevBlock);
+    off += sizeof(UInt256);
+    UInt256Set(&entry->header[off], block->merkleRoot);
+    off += sizeof(UInt256);
+    UInt32SetLE(&entry->header[off], block->timestamp);
+    off += sizeof(uint32_t);
+    UInt32SetLE(&entry->header[off], block->target);
+    off += sizeof(uint32_t);
+    UInt32SetLE(&entry->header[off], block->nonce);
+}
+
+static uint32_t _BRHeaderEntryTimestamp(const BRHeaderEntry *entry)
+{
+    return UInt32GetLE(&entry->header[sizeof(uint32_t) + sizeof(UInt256)*2]);
+}
+
+static uint32_t _BRHeaderEntryTarget(const BRHeaderEntry *entry)
+{
+    return UInt32GetLE(&entry->header[sizeof(uint32_t) + sizeof(UInt256)*2 + sizeof(uint32_t)]);
+}
+
+static const BRHeaderEntry *_BRHeaderChainEntry(const BRHeaderChain *chain, uint32_t height)
+{
+    const BRHeaderEntry *entry = NULL;
+    size_t i;
+
+    if (height >= chain->base && height - chain->base < array_count(chain->headers)) {
+        entry = &chain->headers[height - chain->base];
+    }
+    else if ((height % BLOCK_DIFFICULTY_INTERVAL) == 0 &&
+             (i = height/BLOCK_DIFFICULTY_INTERVAL) < array_count(chain->transitions)) {
+        entry = &chain->transitions[i];
+    }
+
+    return (entry && ! UInt256IsZero(entry->blockHash)) ? entry : NULL;
+}
+
+// drops the oldest headers once there are a quarter more than depth, so the array is only shifted now and then
+static void _BRHeaderChainPrune(BRHeaderChain *chain)
+{
+    size_t count = array_count(chain->headers);
+
+    if (chain->depth > 0 && count > chain->depth + chain->depth/4) {
+        array_rm_range(chain->headers, 0, count - chain->depth);
+        chain->base += count - chain->depth;
+    }
+}
+
+// returns a newly allocated empty header chain that keeps the most recent depth headers, or every header if depth is 0
+// must be freed by calling BRHeaderChainFree()
+BRHeaderChain *BRHeaderChainNew(uint32_t depth)
+{
+    BRHeaderChain *chain = calloc(1, sizeof(*chain));
+
+    assert(chain != NULL);
+    chain->depth = depth;
+    array_new(chain->headers, (depth > 0) ? depth + depth/4 + 1 : 1000);
+    array_new(chain->transitions, 100);
+    return chain;
+}
+
+// changes the number of recent headers kept, older headers are pruned as new ones are set
+void BRHeaderChainSetDepth(BRHeaderChain *chain, uint32_t depth)
+{
+    assert(chain != NULL);
+    chain->depth = depth;
+    _BRHeaderChainPrune(chain);
+}
+
+// sets a store that every header set from now on is also written to, and that headers which are unknown or were pruned
+// are looked up in, or NULL to stop using it (the chain doesn't take ownership of store)
+void BRHeaderChainSetStore(BRHeaderChain *chain, BRHeaderStore *store)
+{
+    assert(chain != NULL);
+    chain->store = store;
+}
+
+// sets the main chain header at block->height, headers above it are discarded if it replaces a different block
+// if block->height isn't next to the headers already in the chain, the chain restarts from block (difficulty transition
+// headers below block->height are kept)
+void BRHeaderChainSet(BRHeaderChain *chain, const BRMerkleBlock *block)
+{
+    size_t count, i;
+    BRHeaderEntry entry;
+
+    assert(chain != NULL);
+    assert(block != NULL);
+    assert(block->height != BLOCK_UNKNOWN_HEIGHT);
+    if (chain->store) BRHeaderStoreSet(chain->store, block);
+    count = array_count(chain->headers);
+    _BRHeaderEntrySet(&entry, block);
+
+    if (block->height < chain->base + count) { // replaces a header already in the chain, or restarts below it
+        if (block->height >= chain->base &&
+            UInt256Eq(chain->headers[block->height - chain->base].blockHash, block->blockHash)) return;
+        i = (block->height + BLOCK_DIFFICULTY_INTERVAL - 1)/BLOCK_DIFFICULTY_INTERVAL;
+        if (i < array_count(chain->transitions)) array_set_count(chain->transitions, i); // transitions above are stale
+    }
+
+    if (count == 0 || block->height < chain->base || block->height > chain->base + count) { // not contiguous
+        array_clear(chain->headers);
+        chain->base = block->height;
+    }
+    else array_set_count(chain->headers, block->height - chain->base); // headers above it no longer connect
+
+    array_add(chain->headers, entry);
+
+    if ((block->height % BLOCK_DIFFICULTY_INTERVAL) == 0) {
+        i = block->height/BLOCK_DIFFICULTY_INTERVAL;
+        if (i >= array_count(chain->transitions)) array_set_count(chain->transitions, i + 1);
+        chain->transitions[i] = entry;
+    }
+
+    _BRHeaderChainPrune(chain);
+}
+
+// writes the main chain header at height to block, with its height and block hash set but no tx hashes
+// returns false if height is unknown or was pruned
+int BRHeaderChainGet(const BRHeaderChain *chain, uint32_t height, BRMerkleBlock *block)
+{
+    const BRHeaderEntry *entry;
+    size_t off = 0;
+
+    assert(chain != NULL);
+    assert(block != NULL);
+    entry = _BRHeaderChainEntry(chain, height);
+    if (! entry) return (chain->store) ? BRHeaderStoreGet(chain->store, height, block) : 0;
+    *block = BR_MERKLE_BLOCK_NONE;
+    block->blockHash = entry->blockHash;
+    block->version = UInt32GetLE(&entry->header[off]);
+    off += sizeof(uint32_t);
+    block->prevBlock = UInt256Get(&entry->header[off]);
+    off += sizeof(UInt256);
+    block->merkleRoot = UInt256Get(&entry->header[off]);
+    off += sizeof(UInt256);
+    block->timestamp = UInt32GetLE(&entry->header[off]);
+    off += sizeof(uint32_t);
+    block->target = UInt32GetLE(&entry->header[off]);
+    off += sizeof(uint32_t);
+    block->nonce = UInt32GetLE(&entry->header[off]);
+    block->height = height;
+    return 1;
+}
+
+// returns the block hash of the main chain header at height, or UINT256_ZERO if height is unknown or was pruned
+UInt256 BRHeaderChainHash(const BRHeaderChain *chain, uint32_t height)
+{
+    const BRHeaderEntry *entry;
+
+    assert(chain != NULL);
+    entry = _BRHeaderChainEntry(chain, height);
+    if (! entry && chain->store) return BRHeaderStoreHash(chain->store, height);
+    return (entry) ? entry->blockHash : UINT256_ZERO;
+}
+
+// returns the timestamp of the difficulty transition block that started the interval height - 1 is in, which is the
+// transition time needed to verify the difficulty target of a block at height, or 0 if it's unknown
+uint32_t BRHeaderChainTransitionTime(const BRHeaderChain *chain, uint32_t height)
+{
+    const BRHeaderEntry *entry;
+    BRMerkleBlock header;
+
+    assert(chain != NULL);
+    if (height == 0) return 0;
+    height = (height - 1) - (height - 1) % BLOCK_DIFFICULTY_INTERVAL;
+    entry = _BRHeaderChainEntry(chain, height);
+    if (! entry && chain->store && BRHeaderStoreGet(chain->store, height, &header)) return header.timestamp;
+    return (entry) ? _BRHeaderEntryTimestamp(entry) : 0;
+}
+
+// writes the timestamps and targets of the count main chain headers ending at height to timestamps and targets, most
+// recent first, so the recent ancestors of a block can be read without looking each one up by its hash
+// returns false if the header at height isn't blockHash, or the headers aren't all among the recent ones kept in memory
+int BRHeaderChainWindow(const BRHeaderChain *chain, uint32_t height, UInt256 blockHash, uint32_t timestamps[],
+                        uint32_t targets[], size_t count)
+{
+    const BRHeaderEntry *entry;
+    size_t i;
+
+    assert(chain != NULL);
+    assert((timestamps != NULL && targets != NULL) || count == 0);
+    if (height < chain->base || height - chain->base >= array_count(chain->headers)) return 0;
+    if (count > height - chain->base + 1 || ! UInt256Eq(chain->headers[height - chain->base].blockHash, blockHash)) {
+        return 0;
+    }
+
+    for (i = 0, entry = &chain->headers[height - chain->base]; i < count; i++, entry--) {
+        timestamps[i] = _BRHeaderEntryTimestamp(entry);
+        targets[i] = _BRHeaderEntryTarget(entry);
+    }
+
+    return 1;
+}
+
+// returns the height of the most recent header, or BLOCK_UNKNOWN_HEIGHT if the chain is empty
+uint32_t BRHeaderChainHeight(const BRHeaderChain *chain)
+{
+    assert(chain != NULL);
+    return (array_count(chain->headers) > 0) ? chain->base + (uint32_t)array_count(chain->headers) - 1 :
+           BLOCK_UNKNOWN_HEIGHT;
+}
+
+// frees memory allocated for chain
+void BRHeaderChainFree(BRHeaderChain *chain)
+{
+    assert(chain != NULL);
+    array_free(chain->headers);
+    array_free(chain->transitions);
+    free(chain);
+}
@@ -0,0 +1,90 @@
+//
+//  BRHeaderChain.h
+//
+//  Copyright (c) 2026 breadwallet LLC.
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#ifndef BRHeaderChain_h
+#define BRHeaderChain_h
+
+#include "BRMerkleBlock.h"
+#include "BRHeaderStore.h"
+#include "support/BRInt.h"
+#include <stddef.h>
+#include <inttypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// a header chain keeps the serialized 80 byte header and block hash of each main chain block in a contiguous array
+// indexed by height, so a block can be looked up by height without walking back through prevBlock links
+// only the most recent depth headers are kept, along with the header at every difficulty transition, which is never
+// pruned so the previous transition of any block can always be found
+// pruned headers can still be found if the chain is backed by a header store
+
+#define HEADER_CHAIN_DEPTH (2*BLOCK_DIFFICULTY_INTERVAL) // default number of recent headers kept
+
+typedef struct BRHeaderChainStruct BRHeaderChain;
+
+// returns a newly allocated empty header chain that keeps the most recent depth headers, or every header if depth is 0
+// must be freed by calling BRHeaderChainFree()
+BRHeaderChain *BRHeaderChainNew(uint32_t depth);
+
+// changes the number of recent headers kept, older headers are pruned as new ones are set
+void BRHeaderChainSetDepth(BRHeaderChain *chain, uint32_t depth);
+
+// sets a store that every header set from now on is also written to, and that headers which are unknown or were pruned
+// are looked up in, or NULL to stop using it (the chain doesn't take ownership of store)
+void BRHeaderChainSetStore(BRHeaderChain *chain, BRHeaderStore *store);
+
+// sets the main chain header at block->height, headers above it are discarded if it replaces a different block
+// if block->height isn't next to the headers already in the chain, the chain restarts from block (difficulty transition
+// headers below block->height are kept)
+void BRHeaderChainSet(BRHeaderChain *chain, const BRMerkleBlock *block);
+
+// writes the main chain header at height to block, with its height and block hash set but no tx hashes
+// returns false if height is unknown or was pruned
+int BRHeaderChainGet(const BRHeaderChain *chain, uint32_t height, BRMerkleBlock *block);
+
+// returns the block hash of the main chain header at height, or UINT256_ZERO if height is unknown or was pruned
+UInt256 BRHeaderChainHash(const BRHeaderChain *chain, uint32_t height);
+
+// returns the timestamp of the difficulty transition block that started the interval height - 1 is in, which is the
+// transition time needed to verify the difficulty target of a block at height, or 0 if it's unknown
+uint32_t BRHeaderChainTransitionTime(const BRHeaderChain *chain, uint32_t height);
+
+// writes the timestamps and targets of the count main chain headers ending at height to timestamps and targets, most
+// recent first, so the recent ancestors of a block can be read without looking each one up by its hash
+// returns false if the header at height isn't blockHash, or the headers aren't all among the recent ones kept in memory
+int BRHeaderChainWindow(const BRHeaderChain *chain, uint32_t height, UInt256 blockHash, uint32_t timestamps[],
+                        uint32_t targets[], size_t count);
+
+// returns the height of the most recent header, or BLOCK_UNKNOWN_HEIGHT if the chain is empty
+uint32_t BRHeaderChainHeight(const BRHeaderChain *chain);
+
+// frees memory allocated for chain
+void BRHeaderChainFree(BRHeaderChain *chain);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BRHeaderChain_h
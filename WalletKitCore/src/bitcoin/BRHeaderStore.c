@@ -0,0 +1,269 @@
+//
+//  BRHeaderStore.c
+//
+//  Copyright (c) 2026 breadwallet LLC.
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+
+#include "BRHeaderStore.h"
+#include "support/BRCrypto.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define HEADER_LEN       80
+#define RECORD_LEN       (sizeof(UInt256) + HEADER_LEN)
+#define FILE_HEADER_LEN  64   // magic, version, base, count, last block height, tail checksum, file header checksum,
+                              // then zero padding
+#define STORE_MAGIC      0x53485242 // "BRHS"
+#define STORE_VERSION    2
+#define STORE_TAIL_COUNT 8    // number of most recent records covered by the tail checksum
+#define STORE_GROW_COUNT 4096 // number of records the file is grown by when it's full
+
+struct BRHeaderStoreStruct {
+    int fd;
+    uint8_t *map;
+    size_t mapLen; // length of the file, which is grown STORE_GROW_COUNT records at a time
+    uint32_t base; // height of the first record
+    uint32_t count;
+    uint32_t lastBlockHeight; // height of the last block committed to the chain, or BLOCK_UNKNOWN_HEIGHT
+};
+
+static uint8_t *_BRHeaderStoreRecord(const BRHeaderStore *store, uint32_t i)
+{
+    return &store->map[FILE_HEADER_LEN + (size_t)i*RECORD_LEN];
+}
+
+static uint32_t _BRHeaderStoreTailChecksum(const BRHeaderStore *store)
+{
+    uint32_t n = (store->count < STORE_TAIL_COUNT) ? store->count : STORE_TAIL_COUNT;
+
+    return BRMurmur3_32(_BRHeaderStoreRecord(store, store->count - n), (size_t)n*RECORD_LEN, STORE_VERSION);
+}
+
+// writes the file header, which must happen after the records it covers are written so a crash in between leaves the
+// previous, still valid, file header in place
+static void _BRHeaderStoreWriteFileHeader(BRHeaderStore *store)
+{
+    UInt32SetLE(&store->map[0], STORE_MAGIC);
+    UInt32SetLE(&store->map[4], STORE_VERSION);
+    UInt32SetLE(&store->map[8], store->base);
+    UInt32SetLE(&store->map[12], store->count);
+    UInt32SetLE(&store->map[16], store->lastBlockHeight);
+    UInt32SetLE(&store->map[20], _BRHeaderStoreTailChecksum(store));
+    UInt32SetLE(&store->map[24], BRMurmur3_32(store->map, 24, STORE_VERSION));
+}
+
+// reads the file header, returns false if it's missing, corrupt, or its tail checksum doesn't match the records
+static int _BRHeaderStoreReadFileHeader(BRHeaderStore *store)
+{
+    uint32_t count = UInt32GetLE(&store->map[12]);
+
+    if (UInt32GetLE(&store->map[0]) != STORE_MAGIC || UInt32GetLE(&store->map[4]) != STORE_VERSION) return 0;
+    if (UInt32GetLE(&store->map[24]) != BRMurmur3_32(store->map, 24, STORE_VERSION)) return 0;
+    if (FILE_HEADER_LEN + (size_t)count*RECORD_LEN > store->mapLen) return 0;
+    store->base = UInt32GetLE(&store->map[8]);
+    store->count = count;
+    store->lastBlockHeight = UInt32GetLE(&store->map[16]);
+    if (count > 0 && store->base >= BLOCK_UNKNOWN_HEIGHT - count) return 0;
+    return (UInt32GetLE(&store->map[20]) == _BRHeaderStoreTailChecksum(store));
+}
+
+// grows the file and remaps it so there's room for at least count records
+static int _BRHeaderStoreReserve(BRHeaderStore *store, uint32_t count)
+{
+    size_t len = FILE_HEADER_LEN + ((size_t)count + STORE_GROW_COUNT)*RECORD_LEN;
+    uint8_t *map;
+
+    if (FILE_HEADER_LEN + (size_t)count*RECORD_LEN <= store->mapLen) return 1;
+    if (ftruncate(store->fd, (off_t)len) != 0) return 0;
+    map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, store->fd, 0);
+    if (map == MAP_FAILED) return 0;
+    if (store->map) munmap(store->map, store->mapLen);
+    store->map = map;
+    store->mapLen = len;
+    return 1;
+}
+
+// opens the header store at path, creating it if needed
+// returns NULL if the file can't be opened or mapped, otherwise must be closed by calling BRHeaderStoreClose()
+BRHeaderStore *BRHeaderStoreOpen(const char *path)
+{
+    BRHeaderStore *store = calloc(1, sizeof(*store));
+    struct stat st;
+
+    assert(store != NULL);
+    assert(path != NULL);
+    store->fd = open(path, O_RDWR | O_CREAT, 0644);
+
+    if (store->fd < 0 || fstat(store->fd, &st) != 0) {
+        if (store->fd >= 0) close(store->fd);
+        free(store);
+        return NULL;
+    }
+
+    if (st.st_size >= FILE_HEADER_LEN) {
+        store->mapLen = (size_t)st.st_size;
+        store->map = mmap(NULL, store->mapLen, PROT_READ | PROT_WRITE, MAP_SHARED, store->fd, 0);
+        if (store->map == MAP_FAILED) store->map = NULL, store->mapLen = 0;
+    }
+
+    if (! store->map && ! _BRHeaderStoreReserve(store, 0)) {
+        close(store->fd);
+        free(store);
+        return NULL;
+    }
+
+    if (! _BRHeaderStoreReadFileHeader(store)) { // new, torn or corrupt, start over empty
+        store->base = store->count = 0;
+        store->lastBlockHeight = BLOCK_UNKNOWN_HEIGHT;
+        _BRHeaderStoreWriteFileHeader(store);
+    }
+
+    return store;
+}
+
+// sets the header at block->height, records above it are truncated if it replaces a different block
+// if block->height isn't next to the records already in the store, the store restarts from block
+// returns false if the file couldn't be grown
+int BRHeaderStoreSet(BRHeaderStore *store, const BRMerkleBlock *block)
+{
+    uint8_t *record;
+    size_t off = sizeof(UInt256);
+
+    assert(store != NULL);
+    assert(block != NULL);
+    assert(block->height != BLOCK_UNKNOWN_HEIGHT);
+
+    if (store->count > 0 && block->height >= store->base && block->height - store->base < store->count) {
+        record = _BRHeaderStoreRecord(store, block->height - store->base);
+        if (UInt256Eq(UInt256Get(record), block->blockHash)) return 1;
+        store->count = block->height - store->base; // records above it no longer connect
+    }
+    else if (store->count == 0 || block->height != store->base + store->count) { // not contiguous
+        store->base = block->height;
+        store->count = 0;
+    }
+
+    if (! _BRHeaderStoreReserve(store, store->count + 1)) return 0;
+    record = _BRHeaderStoreRecord(store, store->count);
+    UInt256Set(record, block->blockHash);
+    UInt32SetLE(&record[off], block->version);
+    off += sizeof(uint32_t);
+    UInt256Set(&record[off], block->prevBlock);
+    off += sizeof(UInt256);
+    UInt256Set(&record[off], block->merkleRoot);
+    off += sizeof(UInt256);
+    UInt32SetLE(&record[off], block->timestamp);
+    off += sizeof(uint32_t);
+    UInt32SetLE(&record[off], block->target);
+    off += sizeof(uint32_t);
+    UInt32SetLE(&record[off], block->nonce);
+    store->count++;
+    _BRHeaderStoreWriteFileHeader(store);
+    return 1;
+}
+
+// writes the header at height to block, with its height and block hash set but no tx hashes
+// returns false if height isn't in the store
+int BRHeaderStoreGet(const BRHeaderStore *store, uint32_t height, BRMerkleBlock *block)
+{
+    const uint8_t *record;
+    size_t off = sizeof(UInt256);
+
+    assert(store != NULL);
+    assert(block != NULL);
+    if (height < store->base || height - store->base >= store->count) return 0;
+    record = _BRHeaderStoreRecord(store, height - store->base);
+    *block = BR_MERKLE_BLOCK_NONE;
+    block->blockHash = UInt256Get(record);
+    block->version = UInt32GetLE(&record[off]);
+    off += sizeof(uint32_t);
+    block->prevBlock = UInt256Get(&record[off]);
+    off += sizeof(UInt256);
+    block->merkleRoot = UInt256Get(&record[off]);
+    off += sizeof(UInt256);
+    block->timestamp = UInt32GetLE(&record[off]);
+    off += sizeof(uint32_t);
+    block->target = UInt32GetLE(&record[off]);
+    off += sizeof(uint32_t);
+    block->nonce = UInt32GetLE(&record[off]);
+    block->height = height;
+    return 1;
+}
+
+// returns the block hash of the header at height, or UINT256_ZERO if height isn't in the store
+UInt256 BRHeaderStoreHash(const BRHeaderStore *store, uint32_t height)
+{
+    assert(store != NULL);
+    if (height < store->base || height - store->base >= store->count) return UINT256_ZERO;
+    return UInt256Get(_BRHeaderStoreRecord(store, height - store->base));
+}
+
+// returns the height of the first record, or BLOCK_UNKNOWN_HEIGHT if the store is empty
+uint32_t BRHeaderStoreBaseHeight(const BRHeaderStore *store)
+{
+    assert(store != NULL);
+    return (store->count > 0) ? store->base : BLOCK_UNKNOWN_HEIGHT;
+}
+
+// returns the height of the most recent record, or BLOCK_UNKNOWN_HEIGHT if the store is empty
+uint32_t BRHeaderStoreHeight(const BRHeaderStore *store)
+{
+    assert(store != NULL);
+    return (store->count > 0) ? store->base + store->count - 1 : BLOCK_UNKNOWN_HEIGHT;
+}
+
+// records the height of the last block committed to the chain, records above it may be headers that were set ahead of
+// their blocks, so a chain restored from the store must stop there
+void BRHeaderStoreSetLastBlockHeight(BRHeaderStore *store, uint32_t height)
+{
+    assert(store != NULL);
+    if (height == store->lastBlockHeight) return;
+    store->lastBlockHeight = height;
+    _BRHeaderStoreWriteFileHeader(store);
+}
+
+// returns the height of the last block committed to the chain, or BLOCK_UNKNOWN_HEIGHT if it's unknown or not in the
+// store
+uint32_t BRHeaderStoreLastBlockHeight(const BRHeaderStore *store)
+{
+    assert(store != NULL);
+    if (store->count == 0 || store->lastBlockHeight == BLOCK_UNKNOWN_HEIGHT || store->lastBlockHeight < store->base) {
+        return BLOCK_UNKNOWN_HEIGHT;
+    }
+
+    return (store->lastBlockHeight - store->base < store->count) ? store->lastBlockHeight :
+           store->base + store->count - 1;
+}
+
+// flushes the store to disk, unmaps and closes the file and frees memory allocated for store
+void BRHeaderStoreClose(BRHeaderStore *store)
+{
+    assert(store != NULL);
+    msync(store->map, store->mapLen, MS_SYNC);
+    munmap(store->map, store->mapLen);
+    close(store->fd);
+    free(store);
+}
@@ -0,0 +1,82 @@
+//
+//  BRHeaderStore.h
+//
+//  Copyright (c) 2026 breadwallet LLC.
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+
+#ifndef BRHeaderStore_h
+#define BRHeaderStore_h
+
+#include "BRMerkleBlock.h"
+#include "support/BRInt.h"
+#include <stddef.h>
+#include <inttypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// a header store is an append-only file of fixed size records, each holding the block hash and serialized 80 byte
+// header of one main chain block, indexed by height from the height of the first record
+// the file is memory mapped, so opening it only reads the file header, and records are paged in as they're looked up
+// the file header holds a checksum of the most recent records, and a store with a torn or corrupt tail is emptied
+// when it's opened rather than trusted
+
+typedef struct BRHeaderStoreStruct BRHeaderStore;
+
+// opens the header store at path, creating it if needed
+// returns NULL if the file can't be opened or mapped, otherwise must be closed by calling BRHeaderStoreClose()
+BRHeaderStore *BRHeaderStoreOpen(const char *path);
+
+// sets the header at block->height, records above it are truncated if it replaces a different block
+// if block->height isn't next to the records already in the store, the store restarts from block
+// returns false if the file couldn't be grown
+int BRHeaderStoreSet(BRHeaderStore *store, const BRMerkleBlock *block);
+
+// writes the header at height to block, with its height and block hash set but no tx hashes
+// returns false if height isn't in the store
+int BRHeaderStoreGet(const BRHeaderStore *store, uint32_t height, BRMerkleBlock *block);
+
+// returns the block hash of the header at height, or UINT256_ZERO if height isn't in the store
+UInt256 BRHeaderStoreHash(const BRHeaderStore *store, uint32_t height);
+
+// returns the height of the first record, or BLOCK_UNKNOWN_HEIGHT if the store is empty
+uint32_t BRHeaderStoreBaseHeight(const BRHeaderStore *store);
+
+// returns the height of the most recent record, or BLOCK_UNKNOWN_HEIGHT if the store is empty
+uint32_t BRHeaderStoreHeight(const BRHeaderStore *store);
+
+// records the height of the last block committed to the chain, records above it may be headers that were set ahead of
+// their blocks, so a chain restored from the store must stop there
+void BRHeaderStoreSetLastBlockHeight(BRHeaderStore *store, uint32_t height);
+
+// returns the height of the last block committed to the chain, or BLOCK_UNKNOWN_HEIGHT if it's unknown or not in the
+// store
+uint32_t BRHeaderStoreLastBlockHeight(const BRHeaderStore *store);
+
+// flushes the store to disk, unmaps and closes the file and frees memory allocated for store
+void BRHeaderStoreClose(BRHeaderStore *store);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BRHeaderStore_h
@@ -35,6 +35,20 @@
 #define MAX_PROOF_OF_WORK 0x1d00ffff    // highest value for difficulty target (higher values are less difficult)
 #define TARGET_TIMESPAN   (14*24*60*60) // the targeted timespan between difficulty target adjustments
 
+#if defined (DEBUG) || defined (BITCOIN_TEST_MAX_PROOF_OF_WORK)
+static uint32_t _maxProofOfWork = MAX_PROOF_OF_WORK;
+
+// for tests only, in DEBUG builds or optimized ones with BITCOIN_TEST_MAX_PROOF_OF_WORK defined: blocks are checked
+// against maxProofOfWork instead of MAX_PROOF_OF_WORK, so that a test chain such as regtest can be mined quickly, or
+// against MAX_PROOF_OF_WORK again if maxProofOfWork is 0
+void BRMerkleBlockSetMaxProofOfWork(uint32_t maxProofOfWork)
+{
+    _maxProofOfWork = (maxProofOfWork) ? maxProofOfWork : MAX_PROOF_OF_WORK;
+}
+#else
+#define _maxProofOfWork MAX_PROOF_OF_WORK
+#endif
+
 inline static int _ceil_log2(int x)
 {
     int r = (x & (x - 1)) ? 1 : 0;
@@ -189,26 +203,41 @@ size_t BRMerkleBlockSerialize(const BRMerkleBlock *block, uint8_t *buf, size_t b
     return (! buf || len <= bufLen) ? len : 0;
 }
 
-static size_t _BRMerkleBlockTxHashesR(const BRMerkleBlock *block, UInt256 *txHashes, size_t hashesCount, size_t *idx,
+// partial merkle tree of a block, read in place from either a parsed block or a serialized message
+typedef struct {
+    const uint8_t *hashes; // read bytewise, a message buffer doesn't keep them aligned
+    size_t hashesCount;
+    const uint8_t *flags;
+    size_t flagsLen;
+    int depth; // depth of the leaf level
+} _BRMerkleTree;
+
+static _BRMerkleTree _BRMerkleBlockTree(const BRMerkleBlock *block)
+{
+    return (_BRMerkleTree) { (const uint8_t *)block->hashes, block->hashesCount, block->flags, block->flagsLen,
+                             _ceil_log2(block->totalTx) };
+}
+
+static size_t _BRMerkleBlockTxHashesR(const _BRMerkleTree *tree, UInt256 *txHashes, size_t hashesCount, size_t *idx,
                                       size_t *hashIdx, size_t *flagIdx, int depth)
 {
     uint8_t flag;
     
-    if (*flagIdx/8 < block->flagsLen && *hashIdx < block->hashesCount) {
-        flag = (block->flags[*flagIdx/8] & (1 << (*flagIdx % 8)));
+    if (*flagIdx/8 < tree->flagsLen && *hashIdx < tree->hashesCount) {
+        flag = (tree->flags[*flagIdx/8] & (1 << (*flagIdx % 8)));
         (*flagIdx)++;
     
-        if (! flag || depth == _ceil_log2(block->totalTx)) {
+        if (! flag || depth == tree->depth) {
             if (flag && *idx < hashesCount) {
-                if (txHashes) txHashes[*idx] = block->hashes[*hashIdx]; // leaf
+                if (txHashes) txHashes[*idx] = UInt256Get(&tree->hashes[*hashIdx*sizeof(UInt256)]); // leaf
                 (*idx)++;
             }
         
             (*hashIdx)++;
         }
         else {
-            _BRMerkleBlockTxHashesR(block, txHashes, hashesCount, idx, hashIdx, flagIdx, depth + 1); // left branch
-            _BRMerkleBlockTxHashesR(block, txHashes, hashesCount, idx, hashIdx, flagIdx, depth + 1); // right branch
+            _BRMerkleBlockTxHashesR(tree, txHashes, hashesCount, idx, hashIdx, flagIdx, depth + 1); // left branch
+            _BRMerkleBlockTxHashesR(tree, txHashes, hashesCount, idx, hashIdx, flagIdx, depth + 1); // right branch
         }
     }
 
@@ -223,7 +252,9 @@ size_t BRMerkleBlockTxHashes(const BRMerkleBlock *block, UInt256 *txHashes, size
 
     assert(block != NULL);
     
-    return _BRMerkleBlockTxHashesR(block, txHashes, (txHashes) ? hashesCount : SIZE_MAX, &idx, &hashIdx, &flagIdx, 0);
+    _BRMerkleTree tree = _BRMerkleBlockTree(block);
+
+    return _BRMerkleBlockTxHashesR(&tree, txHashes, (txHashes) ? hashesCount : SIZE_MAX, &idx, &hashIdx, &flagIdx, 0);
 }
 
 // sets the hashes and flags fields for a block created with BRMerkleBlockNew()
@@ -242,46 +273,127 @@ void BRMerkleBlockSetTxHashes(BRMerkleBlock *block, const UInt256 hashes[], size
     if (block->flags) memcpy(block->flags, flags, flagsLen);
 }
 
-// recursively walks the merkle tree to calculate the merkle root
+// number of nodes in the merkle tree row at the given height above the leaves
+#define _BRMerkleRowWidth(txCount, height) (((txCount) + ((size_t)1 << (height)) - 1) >> (height))
+
+// recursively hashes the subtree at height and position pos
+static UInt256 _BRMerkleBlockSubtreeR(const UInt256 txHashes[], size_t txCount, int height, size_t pos)
+{
+    UInt256 hashes[2], md;
+
+    if (height == 0) return txHashes[pos];
+    hashes[0] = _BRMerkleBlockSubtreeR(txHashes, txCount, height - 1, pos*2); // left branch
+    hashes[1] = (pos*2 + 1 < _BRMerkleRowWidth(txCount, height - 1)) ? // right branch, or dup left branch if missing
+                _BRMerkleBlockSubtreeR(txHashes, txCount, height - 1, pos*2 + 1) : hashes[0];
+    BRSHA256_2(&md, hashes, sizeof(hashes));
+    return md;
+}
+
+// recursively walks the merkle tree depth first, descending only into subtrees that contain a matched tx, as described
+// in BIP37: https://github.com/bitcoin/bips/blob/master/bip-0037.mediawiki
+static void _BRMerkleBlockBuildR(BRMerkleBlock *block, const UInt256 txHashes[], const uint8_t *matches, size_t txCount,
+                                 int height, size_t pos, size_t *flagIdx)
+{
+    size_t i, end = (pos + 1) << height;
+    int match = 0;
+
+    if (end > txCount) end = txCount;
+    for (i = pos << height; ! match && i < end; i++) match = (! matches || matches[i]);
+    if (match) block->flags[*flagIdx/8] |= (1 << (*flagIdx % 8));
+    (*flagIdx)++;
+
+    if (height == 0 || ! match) {
+        block->hashes[block->hashesCount++] = _BRMerkleBlockSubtreeR(txHashes, txCount, height, pos);
+    }
+    else {
+        _BRMerkleBlockBuildR(block, txHashes, matches, txCount, height - 1, pos*2, flagIdx); // left branch
+
+        if (pos*2 + 1 < _BRMerkleRowWidth(txCount, height - 1)) { // right branch
+            _BRMerkleBlockBuildR(block, txHashes, matches, txCount, height - 1, pos*2 + 1, flagIdx);
+        }
+    }
+}
+
+// sets totalTx, and the hashes and flags fields to the partial merkle tree of a block containing txHashes in block
+// order, with only the tx that have a non-zero entry in matches included as matched (or every tx if matches is NULL)
+void BRMerkleBlockSetMatchedTxHashes(BRMerkleBlock *block, const UInt256 txHashes[], const uint8_t *matches,
+                                     size_t txCount)
+{
+    size_t flagIdx = 0, nodeCount = 0;
+    int height;
+
+    assert(block != NULL);
+    assert(txHashes != NULL || txCount == 0);
+    for (height = _ceil_log2((int)txCount); height >= 0; height--) nodeCount += _BRMerkleRowWidth(txCount, height);
+    if (block->hashes) free(block->hashes);
+    if (block->flags) free(block->flags);
+    block->totalTx = (uint32_t)txCount;
+    block->hashes = (txCount > 0) ? malloc(nodeCount*sizeof(UInt256)) : NULL;
+    block->hashesCount = 0;
+    block->flags = (txCount > 0) ? calloc((nodeCount + 7)/8, 1) : NULL;
+    block->flagsLen = 0;
+
+    if (txCount > 0) {
+        assert(block->hashes != NULL);
+        assert(block->flags != NULL);
+        _BRMerkleBlockBuildR(block, txHashes, matches, txCount, _ceil_log2(block->totalTx), 0, &flagIdx);
+        block->hashes = realloc(block->hashes, block->hashesCount*sizeof(UInt256)); // trim to the nodes visited
+        block->flagsLen = (flagIdx + 7)/8;
+        block->flags = realloc(block->flags, block->flagsLen);
+    }
+}
+
+// walks the merkle tree depth first to calculate the merkle root, keeping the pending left branch hash of each level on
+// an explicit stack instead of recursing, so it runs in a fixed amount of stack on any thread
 // NOTE: this merkle tree design has a security vulnerability (CVE-2012-2459), which can be defended against by
 // considering the merkle root invalid if there are duplicate hashes in any rows with an even number of elements
-static UInt256 _BRMerkleBlockRootR(const BRMerkleBlock *block, size_t *hashIdx, size_t *flagIdx, int depth)
+static UInt256 _BRMerkleBlockRoot(const _BRMerkleTree *tree)
 {
-    uint8_t flag;
-    UInt256 hashes[2], md = UINT256_ZERO;
+    UInt256 left[32], hashes[2], md; // left[i] is the left branch hash of the level i node being walked
+    uint8_t flag, right[32]; // right[i] is true once the right branch of the level i node is being walked
+    size_t hashIdx = 0, flagIdx = 0;
+    int depth = 0;
 
-    if (*flagIdx/8 < block->flagsLen && *hashIdx < block->hashesCount) {
-        flag = (block->flags[*flagIdx/8] & (1 << (*flagIdx % 8)));
-        (*flagIdx)++;
+    for (;;) {
+        md = UINT256_ZERO;
+
+        if (flagIdx/8 < tree->flagsLen && hashIdx < tree->hashesCount) {
+            flag = (tree->flags[flagIdx/8] & (1 << (flagIdx % 8)));
+            flagIdx++;
 
-        if (flag && depth != _ceil_log2(block->totalTx)) {
-            hashes[0] = _BRMerkleBlockRootR(block, hashIdx, flagIdx, depth + 1); // left branch
-            hashes[1] = _BRMerkleBlockRootR(block, hashIdx, flagIdx, depth + 1); // right branch
+            if (flag && depth != tree->depth) { // walk the left branch
+                right[depth++] = 0;
+                continue;
+            }
 
-            if (! UInt256IsZero(hashes[0]) && ! UInt256Eq(hashes[0], hashes[1])) {
-                if (UInt256IsZero(hashes[1])) hashes[1] = hashes[0]; // if right branch is missing, dup left branch
+            md = UInt256Get(&tree->hashes[hashIdx++*sizeof(UInt256)]); // leaf
+        }
+
+        while (depth > 0 && right[depth - 1]) { // both branches are done, hash them into their parent
+            depth--;
+
+            if (! UInt256IsZero(left[depth]) && ! UInt256Eq(left[depth], md)) {
+                hashes[0] = left[depth];
+                hashes[1] = (UInt256IsZero(md)) ? left[depth] : md; // if right branch is missing, dup left branch
                 BRSHA256_2(&md, hashes, sizeof(hashes));
             }
-            else *hashIdx = SIZE_MAX; // defend against (CVE-2012-2459)
+            else hashIdx = SIZE_MAX, md = UINT256_ZERO; // defend against (CVE-2012-2459)
         }
-        else md = block->hashes[(*hashIdx)++]; // leaf
+
+        if (depth == 0) break;
+        left[depth - 1] = md; // walk the right branch
+        right[depth - 1] = 1;
     }
-    
+
     return md;
 }
 
-// true if merkle tree and timestamp are valid, and proof-of-work matches the stated difficulty target
-// NOTE: this only checks if the block difficulty matches the difficulty target in the header, it does not check if the
-// target is correct for the block's height in the chain - use BRMerkleBlockVerifyDifficulty() for that
-int BRMerkleBlockIsValid(const BRMerkleBlock *block, uint32_t currentTime)
+static int _BRMerkleBlockIsValid(const BRMerkleBlock *block, const _BRMerkleTree *tree, uint32_t currentTime)
 {
-    assert(block != NULL);
-    
     // target is in "compact" format, where the most significant byte is the size of the value in bytes, next
     // bit is the sign, and the last 23 bits is the value after having been right shifted by (size - 3)*8 bits
     const uint32_t size = block->target >> 24, target = block->target & 0x007fffff;
-    size_t hashIdx = 0, flagIdx = 0;
-    UInt256 merkleRoot = _BRMerkleBlockRootR(block, &hashIdx, &flagIdx, 0), t = UINT256_ZERO;
+    UInt256 merkleRoot = _BRMerkleBlockRoot(tree), t = UINT256_ZERO;
     int r = 1;
     
     // check if merkle root is correct
@@ -291,10 +403,12 @@ int BRMerkleBlockIsValid(const BRMerkleBlock *block, uint32_t currentTime)
     if (block->timestamp > currentTime + BLOCK_MAX_TIME_DRIFT) r = 0;
     
     // check if proof-of-work target is out of range
-    if (target == 0 || (block->target & 0x00800000) || block->target > MAX_PROOF_OF_WORK) r = 0;
+    if (target == 0 || (block->target & 0x00800000) || block->target > _maxProofOfWork || size > sizeof(t)) r = 0;
     
-    if (size > 3) UInt32SetLE(&t.u8[size - 3], target);
-    else UInt32SetLE(t.u8, target >> (3 - size)*8);
+    if (r && size > 3) { // the value's top byte is at t.u8[size - 1], which is at most the last byte of t
+        t.u8[size - 3] = target & 0xff, t.u8[size - 2] = (target >> 8) & 0xff, t.u8[size - 1] = target >> 16;
+    }
+    else if (r) UInt32SetLE(t.u8, target >> (3 - size)*8);
     
     for (int i = sizeof(t) - 1; r && i >= 0; i--) { // check proof-of-work
         if (block->blockHash.u8[i] < t.u8[i]) break;
@@ -304,6 +418,109 @@ int BRMerkleBlockIsValid(const BRMerkleBlock *block, uint32_t currentTime)
     return r;
 }
 
+// true if merkle tree and timestamp are valid, and proof-of-work matches the stated difficulty target
+// NOTE: this only checks if the block difficulty matches the difficulty target in the header, it does not check if the
+// target is correct for the block's height in the chain - use BRMerkleBlockVerifyDifficulty() for that
+int BRMerkleBlockIsValid(const BRMerkleBlock *block, uint32_t currentTime)
+{
+    assert(block != NULL);
+
+    _BRMerkleTree tree = _BRMerkleBlockTree(block);
+
+    return _BRMerkleBlockIsValid(block, &tree, currentTime);
+}
+
+// reads the header fields of a serialized merkleblock or header into block, and points tree at its tx hashes and flags
+// in place, returns true if buf is well formed (blockHash isn't set)
+static int _BRMerkleBlockReadData(const uint8_t *buf, size_t bufLen, BRMerkleBlock *block, _BRMerkleTree *tree)
+{
+    size_t off = 0, len = 0;
+    int r = (buf && 80 <= bufLen);
+    
+    if (r) {
+        block->version = UInt32GetLE(&buf[off]);
+        off += sizeof(uint32_t);
+        block->prevBlock = UInt256Get(&buf[off]);
+        off += sizeof(UInt256);
+        block->merkleRoot = UInt256Get(&buf[off]);
+        off += sizeof(UInt256);
+        block->timestamp = UInt32GetLE(&buf[off]);
+        off += sizeof(uint32_t);
+        block->target = UInt32GetLE(&buf[off]);
+        off += sizeof(uint32_t);
+        block->nonce = UInt32GetLE(&buf[off]);
+        off += sizeof(uint32_t);
+        
+        if (off + sizeof(uint32_t) <= bufLen) {
+            block->totalTx = UInt32GetLE(&buf[off]);
+            off += sizeof(uint32_t);
+            tree->hashesCount = (size_t)BRVarInt(&buf[off], (off <= bufLen ? bufLen - off : 0), &len);
+            off += len;
+            len = tree->hashesCount*sizeof(UInt256);
+            tree->hashes = &buf[off];
+            if (off + len > bufLen || len/sizeof(UInt256) != tree->hashesCount) r = 0;
+            off += len;
+            tree->flagsLen = (size_t)BRVarInt(&buf[off], (r && off <= bufLen ? bufLen - off : 0), &len);
+            off += len;
+            tree->flags = &buf[off];
+            if (off + tree->flagsLen > bufLen) r = 0;
+            tree->depth = _ceil_log2(block->totalTx);
+        }
+    }
+
+    return r;
+}
+
+// buf must contain either a serialized merkleblock or header
+// same result as BRMerkleBlockParse() followed by BRMerkleBlockIsValid(), but the tx hashes and flags are read in place
+// from buf instead of being copied, so a block that will be rejected is never allocated
+// blockHash is set if buf is well formed, and left UINT256_ZERO otherwise
+int BRMerkleBlockIsValidData(const uint8_t *buf, size_t bufLen, uint32_t currentTime, UInt256 *blockHash)
+{
+    BRMerkleBlock block = BR_MERKLE_BLOCK_NONE;
+    _BRMerkleTree tree = { NULL, 0, NULL, 0, 0 };
+    int r;
+    
+    assert(buf != NULL || bufLen == 0);
+    if (blockHash) *blockHash = UINT256_ZERO;
+    r = _BRMerkleBlockReadData(buf, bufLen, &block, &tree);
+
+    if (r) {
+        BRSHA256_2(&block.blockHash, buf, 80);
+        if (blockHash) *blockHash = block.blockHash;
+        r = _BRMerkleBlockIsValid(&block, &tree, currentTime);
+    }
+
+    return r;
+}
+
+// buf must contain a serialized merkleblock or header that BRMerkleBlockIsValidData() found valid, with blockHash
+// returns a merkle block struct built from buf without hashing the header again, or NULL if buf is malformed, that must
+// be freed by calling BRMerkleBlockFree()
+BRMerkleBlock *BRMerkleBlockParseValid(const uint8_t *buf, size_t bufLen, UInt256 blockHash)
+{
+    BRMerkleBlock *block = BRMerkleBlockNew();
+    _BRMerkleTree tree = { NULL, 0, NULL, 0, 0 };
+    
+    assert(buf != NULL || bufLen == 0);
+    
+    if (_BRMerkleBlockReadData(buf, bufLen, block, &tree)) {
+        block->blockHash = blockHash;
+        block->hashesCount = tree.hashesCount;
+        block->hashes = (tree.hashesCount > 0) ? malloc(tree.hashesCount*sizeof(UInt256)) : NULL;
+        if (block->hashes) memcpy(block->hashes, tree.hashes, tree.hashesCount*sizeof(UInt256));
+        block->flagsLen = tree.flagsLen;
+        block->flags = (tree.flagsLen > 0) ? malloc(tree.flagsLen) : NULL;
+        if (block->flags) memcpy(block->flags, tree.flags, tree.flagsLen);
+    }
+    else {
+        BRMerkleBlockFree(block);
+        block = NULL;
+    }
+    
+    return block;
+}
+
 // true if the given tx hash is known to be included in the block
 int BRMerkleBlockContainsTxHash(const BRMerkleBlock *block, UInt256 txHash)
 {
@@ -77,11 +77,34 @@ size_t BRMerkleBlockTxHashes(const BRMerkleBlock *block, UInt256 *txHashes, size
 void BRMerkleBlockSetTxHashes(BRMerkleBlock *block, const UInt256 hashes[], size_t hashesCount,
                               const uint8_t *flags, size_t flagsLen);
 
+// sets totalTx, and the hashes and flags fields to the partial merkle tree of a block containing txHashes in block
+// order, with only the tx that have a non-zero entry in matches included as matched (or every tx if matches is NULL)
+void BRMerkleBlockSetMatchedTxHashes(BRMerkleBlock *block, const UInt256 txHashes[], const uint8_t *matches,
+                                     size_t txCount);
+
 // true if merkle tree and timestamp are valid, and proof-of-work matches the stated difficulty target
 // NOTE: this only checks if the block difficulty matches the difficulty target in the header, it does not check if the
 // target is correct for the block's height in the chain - use BRMerkleBlockVerifyDifficulty() for that
 int BRMerkleBlockIsValid(const BRMerkleBlock *block, uint32_t currentTime);
 
+// buf must contain either a serialized merkleblock or header
+// same result as BRMerkleBlockParse() followed by BRMerkleBlockIsValid(), but the tx hashes and flags are read in place
+// from buf instead of being copied, so a block that will be rejected is never allocated
+// blockHash is set if buf is well formed, and left UINT256_ZERO otherwise
+int BRMerkleBlockIsValidData(const uint8_t *buf, size_t bufLen, uint32_t currentTime, UInt256 *blockHash);
+
+#if defined (DEBUG) || defined (BITCOIN_TEST_MAX_PROOF_OF_WORK)
+// for tests only, in DEBUG builds or optimized ones with BITCOIN_TEST_MAX_PROOF_OF_WORK defined: blocks are checked
+// against maxProofOfWork instead of MAX_PROOF_OF_WORK, so that a test chain such as regtest can be mined quickly, or
+// against MAX_PROOF_OF_WORK again if maxProofOfWork is 0
+void BRMerkleBlockSetMaxProofOfWork(uint32_t maxProofOfWork);
+#endif
+
+// buf must contain a serialized merkleblock or header that BRMerkleBlockIsValidData() found valid, with blockHash
+// returns a merkle block struct built from buf without hashing the header again, or NULL if buf is malformed, that must
+// be freed by calling BRMerkleBlockFree()
+BRMerkleBlock *BRMerkleBlockParseValid(const uint8_t *buf, size_t bufLen, UInt256 blockHash);
+
 // true if the given tx hash is known to be included in the block
 int BRMerkleBlockContainsTxHash(const BRMerkleBlock *block, UInt256 txHash);
 
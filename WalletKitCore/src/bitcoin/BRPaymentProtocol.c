@@ -348,6 +348,30 @@ static void _BRPaymentProtocolOutputFree(BRTxOutput out)
     }
 }
 
+// sets amount and script to the fields of the serialized output in buf, with script pointing into buf
+// returns false if the required script is missing
+static int _BRPaymentProtocolOutputView(const uint8_t *buf, size_t bufLen, uint64_t *amount, const uint8_t **script,
+                                        size_t *scriptLen)
+{
+    size_t off = 0;
+    
+    *amount = 0, *script = NULL, *scriptLen = 0;
+    
+    while (buf && off < bufLen) {
+        const uint8_t *data = NULL;
+        size_t dataLen = bufLen;
+        uint64_t i = 0, key = _ProtoBufField(&i, &data, buf, &dataLen, &off);
+        
+        switch (key >> 3) {
+            case output_amount: *amount = i; break;
+            case output_script: *script = data, *scriptLen = (data) ? dataLen : 0; break;
+            default: break;
+        }
+    }
+    
+    return (*script != NULL);
+}
+
 // returns a newly allocated details struct that must be freed by calling BRPaymentProtocolDetailsFree()
 BRPaymentProtocolDetails *BRPaymentProtocolDetailsNew(const char *network, const BRTxOutput outputs[], size_t outCount,
                                                       uint64_t time, uint64_t expires, const char *memo,
@@ -486,6 +510,74 @@ void BRPaymentProtocolDetailsFree(BRPaymentProtocolDetails *details)
     free(details);
 }
 
+// buf must contain a serialized details struct
+// sets view to reference the fields of the details in buf, returns true on success
+int BRPaymentProtocolDetailsViewParse(BRPaymentProtocolDetailsView *view, const uint8_t *buf, size_t bufLen)
+{
+    const uint8_t *script;
+    size_t off = 0, scriptLen;
+    uint64_t amount;
+    
+    assert(view != NULL);
+    assert(buf != NULL || bufLen == 0);
+    
+    memset(view, 0, sizeof(*view));
+    view->buf = buf;
+    view->bufLen = bufLen;
+    
+    while (buf && off < bufLen) {
+        const uint8_t *data = NULL;
+        size_t dLen = bufLen;
+        uint64_t i = 0, key = _ProtoBufField(&i, &data, buf, &dLen, &off);
+        int out = 0;
+        
+        switch (key >> 3) {
+            case details_network: if (data) view->network = (const char *)data, view->networkLen = dLen; break;
+            case details_outputs: out = _BRPaymentProtocolOutputView(data, dLen, &amount, &script, &scriptLen); break;
+            case details_time: view->time = i; break;
+            case details_expires: view->expires = i; break;
+            case details_memo: if (data) view->memo = (const char *)data, view->memoLen = dLen; break;
+            case details_payment_url:
+                if (data) view->paymentURL = (const char *)data, view->paymentURLLen = dLen;
+                break;
+            case details_merch_data: if (data) view->merchantData = data, view->merchDataLen = dLen; break;
+            default: break;
+        }
+        
+        if (out) view->outCount++;
+    }
+    
+    if (! view->network) view->network = "main", view->networkLen = strlen("main");
+    return (off == bufLen); // false if the last field ran past the end of buf
+}
+
+// sets amount and script to the output corresponding to index, with script pointing into the serialized details
+// returns true on success, or false if index is out-of-bounds
+int BRPaymentProtocolDetailsViewOutput(const BRPaymentProtocolDetailsView *view, size_t idx, uint64_t *amount,
+                                       const uint8_t **script, size_t *scriptLen)
+{
+    size_t off = 0;
+    int r = 0;
+    
+    assert(view != NULL);
+    assert(amount != NULL);
+    assert(script != NULL);
+    assert(scriptLen != NULL);
+    
+    while (! r && view->buf && off < view->bufLen) {
+        const uint8_t *data = NULL;
+        size_t dLen = view->bufLen;
+        uint64_t key = _ProtoBufField(NULL, &data, view->buf, &dLen, &off);
+        
+        if ((key >> 3) == details_outputs && _BRPaymentProtocolOutputView(data, dLen, amount, script, scriptLen)) {
+            if (idx == 0) r = 1;
+            else idx--;
+        }
+    }
+    
+    return r;
+}
+
 // returns a newly allocated request struct that must be freed by calling BRPaymentProtocolRequestFree()
 BRPaymentProtocolRequest *BRPaymentProtocolRequestNew(uint32_t version, const char *pkiType, const uint8_t *pkiData,
                                                       size_t pkiDataLen, BRPaymentProtocolDetails *details,
@@ -628,6 +720,25 @@ size_t BRPaymentProtocolRequestCert(const BRPaymentProtocolRequest *req, uint8_t
     return (idx == 0 && (! cert || len <= certLen)) ? len : 0;
 }
 
+// writes the hash of buf to md using the digest algorithm of pkiType
+// returns the number of bytes written, or the total mdLen needed if md is NULL, or 0 if pkiType has no digest algorithm
+static size_t _BRPaymentProtocolDigest(const char *pkiType, size_t pkiTypeLen, const uint8_t *buf, size_t bufLen,
+                                       uint8_t *md, size_t mdLen)
+{
+    size_t len = 0;
+    
+    if (pkiType && pkiTypeLen == strlen("x509+sha256") && strncmp(pkiType, "x509+sha256", pkiTypeLen) == 0) {
+        if (md && 256/8 <= mdLen) BRSHA256(md, buf, bufLen);
+        len = 256/8;
+    }
+    else if (pkiType && pkiTypeLen == strlen("x509+sha1") && strncmp(pkiType, "x509+sha1", pkiTypeLen) == 0) {
+        if (md && 160/8 <= mdLen) BRSHA1(md, buf, bufLen);
+        len = 160/8;
+    }
+    
+    return (! md || len <= mdLen) ? len : 0;
+}
+
 // writes the hash of the request to md needed to sign or verify the request
 // returns the number of bytes written, or the total mdLen needed if md is NULL
 size_t BRPaymentProtocolRequestDigest(BRPaymentProtocolRequest *req, uint8_t *md, size_t mdLen)
@@ -643,19 +754,10 @@ size_t BRPaymentProtocolRequestDigest(BRPaymentProtocolRequest *req, uint8_t *md
     assert(buf != NULL);
     bufLen = BRPaymentProtocolRequestSerialize(req, buf, bufLen);
     
-    if (req->pkiType && strncmp(req->pkiType, "x509+sha256", strlen("x509+sha256") + 1) == 0) {
-        if (md && 256/8 <= mdLen) BRSHA256(md, buf, bufLen);
-        bufLen = 256/8;
-    }
-    else if (req->pkiType && strncmp(req->pkiType, "x509+sha1", strlen("x509+sha1") + 1) == 0) {
-        if (md && 160/8 <= mdLen) BRSHA1(md, buf, bufLen);
-        bufLen = 160/8;
-    }
-    else bufLen = 0;
-    
+    bufLen = _BRPaymentProtocolDigest(req->pkiType, (req->pkiType) ? strlen(req->pkiType) : 0, buf, bufLen, md, mdLen);
     free(buf);
     if (req->signature) req->sigLen = array_count(req->signature);
-    return (! md || bufLen <= mdLen) ? bufLen : 0;
+    return bufLen;
 }
 
 // frees memory allocated for request struct
@@ -674,6 +776,107 @@ void BRPaymentProtocolRequestFree(BRPaymentProtocolRequest *req)
     free(req);
 }
 
+// buf must contain a serialized request struct
+// sets view to reference the fields of the request in buf, returns true on success
+int BRPaymentProtocolRequestViewParse(BRPaymentProtocolRequestView *view, const uint8_t *buf, size_t bufLen)
+{
+    size_t off = 0;
+    
+    assert(view != NULL);
+    assert(buf != NULL || bufLen == 0);
+    
+    memset(view, 0, sizeof(*view));
+    view->buf = buf;
+    view->bufLen = bufLen;
+    view->version = 1;
+    
+    while (buf && off < bufLen) {
+        const uint8_t *data = NULL;
+        size_t dataLen = bufLen;
+        uint64_t i = 0, key = _ProtoBufField(&i, &data, buf, &dataLen, &off);
+        
+        switch (key >> 3) {
+            case request_version: view->version = (uint32_t)i; break;
+            case request_pki_type: if (data) view->pkiType = (const char *)data, view->pkiTypeLen = dataLen; break;
+            case request_pki_data: if (data) view->pkiData = data, view->pkiDataLen = dataLen; break;
+            case request_details: view->details = data, view->detailsLen = (data) ? dataLen : 0; break;
+            case request_signature: if (data) view->signature = data, view->sigLen = dataLen; break;
+            default: break;
+        }
+    }
+    
+    if (! view->pkiType) view->pkiType = "none", view->pkiTypeLen = strlen("none");
+    return (view->details && off == bufLen); // details are required
+}
+
+// sets cert to the DER encoded certificate corresponding to index, pointing into the serialized request
+// returns the length of the certificate, or 0 if index is out-of-bounds
+size_t BRPaymentProtocolRequestViewCert(const BRPaymentProtocolRequestView *view, const uint8_t **cert, size_t idx)
+{
+    size_t off = 0, len = 0;
+    
+    assert(view != NULL);
+    assert(cert != NULL);
+    
+    *cert = NULL;
+    
+    while (view->pkiData && off < view->pkiDataLen) {
+        const uint8_t *data = NULL;
+        size_t dataLen = view->pkiDataLen;
+        uint64_t key = _ProtoBufField(NULL, &data, view->pkiData, &dataLen, &off);
+        
+        if ((key >> 3) == certificates_cert && data) {
+            if (idx == 0) {
+                *cert = data, len = dataLen;
+                break;
+            }
+            else idx--;
+        }
+    }
+    
+    return len;
+}
+
+// writes the hash of the request to md needed to sign or verify the request, computed over the serialized request as
+// it was received, with the signature field emptied
+// returns the number of bytes written, or the total mdLen needed if md is NULL
+size_t BRPaymentProtocolRequestViewDigest(const BRPaymentProtocolRequestView *view, uint8_t *md, size_t mdLen)
+{
+    size_t off = 0, sigOff = 0, sigEnd = 0, len;
+    
+    assert(view != NULL);
+    len = _BRPaymentProtocolDigest(view->pkiType, view->pkiTypeLen, NULL, 0, NULL, 0);
+    if (! md || len == 0 || len > mdLen) return (! md) ? len : 0;
+    
+    while (view->buf && off < view->bufLen) {
+        const uint8_t *data = NULL;
+        size_t dataLen = view->bufLen, o = off;
+        uint64_t key = _ProtoBufField(NULL, &data, view->buf, &dataLen, &off);
+        
+        if ((key >> 3) == request_signature && data) { // the last signature field is the one that was parsed
+            _ProtoBufVarInt(view->buf, view->bufLen, &o); // skip the key, o is now the offset of the signature length
+            sigOff = o, sigEnd = off;
+        }
+    }
+    
+    if (sigEnd == 0) { // nothing to empty, so the request is hashed in place
+        len = _BRPaymentProtocolDigest(view->pkiType, view->pkiTypeLen, view->buf, view->bufLen, md, mdLen);
+    }
+    else { // a signature can't sign itself, so it's hashed as 0 bytes, the rest of the request is hashed as received
+        size_t bufLen = view->bufLen - (sigEnd - sigOff) + 1;
+        uint8_t _buf[(bufLen <= 0x1000) ? bufLen : 0], *buf = (bufLen <= 0x1000) ? _buf : malloc(bufLen);
+        
+        assert(buf != NULL);
+        memcpy(buf, view->buf, sigOff);
+        buf[sigOff] = 0; // signature length
+        memcpy(&buf[sigOff + 1], &view->buf[sigEnd], view->bufLen - sigEnd);
+        len = _BRPaymentProtocolDigest(view->pkiType, view->pkiTypeLen, buf, bufLen, md, mdLen);
+        if (buf != _buf) free(buf);
+    }
+    
+    return len;
+}
+
 // returns a newly allocated payment struct that must be freed by calling BRPaymentProtocolPaymentFree()
 BRPaymentProtocolPayment *BRPaymentProtocolPaymentNew(const uint8_t *merchantData, size_t merchDataLen,
                                                       BRTransaction *transactions[], size_t txCount,
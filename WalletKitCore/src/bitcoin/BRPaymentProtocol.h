@@ -65,6 +65,34 @@ size_t BRPaymentProtocolDetailsSerialize(const BRPaymentProtocolDetails *details
 // frees memory allocated for details struct
 void BRPaymentProtocolDetailsFree(BRPaymentProtocolDetails *details);
 
+// a details view references the fields of a serialized details struct in place instead of copying them, so the
+// serialized details must not be freed or changed while the view is in use, and the view itself needs no freeing
+// strings in a view are not NULL terminated
+typedef struct {
+    const uint8_t *buf; // serialized details struct
+    size_t bufLen;
+    const char *network; // main / test / regtest, default is "main"
+    size_t networkLen;
+    size_t outCount; // number of outputs, use BRPaymentProtocolDetailsViewOutput() to get each one
+    uint64_t time; // request creation time, seconds since unix epoch, optional
+    uint64_t expires; // when this request should be considered invalid, optional
+    const char *memo; // human-readable description of request for the customer, optional
+    size_t memoLen;
+    const char *paymentURL; // url to send payment and get payment ack, optional
+    size_t paymentURLLen;
+    const uint8_t *merchantData; // arbitrary data to include in the payment message, optional
+    size_t merchDataLen;
+} BRPaymentProtocolDetailsView;
+
+// buf must contain a serialized details struct
+// sets view to reference the fields of the details in buf, returns true on success
+int BRPaymentProtocolDetailsViewParse(BRPaymentProtocolDetailsView *view, const uint8_t *buf, size_t bufLen);
+
+// sets amount and script to the output corresponding to index, with script pointing into the serialized details
+// returns true on success, or false if index is out-of-bounds
+int BRPaymentProtocolDetailsViewOutput(const BRPaymentProtocolDetailsView *view, size_t idx, uint64_t *amount,
+                                       const uint8_t **script, size_t *scriptLen);
+
 typedef struct {
     uint32_t version; // default is 1
     char *pkiType; // none / x509+sha256 / x509+sha1, default is "none"
@@ -99,6 +127,36 @@ size_t BRPaymentProtocolRequestDigest(BRPaymentProtocolRequest *req, uint8_t *md
 // frees memory allocated for request struct
 void BRPaymentProtocolRequestFree(BRPaymentProtocolRequest *req);
 
+// a request view references the fields of a serialized request struct in place instead of copying them, so the
+// serialized request must not be freed or changed while the view is in use, and the view itself needs no freeing
+// strings in a view are not NULL terminated
+typedef struct {
+    const uint8_t *buf; // serialized request struct
+    size_t bufLen;
+    uint32_t version; // default is 1
+    const char *pkiType; // none / x509+sha256 / x509+sha1, default is "none"
+    size_t pkiTypeLen;
+    const uint8_t *pkiData; // depends on pkiType, optional
+    size_t pkiDataLen;
+    const uint8_t *details; // serialized details struct, use BRPaymentProtocolDetailsViewParse() to read it, required
+    size_t detailsLen;
+    const uint8_t *signature; // pki-dependent signature, optional
+    size_t sigLen;
+} BRPaymentProtocolRequestView;
+
+// buf must contain a serialized request struct
+// sets view to reference the fields of the request in buf, returns true on success
+int BRPaymentProtocolRequestViewParse(BRPaymentProtocolRequestView *view, const uint8_t *buf, size_t bufLen);
+
+// sets cert to the DER encoded certificate corresponding to index, pointing into the serialized request
+// returns the length of the certificate, or 0 if index is out-of-bounds
+size_t BRPaymentProtocolRequestViewCert(const BRPaymentProtocolRequestView *view, const uint8_t **cert, size_t idx);
+
+// writes the hash of the request to md needed to sign or verify the request, computed over the serialized request as
+// it was received, with the signature field emptied
+// returns the number of bytes written, or the total mdLen needed if md is NULL
+size_t BRPaymentProtocolRequestViewDigest(const BRPaymentProtocolRequestView *view, uint8_t *md, size_t mdLen);
+
 typedef struct {
     uint8_t *merchantData; // from request->details->merchantData, optional
     size_t merchDataLen;
@@ -23,7 +23,9 @@
 //  THE SOFTWARE.
 
 #include "BRPeer.h"
+#include "BRCompactFilter.h"
 #include "BRMerkleBlock.h"
+#include "BRBlockValidator.h"
 #include "support/BRBase.h"
 #include "support/BRAddress.h"
 #include "support/BRSet.h"
@@ -39,6 +41,7 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <netdb.h>
+#include <poll.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <netinet/in.h>	
@@ -57,6 +60,22 @@
 
 #define PTHREAD_STACK_SIZE  (512 * 1024)
 
+#if defined(__linux__)
+#include <sys/epoll.h>
+#define PEER_REACTOR_EPOLL  1
+#endif
+
+#define REACTOR_TICK        250     // milliseconds between timeout scans when no socket is ready
+#define REACTOR_EVENTS      64
+#define REACTOR_READS       16      // reads per readable peer per wakeup, so one busy peer can't starve the others
+#define RECV_BUF_LENGTH     0x10000 // size of the pooled receive buffers, larger messages get a buffer of their own
+#define RECV_POOL_SLAB      8       // pooled receive buffers allocated together
+#define FRAME_WINDOW        256     // messages framed before dispatch, merkleblocks in a window are validated together
+
+#ifndef MSG_NOSIGNAL   // linux based systems have a MSG_NOSIGNAL send flag, useful for supressing SIGPIPE signals
+#define MSG_NOSIGNAL 0 // set to 0 if undefined (BSD has the SO_NOSIGPIPE sockopt, and windows has no signals at all)
+#endif
+
 // the standard blockchain download protocol works as follows (for SPV mode):
 // - local peer sends getblocks
 // - remote peer reponds with inv containing up to 500 block hashes
@@ -84,6 +103,13 @@
 // - if at any point tx messages consume enough wallet addresses to drop below the bip32 chain gap limit, more addresses
 //   are generated and local peer sends filterload with an updated bloom filter
 // - after filterload is sent, getdata is sent to re-request recent blocks that may contain new tx matching the filter
+//
+// in headers-first mode (BRPeerSetHeadersFirst) getheaders is repeated all the way to the chain tip, and the caller
+// spreads getdata requests for ranges of filtered blocks across every connected peer instead of using getblocks
+//
+// in compact filter mode (BIP157) no bloom filter is loaded, the caller instead sends getcfheaders and getcfilters for
+// each range, matches the filters against wallet scripts locally, and requests full blocks with getdata only for blocks
+// that match
 
 typedef enum {
     inv_undefined = 0,
@@ -100,7 +126,7 @@ typedef struct {
     uint32_t magicNumber;
     char host[INET6_ADDRSTRLEN];
     BRPeerStatus status;
-    int waitingForNetwork;
+    int waitingForNetwork, headersFirst;
     volatile int needsFilterUpdate;
     uint64_t nonce, feePerKb;
     char *useragent;
@@ -127,11 +153,20 @@ typedef struct {
     BRTransaction *(*requestedTx)(void *info, UInt256 txHash);
     int (*networkIsReachable)(void *info);
     void (*threadCleanup)(void *info);
+    void (*relayedFilterHeaders)(void *info, UInt256 stopHash, UInt256 prevHeader, const UInt256 filterHashes[],
+                                 size_t count);
+    void (*relayedFilter)(void *info, UInt256 blockHash, const uint8_t *filter, size_t filterLen);
+    void (*relayedFullBlock)(void *info, BRMerkleBlock *block, BRTransaction *txs[], size_t txCount);
     void **volatile pongInfo;
     void (**volatile pongCallback)(void *info, int success);
     void *volatile mempoolInfo;
     void (*volatile mempoolCallback)(void *info, int success);
-    pthread_t thread;
+    int registered, socketConnected, watchWritable; // reactor registration and socket state, guarded by lock
+    uint8_t *sendBuf; // outgoing bytes not yet accepted by the socket, guarded by lock
+    size_t sendLen, sendCap;
+    uint8_t *recvBuf; // incoming bytes not yet framed, borrowed from the reactor pool, only touched by the reactor thread
+    size_t recvOff, recvLen, recvCap;
+    double msgTimeout;
     pthread_mutex_t lock;
 } BRPeerContext;
 
@@ -415,17 +450,16 @@ static int _BRPeerAcceptInvMessage(BRPeer *peer, const uint8_t *msg, size_t msgL
 static int _BRPeerAcceptTxMessage(BRPeer *peer, const uint8_t *msg, size_t msgLen)
 {
     BRPeerContext *ctx = (BRPeerContext *)peer;
-    BRTransaction *tx = BRTransactionParse(msg, msgLen);
+    BRTransaction *tx = NULL;
     UInt256 txHash;
     int r = 1;
 
-    if (! tx) {
-        peer_log(peer, "malformed tx message with length: %zu", msgLen);
+    if (! ctx->sentFilter && ! ctx->sentGetdata) { // checked first so an unsolicited tx is never copied out
+        peer_log(peer, "got tx message before loading filter");
         r = 0;
     }
-    else if (! ctx->sentFilter && ! ctx->sentGetdata) {
-        peer_log(peer, "got tx message before loading filter");
-        BRTransactionFree(tx);
+    else if (! (tx = BRTransactionParse(msg, msgLen))) {
+        peer_log(peer, "malformed tx message with length: %zu", msgLen);
         r = 0;
     }
     else {
@@ -473,11 +507,19 @@ static int _BRPeerAcceptHeadersMessage(BRPeer *peer, const uint8_t *msg, size_t
         // To improve chain download performance, if this message contains 2000 headers then request the next 2000
         // headers immediately, and switch to requesting blocks when we receive a header newer than earliestKeyTime
         uint32_t timestamp = (count > 0) ? UInt32GetLE(&msg[off + 81*(count - 1) + 68]) : 0;
+        time_t now = time(NULL);
+        UInt256 locators[2];
     
-        if (count >= 2000 || (timestamp > 0 && timestamp + 7*24*60*60 + BLOCK_MAX_TIME_DRIFT >= ctx->earliestKeyTime)) {
+        if (ctx->headersFirst) { // follow the header chain to the tip, filtered blocks are requested by the caller
+            if (count >= 2000) {
+                BRSHA256_2(&locators[0], &msg[off + 81*(count - 1)], 80);
+                BRSHA256_2(&locators[1], &msg[off], 80);
+                BRPeerSendGetheaders(peer, locators, 2, UINT256_ZERO);
+            }
+        }
+        else if (count >= 2000 ||
+                 (timestamp > 0 && timestamp + 7*24*60*60 + BLOCK_MAX_TIME_DRIFT >= ctx->earliestKeyTime)) {
             size_t last = 0;
-            time_t now = time(NULL);
-            UInt256 locators[2];
             
             BRSHA256_2(&locators[0], &msg[off + 81*(count - 1)], 80);
             BRSHA256_2(&locators[1], &msg[off], 80);
@@ -494,29 +536,32 @@ static int _BRPeerAcceptHeadersMessage(BRPeer *peer, const uint8_t *msg, size_t
                 BRPeerSendGetblocks(peer, locators, 2, UINT256_ZERO);
             }
             else BRPeerSendGetheaders(peer, locators, 2, UINT256_ZERO);
-
-            for (size_t i = 0; r && i < count; i++) {
-                BRMerkleBlock *block = BRMerkleBlockParse(&msg[off + 81*i], 81);
-                
-                if (! block) {
-                    peer_log(peer, "malformed headers message with length: %zu", msgLen);
-                    r = 0;
-                }
-                else if (! BRMerkleBlockIsValid(block, (uint32_t)now)) {
-                    peer_log(peer, "invalid block header: %s", u256hex(block->blockHash));
-                    BRMerkleBlockFree(block);
-                    r = 0;
-                }
-                else if (ctx->relayedBlock) {
-                    ctx->relayedBlock(ctx->info, block);
-                }
-                else BRMerkleBlockFree(block);
-            }
         }
         else {
             peer_log(peer, "non-standard headers message, %zu is fewer header(s) than expected", count);
             r = 0;
         }
+
+        BRBlockCheck *checks = (r && count > 0) ? malloc(count*sizeof(*checks)) : NULL;
+
+        assert(checks != NULL || ! r || count == 0);
+        for (size_t i = 0; checks && i < count; i++) checks[i] = (BRBlockCheck) { &msg[off + 81*i], 81, UINT256_ZERO, 0 };
+        if (checks) BRBlockValidatorRun(checks, count, (uint32_t)now); // hash the whole batch on the worker threads
+
+        for (size_t i = 0; r && i < count; i++) {
+            if (! checks[i].valid) {
+                if (UInt256IsZero(checks[i].blockHash)) {
+                    peer_log(peer, "malformed headers message with length: %zu", msgLen);
+                }
+                else peer_log(peer, "invalid block header: %s", u256hex(checks[i].blockHash));
+                r = 0;
+            }
+            else if (ctx->relayedBlock) { // only headers that are passed on are copied out of the receive buffer
+                ctx->relayedBlock(ctx->info, BRMerkleBlockParseValid(&msg[off + 81*i], 81, checks[i].blockHash));
+            }
+        }
+
+        free(checks);
     }
     
     return r;
@@ -709,32 +754,31 @@ static int _BRPeerAcceptPongMessage(BRPeer *peer, const uint8_t *msg, size_t msg
     return r;
 }
 
-static int _BRPeerAcceptMerkleblockMessage(BRPeer *peer, const uint8_t *msg, size_t msgLen)
+// check is the result of validating the message ahead of time along with the rest of its frame window, or NULL
+static int _BRPeerAcceptMerkleblockMessage(BRPeer *peer, const uint8_t *msg, size_t msgLen, const BRBlockCheck *check)
 {
     // Bitcoin nodes don't support querying arbitrary transactions, only transactions not yet accepted in a block. After
     // a merkleblock message, the remote node is expected to send tx messages for the tx referenced in the block. When a
     // non-tx message is received we should have all the tx in the merkleblock.
     BRPeerContext *ctx = (BRPeerContext *)peer;
-    BRMerkleBlock *block = BRMerkleBlockParse(msg, msgLen);
+    BRMerkleBlock *block = NULL;
+    UInt256 blockHash = (check) ? check->blockHash : UINT256_ZERO;
     int r = 1;
   
-    if (! block) {
-        peer_log(peer, "malformed merkleblock message with length: %zu", msgLen);
-        r = 0;
-    }
-    else if (! BRMerkleBlockIsValid(block, (uint32_t)time(NULL))) {
-        peer_log(peer, "invalid merkleblock: %s", u256hex(block->blockHash));
-        BRMerkleBlockFree(block);
-        block = NULL;
+    // validate in place so that only a block we keep is copied out of the receive buffer
+    if (! ((check) ? check->valid : BRMerkleBlockIsValidData(msg, msgLen, (uint32_t)time(NULL), &blockHash))) {
+        if (UInt256IsZero(blockHash)) peer_log(peer, "malformed merkleblock message with length: %zu", msgLen);
+        else peer_log(peer, "invalid merkleblock: %s", u256hex(blockHash));
         r = 0;
     }
     else if (! ctx->sentFilter && ! ctx->sentGetdata) {
         peer_log(peer, "got merkleblock message before loading a filter");
-        BRMerkleBlockFree(block);
-        block = NULL;
         r = 0;
     }
     else {
+        block = BRMerkleBlockParseValid(msg, msgLen, blockHash); // built from the validated message, not reparsed
+        assert(block != NULL);
+
         size_t count = BRMerkleBlockTxHashes(block, NULL, 0);
         UInt256 _hashes[128], *hashes = (count <= 128) ? _hashes : malloc(count*sizeof(UInt256));
         
@@ -762,6 +806,123 @@ static int _BRPeerAcceptMerkleblockMessage(BRPeer *peer, const uint8_t *msg, siz
     return r;
 }
 
+// full blocks are only requested for blocks matched by a compact filter
+static int _BRPeerAcceptBlockMessage(BRPeer *peer, const uint8_t *msg, size_t msgLen)
+{
+    BRPeerContext *ctx = (BRPeerContext *)peer;
+    size_t i = 0, off = 80, len = 0, count = (msgLen > off) ? (size_t)BRVarInt(&msg[off], msgLen - off, &len) : 0;
+    int r = 1;
+
+    if (! ctx->sentGetdata) {
+        peer_log(peer, "got block message before requesting it");
+        r = 0;
+    }
+    else if (len == 0 || count == 0 || count > (msgLen - off)/60) { // a tx is at least 60 bytes
+        peer_log(peer, "malformed block message with length: %zu", msgLen);
+        r = 0;
+    }
+    else {
+        BRMerkleBlock *block = BRMerkleBlockParse(msg, 80);
+        BRTransaction **txs = calloc(count, sizeof(*txs));
+        UInt256 *txHashes = malloc(count*sizeof(*txHashes));
+
+        assert(block != NULL);
+        assert(txs != NULL);
+        assert(txHashes != NULL);
+
+        for (i = 0, off += len; i < count && (txs[i] = BRTransactionParse(&msg[off], msgLen - off)); i++) {
+            txHashes[i] = txs[i]->txHash;
+            off += BRTransactionSerialize(txs[i], NULL, 0);
+        }
+
+        if (i < count || off != msgLen) {
+            peer_log(peer, "malformed block message with length: %zu", msgLen);
+            r = 0;
+        }
+        else { // the merkle tree with every tx matched is checked against the header
+            BRMerkleBlockSetMatchedTxHashes(block, txHashes, NULL, count);
+
+            if (! BRMerkleBlockIsValid(block, (uint32_t)time(NULL))) {
+                peer_log(peer, "invalid block: %s", u256hex(block->blockHash));
+                r = 0;
+            }
+        }
+
+        if (r && ctx->relayedFullBlock) {
+            peer_log(peer, "got block %s with %zu tx", u256hex(block->blockHash), count);
+            ctx->relayedFullBlock(ctx->info, block, txs, count);
+        }
+        else {
+            for (i = count; i > 0; i--) if (txs[i - 1]) BRTransactionFree(txs[i - 1]);
+            BRMerkleBlockFree(block);
+        }
+
+        free(txHashes);
+        free(txs);
+    }
+
+    return r;
+}
+
+// BIP157: https://github.com/bitcoin/bips/blob/master/bip-0157.mediawiki
+static int _BRPeerAcceptCfheadersMessage(BRPeer *peer, const uint8_t *msg, size_t msgLen)
+{
+    BRPeerContext *ctx = (BRPeerContext *)peer;
+    size_t i, off = 1 + 2*sizeof(UInt256), len = 0,
+           count = (msgLen > off) ? (size_t)BRVarInt(&msg[off], msgLen - off, &len) : 0;
+    int r = 1;
+
+    if (len == 0 || off + len + count*sizeof(UInt256) > msgLen) {
+        peer_log(peer, "malformed cfheaders message, length is %zu, should be %zu for %zu filter hash(es)", msgLen,
+                 off + BRVarIntSize(count) + count*sizeof(UInt256), count);
+        r = 0;
+    }
+    else if (msg[0] != COMPACT_FILTER_BASIC || count > 2000) {
+        peer_log(peer, "non-standard cfheaders message, type %d with %zu filter hash(es)", msg[0], count);
+        r = 0;
+    }
+    else {
+        UInt256 _hashes[128], *hashes = (count <= 128) ? _hashes : malloc(count*sizeof(UInt256));
+
+        assert(hashes != NULL);
+        peer_log(peer, "got %zu filter header(s)", count);
+        for (i = 0, off += len; i < count; i++, off += sizeof(UInt256)) hashes[i] = UInt256Get(&msg[off]);
+
+        if (ctx->relayedFilterHeaders) {
+            ctx->relayedFilterHeaders(ctx->info, UInt256Get(&msg[1]), UInt256Get(&msg[1 + sizeof(UInt256)]), hashes,
+                                      count);
+        }
+
+        if (hashes != _hashes) free(hashes);
+    }
+
+    return r;
+}
+
+// BIP157: https://github.com/bitcoin/bips/blob/master/bip-0157.mediawiki
+static int _BRPeerAcceptCfilterMessage(BRPeer *peer, const uint8_t *msg, size_t msgLen)
+{
+    BRPeerContext *ctx = (BRPeerContext *)peer;
+    size_t off = 1 + sizeof(UInt256), len = 0,
+           filterLen = (msgLen > off) ? (size_t)BRVarInt(&msg[off], msgLen - off, &len) : 0;
+    int r = 1;
+
+    if (len == 0 || off + len > msgLen || filterLen > msgLen - off - len) {
+        peer_log(peer, "malformed cfilter message, length is %zu, should be %zu", msgLen,
+                 off + BRVarIntSize(filterLen) + filterLen);
+        r = 0;
+    }
+    else if (msg[0] != COMPACT_FILTER_BASIC) {
+        peer_log(peer, "non-standard cfilter message, type %d", msg[0]);
+        r = 0;
+    }
+    else if (ctx->relayedFilter) { // the filter is matched in place, it's never copied out of the receive buffer
+        ctx->relayedFilter(ctx->info, UInt256Get(&msg[1]), &msg[off + len], filterLen);
+    }
+
+    return r;
+}
+
 // described in BIP61: https://github.com/bitcoin/bips/blob/master/bip-0061.mediawiki
 static int _BRPeerAcceptRejectMessage(BRPeer *peer, const uint8_t *msg, size_t msgLen)
 {
@@ -834,7 +995,9 @@ static int _BRPeerAcceptFeeFilterMessage(BRPeer *peer, const uint8_t *msg, size_
     return r;
 }
 
-static int _BRPeerAcceptMessage(BRPeer *peer, const uint8_t *msg, size_t msgLen, const char *type)
+// check is the result of validating a merkleblock message ahead of time, or NULL
+static int _BRPeerAcceptMessage(BRPeer *peer, const uint8_t *msg, size_t msgLen, const char *type,
+                                const BRBlockCheck *check)
 {
     BRPeerContext *ctx = (BRPeerContext *)peer;
     int r = 1;
@@ -857,43 +1020,106 @@ static int _BRPeerAcceptMessage(BRPeer *peer, const uint8_t *msg, size_t msgLen,
     else if (strncmp(MSG_NOTFOUND, type, 12) == 0) r = _BRPeerAcceptNotfoundMessage(peer, msg, msgLen);
     else if (strncmp(MSG_PING, type, 12) == 0) r = _BRPeerAcceptPingMessage(peer, msg, msgLen);
     else if (strncmp(MSG_PONG, type, 12) == 0) r = _BRPeerAcceptPongMessage(peer, msg, msgLen);
-    else if (strncmp(MSG_MERKLEBLOCK, type, 12) == 0) r = _BRPeerAcceptMerkleblockMessage(peer, msg, msgLen);
+    else if (strncmp(MSG_MERKLEBLOCK, type, 12) == 0) r = _BRPeerAcceptMerkleblockMessage(peer, msg, msgLen, check);
     else if (strncmp(MSG_REJECT, type, 12) == 0) r = _BRPeerAcceptRejectMessage(peer, msg, msgLen);
     else if (strncmp(MSG_FEEFILTER, type, 12) == 0) r = _BRPeerAcceptFeeFilterMessage(peer, msg, msgLen);
+    else if (strncmp(MSG_BLOCK, type, 12) == 0) r = _BRPeerAcceptBlockMessage(peer, msg, msgLen);
+    else if (strncmp(MSG_CFHEADERS, type, 12) == 0) r = _BRPeerAcceptCfheadersMessage(peer, msg, msgLen);
+    else if (strncmp(MSG_CFILTER, type, 12) == 0) r = _BRPeerAcceptCfilterMessage(peer, msg, msgLen);
     else peer_log(peer, "dropping %s, length %zu, not implemented", type, msgLen);
 
     return r;
 }
 
-static int _BRPeerOpenSocket(BRPeer *peer, int domain, double timeout, int *error)
+// All peer connections are serviced by a single reactor thread. Sockets are non-blocking: connect completion and
+// readability are reported by epoll (poll where epoll isn't available), incoming bytes are framed into messages
+// incrementally per peer, and outgoing messages are queued per peer and flushed as the socket accepts them. Peer
+// callbacks are made from the reactor thread.
+
+static struct {
+    pthread_once_t once;
+    pthread_mutex_t lock;
+    int started, fd, wake[2];
+    BRPeerContext **added; // peers handed over by BRPeerConnect(), guarded by lock
+    BRPeerContext **peers; // peers being serviced, only touched by the reactor thread
+    uint8_t **pool; // free receive buffers, only touched by the reactor thread
+} _reactor = { PTHREAD_ONCE_INIT, PTHREAD_MUTEX_INITIALIZER, 0, -1, { -1, -1 }, NULL, NULL, NULL };
+
+static void _BRPeerReactorWake(void)
+{
+    uint8_t b = 0;
+    ssize_t n = write(_reactor.wake[1], &b, sizeof(b)); // a full pipe already has a wakeup pending
+
+    (void)n;
+}
+
+// ctx->lock must be held
+static void _BRPeerReactorWatch(BRPeerContext *ctx, int writable)
+{
+    if (ctx->socket >= 0 && ctx->watchWritable != writable) {
+        ctx->watchWritable = writable;
+#if PEER_REACTOR_EPOLL
+        struct epoll_event ev = { (writable) ? EPOLLIN | EPOLLOUT : EPOLLIN, { .ptr = ctx } };
+
+        epoll_ctl(_reactor.fd, EPOLL_CTL_MOD, ctx->socket, &ev);
+#else
+        _BRPeerReactorWake(); // pollfds are rebuilt on each pass
+#endif
+    }
+}
+
+// ctx->lock must be held
+static void _BRPeerQueue(BRPeerContext *ctx, const void *data, size_t dataLen)
+{
+    if (ctx->sendLen + dataLen > ctx->sendCap) {
+        ctx->sendCap = (ctx->sendLen + dataLen)*3/2;
+        ctx->sendBuf = realloc(ctx->sendBuf, ctx->sendCap);
+        assert(ctx->sendBuf != NULL);
+    }
+
+    if (dataLen > 0) memcpy(&ctx->sendBuf[ctx->sendLen], data, dataLen);
+    ctx->sendLen += dataLen;
+}
+
+// writes as much of the send queue as the socket will accept, returns an errno.h code on failure, ctx->lock must be held
+static int _BRPeerFlush(BRPeerContext *ctx)
+{
+    size_t len = 0;
+    ssize_t n = 0;
+    int error = 0;
+
+    while (! error && len < ctx->sendLen) {
+        n = send(ctx->socket, &ctx->sendBuf[len], ctx->sendLen - len, MSG_NOSIGNAL);
+        if (n >= 0) len += (size_t)n;
+        else if (errno == EWOULDBLOCK || errno == EAGAIN) break;
+        else if (errno != EINTR) error = errno;
+    }
+
+    if (len > 0) memmove(ctx->sendBuf, &ctx->sendBuf[len], ctx->sendLen - len);
+    ctx->sendLen -= len;
+    if (! error) _BRPeerReactorWatch(ctx, ctx->sendLen > 0);
+    return error;
+}
+
+static int _BRPeerOpenSocket(BRPeer *peer, int domain, int *error)
 {
     BRPeerContext *ctx = (BRPeerContext *)peer;
     struct sockaddr_storage addr;
-    struct timeval tv;
-    fd_set fds;
-    socklen_t addrLen, optLen;
-    int count, arg = 0, err = 0, on = 1, r = 1;
-    int sock;
-
-    pthread_mutex_lock(&ctx->lock);
-    sock = ctx->socket = socket(domain, SOCK_STREAM, 0);
-    pthread_mutex_unlock(&ctx->lock);
+    socklen_t addrLen;
+    int arg = 0, err = 0, on = 1, r = 1;
+    int sock = socket(domain, SOCK_STREAM, 0);
 
     if (sock < 0) {
         err = errno;
         r = 0;
     }
     else {
-        tv.tv_sec = 1; // one second timeout for send/receive, so thread doesn't block for too long
-        tv.tv_usec = 0;
-        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
-        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
         setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
 #ifdef SO_NOSIGPIPE // BSD based systems have a SO_NOSIGPIPE socket option to supress SIGPIPE signals
         setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
 #endif
         arg = fcntl(sock, F_GETFL, NULL);
-        if (arg < 0 || fcntl(sock, F_SETFL, arg | O_NONBLOCK) < 0) r = 0; // temporarily set socket non-blocking
+        if (arg < 0 || fcntl(sock, F_SETFL, arg | O_NONBLOCK) < 0) r = 0; // reactor sockets are always non-blocking
         if (! r) err = errno;
     }
 
@@ -913,194 +1139,240 @@ static int _BRPeerOpenSocket(BRPeer *peer, int domain, double timeout, int *erro
             addrLen = sizeof(struct sockaddr_in);
         }
         
-        if (connect(sock, (struct sockaddr *)&addr, addrLen) < 0) err = errno;
-        
-        if (err == EINPROGRESS) {
-            err = 0;
-            optLen = sizeof(err);
-            tv.tv_sec  = (long)  timeout;
-            tv.tv_usec = (long) (timeout*1000000) % 1000000;
-            FD_ZERO(&fds);
-            FD_SET(sock, &fds);
-            count = select(sock + 1, NULL, &fds, NULL, &tv);
-
-            if (count <= 0 || getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &optLen) < 0 || err) {
-                if (count == 0) err = ETIMEDOUT;
-                if (count < 0 || ! err) err = errno;
-                r = 0;
-            }
-        }
-        else if (err && domain == PF_INET6 && _BRPeerIsIPv4(peer)) {
-            return _BRPeerOpenSocket(peer, PF_INET, timeout, error); // fallback to IPv4
+        if (connect(sock, (struct sockaddr *)&addr, addrLen) < 0 && errno != EINPROGRESS) err = errno;
+
+        if (err && domain == PF_INET6 && _BRPeerIsIPv4(peer)) {
+            close(sock);
+            return _BRPeerOpenSocket(peer, PF_INET, error); // fallback to IPv4
         }
         else if (err) r = 0;
+    }
 
-        if (r) peer_log(peer, "socket connected");
-        fcntl(sock, F_SETFL, arg); // restore socket non-blocking status
+    if (r) { // connect completes asynchronously, the socket becoming writable is reported to _BRPeerDidOpenSocket()
+        pthread_mutex_lock(&ctx->lock);
+        ctx->socket = sock;
+        ctx->watchWritable = 1;
+        pthread_mutex_unlock(&ctx->lock);
+#if PEER_REACTOR_EPOLL
+        struct epoll_event ev = { EPOLLIN | EPOLLOUT, { .ptr = ctx } };
+
+        if (epoll_ctl(_reactor.fd, EPOLL_CTL_ADD, sock, &ev) < 0) err = errno, r = 0;
+#endif
     }
+    else if (sock >= 0) close(sock);
 
     if (! r && err) peer_log(peer, "connect error: %s", strerror(err));
     if (error && err) *error = err;
     return r;
 }
 
-static int _peerCheckAndGetSocket (BRPeerContext *ctx, int *socket) {
-    int exists;
-
-    pthread_mutex_lock(&ctx->lock);
-    exists = ctx->socket >= 0;
-    if (NULL != socket) *socket = ctx->socket;
-    pthread_mutex_unlock(&ctx->lock);
-
-    return exists;
-}
-
-static int _peerGetSocket (BRPeerContext *ctx) {
-    int socket;
-
-    pthread_mutex_lock(&ctx->lock);
-    socket = ctx->socket;
-    pthread_mutex_unlock(&ctx->lock);
-
-    return socket;
-}
+// called once the connecting socket is writable, returns an errno.h code if the connect failed
+static int _BRPeerDidOpenSocket(BRPeer *peer)
+{
+    BRPeerContext *ctx = (BRPeerContext *)peer;
+    struct timeval tv;
+    socklen_t optLen = sizeof(int);
+    int err = 0;
 
-static double _peerGetDisconnectTime (BRPeerContext *ctx) {
-    double value;
+    if (getsockopt(ctx->socket, SOL_SOCKET, SO_ERROR, &err, &optLen) < 0) err = errno;
 
-    pthread_mutex_lock(&ctx->lock);
-    value = ctx->disconnectTime;
-    pthread_mutex_unlock(&ctx->lock);
+    if (err) {
+        peer_log(peer, "connect error: %s", strerror(err));
+    }
+    else {
+        peer_log(peer, "socket connected");
+        gettimeofday(&tv, NULL);
+        ctx->startTime = tv.tv_sec + (double)tv.tv_usec/1000000;
+        BRPeerSendVersionMessage(peer); // queued until the socket is marked connected below
+        pthread_mutex_lock(&ctx->lock);
+        ctx->socketConnected = 1;
+        err = _BRPeerFlush(ctx);
+        pthread_mutex_unlock(&ctx->lock);
+        if (err) peer_log(peer, "%s", strerror(err));
+    }
 
-    return value;
+    return err;
 }
 
-static double _peerGetMempoolTime (BRPeerContext *ctx) {
-    double value;
-
-    pthread_mutex_lock(&ctx->lock);
-    value = ctx->mempoolTime;
-    pthread_mutex_unlock(&ctx->lock);
-
-    return value;
+// returns the receive buffer to the pool, a peer only holds one while it has a partial message
+static void _BRPeerRecvRelease(BRPeerContext *ctx)
+{
+    if (ctx->recvCap == RECV_BUF_LENGTH) array_add(_reactor.pool, ctx->recvBuf);
+    else if (ctx->recvBuf) free(ctx->recvBuf);
+    ctx->recvBuf = NULL;
+    ctx->recvOff = ctx->recvLen = ctx->recvCap = 0;
 }
 
-
-static void *_peerThreadRoutine(void *arg)
+// makes room for at least need bytes, keeping any buffered bytes
+static void _BRPeerRecvReserve(BRPeerContext *ctx, size_t need)
 {
-    BRPeer *peer = arg;
-    BRPeerContext *ctx = arg;
-    int socket, error = 0;
+    size_t len = ctx->recvLen - ctx->recvOff;
+    uint8_t *buf;
 
-    pthread_cleanup_push(ctx->threadCleanup, ctx->info);
+    if (need <= RECV_BUF_LENGTH) {
+        if (array_count(_reactor.pool) == 0) {
+            uint8_t *slab = malloc(RECV_POOL_SLAB*RECV_BUF_LENGTH); // slabs live as long as the reactor
 
-    char name[9 + 1 + INET6_ADDRSTRLEN + 1];
-    sprintf (name, "Core BTX, %s", ctx->host);
-    pthread_setname_brd (pthread_self(), name);
+            assert(slab != NULL);
+            for (size_t i = 0; i < RECV_POOL_SLAB; i++) array_add(_reactor.pool, &slab[i*RECV_BUF_LENGTH]);
+        }
 
-    if (_BRPeerOpenSocket(peer, PF_INET6, CONNECT_TIMEOUT, &error)) {
-        struct timeval tv;
-        double time = 0, msgTimeout;
-        uint8_t header[HEADER_LENGTH], *payload = malloc(0x1000);
-        size_t len = 0, payloadLen = 0x1000;
-        ssize_t n = 0;
+        buf = _reactor.pool[array_count(_reactor.pool) - 1];
+        array_rm_last(_reactor.pool);
+        need = RECV_BUF_LENGTH;
+    }
+    else buf = malloc(need);
+
+    assert(buf != NULL);
+    if (len > 0) memcpy(buf, &ctx->recvBuf[ctx->recvOff], len);
+    _BRPeerRecvRelease(ctx);
+    ctx->recvBuf = buf;
+    ctx->recvLen = len;
+    ctx->recvCap = need;
+}
 
-        assert(payload != NULL);
-        gettimeofday(&tv, NULL);
-        ctx->startTime = tv.tv_sec + (double)tv.tv_usec/1000000;
-        BRPeerSendVersionMessage(peer);
-
-        while (_peerCheckAndGetSocket(ctx, &socket) && ! error) {
-            len = 0;
-
-            while (socket >= 0 && ! error && len < HEADER_LENGTH) {
-                n = read(socket, &header[len], sizeof(header) - len);
-                if (n > 0) len += (size_t) n;
-                if (n == 0) error = ECONNRESET;
-                if (n < 0 && errno != EWOULDBLOCK) error = errno;
-                gettimeofday(&tv, NULL);
-                time = tv.tv_sec + (double)tv.tv_usec/1000000;
-                if (! error && time >= _peerGetDisconnectTime(ctx)) error = ETIMEDOUT;
-
-                if (! error && time >= _peerGetMempoolTime(ctx)) {
-                    peer_log(peer, "done waiting for mempool response");
-                    BRPeerSendPing(peer, ctx->mempoolInfo, ctx->mempoolCallback);
-                    ctx->mempoolCallback = NULL;
-
-                    pthread_mutex_lock(&ctx->lock);
-                    ctx->mempoolTime = DBL_MAX;
-                    pthread_mutex_unlock(&ctx->lock);
-                }
+// dispatches each complete message in the receive buffer, returns an errno.h code on a protocol error
+// messages are framed up to FRAME_WINDOW at a time, and the merkleblocks in each window are validated together on the
+// block validator's worker threads before the window is dispatched in order
+static int _BRPeerFrameMessages(BRPeer *peer)
+{
+    BRPeerContext *ctx = (BRPeerContext *)peer;
+    struct { const uint8_t *msg; uint32_t msgLen; const char *type; BRBlockCheck *check; } frames[FRAME_WINDOW];
+    BRBlockCheck checks[FRAME_WINDOW];
+    const uint8_t *header;
+    const char *type;
+    uint32_t msgLen, checksum;
+    size_t i, frameCount, checkCount;
+    UInt256 hash;
+    int error = 0;
+
+    do {
+        frameCount = checkCount = 0;
+
+        while (! error && frameCount < FRAME_WINDOW) {
+            while (ctx->recvLen - ctx->recvOff >= sizeof(uint32_t) &&
+                   UInt32GetLE(&ctx->recvBuf[ctx->recvOff]) != ctx->magicNumber) {
+                ctx->recvOff++; // consume one byte at a time until we find the magic number
+            }
 
-                while (sizeof(uint32_t) <= len && UInt32GetLE(header) != ctx->magicNumber) {
-                    memmove(header, &header[1], --len); // consume one byte at a time until we find the magic number
-                }
+            if (ctx->recvLen - ctx->recvOff < HEADER_LENGTH) break;
+            header = &ctx->recvBuf[ctx->recvOff];
+            type = (const char *)&header[4];
+            msgLen = UInt32GetLE(&header[16]);
+            checksum = UInt32GetLE(&header[20]);
 
-                socket = _peerGetSocket(ctx);
-            }
-            
-            if (error) {
-                peer_log(peer, "%s", strerror(error));
-            }
-            else if (header[15] != 0) { // verify header type field is NULL terminated
+            if (header[15] != 0) { // verify header type field is NULL terminated
                 peer_log(peer, "malformed message header: type not NULL terminated");
                 error = EPROTO;
             }
-            else if (len == HEADER_LENGTH) {
-                const char *type = (const char *)(&header[4]);
-                uint32_t msgLen = UInt32GetLE(&header[16]);
-                uint32_t checksum = UInt32GetLE(&header[20]);
-                UInt256 hash;
-                
-                if (msgLen > MAX_MSG_LENGTH) { // check message length
-                    peer_log(peer, "error reading %s, message length %"PRIu32" is too long", type, msgLen);
+            else if (msgLen > MAX_MSG_LENGTH) { // check message length
+                peer_log(peer, "error reading %s, message length %"PRIu32" is too long", type, msgLen);
+                error = EPROTO;
+            }
+            else if (ctx->recvLen - ctx->recvOff < HEADER_LENGTH + msgLen) break; // wait for the rest of the payload
+            else {
+                ctx->recvOff += HEADER_LENGTH + msgLen;
+                BRSHA256_2(&hash, &header[HEADER_LENGTH], msgLen);
+
+                if (UInt32GetLE(&hash) != checksum) { // verify checksum
+                    peer_log(peer, "error reading %s, invalid checksum %x, expected %x, payload length:%"PRIu32
+                             ", SHA256_2:%s", type, UInt32GetLE(&hash), checksum, msgLen, u256hex(hash));
                     error = EPROTO;
                 }
                 else {
-                    if (msgLen > payloadLen) payload = realloc(payload, (payloadLen = msgLen));
-                    assert(payload != NULL);
-                    len = 0;
-                    socket = _peerGetSocket(ctx);
-                    msgTimeout = time + MESSAGE_TIMEOUT;
-                    
-                    while (socket >= 0 && ! error && len < msgLen) {
-                        n = read(socket, &payload[len], msgLen - len);
-                        if (n > 0) len += (size_t) n;
-                        if (n == 0) error = ECONNRESET;
-                        if (n < 0 && errno != EWOULDBLOCK) error = errno;
-                        gettimeofday(&tv, NULL);
-                        time = tv.tv_sec + (double)tv.tv_usec/1000000;
-                        if (n > 0) msgTimeout = time + MESSAGE_TIMEOUT;
-                        if (! error && time >= msgTimeout) error = ETIMEDOUT;
-                        socket = _peerGetSocket(ctx);
-                    }
-                    
-                    if (error) {
-                        peer_log(peer, "%s", strerror(error));
-                    }
-                    else if (len == msgLen) {
-                        BRSHA256_2(&hash, payload, msgLen);
-                        
-                        if (UInt32GetLE(&hash) != checksum) { // verify checksum
-                            peer_log(peer, "error reading %s, invalid checksum %x, expected %x, payload length:%"PRIu32
-                                     ", SHA256_2:%s", type, UInt32GetLE(&hash), checksum, msgLen, u256hex(hash));
-                            error = EPROTO;
-                        }
-                        else if (! _BRPeerAcceptMessage(peer, payload, msgLen, type)) error = EPROTO;
+                    frames[frameCount].msg = &header[HEADER_LENGTH];
+                    frames[frameCount].msgLen = msgLen;
+                    frames[frameCount].type = type;
+                    frames[frameCount].check = NULL;
+
+                    if (strncmp(MSG_MERKLEBLOCK, type, 12) == 0) {
+                        checks[checkCount] = (BRBlockCheck) { &header[HEADER_LENGTH], msgLen, UINT256_ZERO, 0 };
+                        frames[frameCount].check = &checks[checkCount++];
                     }
+
+                    frameCount++;
                 }
             }
         }
-        
-        free(payload);
+
+        BRBlockValidatorRun(checks, checkCount, (uint32_t)time(NULL));
+
+        // messages framed ahead of an error are still dispatched, as they would have been one at a time
+        for (i = 0; i < frameCount; i++) {
+            if (! _BRPeerAcceptMessage(peer, frames[i].msg, frames[i].msgLen, frames[i].type, frames[i].check)) {
+                error = EPROTO;
+                break;
+            }
+        }
+    } while (! error && frameCount == FRAME_WINDOW);
+
+    return error;
+}
+
+// reads whatever the socket has buffered and frames it, returns an errno.h code on failure
+static int _BRPeerReadMessages(BRPeer *peer, double now)
+{
+    BRPeerContext *ctx = (BRPeerContext *)peer;
+    size_t need;
+    ssize_t n = 0;
+    int i = 0, error = 0;
+
+    while (! error && i < REACTOR_READS) {
+        if (ctx->recvOff > 0) { // move any partial message to the front of the buffer
+            memmove(ctx->recvBuf, &ctx->recvBuf[ctx->recvOff], ctx->recvLen - ctx->recvOff);
+            ctx->recvLen -= ctx->recvOff;
+            ctx->recvOff = 0;
+        }
+
+        // once a header is buffered, make room for its whole payload so the message is framed in place
+        need = (ctx->recvLen >= HEADER_LENGTH) ? HEADER_LENGTH + UInt32GetLE(&ctx->recvBuf[16]) : 0;
+        if (need < RECV_BUF_LENGTH) need = RECV_BUF_LENGTH;
+
+        // trade back down to a pooled buffer once an oversized message has been consumed
+        if (ctx->recvCap < need || (need == RECV_BUF_LENGTH && ctx->recvCap > need)) _BRPeerRecvReserve(ctx, need);
+
+        n = read(ctx->socket, &ctx->recvBuf[ctx->recvLen], ctx->recvCap - ctx->recvLen);
+        if (n == 0) error = ECONNRESET;
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno != EWOULDBLOCK && errno != EAGAIN) error = errno;
+        if (error) peer_log(peer, "%s", strerror(error));
+        if (n <= 0) break;
+        ctx->recvLen += (size_t)n;
+        error = _BRPeerFrameMessages(peer);
+        // a message whose header has arrived must keep making progress, as with the payload read timeout
+        ctx->msgTimeout = (ctx->recvLen - ctx->recvOff >= HEADER_LENGTH) ? now + MESSAGE_TIMEOUT : DBL_MAX;
+        i++;
+    }
+
+    if (ctx->recvOff == ctx->recvLen) _BRPeerRecvRelease(ctx); // nothing buffered, hand the buffer back
+    return error;
+}
+
+// tears down the connection and reports it, ctx may be freed by the disconnected callback
+static void _BRPeerReactorClose(BRPeer *peer, int error)
+{
+    BRPeerContext *ctx = (BRPeerContext *)peer;
+    void (*threadCleanup)(void *) = ctx->threadCleanup;
+    void *info = ctx->info;
+    int socket;
+
+    for (size_t i = array_count(_reactor.peers); i > 0; i--) {
+        if (_reactor.peers[i - 1] != ctx) continue;
+        array_rm(_reactor.peers, i - 1);
+        break;
     }
 
     pthread_mutex_lock(&ctx->lock);
     socket = ctx->socket;
+    ctx->socket = -1;
     ctx->status = BRPeerStatusDisconnected;
+    ctx->registered = ctx->socketConnected = ctx->watchWritable = 0;
+    ctx->sendLen = 0;
     pthread_mutex_unlock(&ctx->lock);
+    _BRPeerRecvRelease(ctx);
+    ctx->msgTimeout = DBL_MAX;
 
-    if (socket >= 0) close(socket);
+    if (socket >= 0) close(socket); // closing also removes the socket from the epoll set
     peer_log(peer, "disconnected");
     
     while (array_count(ctx->pongCallback) > 0) {
@@ -1115,10 +1387,174 @@ static void *_peerThreadRoutine(void *arg)
     if (ctx->mempoolCallback) ctx->mempoolCallback(ctx->mempoolInfo, 0);
     ctx->mempoolCallback = NULL;
     if (ctx->disconnected) ctx->disconnected(ctx->info, error);
-    pthread_cleanup_pop(1);
+    threadCleanup(info);
+}
+
+static void _BRPeerReactorEvent(BRPeerContext *ctx, int readable, int writable, double now)
+{
+    BRPeer *peer = &ctx->peer;
+    int connected, error = 0;
+
+    pthread_mutex_lock(&ctx->lock);
+    connected = ctx->socketConnected;
+    pthread_mutex_unlock(&ctx->lock);
+
+    if (! connected) {
+        error = _BRPeerDidOpenSocket(peer); // errors on a connecting socket can be reported as readable only
+    }
+    else {
+        if (writable) {
+            pthread_mutex_lock(&ctx->lock);
+            error = _BRPeerFlush(ctx);
+            pthread_mutex_unlock(&ctx->lock);
+            if (error) peer_log(peer, "%s", strerror(error));
+        }
+
+        if (! error && readable) error = _BRPeerReadMessages(peer, now);
+    }
+
+    if (error) _BRPeerReactorClose(peer, error);
+}
+
+// opens sockets for newly connecting peers and enforces timeouts
+static void _BRPeerReactorScan(double now)
+{
+    BRPeerContext *ctx;
+    size_t i, count;
+    BRPeerStatus status;
+    double disconnectTime, mempoolTime;
+    int error;
+
+    pthread_mutex_lock(&_reactor.lock);
+    count = array_count(_reactor.added);
+    BRPeerContext *added[count + 1];
+    for (i = 0; i < count; i++) added[i] = _reactor.added[i];
+    array_clear(_reactor.added);
+    pthread_mutex_unlock(&_reactor.lock);
+
+    for (i = 0; i < count; i++) {
+        error = 0;
+        array_add(_reactor.peers, added[i]);
+        if (! _BRPeerOpenSocket(&added[i]->peer, PF_INET6, &error)) _BRPeerReactorClose(&added[i]->peer, error);
+    }
+
+    for (i = array_count(_reactor.peers); i > 0; i--) {
+        ctx = _reactor.peers[i - 1];
+        error = 0;
+        pthread_mutex_lock(&ctx->lock);
+        status = ctx->status;
+        disconnectTime = ctx->disconnectTime;
+        mempoolTime = ctx->mempoolTime;
+        pthread_mutex_unlock(&ctx->lock);
+
+        if (status == BRPeerStatusDisconnected) error = ECONNRESET; // BRPeerDisconnect() was called
+        else if (now >= disconnectTime || now >= ctx->msgTimeout) error = ETIMEDOUT;
+        else if (now >= mempoolTime) {
+            peer_log(&ctx->peer, "done waiting for mempool response");
+            BRPeerSendPing(&ctx->peer, ctx->mempoolInfo, ctx->mempoolCallback);
+            ctx->mempoolCallback = NULL;
+
+            pthread_mutex_lock(&ctx->lock);
+            ctx->mempoolTime = DBL_MAX;
+            pthread_mutex_unlock(&ctx->lock);
+        }
+
+        if (error) {
+            peer_log(&ctx->peer, "%s", strerror(error));
+            _BRPeerReactorClose(&ctx->peer, error);
+        }
+    }
+}
+
+static void *_BRPeerReactorRoutine(void *arg)
+{
+    struct timeval tv;
+    uint8_t drain[64];
+    int i, n;
+
+    pthread_setname_brd(pthread_self(), "Core BTX Reactor");
+
+    for (;;) {
+#if PEER_REACTOR_EPOLL
+        struct epoll_event events[REACTOR_EVENTS];
+
+        n = epoll_wait(_reactor.fd, events, REACTOR_EVENTS, REACTOR_TICK);
+        gettimeofday(&tv, NULL);
+
+        for (i = 0; i < n; i++) {
+            if (events[i].data.ptr == NULL) {
+                while (read(_reactor.wake[0], drain, sizeof(drain)) > 0);
+            }
+            else _BRPeerReactorEvent(events[i].data.ptr, (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0,
+                                     (events[i].events & (EPOLLOUT | EPOLLERR)) != 0,
+                                     tv.tv_sec + (double)tv.tv_usec/1000000);
+        }
+#else
+        size_t count = array_count(_reactor.peers);
+        struct pollfd fds[count + 1];
+        BRPeerContext *ctxs[count + 1];
+
+        fds[0].fd = _reactor.wake[0];
+        fds[0].events = POLLIN;
+
+        for (i = 1; i <= (int)count; i++) {
+            ctxs[i] = _reactor.peers[i - 1];
+            pthread_mutex_lock(&ctxs[i]->lock);
+            fds[i].fd = ctxs[i]->socket;
+            fds[i].events = (ctxs[i]->watchWritable) ? POLLIN | POLLOUT : POLLIN;
+            pthread_mutex_unlock(&ctxs[i]->lock);
+        }
+
+        n = poll(fds, (nfds_t)(count + 1), REACTOR_TICK);
+        gettimeofday(&tv, NULL);
+        if (n > 0 && fds[0].revents) while (read(_reactor.wake[0], drain, sizeof(drain)) > 0);
+
+        for (i = 1; n > 0 && i <= (int)count; i++) {
+            if (fds[i].revents == 0) continue;
+            _BRPeerReactorEvent(ctxs[i], (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) != 0,
+                                (fds[i].revents & (POLLOUT | POLLERR)) != 0, tv.tv_sec + (double)tv.tv_usec/1000000);
+        }
+#endif
+        gettimeofday(&tv, NULL);
+        _BRPeerReactorScan(tv.tv_sec + (double)tv.tv_usec/1000000);
+    }
+
     return NULL; // detached threads don't need to return a value
 }
 
+static void _BRPeerReactorInit(void)
+{
+    pthread_attr_t attr;
+    pthread_t thread;
+    int r = (pipe(_reactor.wake) == 0);
+
+    for (int i = 0; r && i < 2; i++) {
+        int arg = fcntl(_reactor.wake[i], F_GETFL, NULL);
+
+        r = (arg >= 0 && fcntl(_reactor.wake[i], F_SETFL, arg | O_NONBLOCK) >= 0);
+    }
+
+#if PEER_REACTOR_EPOLL
+    if (r) {
+        struct epoll_event ev = { EPOLLIN, { .ptr = NULL } };
+
+        _reactor.fd = epoll_create1(EPOLL_CLOEXEC);
+        r = (_reactor.fd >= 0 && epoll_ctl(_reactor.fd, EPOLL_CTL_ADD, _reactor.wake[0], &ev) == 0);
+    }
+#endif
+
+    array_new(_reactor.added, 10);
+    array_new(_reactor.peers, 10);
+    array_new(_reactor.pool, RECV_POOL_SLAB);
+
+    if (r && pthread_attr_init(&attr) == 0) {
+        _reactor.started = (pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) == 0 &&
+                            pthread_attr_setstacksize(&attr, PTHREAD_STACK_SIZE) == 0 &&
+                            pthread_create(&thread, &attr, _BRPeerReactorRoutine, NULL) == 0);
+        pthread_attr_destroy(&attr);
+    }
+}
+
 static void _dummyThreadCleanup(void *info)
 {
 }
@@ -1141,6 +1577,7 @@ BRPeer *BRPeerNew(uint32_t magicNumber)
     ctx->mempoolTime = DBL_MAX;
     ctx->disconnectTime = DBL_MAX;
     ctx->socket = -1;
+    ctx->msgTimeout = DBL_MAX;
     ctx->threadCleanup = _dummyThreadCleanup;
 
     {
@@ -1165,7 +1602,9 @@ BRPeer *BRPeerNew(uint32_t magicNumber)
 // void notfound(void *, const UInt256[], size_t, const UInt256[], size_t) - called when "notfound" message is received
 // BRTransaction *requestedTx(void *, UInt256) - called when "getdata" message with a tx hash is received from peer
 // int networkIsReachable(void *) - must return true when networking is available, false otherwise
-// void threadCleanup(void *) - called before a thread terminates to faciliate any needed cleanup
+// void threadCleanup(void *) - called after disconnected, once the connection is torn down, to faciliate any needed
+// cleanup
+// all peers share one reactor thread that every callback is called on, so callbacks must not block
 void BRPeerSetCallbacks(BRPeer *peer, void *info,
                         void (*connected)(void *info),
                         void (*disconnected)(void *info, int error),
@@ -1198,12 +1637,46 @@ void BRPeerSetCallbacks(BRPeer *peer, void *info,
     ctx->threadCleanup = (threadCleanup) ? threadCleanup : _dummyThreadCleanup;
 }
 
+// callbacks used to sync with compact block filters instead of bloom filters, info is the same as for BRPeerSetCallbacks()
+// void relayedFilterHeaders(void *, UInt256 stopHash, UInt256 prevHeader, const UInt256[], size_t) - called when a
+//   "cfheaders" message is received from peer, with the filter hashes of the blocks up to stopHash
+// void relayedFilter(void *, UInt256 blockHash, const uint8_t *, size_t) - called when a "cfilter" message is received
+//   from peer, the filter is only valid for the duration of the call
+// void relayedFullBlock(void *, BRMerkleBlock *, BRTransaction *[], size_t) - called when a "block" message is received
+//   from peer, with every tx in the block matched by block and in block order, the callee takes ownership of block and
+//   each tx
+void BRPeerSetCompactFilterCallbacks(BRPeer *peer,
+                                     void (*relayedFilterHeaders)(void *info, UInt256 stopHash, UInt256 prevHeader,
+                                                                  const UInt256 filterHashes[], size_t count),
+                                     void (*relayedFilter)(void *info, UInt256 blockHash, const uint8_t *filter,
+                                                           size_t filterLen),
+                                     void (*relayedFullBlock)(void *info, BRMerkleBlock *block, BRTransaction *txs[],
+                                                              size_t txCount))
+{
+    BRPeerContext *ctx = (BRPeerContext *)peer;
+
+    ctx->relayedFilterHeaders = relayedFilterHeaders;
+    ctx->relayedFilter = relayedFilter;
+    ctx->relayedFullBlock = relayedFullBlock;
+}
+
 // set earliestKeyTime to wallet creation time in order to speed up initial sync
 void BRPeerSetEarliestKeyTime(BRPeer *peer, uint32_t earliestKeyTime)
 {
     ((BRPeerContext *)peer)->earliestKeyTime = earliestKeyTime;
 }
 
+// set this to true to keep requesting headers up to the chain tip instead of switching to getblocks after
+// earliestKeyTime, the caller is then responsible for requesting filtered blocks with getdata (new blocks are also
+// announced with headers from then on)
+void BRPeerSetHeadersFirst(BRPeer *peer, int headersFirst)
+{
+    BRPeerContext *ctx = (BRPeerContext *)peer;
+
+    if (headersFirst && ! ctx->headersFirst) BRPeerSendMessage(peer, NULL, 0, MSG_SENDHEADERS);
+    ctx->headersFirst = headersFirst;
+}
+
 // call this when local block height changes (helps detect tarpit nodes)
 void BRPeerSetCurrentBlockHeight(BRPeer *peer, uint32_t currentBlockHeight)
 {
@@ -1228,10 +1701,9 @@ void BRPeerConnect(BRPeer *peer)
 {
     BRPeerContext *ctx = (BRPeerContext *)peer;
     struct timeval tv;
-    pthread_attr_t attr;
 
     pthread_mutex_lock(&ctx->lock);
-    if (ctx->status == BRPeerStatusDisconnected || ctx->waitingForNetwork) {
+    if ((ctx->status == BRPeerStatusDisconnected && ! ctx->registered) || ctx->waitingForNetwork) {
         ctx->status = BRPeerStatusConnecting;
     
         if (ctx->networkIsReachable && ! ctx->networkIsReachable(ctx->info)) { // delay until network is reachable
@@ -1243,23 +1715,20 @@ void BRPeerConnect(BRPeer *peer)
             ctx->waitingForNetwork = 0;
             gettimeofday(&tv, NULL);
 
-            // No race - set before the thread starts.
+            // No race - set before the reactor sees the peer.
             ctx->disconnectTime = tv.tv_sec + (double)tv.tv_usec/1000000 + CONNECT_TIMEOUT;
+            pthread_once(&_reactor.once, _BRPeerReactorInit);
 
-            if (pthread_attr_init(&attr) != 0) {
-                // error = ENOMEM;
+            if (! _reactor.started) {
                 peer_log(peer, "error creating thread");
                 ctx->status = BRPeerStatusDisconnected;
-                //if (ctx->disconnected) ctx->disconnected(ctx->info, error);
             }
-            else if (pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) != 0 ||
-                     pthread_attr_setstacksize(&attr, PTHREAD_STACK_SIZE) != 0 ||
-                     pthread_create(&ctx->thread, &attr, _peerThreadRoutine, peer) != 0) {
-                // error = EAGAIN;
-                peer_log(peer, "error creating thread");
-                pthread_attr_destroy(&attr);
-                ctx->status = BRPeerStatusDisconnected;
-                //if (ctx->disconnected) ctx->disconnected(ctx->info, error);
+            else {
+                ctx->registered = 1;
+                pthread_mutex_lock(&_reactor.lock);
+                array_add(_reactor.added, ctx);
+                pthread_mutex_unlock(&_reactor.lock);
+                _BRPeerReactorWake();
             }
         }
     }
@@ -1270,16 +1739,18 @@ void BRPeerConnect(BRPeer *peer)
 void BRPeerDisconnect(BRPeer *peer)
 {
     BRPeerContext *ctx = (BRPeerContext *)peer;
-    int socket = -1;
+    int registered;
 
-    if (_peerCheckAndGetSocket(ctx, &socket)) {
-        pthread_mutex_lock(&ctx->lock);
-        ctx->status = BRPeerStatusDisconnected;
-        pthread_mutex_unlock(&ctx->lock);
+    pthread_mutex_lock(&ctx->lock);
+    registered = ctx->registered;
+    if (registered) ctx->status = BRPeerStatusDisconnected; // the reactor closes the socket and reports it
 
-        if (shutdown(socket, SHUT_RDWR) < 0) peer_log(peer, "%s", strerror(errno));
-        close(socket);
+    if (ctx->socket >= 0 && shutdown(ctx->socket, SHUT_RDWR) < 0 && errno != ENOTCONN) {
+        peer_log(peer, "%s", strerror(errno));
     }
+
+    pthread_mutex_unlock(&ctx->lock);
+    if (registered) _BRPeerReactorWake();
 }
 
 // call this to (re)schedule a disconnect in the given number of seconds, or < 0 to cancel (useful for sync timeout)
@@ -1352,10 +1823,6 @@ uint64_t BRPeerFeePerKb(BRPeer *peer)
     return feePerKb;
 }
 
-#ifndef MSG_NOSIGNAL   // linux based systems have a MSG_NOSIGNAL send flag, useful for supressing SIGPIPE signals
-#define MSG_NOSIGNAL 0 // set to 0 if undefined (BSD has the SO_NOSIGPIPE sockopt, and windows has no signals at all)
-#endif
-
 // sends a bitcoin protocol message to peer
 void BRPeerSendMessage(BRPeer *peer, const uint8_t *msg, size_t msgLen, const char *type)
 {
@@ -1364,39 +1831,33 @@ void BRPeerSendMessage(BRPeer *peer, const uint8_t *msg, size_t msgLen, const ch
     }
     else {
         BRPeerContext *ctx = (BRPeerContext *)peer;
-        uint8_t buf[HEADER_LENGTH + msgLen], hash[32];
+        uint8_t header[HEADER_LENGTH], hash[32];
         size_t off = 0;
-        ssize_t n = 0;
-        struct timeval tv;
-        int socket, error = 0;
+        int error = 0;
         
-        UInt32SetLE(&buf[off], ctx->magicNumber);
+        UInt32SetLE(&header[off], ctx->magicNumber);
         off += sizeof(uint32_t);
-        strncpy((char *)&buf[off], type, 12);
+        strncpy((char *)&header[off], type, 12);
         off += 12;
-        UInt32SetLE(&buf[off], (uint32_t)msgLen);
+        UInt32SetLE(&header[off], (uint32_t)msgLen);
         off += sizeof(uint32_t);
         BRSHA256_2(hash, msg, msgLen);
-        memcpy(&buf[off], hash, sizeof(uint32_t));
-        off += sizeof(uint32_t);
-        memcpy(&buf[off], msg, msgLen);
+        memcpy(&header[off], hash, sizeof(uint32_t));
         peer_log(peer, "sending %s", type);
-        msgLen = 0;
-        socket = _peerGetSocket(ctx);
-        if (socket < 0) error = ENOTCONN;
-        
-        while (socket >= 0 && ! error && msgLen < sizeof(buf)) {
-            n = send(socket, &buf[msgLen], sizeof(buf) - msgLen, MSG_NOSIGNAL);
-            if (n >= 0) msgLen += (size_t) n;
-            if (n < 0 && errno != EWOULDBLOCK) error = errno;
-            gettimeofday(&tv, NULL);
-            if (! error && tv.tv_sec + (double)tv.tv_usec/1000000 >= _peerGetDisconnectTime(ctx)) error = ETIMEDOUT;
-            socket = _peerGetSocket(ctx);
+        pthread_mutex_lock(&ctx->lock);
+
+        if (ctx->socket < 0) error = ENOTCONN;
+        else { // the reactor flushes whatever the socket doesn't accept right away
+            _BRPeerQueue(ctx, header, sizeof(header));
+            _BRPeerQueue(ctx, msg, msgLen);
+            if (ctx->socketConnected) error = _BRPeerFlush(ctx);
         }
+
+        pthread_mutex_unlock(&ctx->lock);
         
         if (error) {
             peer_log(peer, "%s", strerror(error));
-            BRPeerDisconnect(peer);
+            if (error != ENOTCONN) BRPeerDisconnect(peer);
         }
     }
 }
@@ -1459,6 +1920,16 @@ void BRPeerSendFilterload(BRPeer *peer, const uint8_t *filter, size_t filterLen)
     BRPeerSendMessage(peer, filter, filterLen, MSG_FILTERLOAD);
 }
 
+void BRPeerSendFilteradd(BRPeer *peer, const uint8_t *data, size_t dataLen)
+{
+    uint8_t msg[BRVarIntSize(dataLen) + dataLen];
+    size_t off = BRVarIntSet(msg, sizeof(msg), dataLen);
+
+    assert(dataLen <= 520); // the largest allowed script push
+    memcpy(&msg[off], data, dataLen);
+    BRPeerSendMessage(peer, msg, off + dataLen, MSG_FILTERADD);
+}
+
 void BRPeerSendMempool(BRPeer *peer, const UInt256 knownTxHashes[], size_t knownTxCount, void *info,
                        void (*completionCallback)(void *info, int success))
 {
@@ -1598,6 +2069,54 @@ void BRPeerSendGetdata(BRPeer *peer, const UInt256 txHashes[], size_t txCount, c
     }
 }
 
+// requests full blocks rather than filtered blocks, used in compact filter mode
+void BRPeerSendGetdataBlocks(BRPeer *peer, const UInt256 blockHashes[], size_t blockCount)
+{
+    size_t i, off = 0;
+
+    if (blockCount > MAX_GETDATA_HASHES) {
+        peer_log(peer, "couldn't send getdata, %zu is too many items, max is %d", blockCount, MAX_GETDATA_HASHES);
+    }
+    else if (blockCount > 0) {
+        size_t msgLen = BRVarIntSize(blockCount) + (sizeof(uint32_t) + sizeof(UInt256))*blockCount;
+        uint8_t msg[msgLen];
+
+        off += BRVarIntSet(&msg[off], (off <= msgLen ? msgLen - off : 0), blockCount);
+
+        for (i = 0; i < blockCount; i++) {
+            UInt32SetLE(&msg[off], inv_witness_block);
+            off += sizeof(uint32_t);
+            UInt256Set(&msg[off], blockHashes[i]);
+            off += sizeof(UInt256);
+        }
+
+        ((BRPeerContext *)peer)->sentGetdata = 1;
+        BRPeerSendMessage(peer, msg, off, MSG_GETDATA);
+    }
+}
+
+// BIP157: https://github.com/bitcoin/bips/blob/master/bip-0157.mediawiki
+void BRPeerSendGetcfheaders(BRPeer *peer, uint32_t startHeight, UInt256 stopHash)
+{
+    uint8_t msg[1 + sizeof(uint32_t) + sizeof(UInt256)];
+
+    msg[0] = COMPACT_FILTER_BASIC;
+    UInt32SetLE(&msg[1], startHeight);
+    UInt256Set(&msg[1 + sizeof(uint32_t)], stopHash);
+    BRPeerSendMessage(peer, msg, sizeof(msg), MSG_GETCFHEADERS);
+}
+
+// BIP157: https://github.com/bitcoin/bips/blob/master/bip-0157.mediawiki
+void BRPeerSendGetcfilters(BRPeer *peer, uint32_t startHeight, UInt256 stopHash)
+{
+    uint8_t msg[1 + sizeof(uint32_t) + sizeof(UInt256)];
+
+    msg[0] = COMPACT_FILTER_BASIC;
+    UInt32SetLE(&msg[1], startHeight);
+    UInt256Set(&msg[1 + sizeof(uint32_t)], stopHash);
+    BRPeerSendMessage(peer, msg, sizeof(msg), MSG_GETCFILTERS);
+}
+
 void BRPeerSendGetaddr(BRPeer *peer)
 {
     ((BRPeerContext *)peer)->sentGetaddr = 1;
@@ -1633,10 +2152,14 @@ void BRPeerRerequestBlocks(BRPeer *peer, UInt256 fromBlock)
     }
 }
 
+// frees memory allocated for peer, which must be disconnected and no longer registered with the reactor
 void BRPeerFree(BRPeer *peer)
 {
     BRPeerContext *ctx = (BRPeerContext *)peer;
     
+    pthread_mutex_lock(&ctx->lock);
+    assert(! ctx->registered); // the reactor would still poll and call back a freed peer
+    pthread_mutex_unlock(&ctx->lock);
     if (ctx->useragent) array_free(ctx->useragent);
     if (ctx->currentBlockTxHashes) array_free(ctx->currentBlockTxHashes);
     if (ctx->knownBlockHashes) array_free(ctx->knownBlockHashes);
@@ -1644,6 +2167,7 @@ void BRPeerFree(BRPeer *peer)
     if (ctx->knownTxHashSet) BRSetFree(ctx->knownTxHashSet);
     if (ctx->pongCallback) array_free(ctx->pongCallback);
     if (ctx->pongInfo) array_free(ctx->pongInfo);
+    if (ctx->sendBuf) free(ctx->sendBuf);
     
     pthread_mutex_destroy(&ctx->lock);
     free(ctx);
@@ -1651,5 +2175,5 @@ void BRPeerFree(BRPeer *peer)
 
 void BRPeerAcceptMessageTest(BRPeer *peer, const uint8_t *msg, size_t msgLen, const char *type)
 {
-    _BRPeerAcceptMessage(peer, msg, msgLen, type);
+    _BRPeerAcceptMessage(peer, msg, msgLen, type, NULL);
 }
@@ -56,6 +56,7 @@ extern "C" {
 #define SERVICES_NODE_BLOOM   0x04 // BIP111: https://github.com/bitcoin/bips/blob/master/bip-0111.mediawiki
 #define SERVICES_NODE_WITNESS 0x08 // BIP144: https://github.com/bitcoin/bips/blob/master/bip-0144.mediawiki
 #define SERVICES_NODE_BCASH   0x20 // https://github.com/Bitcoin-UAHF/spec/blob/master/uahf-technical-spec.md
+#define SERVICES_NODE_COMPACT_FILTERS 0x40 // BIP157: https://github.com/bitcoin/bips/blob/master/bip-0157.mediawiki
     
 #define BR_VERSION "2.1"
 #define USER_AGENT "/bread:" BR_VERSION "/"
@@ -83,6 +84,11 @@ extern "C" {
 #define MSG_ALERT       "alert"
 #define MSG_REJECT      "reject"   // described in BIP61: https://github.com/bitcoin/bips/blob/master/bip-0061.mediawiki
 #define MSG_FEEFILTER   "feefilter"// described in BIP133 https://github.com/bitcoin/bips/blob/master/bip-0133.mediawiki
+#define MSG_SENDHEADERS "sendheaders" // described in BIP130 https://github.com/bitcoin/bips/blob/master/bip-0130.mediawiki
+#define MSG_GETCFILTERS "getcfilters" // described in BIP157 https://github.com/bitcoin/bips/blob/master/bip-0157.mediawiki
+#define MSG_CFILTER     "cfilter"
+#define MSG_GETCFHEADERS "getcfheaders"
+#define MSG_CFHEADERS   "cfheaders"
 
 #define REJECT_INVALID     0x10 // transaction is invalid for some reason (invalid signature, output value > input, etc)
 #define REJECT_SPENT       0x12 // an input is already spent
@@ -122,7 +128,9 @@ BRPeer *BRPeerNew(uint32_t magicNumber);
 // void notfound(void *, const UInt256[], size_t, const UInt256[], size_t) - called when "notfound" message is received
 // BRTransaction *requestedTx(void *, UInt256) - called when "getdata" message with a tx hash is received from peer
 // int networkIsReachable(void *) - must return true when networking is available, false otherwise
-// void threadCleanup(void *) - called before a thread terminates to faciliate any needed cleanup    
+// void threadCleanup(void *) - called after disconnected, once the connection is torn down, to faciliate any needed
+// cleanup
+// all peers share one reactor thread that every callback is called on, so callbacks must not block
 void BRPeerSetCallbacks(BRPeer *peer, void *info,
                         void (*connected)(void *info),
                         void (*disconnected)(void *info, int error),
@@ -138,9 +146,30 @@ void BRPeerSetCallbacks(BRPeer *peer, void *info,
                         int (*networkIsReachable)(void *info),
                         void (*threadCleanup)(void *info));
 
+// callbacks used to sync with compact block filters instead of bloom filters, info is the same as for BRPeerSetCallbacks()
+// void relayedFilterHeaders(void *, UInt256 stopHash, UInt256 prevHeader, const UInt256[], size_t) - called when a
+//   "cfheaders" message is received from peer, with the filter hashes of the blocks up to stopHash
+// void relayedFilter(void *, UInt256 blockHash, const uint8_t *, size_t) - called when a "cfilter" message is received
+//   from peer, the filter is only valid for the duration of the call
+// void relayedFullBlock(void *, BRMerkleBlock *, BRTransaction *[], size_t) - called when a "block" message is received
+//   from peer, with every tx in the block matched by block and in block order, the callee takes ownership of block and
+//   each tx
+void BRPeerSetCompactFilterCallbacks(BRPeer *peer,
+                                     void (*relayedFilterHeaders)(void *info, UInt256 stopHash, UInt256 prevHeader,
+                                                                  const UInt256 filterHashes[], size_t count),
+                                     void (*relayedFilter)(void *info, UInt256 blockHash, const uint8_t *filter,
+                                                           size_t filterLen),
+                                     void (*relayedFullBlock)(void *info, BRMerkleBlock *block, BRTransaction *txs[],
+                                                              size_t txCount));
+
 // set earliestKeyTime to wallet creation time in order to speed up initial sync
 void BRPeerSetEarliestKeyTime(BRPeer *peer, uint32_t earliestKeyTime);
 
+// set this to true to keep requesting headers up to the chain tip instead of switching to getblocks after
+// earliestKeyTime, the caller is then responsible for requesting filtered blocks with getdata (new blocks are also
+// announced with headers from then on)
+void BRPeerSetHeadersFirst(BRPeer *peer, int headersFirst);
+
 // call this when local best block height changes (helps detect tarpit nodes)
 void BRPeerSetCurrentBlockHeight(BRPeer *peer, uint32_t currentBlockHeight);
 
@@ -180,6 +209,7 @@ double BRPeerPingTime(BRPeer *peer);
 // sends a bitcoin protocol message to peer
 void BRPeerSendMessage(BRPeer *peer, const uint8_t *msg, size_t msgLen, const char *type);
 void BRPeerSendFilterload(BRPeer *peer, const uint8_t *filter, size_t filterLen);
+void BRPeerSendFilteradd(BRPeer *peer, const uint8_t *data, size_t dataLen);
 void BRPeerSendMempool(BRPeer *peer, const UInt256 knownTxHashes[], size_t knownTxCount, void *info,
                        void (*completionCallback)(void *info, int success));
 void BRPeerSendGetheaders(BRPeer *peer, const UInt256 locators[], size_t locatorsCount, UInt256 hashStop);
@@ -187,6 +217,9 @@ void BRPeerSendGetblocks(BRPeer *peer, const UInt256 locators[], size_t locators
 void BRPeerSendInv(BRPeer *peer, const UInt256 txHashes[], size_t txCount);
 void BRPeerSendGetdata(BRPeer *peer, const UInt256 txHashes[], size_t txCount, const UInt256 blockHashes[],
                        size_t blockCount);
+void BRPeerSendGetdataBlocks(BRPeer *peer, const UInt256 blockHashes[], size_t blockCount); // full blocks
+void BRPeerSendGetcfheaders(BRPeer *peer, uint32_t startHeight, UInt256 stopHash);
+void BRPeerSendGetcfilters(BRPeer *peer, uint32_t startHeight, UInt256 stopHash);
 void BRPeerSendGetaddr(BRPeer *peer);
 void BRPeerSendPing(BRPeer *peer, void *info, void (*pongCallback)(void *info, int success));
 
@@ -210,7 +243,7 @@ inline static int BRPeerEq(const void *peer, const void *otherPeer)
              ((const BRPeer *)peer)->port == ((const BRPeer *)otherPeer)->port));
 }
 
-// frees memory allocated for peer
+// frees memory allocated for peer, which must be disconnected and no longer registered with the reactor
 void BRPeerFree(BRPeer *peer);
 
 #ifdef __cplusplus
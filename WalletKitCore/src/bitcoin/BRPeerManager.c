@@ -24,17 +24,23 @@
 
 #include "BRPeerManager.h"
 #include "BRBloomFilter.h"
+#include "BRCompactFilter.h"
+#include "BRHeaderChain.h"
+#include "BRTxPeerMap.h"
+#include "BRPeerScores.h"
 #include "support/BRSet.h"
 #include "support/BRArray.h"
 #include "support/BRInt.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <inttypes.h>
 #include <limits.h>
 #include <time.h>
 #include <assert.h>
 #include <pthread.h>
 #include <errno.h>
+#include <sys/time.h>
 #include <netdb.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -43,6 +49,14 @@
 #define MAX_CONNECT_FAILURES  20 // notify user of network problems after this many connect failures in a row
 #define PEER_FLAG_SYNCED      0x01
 #define PEER_FLAG_NEEDSUPDATE 0x02
+#define PEER_FLAG_FILTERED    0x04
+#define SYNC_RANGE_SIZE       500  // filtered blocks requested from a single peer at a time in a headers-first sync
+#define SYNC_MAX_PEER_RANGES  2    // filtered block ranges a single peer may have in flight
+#define SYNC_STALL_TIMEOUT    10.0 // seconds without progress before the range holding back the chain is reassigned
+#define BLOCKS_DEPTH          288  // full blocks kept below lastBlock, older main chain blocks only keep their header
+#define PEER_SWAP_COST_RATIO  3.0  // times the cost of another peer the download peer must reach to be swapped out
+#define PEER_SWAP_INTERVAL    60.0 // minimum seconds between download peer swaps
+#define PTHREAD_STACK_SIZE    (512 * 1024)
 
 #define genesis_block_hash(params) UInt256Reverse((params)->checkpoints[0].hash)
 
@@ -65,81 +79,43 @@ typedef struct {
 } BRPublishedTx;
 
 typedef struct {
-    UInt256 txHash;
-    BRPeer *peers;
-} BRTxPeerList;
+    UInt256 blockHash;
+    BRMerkleBlock *block; // filtered block received ahead of the chain tip, or NULL
+    UInt256 filterHash, filterHeader; // compact filter hash and header, or UINT256_ZERO if not yet received
+} BRSyncBlock;
 
-// true if peer is contained in the list of peers associated with txHash
-static int _BRTxPeerListHasPeer(const BRTxPeerList *list, UInt256 txHash, const BRPeer *peer)
-{
-    for (size_t i = array_count(list); i > 0; i--) {
-        if (! UInt256Eq(list[i - 1].txHash, txHash)) continue;
-
-        for (size_t j = array_count(list[i - 1].peers); j > 0; j--) {
-            if (BRPeerEq(&list[i - 1].peers[j - 1], peer)) return 1;
-        }
-        
-        break;
-    }
-    
-    return 0;
-}
-
-// number of peers associated with txHash
-static size_t _BRTxPeerListCount(const BRTxPeerList *list, UInt256 txHash)
-{
-    for (size_t i = array_count(list); i > 0; i--) {
-        if (UInt256Eq(list[i - 1].txHash, txHash)) return array_count(list[i - 1].peers);
-    }
-    
-    return 0;
-}
-
-// adds peer to the list of peers associated with txHash and returns the new total number of peers
-static size_t _BRTxPeerListAddPeer(BRTxPeerList **list, UInt256 txHash, const BRPeer *peer)
-{
-    for (size_t i = array_count(*list); i > 0; i--) {
-        if (! UInt256Eq((*list)[i - 1].txHash, txHash)) continue;
-        
-        for (size_t j = array_count((*list)[i - 1].peers); j > 0; j--) {
-            if (BRPeerEq(&(*list)[i - 1].peers[j - 1], peer)) return array_count((*list)[i - 1].peers);
-        }
-        
-        array_add((*list)[i - 1].peers, *peer);
-        return array_count((*list)[i - 1].peers);
-    }
+typedef struct {
+    uint32_t height, count, received; // first block height, number of blocks, and blocks received or connected
+    BRPeer *peer, *stalledPeer; // peer the range is requested from (NULL if unassigned), and the last peer that stalled
+    double progressTime; // time the range was requested or last received a block
+} BRSyncRange;
 
-    array_add(*list, ((const BRTxPeerList) { txHash, NULL }));
-    array_new((*list)[array_count(*list) - 1].peers, PEER_MAX_CONNECTIONS);
-    array_add((*list)[array_count(*list) - 1].peers, *peer);
-    return 1;
-}
+typedef struct {
+    uint32_t height, timestamp;
+    size_t hashCount; // number of tx hashes to set the block height of, or SIZE_MAX to mark tx after height unconfirmed
+} BRWalletTxUpdate;
 
-// removes peer from the list of peers associated with txHash, returns true if peer was found
-static int _BRTxPeerListRemovePeer(BRTxPeerList *list, UInt256 txHash, const BRPeer *peer)
-{
-    for (size_t i = array_count(list); i > 0; i--) {
-        if (! UInt256Eq(list[i - 1].txHash, txHash)) continue;
-        
-        for (size_t j = array_count(list[i - 1].peers); j > 0; j--) {
-            if (! BRPeerEq(&list[i - 1].peers[j - 1], peer)) continue;
-            array_rm(list[i - 1].peers, j - 1);
-            return 1;
-        }
-        
-        break;
-    }
-    
-    return 0;
-}
+typedef struct {
+    uint8_t *scripts; // wallet output scripts matched against compact filters, concatenated
+    size_t *scriptLens;
+    size_t refCount; // the manager's reference, plus one for each filter being matched outside of manager->lock
+} BRFilterScripts;
+
+typedef enum {
+    BRPeerManagerJobReconnect,
+    BRPeerManagerJobSyncStarted,
+    BRPeerManagerJobSyncStopped,
+    BRPeerManagerJobSaveBlocks,
+    BRPeerManagerJobSavePeers
+} BRPeerManagerJobType;
 
-// comparator for sorting peers by timestamp, most recent first
-inline static int _peerTimestampCompare(const void *peer, const void *otherPeer)
-{
-    if (((const BRPeer *)peer)->timestamp < ((const BRPeer *)otherPeer)->timestamp) return 1;
-    if (((const BRPeer *)peer)->timestamp > ((const BRPeer *)otherPeer)->timestamp) return -1;
-    return 0;
-}
+typedef struct {
+    BRPeerManagerJobType type;
+    int arg; // syncStopped error, or saveBlocks/savePeers replace flag
+    BRMerkleBlock **blocks; // copies of the blocks to save, freed once saved
+    BRPeer *peers; // copy of the peers to save, freed once saved
+    size_t count;
+} BRPeerManagerJob;
 
 // returns a hash value for a block's prevBlock value suitable for use in a hashtable
 inline static size_t _BRPrevBlockHash(const void *block)
@@ -169,17 +145,30 @@ inline static int _BRBlockHeightEq(const void *block, const void *otherBlock)
 struct BRPeerManagerStruct {
     const BRChainParams *params;
     BRWallet *wallet;
-    int isConnected, connectFailureCount, misbehavinCount, dnsThreadCount, peerThreadCount, maxConnectCount;
+    int isConnected, connectFailureCount, misbehavinCount, dnsThreadCount, peerThreadCount, maxConnectCount, headersFirst;
     BRPeer *peers, *downloadPeer, fixedPeer, **connectedPeers;
+    BRPeerScores *scores; // connection quality statistics of each peer address
+    double swapTime; // time the download peer was last swapped out for being slow
     char downloadPeerName[INET6_ADDRSTRLEN + 6];
     uint32_t earliestKeyTime, syncStartHeight, filterUpdateHeight, estimatedHeight;
     BRBloomFilter *bloomFilter;
     double fpRate, averageTxPerBlock;
     BRSet *blocks, *orphans, *checkpoints;
-    BRMerkleBlock *lastBlock, *lastOrphan;
-    BRTxPeerList *txRelays, *txRequests;
+    BRMerkleBlock *lastBlock, *lastOrphan, *lastHeader;
+    BRHeaderChain *chain; // compact main chain headers by height, including every difficulty transition
+    BRHeaderStore *headerStore; // optional persistent copy of chain, which also records lastBlock's height
+    BRSyncBlock *syncBlocks; // header chain above lastBlock in a headers-first sync, indexed from syncBaseHeight
+    BRSyncRange *syncRanges; // filtered block ranges not yet received, ordered by height
+    uint32_t syncBaseHeight, syncNextHeight;
+    BRSyncMode syncMode;
+    BRFilterScripts *filterScripts; // replaced rather than modified, so filters can be matched against it unlocked
+    size_t filterAddrCount;
+    UInt256 filterHeader, filterHeaderBlock; // compact filter header of filterHeaderBlock, the last block checked
+    BRTxPeerMap *txRelays, *txRequests; // peers that have relayed, or were asked for, each tx
     BRPublishedTx *publishedTx;
     UInt256 *publishedTxHashes;
+    BRWalletTxUpdate *walletUpdates; // wallet updates queued while lock is held, applied in order once it's released
+    UInt256 *walletUpdateHashes;
     void *info;
     void (*syncStarted)(void *info);
     void (*syncStopped)(void *info, int error);
@@ -188,11 +177,266 @@ struct BRPeerManagerStruct {
     void (*savePeers)(void *info, int replace, const BRPeer peers[], size_t peersCount);
     int (*networkIsReachable)(void *info);
     void (*threadCleanup)(void *info);
-    pthread_mutex_t lock;
+    BRPeerManagerJob *jobs; // blocking work queued by peer callbacks for the job thread, guarded by jobLock
+    pthread_t jobThread;
+    int jobThreadStarted, jobsStopped;
+    pthread_mutex_t jobLock; // taken last, after any of the other locks
+    pthread_cond_t jobCond;
+    // lock guards chain state, which is everything not guarded by one of the other locks, txLock guards txRelays and
+    // txRequests, publishLock guards publishedTx and publishedTxHashes, and peersLock guards peers, scores,
+    // misbehavinCount and dnsThreadCount - locks are taken in that order (see BRPeerManagerLock), and any of the later
+    // ones may be taken without the earlier ones, so work that only touches tx relays, the publish queue or the peer
+    // table doesn't wait behind block processing
+    pthread_mutex_t lock, txLock, publishLock, peersLock;
+    uint64_t lockCount[BRPeerManagerLockCount], lockContention[BRPeerManagerLockCount];
 };
 
+static pthread_mutex_t *_BRPeerManagerMutex(BRPeerManager *manager, BRPeerManagerLock lock)
+{
+    switch (lock) {
+        case BRPeerManagerLockTxRelay: return &manager->txLock;
+        case BRPeerManagerLockPublish: return &manager->publishLock;
+        case BRPeerManagerLockPeers: return &manager->peersLock;
+        default: return &manager->lock;
+    }
+}
+
+// acquires one of manager's locks, counting acquisitions that had to wait for another thread to release it
+static void _BRPeerManagerLock(BRPeerManager *manager, BRPeerManagerLock lock)
+{
+    pthread_mutex_t *mutex = _BRPeerManagerMutex(manager, lock);
+    int contended = (pthread_mutex_trylock(mutex) != 0);
+    
+    if (contended) pthread_mutex_lock(mutex);
+    manager->lockCount[lock]++;
+    if (contended) manager->lockContention[lock]++;
+}
+
+static void _BRPeerManagerUnlock(BRPeerManager *manager, BRPeerManagerLock lock)
+{
+    pthread_mutex_unlock(_BRPeerManagerMutex(manager, lock));
+}
+
+// queues setting the block height and timestamp of txHashes in the wallet, or if txHashes is NULL, marking all tx after
+// height as unconfirmed (call with manager->lock held)
+static void _BRPeerManagerQueueWalletUpdate(BRPeerManager *manager, const UInt256 txHashes[], size_t count,
+                                            uint32_t height, uint32_t timestamp)
+{
+    if (! manager->walletUpdates) array_new(manager->walletUpdates, 10);
+    if (! manager->walletUpdateHashes) array_new(manager->walletUpdateHashes, 100);
+    array_add(manager->walletUpdates, ((const BRWalletTxUpdate) { height, timestamp, (txHashes) ? count : SIZE_MAX }));
+    if (txHashes) array_add_array(manager->walletUpdateHashes, txHashes, count);
+}
+
+// releases manager->lock and then applies any queued wallet updates, so wallet callbacks never run with it held
+// updates queued while the lock was held are applied in the order they were queued, but since the chain lock is also
+// taken by the job thread and by API calls, updates released by different threads may be applied in either order
+static void _BRPeerManagerUnlockChain(BRPeerManager *manager)
+{
+    BRWalletTxUpdate *updates = manager->walletUpdates;
+    UInt256 *hashes = manager->walletUpdateHashes;
+    size_t i, j;
+
+    manager->walletUpdates = NULL;
+    manager->walletUpdateHashes = NULL;
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
+
+    for (i = 0, j = 0; updates && i < array_count(updates); i++) {
+        if (updates[i].hashCount == SIZE_MAX) {
+            BRWalletSetTxUnconfirmedAfter(manager->wallet, updates[i].height);
+        }
+        else {
+            BRWalletUpdateTransactions(manager->wallet, &hashes[j], updates[i].hashCount, updates[i].height,
+                                       updates[i].timestamp);
+            j += updates[i].hashCount;
+        }
+    }
+
+    if (updates) array_free(updates);
+    if (hashes) array_free(hashes);
+}
+
+// sets manager->lastBlock, and records its height in the header store, since headers above it may have been set ahead of
+// their blocks by a headers-first sync and mustn't be restored from the store (call with the chain lock held)
+static void _BRPeerManagerSetLastBlock(BRPeerManager *manager, BRMerkleBlock *block)
+{
+    manager->lastBlock = block;
+    if (manager->headerStore) BRHeaderStoreSetLastBlockHeight(manager->headerStore, block->height);
+}
+
+static void _BRPeerManagerConnect(BRPeerManager *manager, int isRetry);
+
+static void _BRPeerManagerRunJob(BRPeerManager *manager, BRPeerManagerJob *job)
+{
+    switch (job->type) {
+        case BRPeerManagerJobReconnect: _BRPeerManagerConnect(manager, 0); break;
+        case BRPeerManagerJobSyncStarted: if (manager->syncStarted) manager->syncStarted(manager->info); break;
+        case BRPeerManagerJobSyncStopped:
+            if (manager->syncStopped) manager->syncStopped(manager->info, job->arg);
+            break;
+        case BRPeerManagerJobSaveBlocks:
+            if (manager->saveBlocks) manager->saveBlocks(manager->info, job->arg, job->blocks, job->count);
+            break;
+        case BRPeerManagerJobSavePeers:
+            if (manager->savePeers) manager->savePeers(manager->info, job->arg, job->peers, job->count);
+            break;
+    }
+
+    for (size_t i = 0; job->blocks && i < job->count; i++) BRMerkleBlockFree(job->blocks[i]);
+    if (job->blocks) free(job->blocks);
+    if (job->peers) free(job->peers);
+}
+
+// runs queued jobs in order, until the manager is freed and the queue is drained
+static void *_BRPeerManagerJobRoutine(void *arg)
+{
+    BRPeerManager *manager = arg;
+    BRPeerManagerJob job;
+    int stopped;
+
+    pthread_mutex_lock(&manager->jobLock);
+
+    for (;;) {
+        while (array_count(manager->jobs) == 0 && ! manager->jobsStopped) {
+            pthread_cond_wait(&manager->jobCond, &manager->jobLock);
+        }
+
+        if (array_count(manager->jobs) == 0) break;
+        job = manager->jobs[0];
+        array_rm(manager->jobs, 0);
+        stopped = manager->jobsStopped;
+        pthread_mutex_unlock(&manager->jobLock);
+        // saves and sync notifications still go out while the manager is being freed, reconnects don't
+        if (! stopped || job.type != BRPeerManagerJobReconnect) _BRPeerManagerRunJob(manager, &job);
+        pthread_mutex_lock(&manager->jobLock);
+    }
+
+    pthread_mutex_unlock(&manager->jobLock);
+    manager->threadCleanup(manager->info);
+    return NULL;
+}
+
+// queues a callback or reconnect to run on the job thread, so peer callbacks on the reactor thread never block on DNS
+// lookups or the persistent store, blocks and peers are copied (may be called with any of manager's locks held)
+static void _BRPeerManagerQueueJob(BRPeerManager *manager, BRPeerManagerJobType type, int arg,
+                                   BRMerkleBlock *blocks[], const BRPeer peers[], size_t count)
+{
+    BRPeerManagerJob job = { type, arg, NULL, NULL, count };
+    pthread_attr_t attr;
+    int queued = 0;
+
+    if (blocks) {
+        job.blocks = calloc(count, sizeof(*job.blocks));
+        assert(job.blocks != NULL);
+        for (size_t i = 0; i < count; i++) job.blocks[i] = BRMerkleBlockCopy(blocks[i]);
+    }
+
+    if (peers) {
+        job.peers = calloc((count > 0) ? count : 1, sizeof(*job.peers));
+        assert(job.peers != NULL);
+        memcpy(job.peers, peers, count*sizeof(*peers));
+    }
+
+    pthread_mutex_lock(&manager->jobLock);
+
+    if (! manager->jobThreadStarted && ! manager->jobsStopped && pthread_attr_init(&attr) == 0) {
+        manager->jobThreadStarted = (pthread_attr_setstacksize(&attr, PTHREAD_STACK_SIZE) == 0 &&
+                                     pthread_create(&manager->jobThread, &attr, _BRPeerManagerJobRoutine,
+                                                    manager) == 0);
+        pthread_attr_destroy(&attr);
+    }
+
+    if (manager->jobThreadStarted) {
+        array_add(manager->jobs, job);
+        pthread_cond_signal(&manager->jobCond);
+        queued = 1;
+    }
+
+    pthread_mutex_unlock(&manager->jobLock);
+    if (! queued) _BRPeerManagerRunJob(manager, &job); // couldn't start the job thread, so run it inline
+}
+
+// true if peer has relayed, or was asked for, the transaction with txHash (map is txRelays or txRequests)
+static int _BRPeerManagerHasTxPeer(BRPeerManager *manager, BRTxPeerMap *map, UInt256 txHash, const BRPeer *peer)
+{
+    int r;
+    
+    _BRPeerManagerLock(manager, BRPeerManagerLockTxRelay);
+    r = BRTxPeerMapHasPeer(map, txHash, peer);
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockTxRelay);
+    return r;
+}
+
+static size_t _BRPeerManagerTxPeerCount(BRPeerManager *manager, BRTxPeerMap *map, UInt256 txHash)
+{
+    size_t count;
+    
+    _BRPeerManagerLock(manager, BRPeerManagerLockTxRelay);
+    count = BRTxPeerMapCount(map, txHash);
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockTxRelay);
+    return count;
+}
+
+static size_t _BRPeerManagerAddTxPeer(BRPeerManager *manager, BRTxPeerMap *map, UInt256 txHash, const BRPeer *peer)
+{
+    size_t count;
+    
+    _BRPeerManagerLock(manager, BRPeerManagerLockTxRelay);
+    count = BRTxPeerMapAddPeer(map, txHash, peer);
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockTxRelay);
+    return count;
+}
+
+static int _BRPeerManagerRemoveTxPeer(BRPeerManager *manager, BRTxPeerMap *map, UInt256 txHash, const BRPeer *peer)
+{
+    int r;
+    
+    _BRPeerManagerLock(manager, BRPeerManagerLockTxRelay);
+    r = BRTxPeerMapRemovePeer(map, txHash, peer);
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockTxRelay);
+    return r;
+}
+
+static double _BRPeerManagerTime(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + (double)tv.tv_usec/1000000;
+}
+
+// estimated seconds for peer to deliver a batch of filtered blocks, from its connection quality so far
+static double _BRPeerManagerPeerCost(BRPeerManager *manager, const BRPeer *peer)
+{
+    double cost;
+
+    _BRPeerManagerLock(manager, BRPeerManagerLockPeers);
+    cost = BRPeerScoresCost(manager->scores, peer);
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockPeers);
+    return cost;
+}
+
+// adds the rolling average ping time of peer's current connection to its score
+static void _BRPeerManagerScorePing(BRPeerManager *manager, BRPeer *peer)
+{
+    _BRPeerManagerLock(manager, BRPeerManagerLockPeers);
+    BRPeerScoresAddPing(manager->scores, peer, BRPeerPingTime(peer), _BRPeerManagerTime());
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockPeers);
+}
+
+// adds a filtered block, or compact filter, received from peer to its throughput score
+static void _BRPeerManagerScoreBlock(BRPeerManager *manager, BRPeer *peer)
+{
+    _BRPeerManagerLock(manager, BRPeerManagerLockPeers);
+    BRPeerScoresAddBlock(manager->scores, peer, _BRPeerManagerTime());
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockPeers);
+}
+
 static void _BRPeerManagerPeerMisbehavin(BRPeerManager *manager, BRPeer *peer)
 {
+    _BRPeerManagerLock(manager, BRPeerManagerLockPeers);
+    BRPeerScoresAddMisbehavin(manager->scores, peer, _BRPeerManagerTime());
+    
     for (size_t i = array_count(manager->peers); i > 0; i--) {
         if (BRPeerEq(&manager->peers[i - 1], peer)) array_rm(manager->peers, i - 1);
     }
@@ -202,24 +446,36 @@ static void _BRPeerManagerPeerMisbehavin(BRPeerManager *manager, BRPeer *peer)
         array_clear(manager->peers);
     }
 
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockPeers);
     BRPeerDisconnect(peer);
 }
 
+// true if any published tx is still waiting for a peer to accept it
+static int _BRPeerManagerHasPendingPublish(BRPeerManager *manager)
+{
+    int r = 0;
+    
+    _BRPeerManagerLock(manager, BRPeerManagerLockPublish);
+    
+    for (size_t i = array_count(manager->publishedTx); ! r && i > 0; i--) {
+        if (manager->publishedTx[i - 1].callback != NULL) r = 1;
+    }
+    
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockPublish);
+    return r;
+}
+
 static void _BRPeerManagerSyncStopped(BRPeerManager *manager)
 {
     manager->syncStartHeight = 0;
 
-    if (manager->downloadPeer) {
-        // don't cancel timeout if there's a pending tx publish callback
-        for (size_t i = array_count(manager->publishedTx); i > 0; i--) {
-            if (manager->publishedTx[i - 1].callback != NULL) return;
-        }
-    
+    // don't cancel timeout if there's a pending tx publish callback
+    if (manager->downloadPeer && ! _BRPeerManagerHasPendingPublish(manager)) {
         BRPeerScheduleDisconnect(manager->downloadPeer, -1); // cancel sync timeout
     }
 }
 
-// adds transaction to list of tx to be published, along with any unconfirmed inputs
+// adds transaction to list of tx to be published, along with any unconfirmed inputs (call with publishLock held)
 static void _BRPeerManagerAddTxToPublishList(BRPeerManager *manager, BRTransaction *tx, void *info,
                                              void (*callback)(void *, int))
 {
@@ -242,22 +498,390 @@ static size_t _BRPeerManagerBlockLocators(BRPeerManager *manager, UInt256 locato
 {
     // append 10 most recent block hashes, decending, then continue appending, doubling the step back each time,
     // finishing with the genesis block (top, -1, -2, -3, -4, -5, -6, -7, -8, -9, -11, -15, -23, -39, -71, -135, ..., 0)
-    BRMerkleBlock *block = manager->lastBlock;
-    int32_t step = 1, i = 0, j;
-    
-    while (block && block->height > 0) {
-        if (locators && i < locatorsCount) locators[i] = block->blockHash;
-        if (++i >= 10) step *= 2;
+    // heights with pruned headers are replaced with the difficulty transition below them
+    uint32_t height = manager->lastBlock->height, step = 1;
+    size_t i = 0;
+    UInt256 hash = manager->lastBlock->blockHash;
+    
+    while (height > 0) {
+        if (! UInt256IsZero(hash)) {
+            if (locators && i < locatorsCount) locators[i] = hash;
+            if (++i >= 10) step *= 2;
+            height = (height > step) ? height - step : 0;
+        }
+        else height -= height % BLOCK_DIFFICULTY_INTERVAL;
         
-        for (j = 0; block && j < step; j++) {
-            block = BRSetGet(manager->blocks, &block->prevBlock);
-        }
+        hash = BRHeaderChainHash(manager->chain, height);
+        if (UInt256IsZero(hash) && (height % BLOCK_DIFFICULTY_INTERVAL) == 0) break;
     }
     
     if (locators && i < locatorsCount) locators[i] = genesis_block_hash(manager->params);
     return (size_t) ++i;
 }
 
+// requests headers following the header chain tip, or following lastBlock when there is no header chain yet
+static void _BRPeerManagerRequestHeaders(BRPeerManager *manager, BRPeer *peer)
+{
+    UInt256 locators[_BRPeerManagerBlockLocators(manager, NULL, 0) + 1];
+    size_t count = 0;
+
+    if (manager->lastHeader) locators[count++] = manager->lastHeader->blockHash;
+    count += _BRPeerManagerBlockLocators(manager, &locators[count], sizeof(locators)/sizeof(*locators) - count);
+    BRPeerSendGetheaders(peer, locators, count, UINT256_ZERO);
+}
+
+// discards headers-first sync state, any header-only blocks are left in the blocks set
+static void _BRPeerManagerSyncReset(BRPeerManager *manager)
+{
+    for (size_t i = array_count(manager->syncBlocks); i > 0; i--) {
+        if (manager->syncBlocks[i - 1].block) BRMerkleBlockFree(manager->syncBlocks[i - 1].block);
+    }
+
+    array_clear(manager->syncBlocks);
+    array_clear(manager->syncRanges);
+    manager->lastHeader = NULL;
+}
+
+// number of blocks in range that have been received or already connected to the chain
+static uint32_t _BRPeerManagerSyncRangeReceived(BRPeerManager *manager, const BRSyncRange *range)
+{
+    uint32_t height, received = 0;
+
+    for (height = range->height; height < range->height + range->count; height++) {
+        if (height <= manager->lastBlock->height ||
+            manager->syncBlocks[height - manager->syncBaseHeight].block) received++;
+    }
+
+    return received;
+}
+
+// number of filtered block ranges in flight to peer
+static size_t _BRPeerManagerSyncRangeCount(BRPeerManager *manager, const BRPeer *peer)
+{
+    size_t count = 0;
+
+    for (size_t i = array_count(manager->syncRanges); i > 0; i--) {
+        if (manager->syncRanges[i - 1].peer == peer) count++;
+    }
+
+    return count;
+}
+
+// returns any filtered block ranges requested from peer to the pool of unassigned ranges
+static void _BRPeerManagerReleaseSyncRanges(BRPeerManager *manager, const BRPeer *peer)
+{
+    for (size_t i = array_count(manager->syncRanges); i > 0; i--) {
+        if (manager->syncRanges[i - 1].peer != peer) continue;
+        manager->syncRanges[i - 1].stalledPeer = manager->syncRanges[i - 1].peer;
+        manager->syncRanges[i - 1].peer = NULL;
+    }
+}
+
+// splits headers above syncNextHeight into ranges of filtered blocks, the last range may be short once the chain tip is
+// reached
+static void _BRPeerManagerSplitSyncRanges(BRPeerManager *manager)
+{
+    uint32_t height = manager->lastHeader->height;
+
+    while (manager->syncNextHeight <= height &&
+           (height + 1 - manager->syncNextHeight >= SYNC_RANGE_SIZE || height >= manager->estimatedHeight)) {
+        BRSyncRange range = { manager->syncNextHeight, height + 1 - manager->syncNextHeight, 0, NULL, NULL, 0 };
+
+        if (range.count > SYNC_RANGE_SIZE) range.count = SYNC_RANGE_SIZE;
+        range.received = _BRPeerManagerSyncRangeReceived(manager, &range);
+        if (range.received < range.count) array_add(manager->syncRanges, range);
+        manager->syncNextHeight += range.count;
+    }
+}
+
+// drops filtered blocks received ahead of the chain tip and splits everything above it into new unassigned ranges,
+// used when the wallet filter is updated since blocks filtered with the old one may be missing wallet transactions
+static void _BRPeerManagerDiscardSyncBlocks(BRPeerManager *manager)
+{
+    for (size_t i = array_count(manager->syncBlocks); i > 0; i--) {
+        if (manager->syncBlocks[i - 1].block) BRMerkleBlockFree(manager->syncBlocks[i - 1].block);
+        manager->syncBlocks[i - 1].block = NULL;
+    }
+
+    // ranges that already completed were dropped, so they have to be split off again
+    array_clear(manager->syncRanges);
+    manager->syncNextHeight = manager->lastBlock->height + 1;
+    if (manager->lastHeader) _BRPeerManagerSplitSyncRanges(manager);
+}
+
+// appends a verified header to the headers-first sync chain, returns false if the header is already in the chain or
+// doesn't connect to it
+static int _BRPeerManagerAddSyncHeader(BRPeerManager *manager, BRMerkleBlock *header, BRMerkleBlock *prev)
+{
+    size_t i, count = array_count(manager->syncBlocks);
+    BRMerkleBlock *b;
+
+    if (count == 0) manager->syncBaseHeight = manager->syncNextHeight = manager->lastBlock->height + 1;
+    if (header->height < manager->syncBaseHeight) return 0;
+    i = header->height - manager->syncBaseHeight;
+
+    if (i > count || ! UInt256Eq(prev->blockHash, (i == 0) ? manager->lastBlock->blockHash :
+                                                              manager->syncBlocks[i - 1].blockHash)) return 0;
+    if (i < count && UInt256Eq(header->blockHash, manager->syncBlocks[i].blockHash)) return 0;
+
+    if (i < count) { // the header chain forked, drop everything from the fork point up
+        for (size_t j = count; j > i; j--) {
+            if (manager->syncBlocks[j - 1].block) BRMerkleBlockFree(manager->syncBlocks[j - 1].block);
+        }
+
+        array_set_count(manager->syncBlocks, i);
+
+        for (size_t j = array_count(manager->syncRanges); j > 0; j--) {
+            BRSyncRange *r = &manager->syncRanges[j - 1];
+
+            if (r->height >= header->height) array_rm(manager->syncRanges, j - 1);
+            else if (r->height + r->count > header->height) {
+                r->count = header->height - r->height;
+                r->received = _BRPeerManagerSyncRangeReceived(manager, r);
+            }
+        }
+
+        if (manager->syncNextHeight > header->height) manager->syncNextHeight = header->height;
+    }
+
+    b = BRSetAdd(manager->blocks, header);
+    if (b && b != header) BRMerkleBlockFree(b); // stale header left over from an earlier sync
+    BRHeaderChainSet(manager->chain, header);
+    array_add(manager->syncBlocks, ((const BRSyncBlock) { header->blockHash, NULL, UINT256_ZERO, UINT256_ZERO }));
+    manager->lastHeader = header;
+    _BRPeerManagerSplitSyncRanges(manager);
+    return 1;
+}
+
+// returns the least busy connected peer with a loaded filter that can take another range, preferring lower cost
+static BRPeer *_BRPeerManagerSyncPeer(BRPeerManager *manager, const BRSyncRange *range, const BRPeer *exclude)
+{
+    BRPeer *p, *peer = NULL;
+    size_t count, peerCount = SYNC_MAX_PEER_RANGES;
+
+    for (size_t i = array_count(manager->connectedPeers); i > 0; i--) {
+        p = manager->connectedPeers[i - 1];
+        if (p == exclude || BRPeerConnectStatus(p) != BRPeerStatusConnected) continue;
+        if ((p->flags & (PEER_FLAG_FILTERED | PEER_FLAG_NEEDSUPDATE)) != PEER_FLAG_FILTERED) continue;
+        if (BRPeerLastBlock(p) + 1 < range->height + range->count) continue; // peer doesn't have the whole range
+        count = _BRPeerManagerSyncRangeCount(manager, p);
+
+        if (count < peerCount || (count == peerCount && peer &&
+                                  _BRPeerManagerPeerCost(manager, p) < _BRPeerManagerPeerCost(manager, peer))) {
+            peer = p;
+            peerCount = count;
+        }
+    }
+
+    return peer;
+}
+
+// true if p would make a better download peer than q during a headers-first sync: a peer that has every header up to
+// height beats one that doesn't, then the one with the lower cost wins, otherwise the one with the higher lastblock
+static int _BRPeerManagerBetterDownloadPeer(BRPeerManager *manager, BRPeer *p, BRPeer *q, uint32_t height)
+{
+    int pHasAll, qHasAll;
+
+    if (! q) return 1;
+    pHasAll = (BRPeerLastBlock(p) >= height), qHasAll = (BRPeerLastBlock(q) >= height);
+    if (pHasAll != qHasAll) return pHasAll;
+    if (pHasAll) return (_BRPeerManagerPeerCost(manager, p) < _BRPeerManagerPeerCost(manager, q));
+    return (BRPeerLastBlock(p) > BRPeerLastBlock(q));
+}
+
+// during a headers-first sync, disconnects the download peer once its measured cost is PEER_SWAP_COST_RATIO times that
+// of the best other peer with a loaded filter, _peerDisconnected() then carries on the sync with that peer
+static void _BRPeerManagerSwapSlowDownloadPeer(BRPeerManager *manager)
+{
+    BRPeer *p, *best = NULL, *peer = manager->downloadPeer;
+    BRPeerStats stats, bestStats;
+    double now = _BRPeerManagerTime(), cost, bestCost;
+    int measured;
+
+    if (! manager->lastHeader || ! peer || manager->swapTime + PEER_SWAP_INTERVAL > now) return;
+
+    for (size_t i = array_count(manager->connectedPeers); i > 0; i--) {
+        p = manager->connectedPeers[i - 1];
+        if (p == peer || BRPeerConnectStatus(p) != BRPeerStatusConnected ||
+            (p->flags & PEER_FLAG_FILTERED) == 0) continue;
+        if (_BRPeerManagerBetterDownloadPeer(manager, p, best, manager->lastHeader->height)) best = p;
+    }
+
+    if (! best || BRPeerLastBlock(best) < manager->lastHeader->height) return;
+    _BRPeerManagerLock(manager, BRPeerManagerLockPeers);
+    measured = (BRPeerScoresGet(manager->scores, peer, &stats) && (stats.blockRate > 0 || stats.stallCount > 0) &&
+                BRPeerScoresGet(manager->scores, best, &bestStats) && bestStats.blockRate > 0);
+    cost = BRPeerScoresCost(manager->scores, peer);
+    bestCost = BRPeerScoresCost(manager->scores, best);
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockPeers);
+    if (! measured || cost < bestCost*PEER_SWAP_COST_RATIO) return;
+
+    peer_log(peer, "download peer is slow, %.1fs per %d blocks against %.1fs for %s, swapping it out", cost,
+             PEER_SCORE_BATCH, bestCost, BRPeerHost(best));
+    manager->swapTime = now;
+    BRPeerDisconnect(peer);
+}
+
+// requests unassigned filtered block ranges from peers with spare capacity, and reassigns the range holding back the
+// chain tip if its peer has stopped making progress
+static void _BRPeerManagerRequestSyncRanges(BRPeerManager *manager)
+{
+    double now = time(NULL);
+    BRSyncRange *r;
+    BRPeer *peer;
+    uint32_t height;
+    size_t count;
+
+    if (! manager->lastHeader) return;
+    if (manager->syncMode == BRSyncModeBloomFilter && ! manager->bloomFilter) return; // wait for pending filter update
+
+    if (array_count(manager->syncRanges) > 0 && manager->syncRanges[0].peer &&
+        manager->syncRanges[0].progressTime + SYNC_STALL_TIMEOUT < now) {
+        r = &manager->syncRanges[0];
+        peer_log(r->peer, "filtered block range at height %"PRIu32" stalled, reassigning", r->height);
+        _BRPeerManagerLock(manager, BRPeerManagerLockPeers);
+        BRPeerScoresAddStall(manager->scores, r->peer, now);
+        _BRPeerManagerUnlock(manager, BRPeerManagerLockPeers);
+        r->stalledPeer = r->peer;
+        r->peer = NULL;
+    }
+
+    _BRPeerManagerSwapSlowDownloadPeer(manager);
+
+    for (size_t i = 0; i < array_count(manager->syncRanges); i++) {
+        r = &manager->syncRanges[i];
+        if (r->peer) continue;
+        peer = _BRPeerManagerSyncPeer(manager, r, r->stalledPeer);
+        if (! peer && r->stalledPeer) peer = _BRPeerManagerSyncPeer(manager, r, NULL); // no one else to ask
+        if (! peer) continue;
+
+        UInt256 hashes[r->count];
+        uint32_t start = 0;
+
+        for (height = r->height, count = 0; height < r->height + r->count; height++) {
+            BRSyncBlock *b = &manager->syncBlocks[height - manager->syncBaseHeight];
+
+            if (height <= manager->lastBlock->height || b->block) continue;
+            if (count == 0) start = height;
+            hashes[count++] = b->blockHash;
+        }
+
+        r->peer = peer;
+        r->progressTime = now;
+
+        if (manager->syncMode == BRSyncModeCompactFilter) { // filter headers come first so each filter can be checked
+            height = r->height + r->count - 1;
+            peer_log(peer, "requesting compact filters from height %"PRIu32" to %"PRIu32, start, height);
+            BRPeerSendGetcfheaders(peer, start, manager->syncBlocks[height - manager->syncBaseHeight].blockHash);
+            BRPeerSendGetcfilters(peer, start, manager->syncBlocks[height - manager->syncBaseHeight].blockHash);
+        }
+        else {
+            peer_log(peer, "requesting %zu filtered block(s) from height %"PRIu32, count, r->height);
+            BRPeerSendGetdata(peer, NULL, 0, hashes, count);
+        }
+
+        if (peer != manager->downloadPeer) BRPeerScheduleDisconnect(peer, PROTOCOL_TIMEOUT);
+    }
+}
+
+// stores a filtered block received ahead of the chain tip, returns false if block isn't part of the header chain, was
+// already received, or was filtered before a pending filter update
+static int _BRPeerManagerAddSyncBlock(BRPeerManager *manager, BRMerkleBlock *block, BRPeer *peer)
+{
+    size_t i = block->height - manager->syncBaseHeight;
+
+    if (i >= array_count(manager->syncBlocks) || ! UInt256Eq(block->blockHash, manager->syncBlocks[i].blockHash) ||
+        manager->syncBlocks[i].block || (peer->flags & PEER_FLAG_NEEDSUPDATE)) return 0;
+    manager->syncBlocks[i].block = block;
+
+    for (size_t j = 0; j < array_count(manager->syncRanges); j++) {
+        BRSyncRange *r = &manager->syncRanges[j];
+
+        if (block->height < r->height || block->height >= r->height + r->count) continue;
+        r->progressTime = time(NULL);
+        if (++r->received >= r->count) array_rm(manager->syncRanges, j);
+        break;
+    }
+
+    // keep the sync timeout going while peer still has ranges in flight, the download peer is kept as long as any
+    // filtered blocks arrive
+    if (peer != manager->downloadPeer) {
+        BRPeerScheduleDisconnect(peer, (_BRPeerManagerSyncRangeCount(manager, peer) > 0) ? PROTOCOL_TIMEOUT : -1);
+    }
+
+    if (manager->downloadPeer) BRPeerScheduleDisconnect(manager->downloadPeer, PROTOCOL_TIMEOUT);
+    manager->connectFailureCount = 0;
+    return 1;
+}
+
+// connects filtered blocks received out of order to the chain tip, returns the new lastBlock if any were connected
+static BRMerkleBlock *_BRPeerManagerCommitSyncBlocks(BRPeerManager *manager, BRPeer *peer)
+{
+    BRMerkleBlock *header, *block = NULL;
+    size_t i, count, txCount = 0;
+    UInt256 *txHashes = NULL;
+    uint32_t txTime;
+
+    while ((i = manager->lastBlock->height + 1 - manager->syncBaseHeight) < array_count(manager->syncBlocks) &&
+           manager->syncBlocks[i].block) {
+        if (manager->syncMode == BRSyncModeCompactFilter) { // check the filter header chain links up across ranges
+            BRSyncBlock *b = &manager->syncBlocks[i];
+
+            if (UInt256Eq(manager->filterHeaderBlock, manager->lastBlock->blockHash) &&
+                ! UInt256Eq(BRCompactFilterHeader(b->filterHash, manager->filterHeader), b->filterHeader)) {
+                peer_log(peer, "compact filter header for block #%"PRIu32" doesn't connect, refetching filters",
+                         manager->lastBlock->height + 1);
+                manager->filterHeaderBlock = UINT256_ZERO;
+                _BRPeerManagerDiscardSyncBlocks(manager);
+                break;
+            }
+
+            manager->filterHeader = b->filterHeader;
+            manager->filterHeaderBlock = b->blockHash;
+        }
+
+        block = manager->syncBlocks[i].block;
+        manager->syncBlocks[i].block = NULL;
+        header = BRSetAdd(manager->blocks, block);
+
+        if (header && header != block) { // replace the header-only block
+            if (manager->lastHeader == header) manager->lastHeader = block;
+            BRMerkleBlockFree(header);
+        }
+
+        count = BRMerkleBlockTxHashes(block, NULL, 0);
+
+        if (count > txCount) {
+            txHashes = realloc(txHashes, count*sizeof(*txHashes));
+            assert(txHashes != NULL);
+            txCount = count;
+        }
+
+        count = BRMerkleBlockTxHashes(block, txHashes, count);
+        txTime = block->timestamp/2 + manager->lastBlock->timestamp/2;
+
+        if ((block->height % 500) == 0 || count > 0 || block->height >= manager->estimatedHeight) {
+            peer_log(peer, "adding block #%"PRIu32", false positive rate: %f", block->height, manager->fpRate);
+        }
+
+        BRHeaderChainSet(manager->chain, block);
+        _BRPeerManagerSetLastBlock(manager, block);
+        if (count > 0) _BRPeerManagerQueueWalletUpdate(manager, txHashes, count, block->height, txTime);
+
+        if ((block->height % BLOCK_DIFFICULTY_INTERVAL) == 0 && block->height + 100 < manager->estimatedHeight &&
+            manager->saveBlocks) { // save transition blocks immediately
+            _BRPeerManagerQueueJob(manager, BRPeerManagerJobSaveBlocks, 0, &block, NULL, 1);
+        }
+    }
+
+    free(txHashes);
+    if (block && manager->downloadPeer) BRPeerSetCurrentBlockHeight(manager->downloadPeer, block->height);
+
+    if (block && block == manager->lastHeader) _BRPeerManagerSyncReset(manager); // every header has its block now
+
+    return block;
+}
+
 static void _setApplyFreeBlock(void *info, void *block)
 {
     BRMerkleBlockFree(block);
@@ -333,8 +957,74 @@ static void _BRPeerManagerLoadBloomFilter(BRPeerManager *manager, BRPeer *peer)
     size_t len = BRBloomFilterSerialize(filter, data, sizeof(data));
     
     BRPeerSendFilterload(peer, data, len);
+    peer->flags |= PEER_FLAG_FILTERED;
 }
 
+// drops a reference to scripts, freeing it once unreferenced (call with manager->lock held)
+static void _BRFilterScriptsRelease(BRFilterScripts *scripts)
+{
+    if (scripts && --scripts->refCount == 0) {
+        array_free(scripts->scripts);
+        array_free(scripts->scriptLens);
+        free(scripts);
+    }
+}
+
+// builds the p2pkh and p2wpkh output scripts of every wallet address, which are matched against compact filters
+static void _BRPeerManagerLoadFilterScripts(BRPeerManager *manager)
+{
+    BRFilterScripts *scripts = calloc(1, sizeof(*scripts));
+
+    // as with the bloom filter, generate some spare addresses to avoid refetching filters each time a wallet
+    // transaction is encountered during the chain sync
+    BRWalletUnusedAddrs(manager->wallet, NULL, SEQUENCE_GAP_LIMIT_EXTERNAL_EXTENDED, SEQUENCE_EXTERNAL_CHAIN);
+    BRWalletUnusedAddrs(manager->wallet, NULL, SEQUENCE_GAP_LIMIT_INTERNAL_EXTENDED, SEQUENCE_INTERNAL_CHAIN);
+
+    size_t addrsCount = BRWalletAllAddrs(manager->wallet, NULL, 0);
+    BRAddress *addrs = malloc(addrsCount*sizeof(*addrs));
+    UInt160 hash;
+
+    assert(addrs != NULL);
+    assert(scripts != NULL);
+    addrsCount = BRWalletAllAddrs(manager->wallet, addrs, addrsCount);
+    array_new(scripts->scripts, addrsCount*(25 + 22));
+    array_new(scripts->scriptLens, addrsCount*2);
+    scripts->refCount = 1;
+
+    for (size_t i = 0; i < addrsCount; i++) {
+        if (! BRAddressHash160(&hash, manager->params->addrParams, addrs[i].s)) continue;
+
+        uint8_t p2pkh[] = { OP_DUP, OP_HASH160, sizeof(hash) }, p2wpkh[] = { OP_0, sizeof(hash) },
+                checksig[] = { OP_EQUALVERIFY, OP_CHECKSIG };
+
+        array_add_array(scripts->scripts, p2pkh, sizeof(p2pkh));
+        array_add_array(scripts->scripts, hash.u8, sizeof(hash));
+        array_add_array(scripts->scripts, checksig, sizeof(checksig));
+        array_add(scripts->scriptLens, sizeof(p2pkh) + sizeof(hash) + sizeof(checksig));
+        array_add_array(scripts->scripts, p2wpkh, sizeof(p2wpkh));
+        array_add_array(scripts->scripts, hash.u8, sizeof(hash));
+        array_add(scripts->scriptLens, sizeof(p2wpkh) + sizeof(hash));
+    }
+
+    free(addrs);
+    _BRFilterScriptsRelease(manager->filterScripts);
+    manager->filterScripts = scripts;
+    manager->filterAddrCount = addrsCount;
+}
+
+// loads the bloom filter on peer, or in compact filter mode, where filters are matched locally, rebuilds the wallet
+// scripts instead
+static void _BRPeerManagerLoadFilter(BRPeerManager *manager, BRPeer *peer)
+{
+    if (manager->syncMode == BRSyncModeCompactFilter) {
+        _BRPeerManagerLoadFilterScripts(manager);
+        peer->flags |= PEER_FLAG_FILTERED;
+    }
+    else _BRPeerManagerLoadBloomFilter(manager, peer);
+}
+
+static void _BRPeerManagerUpdateFilter(BRPeerManager *manager);
+
 static void _updateFilterRerequestDone(void *info, int success)
 {
     BRPeer *peer = ((BRPeerCallbackInfo *)info)->peer;
@@ -343,7 +1033,7 @@ static void _updateFilterRerequestDone(void *info, int success)
     free(info);
     
     if (success) {
-        pthread_mutex_lock(&manager->lock);
+        _BRPeerManagerLock(manager, BRPeerManagerLockChain);
 
         if ((peer->flags & PEER_FLAG_NEEDSUPDATE) == 0) {
             UInt256 locators[_BRPeerManagerBlockLocators(manager, NULL, 0)];
@@ -352,7 +1042,7 @@ static void _updateFilterRerequestDone(void *info, int success)
             BRPeerSendGetblocks(peer, locators, count, UINT256_ZERO);
         }
 
-        pthread_mutex_unlock(&manager->lock);
+        _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
     }
 }
 
@@ -365,11 +1055,17 @@ static void _updateFilterLoadDone(void *info, int success)
     free(info);
     
     if (success) {
-        pthread_mutex_lock(&manager->lock);
+        _BRPeerManagerLock(manager, BRPeerManagerLockChain);
         BRPeerSetNeedsFilterUpdate(peer, 0);
         peer->flags &= ~PEER_FLAG_NEEDSUPDATE;
         
-        if (manager->lastBlock->height < manager->estimatedHeight) { // if syncing, rerequest blocks
+        if (! manager->bloomFilter && manager->syncMode == BRSyncModeBloomFilter) {
+            _BRPeerManagerUpdateFilter(manager); // a full reload was requested while filteradd was pending
+        }
+        else if (manager->lastHeader) { // headers-first sync, request ranges again now that the filter is updated
+            _BRPeerManagerRequestSyncRanges(manager);
+        }
+        else if (manager->lastBlock->height < manager->estimatedHeight) { // if syncing, rerequest blocks
             if (manager->downloadPeer) {
                 peerInfo = calloc(1, sizeof(*peerInfo));
                 assert(peerInfo != NULL);
@@ -381,7 +1077,7 @@ static void _updateFilterLoadDone(void *info, int success)
         }
         else BRPeerSendMempool(peer, NULL, 0, NULL, NULL); // if not syncing, request mempool
         
-        pthread_mutex_unlock(&manager->lock);
+        _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
     }
 }
 
@@ -392,12 +1088,13 @@ static void _updateFilterPingDone(void *info, int success)
     BRPeerCallbackInfo *peerInfo;
     
     if (success) {
-        pthread_mutex_lock(&manager->lock);
+        _BRPeerManagerLock(manager, BRPeerManagerLockChain);
         peer_log(peer, "updating filter with newly created wallet addresses");
         if (manager->bloomFilter) BRBloomFilterFree(manager->bloomFilter);
         manager->bloomFilter = NULL;
 
-        if (manager->lastBlock->height < manager->estimatedHeight) { // if we're syncing, only update download peer
+        // if we're syncing, only update download peer (a headers-first sync downloads from every peer)
+        if (manager->lastBlock->height < manager->estimatedHeight && ! manager->lastHeader) {
             if (manager->downloadPeer) {
                 _BRPeerManagerLoadBloomFilter(manager, manager->downloadPeer);
                 BRPeerSendPing(manager->downloadPeer, info, _updateFilterLoadDone); // wait for pong so filter is loaded
@@ -418,7 +1115,7 @@ static void _updateFilterPingDone(void *info, int success)
             }
         }
 
-         pthread_mutex_unlock(&manager->lock);
+         _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
     }
     else free(info);
 }
@@ -427,10 +1124,32 @@ static void _BRPeerManagerUpdateFilter(BRPeerManager *manager)
 {
     BRPeerCallbackInfo *info;
 
-    if (manager->downloadPeer && (manager->downloadPeer->flags & PEER_FLAG_NEEDSUPDATE) == 0) {
+    if (manager->syncMode == BRSyncModeCompactFilter) { // nothing to load on peers, just refetch unchecked filters
+        _peer_log("BPM: updating filter with newly created wallet addresses\n");
+        _BRPeerManagerLoadFilterScripts(manager);
+
+        if (manager->lastHeader) {
+            _BRPeerManagerDiscardSyncBlocks(manager);
+            _BRPeerManagerRequestSyncRanges(manager);
+        }
+    }
+    else if (manager->downloadPeer && (manager->downloadPeer->flags & PEER_FLAG_NEEDSUPDATE) == 0) {
         BRPeerSetNeedsFilterUpdate(manager->downloadPeer, 1);
         manager->downloadPeer->flags |= PEER_FLAG_NEEDSUPDATE;
         peer_log(manager->downloadPeer, "filter update needed, waiting for pong");
+
+        if (manager->lastHeader) { // headers-first sync, blocks from every peer were filtered with the old filter
+            for (size_t i = array_count(manager->connectedPeers); i > 0; i--) {
+                BRPeer *p = manager->connectedPeers[i - 1];
+
+                if ((p->flags & PEER_FLAG_FILTERED) == 0) continue;
+                BRPeerSetNeedsFilterUpdate(p, 1);
+                p->flags |= PEER_FLAG_NEEDSUPDATE;
+            }
+
+            _BRPeerManagerDiscardSyncBlocks(manager);
+        }
+
         info = calloc(1, sizeof(*info));
         assert(info != NULL);
         info->peer = manager->downloadPeer;
@@ -440,6 +1159,65 @@ static void _BRPeerManagerUpdateFilter(BRPeerManager *manager)
     }
 }
 
+// inserts the outpoints of tx outputs paying to the wallet into the bloom filter, and if sendToPeers is true, also sends
+// them with filteradd to every peer the filter was loaded on
+static void _BRPeerManagerAddTxOutpoints(BRPeerManager *manager, const BRTransaction *tx, int sendToPeers)
+{
+    uint8_t o[sizeof(UInt256) + sizeof(uint32_t)];
+    BRAddress addr;
+
+    for (size_t i = 0; i < tx->outCount; i++) {
+        if (! BRTxOutputAddress(&tx->outputs[i], addr.s, sizeof(addr.s), manager->params->addrParams) ||
+            ! BRWalletContainsAddress(manager->wallet, addr.s)) continue;
+        UInt256Set(o, tx->txHash);
+        UInt32SetLE(&o[sizeof(UInt256)], (uint32_t)i);
+        BRBloomFilterInsertData(manager->bloomFilter, o, sizeof(o));
+
+        for (size_t j = array_count(manager->connectedPeers); sendToPeers && j > 0; j--) {
+            BRPeer *p = manager->connectedPeers[j - 1];
+
+            if (BRPeerConnectStatus(p) != BRPeerStatusConnected || (p->flags & PEER_FLAG_FILTERED) == 0) continue;
+            BRPeerSendFilteradd(p, o, sizeof(o));
+        }
+    }
+}
+
+// adds newly generated wallet addresses to the bloom filter already loaded on peers, only rebuilding and reloading
+// the whole filter once the added addresses push its estimated false positive rate too high
+static void _BRPeerManagerFilterAddAddrs(BRPeerManager *manager, const UInt160 hashes[], size_t hashCount)
+{
+    BRPeerCallbackInfo *info;
+
+    for (size_t i = 0; i < hashCount; i++) BRBloomFilterInsertData(manager->bloomFilter, hashes[i].u8, sizeof(*hashes));
+
+    if (BRBloomFilterFalsePositiveRate(manager->bloomFilter) > BLOOM_DEFAULT_FALSEPOSITIVE_RATE) {
+        BRBloomFilterFree(manager->bloomFilter);
+        manager->bloomFilter = NULL; // reset bloom filter so it's recreated with new wallet addresses
+        _BRPeerManagerUpdateFilter(manager);
+        return;
+    }
+
+    if (manager->downloadPeer) peer_log(manager->downloadPeer, "adding %zu new wallet addresses to filter", hashCount);
+    if (manager->lastHeader) _BRPeerManagerDiscardSyncBlocks(manager); // blocks were filtered without the addresses
+
+    for (size_t i = array_count(manager->connectedPeers); i > 0; i--) {
+        BRPeer *p = manager->connectedPeers[i - 1];
+
+        if (BRPeerConnectStatus(p) != BRPeerStatusConnected || (p->flags & PEER_FLAG_FILTERED) == 0) continue;
+        for (size_t j = 0; j < hashCount; j++) BRPeerSendFilteradd(p, hashes[j].u8, sizeof(*hashes));
+
+        // as with a full reload, blocks already requested were filtered without the new addresses, so ignore blocks
+        // from peer until it answers a ping, after which they're requested again
+        BRPeerSetNeedsFilterUpdate(p, 1);
+        p->flags |= PEER_FLAG_NEEDSUPDATE;
+        info = calloc(1, sizeof(*info));
+        assert(info != NULL);
+        info->peer = p;
+        info->manager = manager;
+        BRPeerSendPing(p, info, _updateFilterLoadDone);
+    }
+}
+
 // unconfirmed transactions that aren't in the mempools of any of connected peers have likely dropped off the network
 static void _requestUnrelayedTxGetdataDone(void *info, int success)
 {
@@ -447,9 +1225,10 @@ static void _requestUnrelayedTxGetdataDone(void *info, int success)
     BRPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
     int isPublishing;
     size_t count = 0;
+    uint32_t lastHeight;
 
     free(info);
-    pthread_mutex_lock(&manager->lock);
+    _BRPeerManagerLock(manager, BRPeerManagerLockChain);
     if (success) peer->flags |= PEER_FLAG_SYNCED;
     
     for (size_t i = array_count(manager->connectedPeers); i > 0; i--) {
@@ -460,6 +1239,9 @@ static void _requestUnrelayedTxGetdataDone(void *info, int success)
         break;
     }
 
+    lastHeight = manager->lastBlock->height;
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
+
     // don't remove transactions until we're connected to maxConnectCount peers, and all peers have finished
     // relaying their mempools
     if (count >= manager->maxConnectCount) {
@@ -472,26 +1254,28 @@ static void _requestUnrelayedTxGetdataDone(void *info, int success)
         for (size_t i = txCount; i > 0; i--) {
             hash = tx[i - 1]->txHash;
             isPublishing = 0;
+            _BRPeerManagerLock(manager, BRPeerManagerLockPublish);
             
             for (size_t j = array_count(manager->publishedTx); ! isPublishing && j > 0; j--) {
                 if (BRTransactionEq(manager->publishedTx[j - 1].tx, tx[i - 1]) &&
                     manager->publishedTx[j - 1].callback != NULL) isPublishing = 1;
             }
             
-            if (! isPublishing && _BRTxPeerListCount(manager->txRelays, hash) == 0 &&
-                _BRTxPeerListCount(manager->txRequests, hash) == 0) {
-                peer_log(peer, "removing tx unconfirmed at: %d, txHash: %s", manager->lastBlock->height, u256hex(hash));
+            _BRPeerManagerUnlock(manager, BRPeerManagerLockPublish);
+            
+            if (! isPublishing && _BRPeerManagerTxPeerCount(manager, manager->txRelays, hash) == 0 &&
+                _BRPeerManagerTxPeerCount(manager, manager->txRequests, hash) == 0) {
+                _peer_log("BPM: removing tx unconfirmed at: %d, txHash: %s\n", lastHeight, u256hex(hash));
                 assert(tx[i - 1]->blockHeight == TX_UNCONFIRMED);
                 BRWalletRemoveTransaction(manager->wallet, hash);
             }
-            else if (! isPublishing && _BRTxPeerListCount(manager->txRelays, hash) < manager->maxConnectCount) {
+            else if (! isPublishing &&
+                     _BRPeerManagerTxPeerCount(manager, manager->txRelays, hash) < manager->maxConnectCount) {
                 // set timestamp 0 to mark as unverified
                 BRWalletUpdateTransactions(manager->wallet, &hash, 1, TX_UNCONFIRMED, 0);
             }
         }
     }
-
-    pthread_mutex_unlock(&manager->lock);
 }
 
 static void _BRPeerManagerRequestUnrelayedTx(BRPeerManager *manager, BRPeer *peer)
@@ -503,13 +1287,17 @@ static void _BRPeerManagerRequestUnrelayedTx(BRPeerManager *manager, BRPeer *pee
     
     txCount = BRWalletTxUnconfirmedBefore(manager->wallet, tx, txCount, TX_UNCONFIRMED);
     
+    _BRPeerManagerLock(manager, BRPeerManagerLockTxRelay);
+    
     for (size_t i = 0; i < txCount; i++) {
-        if (! _BRTxPeerListHasPeer(manager->txRelays, tx[i]->txHash, peer) &&
-            ! _BRTxPeerListHasPeer(manager->txRequests, tx[i]->txHash, peer)) {
+        if (! BRTxPeerMapHasPeer(manager->txRelays, tx[i]->txHash, peer) &&
+            ! BRTxPeerMapHasPeer(manager->txRequests, tx[i]->txHash, peer)) {
             txHashes[hashCount++] = tx[i]->txHash;
-            _BRTxPeerListAddPeer(&manager->txRequests, tx[i]->txHash, peer);
+            BRTxPeerMapAddPeer(manager->txRequests, tx[i]->txHash, peer);
         }
     }
+    
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockTxRelay);
 
     if (hashCount > 0) {
         BRPeerSendGetdata(peer, txHashes, hashCount, NULL, 0);
@@ -527,6 +1315,8 @@ static void _BRPeerManagerRequestUnrelayedTx(BRPeerManager *manager, BRPeer *pee
 
 static void _BRPeerManagerPublishPendingTx(BRPeerManager *manager, BRPeer *peer)
 {
+    _BRPeerManagerLock(manager, BRPeerManagerLockPublish);
+    
     for (size_t i = array_count(manager->publishedTx); i > 0; i--) {
         if (manager->publishedTx[i - 1].callback == NULL) continue;
         BRPeerScheduleDisconnect(peer, PROTOCOL_TIMEOUT); // schedule publish timeout
@@ -534,6 +1324,16 @@ static void _BRPeerManagerPublishPendingTx(BRPeerManager *manager, BRPeer *peer)
     }
     
     BRPeerSendInv(peer, manager->publishedTxHashes, array_count(manager->publishedTxHashes));
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockPublish);
+}
+
+// requests peer's mempool, along with any published tx it doesn't already have
+static void _BRPeerManagerSendMempool(BRPeerManager *manager, BRPeer *peer, void *info,
+                                      void (*callback)(void *info, int success))
+{
+    _BRPeerManagerLock(manager, BRPeerManagerLockPublish);
+    BRPeerSendMempool(peer, manager->publishedTxHashes, array_count(manager->publishedTxHashes), info, callback);
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockPublish);
 }
 
 static void _mempoolDone(void *info, int success)
@@ -546,7 +1346,7 @@ static void _mempoolDone(void *info, int success)
     
     if (success) {
         peer_log(peer, "mempool request finished");
-        pthread_mutex_lock(&manager->lock);
+        _BRPeerManagerLock(manager, BRPeerManagerLockChain);
         if (manager->syncStartHeight > 0) {
             peer_log(peer, "sync succeeded");
             syncFinished = 1;
@@ -555,9 +1355,9 @@ static void _mempoolDone(void *info, int success)
 
         _BRPeerManagerRequestUnrelayedTx(manager, peer);
         BRPeerSendGetaddr(peer); // request a list of other bitcoin peers
-        pthread_mutex_unlock(&manager->lock);
+        _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
         if (manager->txStatusUpdate) manager->txStatusUpdate(manager->info);
-        if (syncFinished && manager->syncStopped) manager->syncStopped(manager->info, 0);
+        if (syncFinished) _BRPeerManagerQueueJob(manager, BRPeerManagerJobSyncStopped, 0, NULL, NULL, 0);
     }
     else peer_log(peer, "mempool request failed");
 }
@@ -567,12 +1367,11 @@ static void _loadBloomFilterDone(void *info, int success)
     BRPeer *peer = ((BRPeerCallbackInfo *)info)->peer;
     BRPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
 
-    pthread_mutex_lock(&manager->lock);
+    _BRPeerManagerLock(manager, BRPeerManagerLockChain);
     
     if (success) {
-        BRPeerSendMempool(peer, manager->publishedTxHashes, array_count(manager->publishedTxHashes), info,
-                          _mempoolDone);
-        pthread_mutex_unlock(&manager->lock);
+        _BRPeerManagerSendMempool(manager, peer, info, _mempoolDone);
+        _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
     }
     else {
         free(info);
@@ -580,10 +1379,10 @@ static void _loadBloomFilterDone(void *info, int success)
         if (peer == manager->downloadPeer) {
             peer_log(peer, "sync succeeded");
             _BRPeerManagerSyncStopped(manager);
-            pthread_mutex_unlock(&manager->lock);
-            if (manager->syncStopped) manager->syncStopped(manager->info, 0);
+            _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
+            _BRPeerManagerQueueJob(manager, BRPeerManagerJobSyncStopped, 0, NULL, NULL, 0);
         }
-        else pthread_mutex_unlock(&manager->lock);
+        else _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
     }
 }
 
@@ -600,13 +1399,16 @@ static void _BRPeerManagerLoadMempools(BRPeerManager *manager)
         info->peer = peer;
         info->manager = manager;
         
-        if (peer != manager->downloadPeer || manager->fpRate > BLOOM_REDUCED_FALSEPOSITIVE_RATE*5.0) {
+        if (manager->syncMode == BRSyncModeCompactFilter) { // without a bloom filter, peers would send their whole mempool
+            _BRPeerManagerPublishPendingTx(manager, peer);
+            BRPeerSendPing(peer, info, _mempoolDone);
+        }
+        else if (peer != manager->downloadPeer || manager->fpRate > BLOOM_REDUCED_FALSEPOSITIVE_RATE*5.0) {
             _BRPeerManagerLoadBloomFilter(manager, peer);
             _BRPeerManagerPublishPendingTx(manager, peer);
             BRPeerSendPing(peer, info, _loadBloomFilterDone); // load mempool after updating bloomfilter
         }
-        else BRPeerSendMempool(peer, manager->publishedTxHashes, array_count(manager->publishedTxHashes), info,
-                               _mempoolDone);
+        else _BRPeerManagerSendMempool(manager, peer, info, _mempoolDone);
     }
 }
 
@@ -649,7 +1451,7 @@ static void *_findPeersThreadRoutine(void *arg)
     pthread_cleanup_push(manager->threadCleanup, manager->info);
     addrList = _addressLookup(((BRFindPeersInfo *)arg)->hostname);
     free(arg);
-    pthread_mutex_lock(&manager->lock);
+    _BRPeerManagerLock(manager, BRPeerManagerLockPeers);
     
     for (addr = addrList; addr && ! UInt128IsZero(*addr); addr++) {
         age = 24*60*60 + BRRand(2*24*60*60); // add between 1 and 3 days
@@ -657,13 +1459,13 @@ static void *_findPeersThreadRoutine(void *arg)
     }
 
     manager->dnsThreadCount--;
-    pthread_mutex_unlock(&manager->lock);
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockPeers);
     if (addrList) free(addrList);
     pthread_cleanup_pop(1);
     return NULL;
 }
 
-// DNS peer discovery
+// DNS peer discovery (call with manager->lock held, peersLock is taken here)
 static void _BRPeerManagerFindPeers(BRPeerManager *manager)
 {
     uint64_t services = SERVICES_NODE_NETWORK | SERVICES_NODE_BLOOM | manager->params->services;
@@ -674,6 +1476,8 @@ static void _BRPeerManagerFindPeers(BRPeerManager *manager)
     UInt128 *addr, *addrList;
     BRFindPeersInfo *info;
     
+    _BRPeerManagerLock(manager, BRPeerManagerLockPeers);
+
     if (! UInt128IsZero(manager->fixedPeer.address)) {
         array_set_count(manager->peers, 1);
         manager->peers[0] = manager->fixedPeer;
@@ -701,13 +1505,17 @@ static void _BRPeerManagerFindPeers(BRPeerManager *manager)
         ts.tv_nsec = 1;
 
         do {
-            pthread_mutex_unlock(&manager->lock);
+            _BRPeerManagerUnlock(manager, BRPeerManagerLockPeers);
+            _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
             nanosleep(&ts, NULL); // pthread_yield() isn't POSIX standard :(
-            pthread_mutex_lock(&manager->lock);
+            _BRPeerManagerLock(manager, BRPeerManagerLockChain);
+            _BRPeerManagerLock(manager, BRPeerManagerLockPeers);
         } while (manager->dnsThreadCount > 0 && array_count(manager->peers) < PEER_MAX_CONNECTIONS);
     
-        qsort(manager->peers, array_count(manager->peers), sizeof(*manager->peers), _peerTimestampCompare);
+        BRPeerScoresSort(manager->scores, manager->peers, array_count(manager->peers));
     }
+
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockPeers);
 }
 
 static void _peerConnected(void *info)
@@ -717,8 +1525,9 @@ static void _peerConnected(void *info)
     BRPeerCallbackInfo *peerInfo;
     time_t now = time(NULL);
     
-    pthread_mutex_lock(&manager->lock);
+    _BRPeerManagerLock(manager, BRPeerManagerLockChain);
     if (peer->timestamp > now + 2*60*60 || peer->timestamp < now - 2*60*60) peer->timestamp = (uint64_t) now; // sanity check
+    _BRPeerManagerScorePing(manager, peer); // verack time is the first ping time sample
     
     // TODO: XXX does this work with 0.11 pruned nodes?
     if ((peer->services & manager->params->services) != manager->params->services) {
@@ -733,7 +1542,13 @@ static void _peerConnected(void *info)
         peer_log(peer, "node isn't synced");
         BRPeerDisconnect(peer);
     }
-    else if (BRPeerVersion(peer) >= 70011 && (peer->services & SERVICES_NODE_BLOOM) != SERVICES_NODE_BLOOM) {
+    else if (manager->syncMode == BRSyncModeCompactFilter &&
+             (peer->services & SERVICES_NODE_COMPACT_FILTERS) != SERVICES_NODE_COMPACT_FILTERS) {
+        peer_log(peer, "node doesn't serve compact block filters");
+        BRPeerDisconnect(peer);
+    }
+    else if (manager->syncMode == BRSyncModeBloomFilter && BRPeerVersion(peer) >= 70011 &&
+             (peer->services & SERVICES_NODE_BLOOM) != SERVICES_NODE_BLOOM) {
         peer_log(peer, "node doesn't support SPV mode");
         BRPeerDisconnect(peer);
     }
@@ -742,24 +1557,29 @@ static void _peerConnected(void *info)
               manager->lastBlock->height >= BRPeerLastBlock(peer))) {
         if (manager->lastBlock->height >= BRPeerLastBlock(peer)) { // only load bloom filter if we're done syncing
             manager->connectFailureCount = 0; // also reset connect failure count if we're already synced
-            _BRPeerManagerLoadBloomFilter(manager, peer);
+            _BRPeerManagerLoadFilter(manager, peer);
             _BRPeerManagerPublishPendingTx(manager, peer);
             peerInfo = calloc(1, sizeof(*peerInfo));
             assert(peerInfo != NULL);
             peerInfo->peer = peer;
             peerInfo->manager = manager;
-            BRPeerSendPing(peer, peerInfo, _loadBloomFilterDone);
+            BRPeerSendPing(peer, peerInfo,
+                           (manager->syncMode == BRSyncModeCompactFilter) ? _mempoolDone : _loadBloomFilterDone);
+        }
+        else if (manager->headersFirst) { // help download filtered blocks during a headers-first sync
+            _BRPeerManagerLoadFilter(manager, peer);
+            _BRPeerManagerRequestSyncRanges(manager);
         }
     }
-    else { // select the peer with the lowest ping time to download the chain from if we're behind
+    else { // select the peer with the lowest cost to download the chain from if we're behind
         // BUG: XXX a malicious peer can report a higher lastblock to make us select them as the download peer, if
         // two peers agree on lastblock, use one of those two instead
         for (size_t i = array_count(manager->connectedPeers); i > 0; i--) {
             BRPeer *p = manager->connectedPeers[i - 1];
             
             if (BRPeerConnectStatus(p) != BRPeerStatusConnected) continue;
-            if ((BRPeerPingTime(p) < BRPeerPingTime(peer) && BRPeerLastBlock(p) >= BRPeerLastBlock(peer)) ||
-                BRPeerLastBlock(p) > BRPeerLastBlock(peer)) peer = p;
+            if ((_BRPeerManagerPeerCost(manager, p) < _BRPeerManagerPeerCost(manager, peer) &&
+                 BRPeerLastBlock(p) >= BRPeerLastBlock(peer)) || BRPeerLastBlock(p) > BRPeerLastBlock(peer)) peer = p;
         }
         
         if (manager->downloadPeer) {
@@ -770,11 +1590,19 @@ static void _peerConnected(void *info)
         manager->downloadPeer = peer;
         manager->isConnected = 1;
         manager->estimatedHeight = BRPeerLastBlock(peer);
-        _BRPeerManagerLoadBloomFilter(manager, peer);
+        _BRPeerManagerLoadFilter(manager, peer);
         BRPeerSetCurrentBlockHeight(peer, manager->lastBlock->height);
         _BRPeerManagerPublishPendingTx(manager, peer);
             
-        if (manager->lastBlock->height < BRPeerLastBlock(peer)) { // start blockchain sync
+        if (manager->lastBlock->height < BRPeerLastBlock(peer) && manager->headersFirst) { // headers-first sync
+            // request the whole header chain from the download peer, filtered blocks are then requested in ranges
+            // from every connected peer as headers arrive
+            BRPeerScheduleDisconnect(peer, PROTOCOL_TIMEOUT); // schedule sync timeout
+            BRPeerSetHeadersFirst(peer, 1);
+            _BRPeerManagerRequestHeaders(manager, peer);
+            _BRPeerManagerRequestSyncRanges(manager);
+        }
+        else if (manager->lastBlock->height < BRPeerLastBlock(peer)) { // start blockchain sync
             UInt256 locators[_BRPeerManagerBlockLocators(manager, NULL, 0)];
             size_t count = _BRPeerManagerBlockLocators(manager, locators, sizeof(locators)/sizeof(*locators));
             
@@ -793,30 +1621,32 @@ static void _peerConnected(void *info)
         }
     }
 
-    pthread_mutex_unlock(&manager->lock);
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
 }
 
 static void _peerDisconnected(void *info, int error)
 {
     BRPeer *peer = ((BRPeerCallbackInfo *)info)->peer;
     BRPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
-    BRTxPeerList *peerList;
     int willSave = 0, willReconnect = 0, txError = 0;
     size_t txCount = 0;
     
     //free(info);
-    pthread_mutex_lock(&manager->lock);
+    _BRPeerManagerLock(manager, BRPeerManagerLockChain);
+    _BRPeerManagerScorePing(manager, peer);
 
-    BRPublishedTx pubTx[array_count(manager->publishedTx)];
-    
     if (error == EPROTO) { // if it's protocol error, the peer isn't following standard policy
         _BRPeerManagerPeerMisbehavin(manager, peer);
     }
     else if (error) { // timeout or some non-protocol related network error
+        _BRPeerManagerLock(manager, BRPeerManagerLockPeers);
+        if (error == ETIMEDOUT) BRPeerScoresAddStall(manager->scores, peer, _BRPeerManagerTime());
+
         for (size_t i = array_count(manager->peers); i > 0; i--) {
             if (BRPeerEq(&manager->peers[i - 1], peer)) array_rm(manager->peers, i - 1);
         }
         
+        _BRPeerManagerUnlock(manager, BRPeerManagerLockPeers);
         manager->connectFailureCount++;
         
         // if it's a timeout and there's pending tx publish callbacks, the tx publish timed out
@@ -825,32 +1655,67 @@ static void _peerDisconnected(void *info, int error)
                                    array_count(manager->connectedPeers) == 1)) txError = ETIMEDOUT;
     }
     
-    for (size_t i = array_count(manager->txRelays); i > 0; i--) {
-        peerList = &manager->txRelays[i - 1];
-
-        for (size_t j = array_count(peerList->peers); j > 0; j--) {
-            if (BRPeerEq(&peerList->peers[j - 1], peer)) array_rm(peerList->peers, j - 1);
-        }
-    }
+    _BRPeerManagerLock(manager, BRPeerManagerLockTxRelay);
+    BRTxPeerMapRemovePeerAll(manager->txRelays, peer);
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockTxRelay);
 
     if (peer == manager->downloadPeer) { // download peer disconnected
         manager->isConnected = 0;
         manager->downloadPeer = NULL;
         if (manager->connectFailureCount > MAX_CONNECT_FAILURES) manager->connectFailureCount = MAX_CONNECT_FAILURES;
+
+        // during a headers-first sync, carry on with a peer that is already downloading filtered blocks
+        for (size_t i = array_count(manager->connectedPeers); manager->lastHeader && i > 0; i--) {
+            BRPeer *p = manager->connectedPeers[i - 1];
+
+            if (p == peer || BRPeerConnectStatus(p) != BRPeerStatusConnected ||
+                (p->flags & PEER_FLAG_FILTERED) == 0) continue;
+            if (_BRPeerManagerBetterDownloadPeer(manager, p, manager->downloadPeer, manager->lastHeader->height)) {
+                manager->downloadPeer = p;
+            }
+        }
+
+        if (manager->downloadPeer) {
+            peer_log(manager->downloadPeer, "continuing headers-first sync with new download peer");
+            manager->isConnected = 1;
+            BRPeerSetCurrentBlockHeight(manager->downloadPeer, manager->lastBlock->height);
+            BRPeerSetHeadersFirst(manager->downloadPeer, 1);
+            BRPeerScheduleDisconnect(manager->downloadPeer, PROTOCOL_TIMEOUT); // schedule sync timeout
+            _BRPeerManagerRequestHeaders(manager, manager->downloadPeer);
+        }
     }
 
     if (! manager->isConnected && manager->connectFailureCount == MAX_CONNECT_FAILURES) {
         _BRPeerManagerSyncStopped(manager);
         
         // clear out stored peers so we get a fresh list from DNS on next connect attempt
+        _BRPeerManagerLock(manager, BRPeerManagerLockPeers);
         array_clear(manager->peers);
+        _BRPeerManagerUnlock(manager, BRPeerManagerLockPeers);
         txError = ENOTCONN; // trigger any pending tx publish callbacks
         willSave = 1;
         peer_log(peer, "sync failed");
     }
     else if (manager->connectFailureCount < MAX_CONNECT_FAILURES) willReconnect = 1;
     
+    for (size_t i = array_count(manager->connectedPeers); i > 0; i--) {
+        if (manager->connectedPeers[i - 1] != peer) continue;
+        array_rm(manager->connectedPeers, i - 1);
+        break;
+    }
+
+    if (manager->lastHeader) { // hand any filtered block ranges requested from peer to the remaining peers
+        _BRPeerManagerReleaseSyncRanges(manager, peer);
+        _BRPeerManagerRequestSyncRanges(manager);
+    }
+
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
+    
     if (txError) {
+        _BRPeerManagerLock(manager, BRPeerManagerLockPublish);
+
+        BRPublishedTx pubTx[array_count(manager->publishedTx)];
+
         for (size_t i = array_count(manager->publishedTx); i > 0; i--) {
             if (manager->publishedTx[i - 1].callback == NULL) continue;
             peer_log(peer, "transaction canceled: %s", strerror(txError));
@@ -858,24 +1723,19 @@ static void _peerDisconnected(void *info, int error)
             manager->publishedTx[i - 1].callback = NULL;
             manager->publishedTx[i - 1].info = NULL;
         }
-    }
-    
-    for (size_t i = array_count(manager->connectedPeers); i > 0; i--) {
-        if (manager->connectedPeers[i - 1] != peer) continue;
-        array_rm(manager->connectedPeers, i - 1);
-        break;
-    }
 
-    BRPeerFree(peer);
-    pthread_mutex_unlock(&manager->lock);
-    
-    for (size_t i = 0; i < txCount; i++) {
-        pubTx[i].callback(pubTx[i].info, txError);
+        _BRPeerManagerUnlock(manager, BRPeerManagerLockPublish);
+
+        for (size_t i = 0; i < txCount; i++) {
+            pubTx[i].callback(pubTx[i].info, txError);
+        }
     }
     
-    if (willSave && manager->savePeers) manager->savePeers(manager->info, 1, NULL, 0);
-    if (willSave && manager->syncStopped) manager->syncStopped(manager->info, error);
-    if (willReconnect) BRPeerManagerConnect(manager); // try connecting to another peer
+    BRPeerFree(peer); // peer is no longer in connectedPeers, so nothing else can reach it
+
+    if (willSave) _BRPeerManagerQueueJob(manager, BRPeerManagerJobSavePeers, 1, NULL, NULL, 0);
+    if (willSave) _BRPeerManagerQueueJob(manager, BRPeerManagerJobSyncStopped, error, NULL, NULL, 0);
+    if (willReconnect) _BRPeerManagerQueueJob(manager, BRPeerManagerJobReconnect, 0, NULL, NULL, 0); // try another peer
     if (manager->txStatusUpdate) manager->txStatusUpdate(manager->info);
 }
 
@@ -885,11 +1745,11 @@ static void _peerRelayedPeers(void *info, const BRPeer peers[], size_t peersCoun
     BRPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
     time_t now = time(NULL);
 
-    pthread_mutex_lock(&manager->lock);
+    _BRPeerManagerLock(manager, BRPeerManagerLockPeers);
     peer_log(peer, "relayed %zu peer(s)", peersCount);
 
     array_add_array(manager->peers, peers, peersCount);
-    qsort(manager->peers, array_count(manager->peers), sizeof(*manager->peers), _peerTimestampCompare);
+    BRPeerScoresSort(manager->scores, manager->peers, array_count(manager->peers));
 
     // limit total to 2500 peers
     if (array_count(manager->peers) > 2500) array_set_count(manager->peers, 2500);
@@ -902,42 +1762,52 @@ static void _peerRelayedPeers(void *info, const BRPeer peers[], size_t peersCoun
     BRPeer save[peersCount];
 
     for (size_t i = 0; i < peersCount; i++) save[i] = manager->peers[i];
-    pthread_mutex_unlock(&manager->lock);
+    BRPeerScoresStamp(manager->scores, save, peersCount); // so the saved order survives a store that doesn't keep it
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockPeers);
     
     // peer relaying is complete when we receive <1000
-    if (peersCount > 1 && peersCount < 1000 &&
-        manager->savePeers) manager->savePeers(manager->info, 1, save, peersCount);
+    if (peersCount > 1 && peersCount < 1000) _BRPeerManagerQueueJob(manager, BRPeerManagerJobSavePeers, 1, NULL, save,
+                                                                     peersCount);
 }
 
 static void _peerRelayedTx(void *info, BRTransaction *tx)
 {
     BRPeer *peer = ((BRPeerCallbackInfo *)info)->peer;
     BRPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
+    BRAddress addrs[SEQUENCE_GAP_LIMIT_EXTERNAL + SEQUENCE_GAP_LIMIT_INTERNAL];
     void *txInfo = NULL;
     void (*txCallback)(void *, int) = NULL;
-    int isWalletTx = 0, hasPendingCallbacks = 0;
+    int isWalletTx = 0, isPublished = 0, hasPendingCallbacks = 0, isSyncing, isDownloadPeer;
     size_t relayCount = 0;
     
-    pthread_mutex_lock(&manager->lock);
+    // snapshot the sync state, the wallet has its own lock so none of the wallet calls below need manager->lock
+    _BRPeerManagerLock(manager, BRPeerManagerLockChain);
     peer_log(peer, "relayed tx: %s", u256hex(tx->txHash));
-    
+    isSyncing = (manager->syncStartHeight > 0);
+    isDownloadPeer = (peer == manager->downloadPeer);
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
+    _BRPeerManagerLock(manager, BRPeerManagerLockPublish);
+
     for (size_t i = array_count(manager->publishedTx); i > 0; i--) { // see if tx is in list of published tx
         if (UInt256Eq(manager->publishedTxHashes[i - 1], tx->txHash)) {
             txInfo = manager->publishedTx[i - 1].info;
             txCallback = manager->publishedTx[i - 1].callback;
             manager->publishedTx[i - 1].info = NULL;
             manager->publishedTx[i - 1].callback = NULL;
-            relayCount = _BRTxPeerListAddPeer(&manager->txRelays, tx->txHash, peer);
+            isPublished = 1;
         }
         else if (manager->publishedTx[i - 1].callback != NULL) hasPendingCallbacks = 1;
     }
 
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockPublish);
+    if (isPublished) relayCount = _BRPeerManagerAddTxPeer(manager, manager->txRelays, tx->txHash, peer);
+
     // cancel tx publish timeout if no publish callbacks are pending, and syncing is done or this is not downloadPeer
-    if (! hasPendingCallbacks && (manager->syncStartHeight == 0 || peer != manager->downloadPeer)) {
+    if (! hasPendingCallbacks && (! isSyncing || ! isDownloadPeer)) {
         BRPeerScheduleDisconnect(peer, -1); // cancel publish tx timeout
     }
 
-    if (manager->syncStartHeight == 0 || BRWalletContainsTransaction(manager->wallet, tx)) {
+    if (! isSyncing || BRWalletContainsTransaction(manager->wallet, tx)) {
         isWalletTx = BRWalletRegisterTransaction(manager->wallet, tx);
         if (isWalletTx) tx = BRWalletTransactionForHash(manager->wallet, tx->txHash);
     }
@@ -948,38 +1818,49 @@ static void _peerRelayedTx(void *info, BRTransaction *tx)
     
     if (tx && isWalletTx) {
         // reschedule sync timeout
-        if (manager->syncStartHeight > 0 && peer == manager->downloadPeer) {
-            BRPeerScheduleDisconnect(peer, PROTOCOL_TIMEOUT);
-        }
+        if (isSyncing && isDownloadPeer) BRPeerScheduleDisconnect(peer, PROTOCOL_TIMEOUT);
         
         if (BRWalletAmountSentByTx(manager->wallet, tx) > 0 && BRWalletTransactionIsValid(manager->wallet, tx)) {
+            _BRPeerManagerLock(manager, BRPeerManagerLockPublish);
             _BRPeerManagerAddTxToPublishList(manager, tx, NULL, NULL); // add valid send tx to mempool
+            _BRPeerManagerUnlock(manager, BRPeerManagerLockPublish);
         }
 
         // keep track of how many peers have or relay a tx, this indicates how likely the tx is to confirm
         // (we only need to track this after syncing is complete)
-        if (manager->syncStartHeight == 0) relayCount = _BRTxPeerListAddPeer(&manager->txRelays, tx->txHash, peer);
-        
-        _BRTxPeerListRemovePeer(manager->txRequests, tx->txHash, peer);
+        if (! isSyncing) relayCount = _BRPeerManagerAddTxPeer(manager, manager->txRelays, tx->txHash, peer);
+        _BRPeerManagerRemoveTxPeer(manager, manager->txRequests, tx->txHash, peer);
         
+        // the transaction likely consumed one or more wallet addresses, so make sure at least the next <gap limit>
+        // unused addresses are generated before checking them against the filter
+        BRWalletUnusedAddrs(manager->wallet, addrs, SEQUENCE_GAP_LIMIT_EXTERNAL, SEQUENCE_EXTERNAL_CHAIN);
+        BRWalletUnusedAddrs(manager->wallet, addrs + SEQUENCE_GAP_LIMIT_EXTERNAL, SEQUENCE_GAP_LIMIT_INTERNAL,
+                            SEQUENCE_INTERNAL_CHAIN);
+        _BRPeerManagerLock(manager, BRPeerManagerLockChain);
+
         if (manager->bloomFilter != NULL) { // check if bloom filter is already being updated
-            BRAddress addrs[SEQUENCE_GAP_LIMIT_EXTERNAL + SEQUENCE_GAP_LIMIT_INTERNAL];
-            UInt160 hash;
+            UInt160 hash, hashes[SEQUENCE_GAP_LIMIT_EXTERNAL + SEQUENCE_GAP_LIMIT_INTERNAL];
+            size_t hashCount = 0;
 
-            // the transaction likely consumed one or more wallet addresses, so check that at least the next <gap limit>
-            // unused addresses are still matched by the bloom filter
-            BRWalletUnusedAddrs(manager->wallet, addrs, SEQUENCE_GAP_LIMIT_EXTERNAL, SEQUENCE_EXTERNAL_CHAIN);
-            BRWalletUnusedAddrs(manager->wallet, addrs + SEQUENCE_GAP_LIMIT_EXTERNAL, SEQUENCE_GAP_LIMIT_INTERNAL, SEQUENCE_INTERNAL_CHAIN);
+            // peers add the outpoints of matched transactions to their filters (BLOOM_UPDATE_ALL), so do the same here
+            // to keep the estimated false positive rate accurate
+            _BRPeerManagerAddTxOutpoints(manager, tx, 0);
 
             for (size_t i = 0; i < SEQUENCE_GAP_LIMIT_EXTERNAL + SEQUENCE_GAP_LIMIT_INTERNAL; i++) {
                 if (! BRAddressHash160(&hash, manager->params->addrParams, addrs[i].s) ||
                     BRBloomFilterContainsData(manager->bloomFilter, hash.u8, sizeof(hash))) continue;
-                if (manager->bloomFilter) BRBloomFilterFree(manager->bloomFilter);
-                manager->bloomFilter = NULL; // reset bloom filter so it's recreated with new wallet addresses
-                _BRPeerManagerUpdateFilter(manager);
-                break;
+                hashes[hashCount++] = hash;
             }
+
+            if (hashCount > 0) _BRPeerManagerFilterAddAddrs(manager, hashes, hashCount);
         }
+        else if (manager->syncMode == BRSyncModeCompactFilter &&
+                 BRWalletAllAddrs(manager->wallet, NULL, 0) != manager->filterAddrCount) {
+            // any newly generated addresses mean the wallet scripts matched against filters are stale
+            _BRPeerManagerUpdateFilter(manager);
+        }
+
+        _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
     }
     
     // set timestamp when tx is verified
@@ -987,7 +1868,6 @@ static void _peerRelayedTx(void *info, BRTransaction *tx)
         BRWalletUpdateTransactions(manager->wallet, &tx->txHash, 1, TX_UNCONFIRMED, (uint32_t)time(NULL));
     }
     
-    pthread_mutex_unlock(&manager->lock);
     if (txCallback) txCallback(txInfo, 0);
 }
 
@@ -997,12 +1877,16 @@ static void _peerHasTx(void *info, UInt256 txHash)
     BRPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
     BRTransaction *tx;
     BRPublishedTx pubTx = { NULL, NULL, NULL };
-    int isWalletTx = 0, hasPendingCallbacks = 0;
+    int isWalletTx = 0, isPublished = 0, hasPendingCallbacks = 0, isSyncing, isDownloadPeer;
     size_t relayCount = 0;
     
-    pthread_mutex_lock(&manager->lock);
-    tx = BRWalletTransactionForHash(manager->wallet, txHash);
+    _BRPeerManagerLock(manager, BRPeerManagerLockChain);
     peer_log(peer, "has tx: %s", u256hex(txHash));
+    isSyncing = (manager->syncStartHeight > 0);
+    isDownloadPeer = (peer == manager->downloadPeer);
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
+    tx = BRWalletTransactionForHash(manager->wallet, txHash);
+    _BRPeerManagerLock(manager, BRPeerManagerLockPublish);
 
     for (size_t i = array_count(manager->publishedTx); i > 0; i--) { // see if tx is in list of published tx
         if (UInt256Eq(manager->publishedTxHashes[i - 1], txHash)) {
@@ -1010,13 +1894,16 @@ static void _peerHasTx(void *info, UInt256 txHash)
             if (! tx) tx = pubTx.tx;
             manager->publishedTx[i - 1].callback = NULL;
             manager->publishedTx[i - 1].info = NULL;
-            relayCount = _BRTxPeerListAddPeer(&manager->txRelays, txHash, peer);
+            isPublished = 1;
         }
         else if (manager->publishedTx[i - 1].callback != NULL) hasPendingCallbacks = 1;
     }
     
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockPublish);
+    if (isPublished) relayCount = _BRPeerManagerAddTxPeer(manager, manager->txRelays, txHash, peer);
+
     // cancel tx publish timeout if no publish callbacks are pending, and syncing is done or this is not downloadPeer
-    if (! hasPendingCallbacks && (manager->syncStartHeight == 0 || peer != manager->downloadPeer)) {
+    if (! hasPendingCallbacks && (! isSyncing || ! isDownloadPeer)) {
         BRPeerScheduleDisconnect(peer, -1); // cancel publish tx timeout
     }
 
@@ -1025,23 +1912,20 @@ static void _peerHasTx(void *info, UInt256 txHash)
         if (isWalletTx) tx = BRWalletTransactionForHash(manager->wallet, tx->txHash);
 
         // reschedule sync timeout
-        if (manager->syncStartHeight > 0 && peer == manager->downloadPeer && isWalletTx) {
-            BRPeerScheduleDisconnect(peer, PROTOCOL_TIMEOUT);
-        }
+        if (isSyncing && isDownloadPeer && isWalletTx) BRPeerScheduleDisconnect(peer, PROTOCOL_TIMEOUT);
         
         // keep track of how many peers have or relay a tx, this indicates how likely the tx is to confirm
         // (we only need to track this after syncing is complete)
-        if (manager->syncStartHeight == 0) relayCount = _BRTxPeerListAddPeer(&manager->txRelays, txHash, peer);
+        if (! isSyncing) relayCount = _BRPeerManagerAddTxPeer(manager, manager->txRelays, txHash, peer);
 
         // set timestamp when tx is verified
         if (relayCount >= manager->maxConnectCount && tx && tx->blockHeight == TX_UNCONFIRMED && tx->timestamp == 0) {
             BRWalletUpdateTransactions(manager->wallet, &txHash, 1, TX_UNCONFIRMED, (uint32_t)time(NULL));
         }
 
-        _BRTxPeerListRemovePeer(manager->txRequests, txHash, peer);
+        _BRPeerManagerRemoveTxPeer(manager, manager->txRequests, txHash, peer);
     }
     
-    pthread_mutex_unlock(&manager->lock);
     if (pubTx.callback) pubTx.callback(pubTx.info, 0);
 }
 
@@ -1051,13 +1935,14 @@ static void _peerRejectedTx(void *info, UInt256 txHash, uint8_t code)
     BRPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
     BRTransaction *tx, *t;
 
-    pthread_mutex_lock(&manager->lock);
+    _BRPeerManagerLock(manager, BRPeerManagerLockChain);
     peer_log(peer, "rejected tx: %s", u256hex(txHash));
     tx = BRWalletTransactionForHash(manager->wallet, txHash);
-    _BRTxPeerListRemovePeer(manager->txRequests, txHash, peer);
+    _BRPeerManagerRemoveTxPeer(manager, manager->txRequests, txHash, peer);
 
     if (tx) {
-        if (_BRTxPeerListRemovePeer(manager->txRelays, txHash, peer) && tx->blockHeight == TX_UNCONFIRMED) {
+        if (_BRPeerManagerRemoveTxPeer(manager, manager->txRelays, txHash, peer) &&
+            tx->blockHeight == TX_UNCONFIRMED) {
             // set timestamp 0 to mark tx as unverified
             BRWalletUpdateTransactions(manager->wallet, &txHash, 1, TX_UNCONFIRMED, 0);
         }
@@ -1075,44 +1960,70 @@ static void _peerRejectedTx(void *info, UInt256 txHash, uint8_t code)
         }
     }
 
-    pthread_mutex_unlock(&manager->lock);
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
     if (manager->txStatusUpdate) manager->txStatusUpdate(manager->info);
 }
 
+// frees blocks more than BLOCKS_DEPTH below lastBlock, except checkpoints, their headers are still in manager->chain
+static void _BRPeerManagerPruneBlocks(BRPeerManager *manager)
+{
+    BRMerkleBlock *b = manager->lastBlock;
+    UInt256 prevBlock;
+
+    for (uint32_t i = 0; b && i < BLOCKS_DEPTH; i++) b = BRSetGet(manager->blocks, &b->prevBlock);
+    if (b) prevBlock = b->prevBlock;
+
+    while (b) {
+        b = BRSetGet(manager->blocks, &prevBlock);
+        if (! b) break;
+        prevBlock = b->prevBlock;
+        if (BRSetContains(manager->checkpoints, b)) continue; // checkpoints are indexed by height
+        if (BRSetGet(manager->orphans, b) == b) BRSetRemove(manager->orphans, b);
+        if (manager->lastOrphan == b) manager->lastOrphan = NULL;
+        BRSetRemove(manager->blocks, b);
+        BRMerkleBlockFree(b);
+    }
+}
+
+// returns the main chain block at height, recreating it from manager->chain if it was pruned from manager->blocks, or
+// NULL if the header at height isn't known
+static BRMerkleBlock *_BRPeerManagerChainBlock(BRPeerManager *manager, uint32_t height)
+{
+    UInt256 hash = BRHeaderChainHash(manager->chain, height);
+    BRMerkleBlock header, *block = (UInt256IsZero(hash)) ? NULL : BRSetGet(manager->blocks, &hash);
+
+    if (! block && BRHeaderChainGet(manager->chain, height, &header)) {
+        block = BRMerkleBlockCopy(&header);
+        BRSetAdd(manager->blocks, block);
+    }
+
+    return block;
+}
+
 static int _BRPeerManagerVerifyBlock(BRPeerManager *manager, BRMerkleBlock *block, BRMerkleBlock *prev, BRPeer *peer)
 {
+    uint32_t transitionTime = 0;
     int r = 1;
 
     if (! prev || ! UInt256Eq(block->prevBlock, prev->blockHash) || block->height != prev->height + 1) r = 0;
 
     // check if we hit a difficulty transition, and find previous transition time
     if (r && (block->height % BLOCK_DIFFICULTY_INTERVAL) == 0) {
-        BRMerkleBlock *b = block;
-        UInt256 prevBlock;
-
-        for (uint32_t i = 0; b && i < BLOCK_DIFFICULTY_INTERVAL; i++) {
-            b = BRSetGet(manager->blocks, &b->prevBlock);
-        }
+        transitionTime = BRHeaderChainTransitionTime(manager->chain, block->height);
 
-        if (! b) {
+        if (transitionTime == 0) {
             peer_log(peer, "missing previous difficulty tansition, can't verify block: %s", u256hex(block->blockHash));
             r = 0;
         }
-        else prevBlock = b->prevBlock;
-
-        while (b) { // free up some memory
-            b = BRSetGet(manager->blocks, &prevBlock);
-            if (b) prevBlock = b->prevBlock;
 
-            if (b && (b->height % BLOCK_DIFFICULTY_INTERVAL) != 0) {
-                BRSetRemove(manager->blocks, b);
-                BRMerkleBlockFree(b);
-            }
-        }
+        _BRPeerManagerPruneBlocks(manager); // free up some memory
     }
 
-    // verify block difficulty
-    if (r && ! manager->params->verifyDifficulty(block, manager->blocks)) {
+    // verify block difficulty, on mainnet this only needs prev and the transition time, so the header chain is used
+    // instead of walking back through every block in the interval, other chains read the recent ancestors they need
+    // from the header chain too
+    if (r && ! ((manager->params == BRMainNetParams) ? BRMerkleBlockVerifyDifficulty(block, prev, transitionTime) :
+                manager->params->verifyDifficulty(block, manager->blocks, manager->chain))) {
         peer_log(peer, "relayed block with invalid difficulty target %x, blockHash: %s", block->target,
                  u256hex(block->blockHash));
         r = 0;
@@ -1141,7 +2052,8 @@ static void _peerRelayedBlockFailed (BRMerkleBlock *blockToFree, BRPeer *peer, c
     assert (0);
 }
 
-static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
+// filterChecked is true for a header-only block whose compact filter ruled out any wallet transactions
+static void _BRPeerManagerRelayedBlock(void *info, BRMerkleBlock *block, int filterChecked)
 {
     if (NULL == info || NULL == block) {
         _peerRelayedBlockFailed (block, NULL, "missed 'info' or 'block'");
@@ -1181,7 +2093,11 @@ static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
     assert(txHashes != NULL);
     txCount = BRMerkleBlockTxHashes(block, txHashes, txCount);
 
-    pthread_mutex_lock(&manager->lock);
+    for (i = 0; i < txCount; i++) { // wallet tx are not false-positives, look them up before taking manager->lock
+        if (! BRWalletTransactionForHash(manager->wallet, txHashes[i])) fpCount++;
+    }
+
+    _BRPeerManagerLock(manager, BRPeerManagerLockChain);
     prev = BRSetGet(manager->blocks, &block->prevBlock);
 
     if (prev) {
@@ -1190,11 +2106,7 @@ static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
     }
     
     // track the observed bloom filter false positive rate using a low pass filter to smooth out variance
-    if (peer == manager->downloadPeer && block->totalTx > 0) {
-        for (i = 0; i < txCount; i++) { // wallet tx are not false-positives
-            if (! BRWalletTransactionForHash(manager->wallet, txHashes[i])) fpCount++;
-        }
-        
+    if (peer == manager->downloadPeer && block->totalTx > 0 && manager->syncMode == BRSyncModeBloomFilter) {
         // moving average number of tx-per-block
         manager->averageTxPerBlock = manager->averageTxPerBlock*0.999 + block->totalTx*0.001;
         
@@ -1215,12 +2127,44 @@ static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
         }
     }
 
+    // in a headers-first sync, headers newer than one week before earliestKeyTime extend the header chain, as do any
+    // new blocks found on top of it
+    if (prev && ! filterChecked &&
+        ((block->totalTx == 0 && block->timestamp + 7*24*60*60 - 2*60*60 > manager->earliestKeyTime &&
+          manager->headersFirst && peer == manager->downloadPeer) ||
+         (manager->lastHeader && prev == manager->lastHeader))) {
+        if (! _BRPeerManagerVerifyBlock(manager, block, prev, peer)) { // header is invalid
+            peer_log(peer, "relayed invalid block header");
+            BRMerkleBlockFree(block);
+            block = NULL;
+            _BRPeerManagerPeerMisbehavin(manager, peer);
+        }
+        else if (! _BRPeerManagerAddSyncHeader(manager, block, prev)) { // already have it, or it's on another chain
+            BRMerkleBlockFree(block);
+            block = NULL;
+        }
+        else {
+            if ((block->height % 2000) == 0 || block->height >= BRPeerLastBlock(peer)) {
+                peer_log(peer, "adding header #%"PRIu32, block->height);
+            }
+
+            if (peer == manager->downloadPeer) {
+                BRPeerScheduleDisconnect(peer, PROTOCOL_TIMEOUT); // reschedule sync timeout
+                manager->connectFailureCount = 0; // reset failure count once we know our initial request didn't timeout
+            }
+
+            _BRPeerManagerRequestSyncRanges(manager);
+        }
+    }
     // ignore block headers that are newer than one week before earliestKeyTime (it's a header if it has 0 totalTx)
-    if (block->totalTx == 0 && block->timestamp + 7*24*60*60 - 2*60*60 > manager->earliestKeyTime) {
+    else if (! filterChecked && block->totalTx == 0 &&
+             block->timestamp + 7*24*60*60 - 2*60*60 > manager->earliestKeyTime) {
         BRMerkleBlockFree(block);
         block = NULL;
     }
-    else if (manager->bloomFilter == NULL) { // ingore potentially incomplete blocks when a filter update is pending
+    else if (manager->syncMode == BRSyncModeBloomFilter &&
+             (manager->bloomFilter == NULL || (peer->flags & PEER_FLAG_NEEDSUPDATE))) {
+        // ingore potentially incomplete blocks when a filter update is pending
         BRMerkleBlockFree(block);
         block = NULL;
 
@@ -1254,6 +2198,22 @@ static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
             manager->lastOrphan = block;
         }
     }
+    else if (manager->lastHeader && block->height > manager->lastBlock->height) { // headers-first filtered block
+        if (! _BRPeerManagerAddSyncBlock(manager, block, peer)) {
+            BRMerkleBlockFree(block);
+            block = NULL;
+        }
+        else {
+            block = _BRPeerManagerCommitSyncBlocks(manager, peer); // new lastBlock, if any blocks were connected
+
+            // chain download is complete, new blocks found after that are fetched the same way but only extend it
+            if (block && block->height >= manager->estimatedHeight && manager->syncStartHeight > 0) {
+                saveCount = (block->height % BLOCK_DIFFICULTY_INTERVAL) + BLOCK_DIFFICULTY_INTERVAL + 1;
+                _BRPeerManagerLoadMempools(manager);
+            }
+            else _BRPeerManagerRequestSyncRanges(manager);
+        }
+    }
     else if (! _BRPeerManagerVerifyBlock(manager, block, prev, peer)) { // block is invalid
         peer_log(peer, "relayed invalid block");
         BRMerkleBlockFree(block);
@@ -1265,9 +2225,16 @@ static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
             peer_log(peer, "adding block #%"PRIu32", false positive rate: %f", block->height, manager->fpRate);
         }
         
-        BRSetAdd(manager->blocks, block);
-        manager->lastBlock = block;
-        if (txCount > 0) BRWalletUpdateTransactions(manager->wallet, txHashes, txCount, block->height, txTime);
+        b = BRSetAdd(manager->blocks, block);
+
+        if (b && b != block) { // header left over from an earlier headers-first sync
+            if (BRSetGet(manager->orphans, b) == b) BRSetRemove(manager->orphans, b);
+            if (manager->lastOrphan == b) manager->lastOrphan = NULL;
+            BRMerkleBlockFree(b);
+        }
+        BRHeaderChainSet(manager->chain, block);
+        _BRPeerManagerSetLastBlock(manager, block);
+        if (txCount > 0) _BRPeerManagerQueueWalletUpdate(manager, txHashes, txCount, block->height, txTime);
         if (manager->downloadPeer) BRPeerSetCurrentBlockHeight(manager->downloadPeer, block->height);
             
         if (block->height < manager->estimatedHeight && peer == manager->downloadPeer) {
@@ -1298,7 +2265,7 @@ static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
         }
 
         if (BRMerkleBlockEq(b, block)) { // if it's not on a fork, set block heights for its transactions
-            if (txCount > 0) BRWalletUpdateTransactions(manager->wallet, txHashes, txCount, block->height, txTime);
+            if (txCount > 0) _BRPeerManagerQueueWalletUpdate(manager, txHashes, txCount, block->height, txTime);
             if (block->height == manager->lastBlock->height) manager->lastBlock = block;
         }
         
@@ -1330,11 +2297,11 @@ static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
         // TODO: calculate chain work and use that instead of block height to determine longest chain
         if (block->height > manager->lastBlock->height) { // check if fork is now longer than main chain
             b = block;
-            b2 = manager->lastBlock;
-            
-            while (b && b2 && ! BRMerkleBlockEq(b, b2)) { // walk back to where the fork joins the main chain
+
+            // walk back to where the fork joins the main chain
+            while (b && (b->height > manager->lastBlock->height ||
+                         ! UInt256Eq(b->blockHash, BRHeaderChainHash(manager->chain, b->height)))) {
                 b = BRSetGet(manager->blocks, &b->prevBlock);
-                if (b && b->height < b2->height) b2 = BRSetGet(manager->blocks, &b2->prevBlock);
             }
 
             if (NULL == b) {
@@ -1343,14 +2310,20 @@ static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
             }
             peer_log(peer, "reorganizing chain from height %"PRIu32", new height is %"PRIu32, b->height, block->height);
         
-            BRWalletSetTxUnconfirmedAfter(manager->wallet, b->height); // mark tx after the join point as unconfirmed
+            // mark tx after the join point as unconfirmed
+            _BRPeerManagerQueueWalletUpdate(manager, NULL, 0, b->height, 0);
 
+            BRMerkleBlock *forkBlocks[block->height - b->height];
+
+            b2 = b;
             b = block;
         
-            while (b && b2 && b->height > b2->height) { // set transaction heights for new main chain
+            while (b && b->height > b2->height) { // set transaction heights for new main chain
                 size_t count = BRMerkleBlockTxHashes(b, NULL, 0);
                 uint32_t height = b->height, timestamp = b->timestamp;
                 
+                forkBlocks[height - b2->height - 1] = b;
+                
                 if (count > txCount) {
                     txHashes = (txHashes != _txHashes) ? realloc(txHashes, count*sizeof(*txHashes)) :
                                malloc(count*sizeof(*txHashes));
@@ -1364,10 +2337,13 @@ static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
                 count = BRMerkleBlockTxHashes(b, txHashes, count);
                 b = BRSetGet(manager->blocks, &b->prevBlock);
                 if (b) timestamp = timestamp/2 + b->timestamp/2;
-                if (count > 0) BRWalletUpdateTransactions(manager->wallet, txHashes, count, height, timestamp);
+                if (count > 0) _BRPeerManagerQueueWalletUpdate(manager, txHashes, count, height, timestamp);
             }
         
-            manager->lastBlock = block;
+            // the fork is now the main chain, headers are set from the join point up since any that replace a
+            // different block drop everything above them
+            for (i = 0; i < block->height - b2->height; i++) BRHeaderChainSet(manager->chain, forkBlocks[i]);
+            _BRPeerManagerSetLastBlock(manager, block);
             
             if (block->height == manager->estimatedHeight) { // chain download is complete
                 saveCount = (block->height % BLOCK_DIFFICULTY_INTERVAL) + BLOCK_DIFFICULTY_INTERVAL + 1;
@@ -1394,7 +2370,10 @@ static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
             return;
         }
         saveBlocks[i] = b;
+        b2 = b;
         b = BRSetGet(manager->blocks, &b->prevBlock);
+        if (! b && b2->height > 0) b = _BRPeerManagerChainBlock(manager, b2->height - 1); // recreate pruned blocks
+        if (b && ! UInt256Eq(b->blockHash, b2->prevBlock)) b = NULL;
     }
     
     // make sure the set of blocks to be saved starts at a difficulty interval
@@ -1404,15 +2383,166 @@ static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
         _peerRelayedBlockFailed (NULL, peer, "In 'save' missed 'difficulty'");
         return;
     }
-    if (i > 0 && manager->saveBlocks) manager->saveBlocks(manager->info, (i > 1 ? 1 : 0), saveBlocks, i);
-    pthread_mutex_unlock(&manager->lock);
+    if (i > 0 && manager->saveBlocks) _BRPeerManagerQueueJob(manager, BRPeerManagerJobSaveBlocks, (i > 1 ? 1 : 0),
+                                                             saveBlocks, NULL, i);
+    _BRPeerManagerUnlockChain(manager);
     
     if (block && block->height != BLOCK_UNKNOWN_HEIGHT && block->height >= BRPeerLastBlock(peer) &&
         manager->txStatusUpdate) {
         manager->txStatusUpdate(manager->info); // notify that transaction confirmations may have changed
     }
     
-    if (next) _peerRelayedBlock(info, next);
+    if (next) _BRPeerManagerRelayedBlock(info, next, 0);
+}
+
+static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
+{
+    if (info && block && block->totalTx > 0) { // a filtered block rather than a header
+        _BRPeerManagerScoreBlock(((BRPeerCallbackInfo *)info)->manager, ((BRPeerCallbackInfo *)info)->peer);
+    }
+
+    _BRPeerManagerRelayedBlock(info, block, 0);
+}
+
+static void _peerRelayedFilterHeaders(void *info, UInt256 stopHash, UInt256 prevHeader, const UInt256 filterHashes[],
+                                      size_t count)
+{
+    BRPeer *peer = ((BRPeerCallbackInfo *)info)->peer;
+    BRPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
+    BRMerkleBlock *stop;
+    UInt256 header = prevHeader;
+    size_t i, j;
+
+    _BRPeerManagerLock(manager, BRPeerManagerLockChain);
+    stop = BRSetGet(manager->blocks, &stopHash);
+
+    // only filter headers for blocks in the header chain are kept
+    if (manager->lastHeader && stop && count > 0 && stop->height + 1 >= manager->syncBaseHeight + count &&
+        stop->height - manager->syncBaseHeight < array_count(manager->syncBlocks) &&
+        UInt256Eq(manager->syncBlocks[stop->height - manager->syncBaseHeight].blockHash, stopHash)) {
+        for (i = 0, j = stop->height + 1 - count - manager->syncBaseHeight; i < count; i++, j++) {
+            header = BRCompactFilterHeader(filterHashes[i], header);
+            if (manager->syncBlocks[j].block) continue; // already received
+            manager->syncBlocks[j].filterHash = filterHashes[i];
+            manager->syncBlocks[j].filterHeader = header;
+        }
+    }
+    else peer_log(peer, "ignoring compact filter headers that don't match the header chain");
+
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
+}
+
+// returns the header chain sync block with blockHash if it's still waiting for its compact filter and its filter
+// header is known, or NULL otherwise, and sets header to the block's header (call with manager->lock held)
+static BRSyncBlock *_BRPeerManagerFilterSyncBlock(BRPeerManager *manager, UInt256 blockHash, BRMerkleBlock **header)
+{
+    BRSyncBlock *b = NULL;
+
+    *header = BRSetGet(manager->blocks, &blockHash);
+
+    if (manager->lastHeader && *header && (*header)->height > manager->lastBlock->height &&
+        (*header)->height - manager->syncBaseHeight < array_count(manager->syncBlocks)) {
+        b = &manager->syncBlocks[(*header)->height - manager->syncBaseHeight];
+    }
+
+    // not in the header chain, already received, or its filter header is missing
+    if (b && (! UInt256Eq(b->blockHash, blockHash) || b->block || UInt256IsZero(b->filterHash))) b = NULL;
+    return b;
+}
+
+static void _peerRelayedFilter(void *info, UInt256 blockHash, const uint8_t *filter, size_t filterLen)
+{
+    BRPeer *peer = ((BRPeerCallbackInfo *)info)->peer;
+    BRPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
+    BRMerkleBlock *header, *block = NULL;
+    BRSyncBlock *b;
+    BRFilterScripts *scripts = NULL;
+    UInt256 filterHash = UINT256_ZERO;
+    int isValid = 0, isMatch = 0;
+
+    _BRPeerManagerScoreBlock(manager, peer);
+    _BRPeerManagerLock(manager, BRPeerManagerLockChain);
+    b = _BRPeerManagerFilterSyncBlock(manager, blockHash, &header);
+
+    if (b) { // hold a reference to the wallet scripts, and match the filter against them without the lock
+        filterHash = b->filterHash;
+        scripts = manager->filterScripts;
+        if (scripts) scripts->refCount++;
+    }
+
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
+    if (! b) return;
+    isValid = UInt256Eq(BRCompactFilterHash(filter, filterLen), filterHash);
+
+    if (isValid && scripts) {
+        isMatch = BRCompactFilterMatchAny(filter, filterLen, blockHash, scripts->scripts, scripts->scriptLens,
+                                          array_count(scripts->scriptLens));
+    }
+
+    _BRPeerManagerLock(manager, BRPeerManagerLockChain);
+    b = _BRPeerManagerFilterSyncBlock(manager, blockHash, &header);
+
+    if (! b || ! UInt256Eq(b->filterHash, filterHash) || manager->filterScripts != scripts) {
+        // the sync moved on, or the wallet scripts were rebuilt and unchecked filters refetched, while matching
+    }
+    else if (! isValid) {
+        peer_log(peer, "compact filter for block #%"PRIu32" doesn't match its filter header", header->height);
+        _BRPeerManagerReleaseSyncRanges(manager, peer);
+        _BRPeerManagerRequestSyncRanges(manager);
+    }
+    else if (isMatch) {
+        peer_log(peer, "compact filter matched block #%"PRIu32", requesting full block", header->height);
+        BRPeerSendGetdataBlocks(peer, &blockHash, 1);
+    }
+    else block = BRMerkleBlockCopy(header); // no wallet transactions, so the header is all that's needed
+
+    if (scripts) _BRFilterScriptsRelease(scripts);
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
+    if (block) _BRPeerManagerRelayedBlock(info, block, 1);
+}
+
+static void _peerRelayedFullBlock(void *info, BRMerkleBlock *block, BRTransaction *txs[], size_t txCount)
+{
+    BRPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
+    BRMerkleBlock *header;
+    UInt256 _txHashes[128], *txHashes = (txCount <= 128) ? _txHashes : malloc(txCount*sizeof(UInt256));
+    uint8_t _matches[128], *matches = (txCount <= 128) ? _matches : malloc(txCount);
+    int isRequested = 0;
+    size_t i;
+
+    assert(txHashes != NULL);
+    assert(matches != NULL);
+    _BRPeerManagerLock(manager, BRPeerManagerLockChain);
+    header = BRSetGet(manager->blocks, &block->blockHash);
+
+    // only accept blocks requested after their compact filter matched
+    if (manager->lastHeader && header && header->height > manager->lastBlock->height &&
+        header->height - manager->syncBaseHeight < array_count(manager->syncBlocks)) {
+        BRSyncBlock *b = &manager->syncBlocks[header->height - manager->syncBaseHeight];
+
+        isRequested = (UInt256Eq(b->blockHash, block->blockHash) && ! b->block && ! UInt256IsZero(b->filterHash));
+    }
+
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
+
+    for (i = 0; i < txCount; i++) { // keep only wallet transactions, the rest are dropped
+        txHashes[i] = txs[i]->txHash;
+        matches[i] = (isRequested && BRWalletContainsTransaction(manager->wallet, txs[i]));
+
+        if (matches[i] && ! BRWalletTransactionForHash(manager->wallet, txs[i]->txHash)) {
+            _peerRelayedTx(info, txs[i]);
+        }
+        else BRTransactionFree(txs[i]);
+    }
+
+    if (isRequested) {
+        BRMerkleBlockSetMatchedTxHashes(block, txHashes, matches, txCount);
+        _peerRelayedBlock(info, block);
+    }
+    else BRMerkleBlockFree(block);
+
+    if (txHashes != _txHashes) free(txHashes);
+    if (matches != _matches) free(matches);
 }
 
 static void _peerDataNotfound(void *info, const UInt256 txHashes[], size_t txCount,
@@ -1421,14 +2551,19 @@ static void _peerDataNotfound(void *info, const UInt256 txHashes[], size_t txCou
     BRPeer *peer = ((BRPeerCallbackInfo *)info)->peer;
     BRPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
 
-    pthread_mutex_lock(&manager->lock);
+    _BRPeerManagerLock(manager, BRPeerManagerLockChain);
 
     for (size_t i = 0; i < txCount; i++) {
-        _BRTxPeerListRemovePeer(manager->txRelays, txHashes[i], peer);
-        _BRTxPeerListRemovePeer(manager->txRequests, txHashes[i], peer);
+        _BRPeerManagerRemoveTxPeer(manager, manager->txRelays, txHashes[i], peer);
+        _BRPeerManagerRemoveTxPeer(manager, manager->txRequests, txHashes[i], peer);
     }
 
-    pthread_mutex_unlock(&manager->lock);
+    if (blockCount > 0 && manager->lastHeader) { // peer doesn't have the filtered blocks, ask someone else
+        _BRPeerManagerReleaseSyncRanges(manager, peer);
+        _BRPeerManagerRequestSyncRanges(manager);
+    }
+
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
 }
 
 static void _peerSetFeePerKb(void *info, uint64_t feePerKb)
@@ -1437,7 +2572,7 @@ static void _peerSetFeePerKb(void *info, uint64_t feePerKb)
     BRPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
     uint64_t maxFeePerKb = 0, secondFeePerKb = 0;
     
-    pthread_mutex_lock(&manager->lock);
+    _BRPeerManagerLock(manager, BRPeerManagerLockChain);
     
     for (size_t i = array_count(manager->connectedPeers); i > 0; i--) { // find second highest fee rate
         p = manager->connectedPeers[i - 1];
@@ -1451,7 +2586,7 @@ static void _peerSetFeePerKb(void *info, uint64_t feePerKb)
         BRWalletSetFeePerKb(manager->wallet, secondFeePerKb*3/2);
     }
 
-    pthread_mutex_unlock(&manager->lock);
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
 }
 
 static BRTransaction *_peerRequestedTx(void *info, UInt256 txHash)
@@ -1459,9 +2594,12 @@ static BRTransaction *_peerRequestedTx(void *info, UInt256 txHash)
     BRPeer *peer = ((BRPeerCallbackInfo *)info)->peer;
     BRPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
     BRPublishedTx pubTx = { NULL, NULL, NULL };
-    int hasPendingCallbacks = 0, error = 0;
+    int hasPendingCallbacks = 0, isSyncing, error = 0;
 
-    pthread_mutex_lock(&manager->lock);
+    _BRPeerManagerLock(manager, BRPeerManagerLockChain);
+    isSyncing = (manager->syncStartHeight > 0 && peer == manager->downloadPeer);
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
+    _BRPeerManagerLock(manager, BRPeerManagerLockPublish);
 
     for (size_t i = array_count(manager->publishedTx); i > 0; i--) {
         if (UInt256Eq(manager->publishedTxHashes[i - 1], txHash)) {
@@ -1472,15 +2610,13 @@ static BRTransaction *_peerRequestedTx(void *info, UInt256 txHash)
         else if (manager->publishedTx[i - 1].callback != NULL) hasPendingCallbacks = 1;
     }
 
-    // cancel tx publish timeout if no publish callbacks are pending, and syncing is done or this is not downloadPeer
-    if (! hasPendingCallbacks && (manager->syncStartHeight == 0 || peer != manager->downloadPeer)) {
-        BRPeerScheduleDisconnect(peer, -1); // cancel publish tx timeout
-    }
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockPublish);
 
-    _BRTxPeerListAddPeer(&manager->txRelays, txHash, peer);
+    // cancel tx publish timeout if no publish callbacks are pending, and syncing is done or this is not downloadPeer
+    if (! hasPendingCallbacks && ! isSyncing) BRPeerScheduleDisconnect(peer, -1); // cancel publish tx timeout
+    _BRPeerManagerAddTxPeer(manager, manager->txRelays, txHash, peer);
     if (pubTx.tx) BRWalletRegisterTransaction(manager->wallet, pubTx.tx);
     if (pubTx.tx && ! BRWalletTransactionIsValid(manager->wallet, pubTx.tx)) error = EINVAL;
-    pthread_mutex_unlock(&manager->lock);
     if (pubTx.callback) pubTx.callback(pubTx.info, error);
     return pubTx.tx;
 }
@@ -1497,9 +2633,9 @@ static void _peerThreadCleanup(void *info)
     BRPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
 
     free(info);
-    pthread_mutex_lock(&manager->lock);
+    _BRPeerManagerLock(manager, BRPeerManagerLockChain);
     manager->peerThreadCount--;
-    pthread_mutex_unlock(&manager->lock);
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
     if (manager->threadCleanup) manager->threadCleanup(manager->info);
 }
 
@@ -1507,6 +2643,23 @@ static void _dummyThreadCleanup(void *info)
 {
 }
 
+// keeps tx peer map entries for wallet and published transactions past their ttl, since relay counts of unconfirmed
+// wallet transactions decide if they're verified or should be removed (called with txLock held)
+static int _txPeerMapKeep(void *info, UInt256 txHash)
+{
+    BRPeerManager *manager = info;
+    int r = 0;
+    
+    _BRPeerManagerLock(manager, BRPeerManagerLockPublish);
+
+    for (size_t i = array_count(manager->publishedTxHashes); ! r && i > 0; i--) {
+        if (UInt256Eq(manager->publishedTxHashes[i - 1], txHash)) r = 1;
+    }
+    
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockPublish);
+    return (r || BRWalletTransactionForHash(manager->wallet, txHash) != NULL);
+}
+
 // returns a newly allocated BRPeerManager struct that must be freed by calling BRPeerManagerFree()
 BRPeerManager *BRPeerManagerNew(const BRChainParams *params, BRWallet *wallet, uint32_t earliestKeyTime,
                                 BRMerkleBlock *blocks[], size_t blocksCount, const BRPeer peers[], size_t peersCount)
@@ -1525,13 +2678,16 @@ BRPeerManager *BRPeerManagerNew(const BRChainParams *params, BRWallet *wallet, u
     manager->earliestKeyTime = earliestKeyTime;
     manager->averageTxPerBlock = 1400;
     manager->maxConnectCount = PEER_MAX_CONNECTIONS;
+    manager->headersFirst = 1;
     array_new(manager->peers, peersCount);
     if (peers) array_add_array(manager->peers, peers, peersCount);
-    qsort(manager->peers, array_count(manager->peers), sizeof(*manager->peers), _peerTimestampCompare);
+    manager->scores = BRPeerScoresNew();
+    BRPeerScoresSort(manager->scores, manager->peers, array_count(manager->peers)); // no scores yet, so by timestamp
     array_new(manager->connectedPeers, PEER_MAX_CONNECTIONS);
     manager->blocks = BRSetNew(BRMerkleBlockHash, BRMerkleBlockEq, blocksCount);
     manager->orphans = BRSetNew(_BRPrevBlockHash, _BRPrevBlockEq, blocksCount); // orphans are indexed by prevBlock
     manager->checkpoints = BRSetNew(_BRBlockHeightHash, _BRBlockHeightEq, 100); // checkpoints are indexed by height
+    manager->chain = BRHeaderChainNew(HEADER_CHAIN_DEPTH);
 
     for (size_t i = 0; i < manager->params->checkpointsCount; i++) {
         block = BRMerkleBlockNew();
@@ -1541,6 +2697,7 @@ BRPeerManager *BRPeerManagerNew(const BRChainParams *params, BRWallet *wallet, u
         block->target = manager->params->checkpoints[i].target;
         BRSetAdd(manager->checkpoints, block);
         BRSetAdd(manager->blocks, block);
+        BRHeaderChainSet(manager->chain, block);
         if (i == 0 || block->timestamp + 7*24*60*60 < manager->earliestKeyTime) manager->lastBlock = block;
     }
 
@@ -1559,6 +2716,7 @@ BRPeerManager *BRPeerManagerNew(const BRChainParams *params, BRWallet *wallet, u
     
     while (block) {
         BRSetAdd(manager->blocks, block);
+        BRHeaderChainSet(manager->chain, block);
         manager->lastBlock = block;
         orphan.prevBlock = block->prevBlock;
         BRSetRemove(manager->orphans, &orphan);
@@ -1568,11 +2726,19 @@ BRPeerManager *BRPeerManagerNew(const BRChainParams *params, BRWallet *wallet, u
 
     _peer_log("BPM: initialized with %u last block height\n", manager->lastBlock->height);
 
-    array_new(manager->txRelays, 10);
-    array_new(manager->txRequests, 10);
+    manager->txRelays = BRTxPeerMapNew(TX_PEER_MAP_TTL, manager, _txPeerMapKeep);
+    manager->txRequests = BRTxPeerMapNew(TX_PEER_MAP_TTL, manager, _txPeerMapKeep);
     array_new(manager->publishedTx, 10);
     array_new(manager->publishedTxHashes, 10);
+    array_new(manager->syncBlocks, 10);
+    array_new(manager->syncRanges, 10);
     pthread_mutex_init(&manager->lock, NULL);
+    pthread_mutex_init(&manager->txLock, NULL);
+    pthread_mutex_init(&manager->publishLock, NULL);
+    pthread_mutex_init(&manager->peersLock, NULL);
+    array_new(manager->jobs, 10);
+    pthread_mutex_init(&manager->jobLock, NULL);
+    pthread_cond_init(&manager->jobCond, NULL);
     manager->threadCleanup = _dummyThreadCleanup;
     return manager;
 }
@@ -1587,7 +2753,10 @@ BRPeerManager *BRPeerManagerNew(const BRChainParams *params, BRWallet *wallet, u
 // void savePeers(void *, int, const BRPeer[], size_t) - called when peers should be saved to the persistent store
 // - if replace is true, remove any previously saved peers first
 // int networkIsReachable(void *) - must return true when networking is available, false otherwise
-// void threadCleanup(void *) - called before a thread terminates to faciliate any needed cleanup
+// void threadCleanup(void *) - called on the shared peer reactor thread once each peer connection is torn down, and
+// before the manager's job thread and dns lookup threads terminate, to faciliate any needed cleanup
+// syncStarted, syncStopped, saveBlocks and savePeers are called in order on the manager's job thread, never on the
+// reactor thread, so they may block, and the blocks passed to saveBlocks are copies freed once it returns
 void BRPeerManagerSetCallbacks(BRPeerManager *manager, void *info,
                                void (*syncStarted)(void *info),
                                void (*syncStopped)(void *info, int error),
@@ -1614,19 +2783,105 @@ void BRPeerManagerSetFixedPeer(BRPeerManager *manager, UInt128 address, uint16_t
 {
     assert(manager != NULL);
 
-    pthread_mutex_lock(&manager->lock);
+    _BRPeerManagerLock(manager, BRPeerManagerLockChain);
     int samePeer = (UInt128Eq(address, manager->fixedPeer.address) &&
                     (port == manager->fixedPeer.port || UInt128IsZero(address)));
-    pthread_mutex_unlock(&manager->lock);
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
 
     if (!samePeer) {
         BRPeerManagerDisconnect(manager);
-        pthread_mutex_lock(&manager->lock);
+        _BRPeerManagerLock(manager, BRPeerManagerLockChain);
         manager->maxConnectCount = UInt128IsZero(address) ? PEER_MAX_CONNECTIONS : 1;
         manager->fixedPeer = ((const BRPeer) { address, port, 0, 0, 0 });
+        _BRPeerManagerLock(manager, BRPeerManagerLockPeers);
         array_clear(manager->peers);
-        pthread_mutex_unlock(&manager->lock);
+        _BRPeerManagerUnlock(manager, BRPeerManagerLockPeers);
+        _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
+    }
+}
+
+// set this to false to sync through a single download peer with getblocks instead of fetching the header chain first
+// and spreading filtered block requests across all connected peers (enabled by default)
+void BRPeerManagerSetHeadersFirst(BRPeerManager *manager, int headersFirst)
+{
+    assert(manager != NULL);
+    _BRPeerManagerLock(manager, BRPeerManagerLockChain);
+    manager->headersFirst = (headersFirst || manager->syncMode == BRSyncModeCompactFilter);
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
+}
+
+// selects how wallet transactions are found during the chain sync, call before BRPeerManagerConnect()
+// BRSyncModeCompactFilter only connects to nodes serving compact filters, and always does a headers-first sync
+void BRPeerManagerSetSyncMode(BRPeerManager *manager, BRSyncMode mode)
+{
+    assert(manager != NULL);
+    _BRPeerManagerLock(manager, BRPeerManagerLockChain);
+    manager->syncMode = mode;
+    if (mode == BRSyncModeCompactFilter) manager->headersFirst = 1; // filters are fetched in header chain ranges
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
+}
+
+// sets how many of the most recent main chain block headers are kept in memory, older ones are pruned except for
+// difficulty transitions (default is two difficulty intervals, 0 keeps every header)
+void BRPeerManagerSetPruneDepth(BRPeerManager *manager, uint32_t depth)
+{
+    assert(manager != NULL);
+    _BRPeerManagerLock(manager, BRPeerManagerLockChain);
+    BRHeaderChainSetDepth(manager->chain, depth);
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
+}
+
+// backs the main chain headers with a memory mapped header store, not thread-safe, call once before
+// BRPeerManagerConnect()
+// if the last block recorded in store is ahead of the blocks the manager was created with, the chain is restored from
+// the headers up to it, and older ones are paged in as they're needed, so blocks can be empty, otherwise store is filled
+// in from the current chain
+// headers set ahead of their blocks by a headers-first sync are written to store too, but aren't restored
+// store must stay open until the manager is freed
+void BRPeerManagerSetHeaderStore(BRPeerManager *manager, BRHeaderStore *store)
+{
+    uint32_t base, height, h;
+    BRMerkleBlock header, *block;
+
+    assert(manager != NULL);
+    assert(store != NULL);
+    _BRPeerManagerLock(manager, BRPeerManagerLockChain);
+    base = BRHeaderStoreBaseHeight(store);
+    height = BRHeaderStoreLastBlockHeight(store); // headers above the last block committed are never restored
+
+    if (height != BLOCK_UNKNOWN_HEIGHT && height > manager->lastBlock->height) {
+        // start from a difficulty transition at least BLOCKS_DEPTH back, like the blocks passed to BRPeerManagerNew()
+        h = (height - base > BLOCKS_DEPTH) ? height - BLOCKS_DEPTH : base;
+        h -= h % BLOCK_DIFFICULTY_INTERVAL;
+        if (h < base) h += BLOCK_DIFFICULTY_INTERVAL;
+
+        for (; h <= height && BRHeaderStoreGet(store, h, &header); h++) {
+            block = BRSetGet(manager->blocks, &header);
+            if (! block) BRSetAdd(manager->blocks, (block = BRMerkleBlockCopy(&header)));
+            BRHeaderChainSet(manager->chain, block);
+            manager->lastBlock = block;
+        }
+
+        _BRPeerManagerPruneBlocks(manager);
+        _peer_log("BPM: restored header store with %u last block height\n", manager->lastBlock->height);
     }
+
+    BRHeaderChainSetStore(manager->chain, store);
+
+    // fill in store from the last difficulty transition so the chain can be restored from it next time
+    if (! UInt256Eq(BRHeaderStoreHash(store, manager->lastBlock->height), manager->lastBlock->blockHash)) {
+        for (h = manager->lastBlock->height - manager->lastBlock->height % BLOCK_DIFFICULTY_INTERVAL;
+             h <= manager->lastBlock->height; h++) {
+            if (BRHeaderChainGet(manager->chain, h, &header)) BRHeaderStoreSet(store, &header);
+        }
+    }
+
+    manager->headerStore = store;
+    BRHeaderStoreSetLastBlockHeight(store, (UInt256Eq(BRHeaderStoreHash(store, manager->lastBlock->height),
+                                                      manager->lastBlock->blockHash)) ? manager->lastBlock->height :
+                                    BLOCK_UNKNOWN_HEIGHT);
+
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
 }
 
 // current connect status
@@ -1635,7 +2890,7 @@ BRPeerStatus BRPeerManagerConnectStatus(BRPeerManager *manager)
     BRPeerStatus status = BRPeerStatusDisconnected;
     
     assert(manager != NULL);
-    pthread_mutex_lock(&manager->lock);
+    _BRPeerManagerLock(manager, BRPeerManagerLockChain);
     if (manager->isConnected != 0) status = BRPeerStatusConnected;
 
     for (size_t i = array_count(manager->connectedPeers); i > 0 && status == BRPeerStatusDisconnected; i--) {
@@ -1643,23 +2898,29 @@ BRPeerStatus BRPeerManagerConnectStatus(BRPeerManager *manager)
         status = BRPeerStatusConnecting;
     }
 
-    pthread_mutex_unlock(&manager->lock);
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
     return status;
 }
 
-// connect to bitcoin peer-to-peer network (also call this whenever networkIsReachable() status changes)
-void BRPeerManagerConnect(BRPeerManager *manager)
+// connects to more peers, isRetry is true for a manual retry, false for an automatic reconnect from the job thread
+// after a peer disconnects, which is skipped once there have been too many connect failures in a row
+static void _BRPeerManagerConnect(BRPeerManager *manager, int isRetry)
 {
-    assert(manager != NULL);
-    pthread_mutex_lock(&manager->lock);
-    if (manager->connectFailureCount >= MAX_CONNECT_FAILURES) manager->connectFailureCount = 0; //this is a manual retry
-    
+    _BRPeerManagerLock(manager, BRPeerManagerLockChain);
+
+    if (manager->connectFailureCount >= MAX_CONNECT_FAILURES) {
+        if (! isRetry) {
+            _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
+            return;
+        }
+
+        manager->connectFailureCount = 0;
+    }
+
     if ((! manager->downloadPeer || manager->lastBlock->height < manager->estimatedHeight) &&
         manager->syncStartHeight == 0) {
         manager->syncStartHeight = manager->lastBlock->height + 1;
-        pthread_mutex_unlock(&manager->lock);
-        if (manager->syncStarted) manager->syncStarted(manager->info);
-        pthread_mutex_lock(&manager->lock);
+        _BRPeerManagerQueueJob(manager, BRPeerManagerJobSyncStarted, 0, NULL, NULL, 0);
     }
     
     for (size_t i = array_count(manager->connectedPeers); i > 0; i--) {
@@ -1671,15 +2932,19 @@ void BRPeerManagerConnect(BRPeerManager *manager)
     if (array_count(manager->connectedPeers) < manager->maxConnectCount) {
         time_t now = time(NULL);
         BRPeer *peers;
+        int needsPeers;
 
-        if (array_count(manager->peers) < manager->maxConnectCount ||
-            manager->peers[manager->maxConnectCount - 1].timestamp + 3*24*60*60 < now) {
-            _BRPeerManagerFindPeers(manager);
-        }
+        _BRPeerManagerLock(manager, BRPeerManagerLockPeers);
+        needsPeers = (array_count(manager->peers) < manager->maxConnectCount ||
+                      manager->peers[manager->maxConnectCount - 1].timestamp + 3*24*60*60 < now);
+        _BRPeerManagerUnlock(manager, BRPeerManagerLockPeers);
+        if (needsPeers) _BRPeerManagerFindPeers(manager);
         
         array_new(peers, 100);
+        _BRPeerManagerLock(manager, BRPeerManagerLockPeers);
         array_add_array(peers, manager->peers,
                         (array_count(manager->peers) < 100) ? array_count(manager->peers) : 100);
+        _BRPeerManagerUnlock(manager, BRPeerManagerLockPeers);
 
         while (array_count(peers) > 0 && array_count(manager->connectedPeers) < manager->maxConnectCount) {
             size_t i = BRRand((uint32_t)array_count(peers)); // index of random peer
@@ -1705,13 +2970,15 @@ void BRPeerManagerConnect(BRPeerManager *manager)
                 BRPeerSetCallbacks(info->peer, info, _peerConnected, _peerDisconnected, _peerRelayedPeers,
                                    _peerRelayedTx, _peerHasTx, _peerRejectedTx, _peerRelayedBlock, _peerDataNotfound,
                                    _peerSetFeePerKb, _peerRequestedTx, _peerNetworkIsReachable, _peerThreadCleanup);
+                BRPeerSetCompactFilterCallbacks(info->peer, _peerRelayedFilterHeaders, _peerRelayedFilter,
+                                                _peerRelayedFullBlock);
                 BRPeerSetEarliestKeyTime(info->peer, manager->earliestKeyTime);
                 BRPeerConnect(info->peer);
 
                 if (BRPeerConnectStatus(info->peer) == BRPeerStatusDisconnected) {
-                    pthread_mutex_unlock(&manager->lock);
+                    _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
                     _peerDisconnected(info, ENOTCONN);
-                    pthread_mutex_lock(&manager->lock);
+                    _BRPeerManagerLock(manager, BRPeerManagerLockChain);
                     manager->peerThreadCount--;
                 }
             }
@@ -1722,10 +2989,17 @@ void BRPeerManagerConnect(BRPeerManager *manager)
     
     if (array_count(manager->connectedPeers) == 0) {
         _BRPeerManagerSyncStopped(manager);
-        pthread_mutex_unlock(&manager->lock);
-        if (manager->syncStopped) manager->syncStopped(manager->info, ENETUNREACH);
+        _BRPeerManagerQueueJob(manager, BRPeerManagerJobSyncStopped, ENETUNREACH, NULL, NULL, 0);
     }
-    else pthread_mutex_unlock(&manager->lock);
+
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
+}
+
+// connect to bitcoin peer-to-peer network (also call this whenever networkIsReachable() status changes)
+void BRPeerManagerConnect(BRPeerManager *manager)
+{
+    assert(manager != NULL);
+    _BRPeerManagerConnect(manager, 1);
 }
 
 void BRPeerManagerDisconnect(BRPeerManager *manager)
@@ -1735,53 +3009,63 @@ void BRPeerManagerDisconnect(BRPeerManager *manager)
     BRPeer *p;
     
     assert(manager != NULL);
-    pthread_mutex_lock(&manager->lock);
+    _BRPeerManagerLock(manager, BRPeerManagerLockChain);
 
-    // prevent new peers from being spawned
+    // prevent new peers from being spawned, including by reconnects already queued for the job thread
     maxConnectCount = manager->maxConnectCount;
     manager->maxConnectCount = 0;
+    manager->connectFailureCount = MAX_CONNECT_FAILURES; // prevent futher automatic reconnect attempts
     
     for (size_t i = array_count(manager->connectedPeers); i > 0; i--) {
         p = manager->connectedPeers[i - 1];
-        manager->connectFailureCount = MAX_CONNECT_FAILURES; // prevent futher automatic reconnect attempts
         BRPeerDisconnect(p);
         if (BRPeerConnectStatus(p) == BRPeerStatusConnecting) manager->peerThreadCount--; // waiting for network
     }
 
     peerThreadCount = manager->peerThreadCount;
+    _BRPeerManagerLock(manager, BRPeerManagerLockPeers);
     dnsThreadCount = manager->dnsThreadCount;
-    pthread_mutex_unlock(&manager->lock);
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockPeers);
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
     ts.tv_sec = 0;
     ts.tv_nsec = 1;
     
     while (peerThreadCount > 0 || dnsThreadCount > 0) {
         nanosleep(&ts, NULL); // pthread_yield() isn't POSIX standard :(
-        pthread_mutex_lock(&manager->lock);
+        _BRPeerManagerLock(manager, BRPeerManagerLockChain);
         peerThreadCount = manager->peerThreadCount;
+        _BRPeerManagerLock(manager, BRPeerManagerLockPeers);
         dnsThreadCount = manager->dnsThreadCount;
-        pthread_mutex_unlock(&manager->lock);
+        _BRPeerManagerUnlock(manager, BRPeerManagerLockPeers);
+        _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
     }
 
-    pthread_mutex_lock(&manager->lock);
+    _BRPeerManagerLock(manager, BRPeerManagerLockChain);
     manager->maxConnectCount = maxConnectCount;
-    pthread_mutex_unlock(&manager->lock);
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
 }
 
 static int _BRPeerManagerRescan(BRPeerManager *manager, BRMerkleBlock *newLastBlock) {
     if (NULL == newLastBlock) return 0;
 
-    manager->lastBlock = newLastBlock;
+    _BRPeerManagerSetLastBlock(manager, newLastBlock);
+    _BRPeerManagerSyncReset(manager);
     _peer_log("BPM: rescanning with %u last block height", manager->lastBlock->height);
 
     if (manager->downloadPeer) { // disconnect the current download peer so a new random one will be selected
+        _BRPeerManagerLock(manager, BRPeerManagerLockPeers);
+
         for (size_t i = array_count(manager->peers); i > 0; i--) {
             if (BRPeerEq(&manager->peers[i - 1], manager->downloadPeer)) array_rm(manager->peers, i - 1);
         }
 
+        _BRPeerManagerUnlock(manager, BRPeerManagerLockPeers);
+
         BRPeerDisconnect(manager->downloadPeer);
     }
 
     manager->syncStartHeight = 0; // a syncStartHeight of 0 indicates that syncing hasn't started yet
+    manager->filterHeaderBlock = UINT256_ZERO;
     return 1;
 }
 
@@ -1790,7 +3074,7 @@ static int _BRPeerManagerRescan(BRPeerManager *manager, BRMerkleBlock *newLastBl
 void BRPeerManagerRescan(BRPeerManager *manager)
 {
     assert(manager != NULL);
-    pthread_mutex_lock(&manager->lock);
+    _BRPeerManagerLock(manager, BRPeerManagerLockChain);
     
     int needConnect = 0;
     if (manager->isConnected) {
@@ -1808,7 +3092,7 @@ void BRPeerManagerRescan(BRPeerManager *manager)
 
         needConnect = _BRPeerManagerRescan(manager, newLastBlock);
     }
-    pthread_mutex_unlock(&manager->lock);
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
     if (needConnect) BRPeerManagerConnect(manager);
 }
 
@@ -1816,7 +3100,7 @@ void BRPeerManagerRescan(BRPeerManager *manager)
 void BRPeerManagerRescanFromLastHardcodedCheckpoint(BRPeerManager *manager)
 {
     assert(manager != NULL);
-    pthread_mutex_lock(&manager->lock);
+    _BRPeerManagerLock(manager, BRPeerManagerLockChain);
 
     int needConnect = 0;
     if (manager->isConnected) {
@@ -1826,19 +3110,17 @@ void BRPeerManagerRescanFromLastHardcodedCheckpoint(BRPeerManager *manager)
             needConnect = _BRPeerManagerRescan(manager, BRSetGet (manager->blocks, &hash));
         }
     }
-    pthread_mutex_unlock(&manager->lock);
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
     if (needConnect) BRPeerManagerConnect(manager);
 }
 
 static BRMerkleBlock *_BRPeerManagerLookupBlockFromBlockNumber(BRPeerManager *manager, uint32_t blockNumber)
 {
-    BRMerkleBlock *block = manager->lastBlock;
+    BRMerkleBlock *block = NULL;
 
-    // walk the chain, looking for blockNumber
-    while (block) {
-        if (block->height == blockNumber) return block;
-        block = BRSetGet (manager->blocks, &block->prevBlock);
-    }
+    // look up blockNumber in the main chain
+    if (blockNumber <= manager->lastBlock->height) block = _BRPeerManagerChainBlock(manager, blockNumber);
+    if (block) return block;
 
     // blockNumber not in the (abbreviated) chain - look through checkpoints
     for (int i = 0; i < manager->params->checkpointsCount; i++)
@@ -1855,7 +3137,7 @@ static BRMerkleBlock *_BRPeerManagerLookupBlockFromBlockNumber(BRPeerManager *ma
 void BRPeerManagerRescanFromBlockNumber(BRPeerManager *manager, uint32_t blockNumber)
 {
     assert(manager != NULL);
-    pthread_mutex_lock(&manager->lock);
+    _BRPeerManagerLock(manager, BRPeerManagerLockChain);
 
     int needConnect = 0;
     if (manager->isConnected) {
@@ -1874,7 +3156,7 @@ void BRPeerManagerRescanFromBlockNumber(BRPeerManager *manager, uint32_t blockNu
 
         needConnect = _BRPeerManagerRescan(manager, block);
     }
-    pthread_mutex_unlock(&manager->lock);
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
     if (needConnect) BRPeerManagerConnect(manager);
 }
 
@@ -1884,10 +3166,10 @@ uint32_t BRPeerManagerEstimatedBlockHeight(BRPeerManager *manager)
     uint32_t height;
     
     assert(manager != NULL);
-    pthread_mutex_lock(&manager->lock);
+    _BRPeerManagerLock(manager, BRPeerManagerLockChain);
     height = (manager->lastBlock->height < manager->estimatedHeight) ? manager->estimatedHeight :
              manager->lastBlock->height;
-    pthread_mutex_unlock(&manager->lock);
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
     return height;
 }
 
@@ -1897,9 +3179,9 @@ uint32_t BRPeerManagerLastBlockHeight(BRPeerManager *manager)
     uint32_t height;
     
     assert(manager != NULL);
-    pthread_mutex_lock(&manager->lock);
+    _BRPeerManagerLock(manager, BRPeerManagerLockChain);
     height = manager->lastBlock->height;
-    pthread_mutex_unlock(&manager->lock);
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
     return height;
 }
 
@@ -1909,9 +3191,9 @@ uint32_t BRPeerManagerLastBlockTimestamp(BRPeerManager *manager)
     uint32_t timestamp;
     
     assert(manager != NULL);
-    pthread_mutex_lock(&manager->lock);
+    _BRPeerManagerLock(manager, BRPeerManagerLockChain);
     timestamp = manager->lastBlock->timestamp;
-    pthread_mutex_unlock(&manager->lock);
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
     return timestamp;
 }
 
@@ -1922,7 +3204,7 @@ double BRPeerManagerSyncProgress(BRPeerManager *manager, uint32_t startHeight)
     double progress;
     
     assert(manager != NULL);
-    pthread_mutex_lock(&manager->lock);
+    _BRPeerManagerLock(manager, BRPeerManagerLockChain);
     if (startHeight == 0) startHeight = manager->syncStartHeight;
     
     if (! manager->downloadPeer && manager->syncStartHeight == 0) {
@@ -1936,7 +3218,7 @@ double BRPeerManagerSyncProgress(BRPeerManager *manager, uint32_t startHeight)
     }
     else progress = 1.0;
 
-    pthread_mutex_unlock(&manager->lock);
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
     return progress;
 }
 
@@ -1946,13 +3228,13 @@ size_t BRPeerManagerPeerCount(BRPeerManager *manager)
     size_t count = 0;
     
     assert(manager != NULL);
-    pthread_mutex_lock(&manager->lock);
+    _BRPeerManagerLock(manager, BRPeerManagerLockChain);
     
     for (size_t i = array_count(manager->connectedPeers); i > 0; i--) {
         if (BRPeerConnectStatus(manager->connectedPeers[i - 1]) != BRPeerStatusDisconnected) count++;
     }
     
-    pthread_mutex_unlock(&manager->lock);
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
     return count;
 }
 
@@ -1960,14 +3242,14 @@ size_t BRPeerManagerPeerCount(BRPeerManager *manager)
 const char *BRPeerManagerDownloadPeerName(BRPeerManager *manager)
 {
     assert(manager != NULL);
-    pthread_mutex_lock(&manager->lock);
+    _BRPeerManagerLock(manager, BRPeerManagerLockChain);
 
     if (manager->downloadPeer) {
         sprintf(manager->downloadPeerName, "%s:%d", BRPeerHost(manager->downloadPeer), manager->downloadPeer->port);
     }
     else manager->downloadPeerName[0] = '\0';
     
-    pthread_mutex_unlock(&manager->lock);
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
     return manager->downloadPeerName;
 }
 
@@ -1977,9 +3259,9 @@ static void _publishTxInvDone(void *info, int success)
     BRPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
     
     free(info);
-    pthread_mutex_lock(&manager->lock);
+    _BRPeerManagerLock(manager, BRPeerManagerLockChain);
     _BRPeerManagerRequestUnrelayedTx(manager, peer);
-    pthread_mutex_unlock(&manager->lock);
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
 }
 
 // publishes tx to bitcoin network (do not call BRTransactionFree() on tx afterward)
@@ -1988,31 +3270,36 @@ void BRPeerManagerPublishTx(BRPeerManager *manager, BRTransaction *tx, void *inf
 {
     assert(manager != NULL);
     assert(tx != NULL && BRTransactionIsSigned(tx));
-    if (tx) pthread_mutex_lock(&manager->lock);
+    if (tx) _BRPeerManagerLock(manager, BRPeerManagerLockChain);
     
     if (tx && ! BRTransactionIsSigned(tx)) {
-        pthread_mutex_unlock(&manager->lock);
+        _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
         if (callback) callback(info, EINVAL); // transaction not signed
         tx = NULL;
     }
     else if (tx && ! manager->isConnected) {
         int connectFailureCount = manager->connectFailureCount;
 
-        pthread_mutex_unlock(&manager->lock);
+        _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
 
         if (connectFailureCount >= MAX_CONNECT_FAILURES ||
             (manager->networkIsReachable && ! manager->networkIsReachable(manager->info))) {
             if (callback) callback(info, ENOTCONN); // not connected to bitcoin network
             tx = NULL;
         }
-        else pthread_mutex_lock(&manager->lock);
+        else _BRPeerManagerLock(manager, BRPeerManagerLockChain);
     }
     
     if (tx) {
         size_t i, count = 0;
         
         tx->timestamp = (uint32_t)time(NULL); // set timestamp to publish time
+        _BRPeerManagerLock(manager, BRPeerManagerLockPublish);
         _BRPeerManagerAddTxToPublishList(manager, tx, info, callback);
+        _BRPeerManagerUnlock(manager, BRPeerManagerLockPublish);
+
+        // peers don't match transactions we send them against their filters, so add outpoints for any change
+        if (manager->bloomFilter) _BRPeerManagerAddTxOutpoints(manager, tx, 1);
 
         for (i = array_count(manager->connectedPeers); i > 0; i--) {
             if (BRPeerConnectStatus(manager->connectedPeers[i - 1]) == BRPeerStatusConnected) count++;
@@ -2036,52 +3323,71 @@ void BRPeerManagerPublishTx(BRPeerManager *manager, BRTransaction *tx, void *inf
             }
         }
 
-        pthread_mutex_unlock(&manager->lock);
+        _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
     }
 }
 
 // number of connected peers that have relayed the given unconfirmed transaction
 size_t BRPeerManagerRelayCount(BRPeerManager *manager, UInt256 txHash)
 {
-    size_t count = 0;
-
     assert(manager != NULL);
     assert(! UInt256IsZero(txHash));
-    pthread_mutex_lock(&manager->lock);
-    
-    for (size_t i = array_count(manager->txRelays); i > 0; i--) {
-        if (! UInt256Eq(manager->txRelays[i - 1].txHash, txHash)) continue;
-        count = array_count(manager->txRelays[i - 1].peers);
-        break;
-    }
-    
-    pthread_mutex_unlock(&manager->lock);
-    return count;
+    return _BRPeerManagerTxPeerCount(manager, manager->txRelays, txHash);
+}
+
+// sets acquired to the number of times the given lock has been acquired, and contended to how many of those times it
+// was already held by another thread
+void BRPeerManagerLockContention(BRPeerManager *manager, BRPeerManagerLock lock, uint64_t *acquired,
+                                 uint64_t *contended)
+{
+    assert(manager != NULL);
+    assert(lock < BRPeerManagerLockCount);
+    _BRPeerManagerLock(manager, lock);
+    if (acquired) *acquired = manager->lockCount[lock];
+    if (contended) *contended = manager->lockContention[lock];
+    _BRPeerManagerUnlock(manager, lock);
 }
 
 const BRChainParams *BRPeerManagerChainParams (BRPeerManager *manager) {
     return manager->params;
 }
 
-// frees memory allocated for manager
+// disconnects if connected, runs any queued callbacks and frees memory allocated for manager (don't call from a
+// callback)
 void BRPeerManagerFree(BRPeerManager *manager)
 {
     BRTransaction *tx;
+    int jobThreadStarted;
     
     assert(manager != NULL);
-    pthread_mutex_lock(&manager->lock);
+    BRPeerManagerDisconnect(manager); // deregisters connected peers from the reactor before they're freed
+
+    // run the jobs already queued (other than reconnects), and wait for the job thread to exit
+    pthread_mutex_lock(&manager->jobLock);
+    manager->jobsStopped = 1;
+    jobThreadStarted = manager->jobThreadStarted;
+    pthread_cond_signal(&manager->jobCond);
+    pthread_mutex_unlock(&manager->jobLock);
+    if (jobThreadStarted) pthread_join(manager->jobThread, NULL);
+    array_free(manager->jobs);
+
+    _BRPeerManagerLock(manager, BRPeerManagerLockChain);
     array_free(manager->peers);
     for (size_t i = array_count(manager->connectedPeers); i > 0; i--) BRPeerFree(manager->connectedPeers[i - 1]);
     array_free(manager->connectedPeers);
+    _BRPeerManagerSyncReset(manager);
+    array_free(manager->syncBlocks);
+    array_free(manager->syncRanges);
+    _BRFilterScriptsRelease(manager->filterScripts);
     BRSetApply(manager->blocks, NULL, _setApplyFreeBlock);
     BRSetFree(manager->blocks);
     BRSetApply(manager->orphans, NULL, _setApplyFreeBlock);
     BRSetFree(manager->orphans);
     BRSetFree(manager->checkpoints);
-    for (size_t i = array_count(manager->txRelays); i > 0; i--) array_free(manager->txRelays[i - 1].peers);
-    array_free(manager->txRelays);
-    for (size_t i = array_count(manager->txRequests); i > 0; i--) array_free(manager->txRequests[i - 1].peers);
-    array_free(manager->txRequests);
+    BRHeaderChainFree(manager->chain);
+    BRTxPeerMapFree(manager->txRelays);
+    BRTxPeerMapFree(manager->txRequests);
+    BRPeerScoresFree(manager->scores);
 
     for (size_t i = array_count(manager->publishedTx); i > 0; i--) {
         tx = manager->publishedTx[i - 1].tx;
@@ -2092,7 +3398,14 @@ void BRPeerManagerFree(BRPeerManager *manager)
 
     array_free(manager->publishedTx);
     array_free(manager->publishedTxHashes);
-    pthread_mutex_unlock(&manager->lock);
+    if (manager->walletUpdates) array_free(manager->walletUpdates);
+    if (manager->walletUpdateHashes) array_free(manager->walletUpdateHashes);
+    _BRPeerManagerUnlock(manager, BRPeerManagerLockChain);
     pthread_mutex_destroy(&manager->lock);
+    pthread_mutex_destroy(&manager->txLock);
+    pthread_mutex_destroy(&manager->publishLock);
+    pthread_mutex_destroy(&manager->peersLock);
+    pthread_mutex_destroy(&manager->jobLock);
+    pthread_cond_destroy(&manager->jobCond);
     free(manager);
 }
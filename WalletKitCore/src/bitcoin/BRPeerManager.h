@@ -27,6 +27,7 @@
 
 #include "BRPeer.h"
 #include "BRMerkleBlock.h"
+#include "BRHeaderStore.h"
 #include "BRTransaction.h"
 #include "BRWallet.h"
 #include "BRChainParams.h"
@@ -41,6 +42,20 @@ extern "C" {
 
 typedef struct BRPeerManagerStruct BRPeerManager;
 
+typedef enum {
+    BRSyncModeBloomFilter = 0,  // peers filter blocks and transactions with a BIP37 bloom filter of wallet addresses
+    BRSyncModeCompactFilter     // BIP157 compact block filters are matched locally, so wallet addresses are never sent
+} BRSyncMode;
+
+// the peer manager's state is split into independently locked domains, always locked in this order
+typedef enum {
+    BRPeerManagerLockChain = 0, // blocks, sync state, filters and connected peers
+    BRPeerManagerLockTxRelay,   // peers that have relayed, or were asked for, each transaction
+    BRPeerManagerLockPublish,   // transactions waiting to be published
+    BRPeerManagerLockPeers,     // known peer addresses and dns peer discovery
+    BRPeerManagerLockCount
+} BRPeerManagerLock;
+
 // returns a newly allocated BRPeerManager struct that must be freed by calling BRPeerManagerFree()
 BRPeerManager *BRPeerManagerNew(const BRChainParams *params, BRWallet *wallet, uint32_t earliestKeyTime,
                                 BRMerkleBlock *blocks[], size_t blocksCount, const BRPeer peers[], size_t peersCount);
@@ -55,7 +70,10 @@ BRPeerManager *BRPeerManagerNew(const BRChainParams *params, BRWallet *wallet, u
 // void savePeers(void *, int, const BRPeer[], size_t) - called when peers should be saved to the persistent store
 // - if replace is true, remove any previously saved peers first
 // int networkIsReachable(void *) - must return true when networking is available, false otherwise
-// void threadCleanup(void *) - called before a thread terminates to faciliate any needed cleanup
+// void threadCleanup(void *) - called on the shared peer reactor thread once each peer connection is torn down, and
+// before the manager's job thread and dns lookup threads terminate, to faciliate any needed cleanup
+// syncStarted, syncStopped, saveBlocks and savePeers are called in order on the manager's job thread, never on the
+// reactor thread, so they may block, and the blocks passed to saveBlocks are copies freed once it returns
 void BRPeerManagerSetCallbacks(BRPeerManager *manager, void *info,
                                void (*syncStarted)(void *info),
                                void (*syncStopped)(void *info, int error),
@@ -69,6 +87,27 @@ void BRPeerManagerSetCallbacks(BRPeerManager *manager, void *info,
 // set address to UINT128_ZERO to revert to default behavior
 void BRPeerManagerSetFixedPeer(BRPeerManager *manager, UInt128 address, uint16_t port);
 
+// set this to false to sync through a single download peer with getblocks instead of fetching the header chain first
+// and spreading filtered block requests across all connected peers (enabled by default)
+void BRPeerManagerSetHeadersFirst(BRPeerManager *manager, int headersFirst);
+
+// selects how wallet transactions are found during the chain sync, call before BRPeerManagerConnect()
+// BRSyncModeCompactFilter only connects to nodes serving compact filters, and always does a headers-first sync
+void BRPeerManagerSetSyncMode(BRPeerManager *manager, BRSyncMode mode);
+
+// sets how many of the most recent main chain block headers are kept in memory, older ones are pruned except for
+// difficulty transitions (default is two difficulty intervals, 0 keeps every header)
+void BRPeerManagerSetPruneDepth(BRPeerManager *manager, uint32_t depth);
+
+// backs the main chain headers with a memory mapped header store, not thread-safe, call once before
+// BRPeerManagerConnect()
+// if the last block recorded in store is ahead of the blocks the manager was created with, the chain is restored from
+// the headers up to it, and older ones are paged in as they're needed, so blocks can be empty, otherwise store is filled
+// in from the current chain
+// headers set ahead of their blocks by a headers-first sync are written to store too, but aren't restored
+// store must stay open until the manager is freed
+void BRPeerManagerSetHeaderStore(BRPeerManager *manager, BRHeaderStore *store);
+
 // current connect status
 BRPeerStatus BRPeerManagerConnectStatus(BRPeerManager *manager);
 
@@ -115,10 +154,16 @@ void BRPeerManagerPublishTx(BRPeerManager *manager, BRTransaction *tx, void *inf
 // number of connected peers that have relayed the given unconfirmed transaction
 size_t BRPeerManagerRelayCount(BRPeerManager *manager, UInt256 txHash);
 
+// sets acquired to the number of times the given lock has been acquired, and contended to how many of those times it
+// was already held by another thread
+void BRPeerManagerLockContention(BRPeerManager *manager, BRPeerManagerLock lock, uint64_t *acquired,
+                                 uint64_t *contended);
+
 // return the BRChainParams used to create this peer manager
 const BRChainParams *BRPeerManagerChainParams(BRPeerManager *manager);
 
-// frees memory allocated for manager (call BRPeerManagerDisconnect() first if connected)
+// disconnects if connected, runs any queued callbacks and frees memory allocated for manager (don't call from a
+// callback)
 void BRPeerManagerFree(BRPeerManager *manager);
 
 #ifdef __cplusplus
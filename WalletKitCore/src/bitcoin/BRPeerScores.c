@@ -0,0 +1,265 @@
+//
+//  BRPeerScores.c
+//
+//  Copyright (c) 2026 breadwallet LLC.
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+
+#include "BRPeerScores.h"
+#include "support/BRSet.h"
+#include <stdlib.h>
+#include <float.h>
+#include <assert.h>
+
+typedef struct {
+    BRPeer peer; // must be first, so an entry can be looked up by peer
+    BRPeerStats stats;
+    double windowTime, blockTime; // time the current throughput sample started, and of the last block received
+    uint32_t windowCount; // blocks received in the current throughput sample after the one that started it
+} BRPeerScoreEntry;
+
+struct BRPeerScoresStruct {
+    BRSet *entries;
+};
+
+typedef struct {
+    int rank; // 0 for fast peers, 1 for peers that were never measured or are typical, 2 for slow ones
+    double cost;
+    BRPeer peer;
+} BRPeerRank;
+
+static BRPeerScoreEntry *_BRPeerScoresEntry(BRPeerScores *scores, const BRPeer *peer, double now)
+{
+    BRPeerScoreEntry *entry = BRSetGet(scores->entries, peer), *e, *oldest = NULL;
+
+    if (! entry) {
+        if (BRSetCount(scores->entries) >= PEER_SCORE_MAX_PEERS) { // drop the least recently updated peer
+            for (e = BRSetIterate(scores->entries, NULL); e; e = BRSetIterate(scores->entries, e)) {
+                if (! oldest || e->stats.updateTime < oldest->stats.updateTime) oldest = e;
+            }
+
+            BRSetRemove(scores->entries, oldest);
+            free(oldest);
+        }
+
+        entry = calloc(1, sizeof(*entry));
+        assert(entry != NULL);
+        entry->peer = *peer;
+        BRSetAdd(scores->entries, entry);
+    }
+
+    entry->stats.updateTime = now;
+    return entry;
+}
+
+static double _BRPeerStatsCost(const BRPeerStats *stats)
+{
+    double pingTime = (stats && stats->pingTime > 0) ? stats->pingTime : PEER_SCORE_DEFAULT_PING,
+           blockRate = (stats && stats->blockRate > 0) ? stats->blockRate : PEER_SCORE_DEFAULT_RATE;
+
+    return pingTime + PEER_SCORE_BATCH/blockRate + ((stats) ? stats->stallCount*PEER_SCORE_STALL_PENALTY +
+                                                    stats->misbehavinCount*PEER_SCORE_BAD_PENALTY : 0);
+}
+
+static int _BRPeerStatsRank(const BRPeerStats *stats, double cost)
+{
+    if (cost > PEER_SCORE_DEFAULT_COST*2) return 2;
+    return (stats && cost < PEER_SCORE_DEFAULT_COST) ? 0 : 1;
+}
+
+// comparator for sorting ranked peers, by rank, then lowest cost first for fast peers, then most recent timestamp first
+static int _BRPeerRankCompare(const void *rank, const void *otherRank)
+{
+    const BRPeerRank *a = rank, *b = otherRank;
+
+    if (a->rank != b->rank) return (a->rank < b->rank) ? -1 : 1;
+    if (a->rank == 0 && a->cost != b->cost) return (a->cost < b->cost) ? -1 : 1;
+    if (a->peer.timestamp != b->peer.timestamp) return (a->peer.timestamp > b->peer.timestamp) ? -1 : 1;
+    return 0;
+}
+
+// returns a newly allocated empty table that must be freed by calling BRPeerScoresFree()
+BRPeerScores *BRPeerScoresNew(void)
+{
+    BRPeerScores *scores = calloc(1, sizeof(*scores));
+
+    assert(scores != NULL);
+    scores->entries = BRSetNew(BRPeerHash, BRPeerEq, 100);
+    return scores;
+}
+
+// adds a ping time sample for peer, such as the rolling average BRPeerPingTime() of its current connection
+void BRPeerScoresAddPing(BRPeerScores *scores, const BRPeer *peer, double pingTime, double now)
+{
+    BRPeerScoreEntry *entry;
+
+    assert(scores != NULL);
+    assert(peer != NULL);
+    if (! (pingTime > 0 && pingTime < DBL_MAX)) return; // not measured yet
+    entry = _BRPeerScoresEntry(scores, peer, now);
+    entry->stats.pingTime = (entry->stats.pingTime > 0) ? entry->stats.pingTime*0.5 + pingTime*0.5 : pingTime;
+}
+
+// records a filtered block received from peer at time now, every PEER_SCORE_WINDOW blocks received without a gap of
+// more than PEER_SCORE_IDLE_TIME seconds make a throughput sample
+void BRPeerScoresAddBlock(BRPeerScores *scores, const BRPeer *peer, double now)
+{
+    BRPeerScoreEntry *entry;
+    double blockRate;
+
+    assert(scores != NULL);
+    assert(peer != NULL);
+    entry = _BRPeerScoresEntry(scores, peer, now);
+    entry->stats.blockCount++;
+
+    if (entry->stats.blockCount == 1 || now < entry->blockTime || now - entry->blockTime > PEER_SCORE_IDLE_TIME) {
+        entry->windowTime = now; // peer was idle, so the time since its last block says nothing about its throughput
+        entry->windowCount = 0;
+    }
+    else if (++entry->windowCount >= PEER_SCORE_WINDOW) {
+        blockRate = entry->windowCount/((now - entry->windowTime > 0.001) ? now - entry->windowTime : 0.001);
+        entry->stats.blockRate = (entry->stats.blockRate > 0) ? entry->stats.blockRate*0.5 + blockRate*0.5 : blockRate;
+        entry->stats.stallCount /= 2;
+        entry->windowTime = now;
+        entry->windowCount = 0;
+    }
+
+    entry->blockTime = now;
+}
+
+// records a request to peer that stalled or timed out
+void BRPeerScoresAddStall(BRPeerScores *scores, const BRPeer *peer, double now)
+{
+    assert(scores != NULL);
+    assert(peer != NULL);
+    _BRPeerScoresEntry(scores, peer, now)->stats.stallCount++;
+}
+
+// records a protocol violation by peer
+void BRPeerScoresAddMisbehavin(BRPeerScores *scores, const BRPeer *peer, double now)
+{
+    assert(scores != NULL);
+    assert(peer != NULL);
+    _BRPeerScoresEntry(scores, peer, now)->stats.misbehavinCount++;
+}
+
+// writes the statistics of peer to stats, returns false if peer has none
+int BRPeerScoresGet(const BRPeerScores *scores, const BRPeer *peer, BRPeerStats *stats)
+{
+    const BRPeerScoreEntry *entry;
+
+    assert(scores != NULL);
+    assert(peer != NULL);
+    assert(stats != NULL);
+    entry = BRSetGet(scores->entries, peer);
+    if (entry) *stats = entry->stats;
+    return (entry) ? 1 : 0;
+}
+
+// estimated seconds for peer to deliver PEER_SCORE_BATCH filtered blocks, lower is better
+double BRPeerScoresCost(const BRPeerScores *scores, const BRPeer *peer)
+{
+    const BRPeerScoreEntry *entry;
+
+    assert(scores != NULL);
+    assert(peer != NULL);
+    entry = BRSetGet(scores->entries, peer);
+    return _BRPeerStatsCost((entry) ? &entry->stats : NULL);
+}
+
+// sorts peers measured faster than a typical peer first, lowest cost first, then peers that were never measured or are
+// typical, and then peers that cost more than twice a typical peer, each of those last two groups by most recent
+// timestamp first
+void BRPeerScoresSort(const BRPeerScores *scores, BRPeer peers[], size_t count)
+{
+    const BRPeerScoreEntry *entry;
+    BRPeerRank *ranks;
+    size_t i;
+
+    assert(scores != NULL);
+    assert(peers != NULL || count == 0);
+    if (count < 2) return;
+    ranks = malloc(count*sizeof(*ranks));
+    assert(ranks != NULL);
+
+    for (i = 0; i < count; i++) {
+        entry = BRSetGet(scores->entries, &peers[i]);
+        ranks[i].peer = peers[i];
+        ranks[i].cost = _BRPeerStatsCost((entry) ? &entry->stats : NULL);
+        ranks[i].rank = _BRPeerStatsRank((entry) ? &entry->stats : NULL, ranks[i].cost);
+    }
+
+    qsort(ranks, count, sizeof(*ranks), _BRPeerRankCompare);
+    for (i = 0; i < count; i++) peers[i] = ranks[i].peer;
+    free(ranks);
+}
+
+// adjusts the timestamps of peers about to be saved, so the order BRPeerScoresSort() gives them survives a store that
+// only keeps timestamps: fast peers are stamped with the time they were last measured, and peers that cost more than
+// twice a typical peer are pushed back by PEER_SCORE_TIMESTAMP_PENALTY
+void BRPeerScoresStamp(const BRPeerScores *scores, BRPeer peers[], size_t count)
+{
+    const BRPeerScoreEntry *entry;
+    double cost;
+
+    assert(scores != NULL);
+    assert(peers != NULL || count == 0);
+
+    for (size_t i = 0; i < count; i++) {
+        entry = BRSetGet(scores->entries, &peers[i]);
+        if (! entry) continue;
+        cost = _BRPeerStatsCost(&entry->stats);
+
+        switch (_BRPeerStatsRank(&entry->stats, cost)) {
+            case 0:
+                if (entry->stats.updateTime > peers[i].timestamp) {
+                    peers[i].timestamp = (uint64_t)entry->stats.updateTime;
+                }
+                break;
+            case 2:
+                peers[i].timestamp = (peers[i].timestamp > PEER_SCORE_TIMESTAMP_PENALTY) ?
+                                     peers[i].timestamp - PEER_SCORE_TIMESTAMP_PENALTY : 0;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+// number of peers with statistics
+size_t BRPeerScoresCount(const BRPeerScores *scores)
+{
+    assert(scores != NULL);
+    return BRSetCount(scores->entries);
+}
+
+static void _setApplyFreeEntry(void *info, void *entry)
+{
+    free(entry);
+}
+
+// frees memory allocated for scores
+void BRPeerScoresFree(BRPeerScores *scores)
+{
+    assert(scores != NULL);
+    BRSetApply(scores->entries, NULL, _setApplyFreeEntry);
+    BRSetFree(scores->entries);
+    free(scores);
+}
@@ -0,0 +1,106 @@
+//
+//  BRPeerScores.h
+//
+//  Copyright (c) 2026 breadwallet LLC.
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+
+#ifndef BRPeerScores_h
+#define BRPeerScores_h
+
+#include "BRPeer.h"
+#include <stddef.h>
+#include <inttypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// a peer score table keeps rolling connection quality statistics for each peer address, which outlive any one
+// connection so they can be used to choose which connected peer to download from, and which known peers to try first
+// each peer is summarized by its cost, the estimated seconds it takes to deliver PEER_SCORE_BATCH filtered blocks
+// including penalties for stalls and misbehavior, and peers that were never measured cost the same as a typical peer
+
+#define PEER_SCORE_MAX_PEERS     1000  // peers tracked at once, the least recently updated peer is dropped to make room
+#define PEER_SCORE_BATCH         500   // filtered blocks the cost of a peer is estimated for
+#define PEER_SCORE_WINDOW        50    // filtered blocks in each throughput sample
+#define PEER_SCORE_IDLE_TIME     5.0   // seconds between filtered blocks after which a throughput sample starts over
+#define PEER_SCORE_DEFAULT_PING  0.25  // seconds, assumed ping time of a peer that was never measured
+#define PEER_SCORE_DEFAULT_RATE  100.0 // filtered blocks per second assumed for a peer that was never measured
+#define PEER_SCORE_STALL_PENALTY 10.0  // seconds added to the cost of a peer for each stall
+#define PEER_SCORE_BAD_PENALTY   600.0 // seconds added to the cost of a peer each time it misbehaved
+#define PEER_SCORE_TIMESTAMP_PENALTY (2*60*60) // seconds slow peers' timestamps are pushed back by when saved
+
+#define PEER_SCORE_DEFAULT_COST (PEER_SCORE_DEFAULT_PING + PEER_SCORE_BATCH/PEER_SCORE_DEFAULT_RATE)
+
+typedef struct {
+    double pingTime; // rolling average ping time in seconds, or 0 if unknown
+    double blockRate; // rolling average filtered blocks per second while the peer was sending them, or 0 if unknown
+    uint32_t blockCount; // filtered blocks received
+    uint32_t stallCount; // stalled requests, halved with each throughput sample the peer completes
+    uint32_t misbehavinCount; // protocol violations
+    double updateTime; // time the statistics were last updated
+} BRPeerStats;
+
+typedef struct BRPeerScoresStruct BRPeerScores;
+
+// returns a newly allocated empty table that must be freed by calling BRPeerScoresFree()
+BRPeerScores *BRPeerScoresNew(void);
+
+// adds a ping time sample for peer, such as the rolling average BRPeerPingTime() of its current connection
+void BRPeerScoresAddPing(BRPeerScores *scores, const BRPeer *peer, double pingTime, double now);
+
+// records a filtered block received from peer at time now, every PEER_SCORE_WINDOW blocks received without a gap of
+// more than PEER_SCORE_IDLE_TIME seconds make a throughput sample
+void BRPeerScoresAddBlock(BRPeerScores *scores, const BRPeer *peer, double now);
+
+// records a request to peer that stalled or timed out
+void BRPeerScoresAddStall(BRPeerScores *scores, const BRPeer *peer, double now);
+
+// records a protocol violation by peer
+void BRPeerScoresAddMisbehavin(BRPeerScores *scores, const BRPeer *peer, double now);
+
+// writes the statistics of peer to stats, returns false if peer has none
+int BRPeerScoresGet(const BRPeerScores *scores, const BRPeer *peer, BRPeerStats *stats);
+
+// estimated seconds for peer to deliver PEER_SCORE_BATCH filtered blocks, lower is better
+double BRPeerScoresCost(const BRPeerScores *scores, const BRPeer *peer);
+
+// sorts peers measured faster than a typical peer first, lowest cost first, then peers that were never measured or are
+// typical, and then peers that cost more than twice a typical peer, each of those last two groups by most recent
+// timestamp first
+void BRPeerScoresSort(const BRPeerScores *scores, BRPeer peers[], size_t count);
+
+// adjusts the timestamps of peers about to be saved, so the order BRPeerScoresSort() gives them survives a store that
+// only keeps timestamps: fast peers are stamped with the time they were last measured, and peers that cost more than
+// twice a typical peer are pushed back by PEER_SCORE_TIMESTAMP_PENALTY
+void BRPeerScoresStamp(const BRPeerScores *scores, BRPeer peers[], size_t count);
+
+// number of peers with statistics
+size_t BRPeerScoresCount(const BRPeerScores *scores);
+
+// frees memory allocated for scores
+void BRPeerScoresFree(BRPeerScores *scores);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BRPeerScores_h
@@ -27,6 +27,8 @@
 #include <stdlib.h>
 #include <limits.h>
 #include <time.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #define TX_VERSION           0x00000001
 #define TX_LOCKTIME          0x00000000
@@ -36,6 +38,10 @@
 #define SIGHASH_ANYONECANPAY 0x80 // let other people add inputs, I don't care where the rest of the bitcoins come from
 #define SIGHASH_FORKID       0x40 // use BIP143 digest method (for b-cash/b-gold signatures)
 
+#define TX_SIGN_MAX_THREADS  8            // most threads BRTransactionSignParallel() signs on, counting the caller
+#define TX_SIGN_CHUNK        4            // inputs a signing thread claims at a time
+#define TX_SIGN_STACK_SIZE   (512 * 1024) // stack size of each signing thread
+
 size_t BRTxInputAddress(const BRTxInput *input, char *address, size_t addrLen, BRAddressParams params)
 {
     size_t r = BRAddressFromScriptPubKey(address, addrLen, params, input->script, input->scriptLen);
@@ -351,6 +357,163 @@ static size_t _BRTransactionData(const BRTransaction *tx, uint8_t *data, size_t
     return (! data || off <= dataLen) ? off : 0;
 }
 
+// a compact tx holds its inputs and outputs in the single allocation tx->compact, stored as fixed size records followed
+// by every script, signature and witness they point to
+
+// size of the single allocation holding the inputs and outputs of tx in compact form
+static size_t _BRTransactionCompactSize(const BRTransaction *tx)
+{
+    size_t size = tx->inCount*sizeof(*tx->inputs) + tx->outCount*sizeof(*tx->outputs);
+
+    for (size_t i = 0; i < tx->inCount; i++) {
+        size += tx->inputs[i].scriptLen + tx->inputs[i].sigLen + tx->inputs[i].witLen;
+    }
+
+    for (size_t i = 0; i < tx->outCount; i++) {
+        size += tx->outputs[i].scriptLen;
+    }
+
+    return size;
+}
+
+// copies len bytes to *data and advances it past them, returns where they were copied to, or NULL if bytes is NULL
+static uint8_t *_BRTxDataAdd(uint8_t **data, const uint8_t *bytes, size_t len)
+{
+    uint8_t *r = (bytes) ? *data : NULL;
+
+    if (bytes && len > 0) memcpy(*data, bytes, len);
+    if (bytes) *data += len;
+    return r;
+}
+
+// returns a newly allocated compact copy of tx with its inputs and outputs in the given order
+static BRTransaction *_BRTransactionCompact(const BRTransaction *tx)
+{
+    BRTransaction *cpy = malloc(sizeof(*cpy));
+    BRTxInput *input;
+    BRTxOutput *output;
+    uint8_t *data;
+
+    assert(cpy != NULL);
+    *cpy = *tx;
+    cpy->compact = malloc(_BRTransactionCompactSize(tx) + 1); // one spare byte so an empty tx still gets a pointer
+    assert(cpy->compact != NULL);
+    cpy->inputs = (BRTxInput *)cpy->compact;
+    cpy->outputs = (BRTxOutput *)&cpy->inputs[cpy->inCount];
+    data = (uint8_t *)&cpy->outputs[cpy->outCount];
+
+    for (size_t i = 0; i < tx->inCount; i++) {
+        input = &cpy->inputs[i];
+        *input = tx->inputs[i];
+        input->script = _BRTxDataAdd(&data, tx->inputs[i].script, input->scriptLen);
+        input->signature = _BRTxDataAdd(&data, tx->inputs[i].signature, input->sigLen);
+        input->witness = _BRTxDataAdd(&data, tx->inputs[i].witness, input->witLen);
+    }
+
+    for (size_t i = 0; i < tx->outCount; i++) {
+        output = &cpy->outputs[i];
+        *output = tx->outputs[i];
+        output->script = _BRTxDataAdd(&data, tx->outputs[i].script, output->scriptLen);
+    }
+
+    return cpy;
+}
+
+// points p, which points into the compact allocation of tx, at the same offset into the compact allocation of cpy
+static void *_BRTransactionRebase(const BRTransaction *tx, BRTransaction *cpy, const void *p)
+{
+    return (p) ? cpy->compact + ((const uint8_t *)p - tx->compact) : NULL;
+}
+
+// converts a compact tx back to separately allocated inputs, outputs and scripts so it can be modified in place, and
+// frees the compact allocation
+static void _BRTransactionExpand(BRTransaction *tx)
+{
+    BRTxInput *inputs = tx->inputs, input;
+    BRTxOutput *outputs = tx->outputs, output;
+
+    if (! tx->compact) return;
+    array_new(tx->inputs, tx->inCount);
+    array_new(tx->outputs, tx->outCount);
+
+    for (size_t i = 0; i < tx->inCount; i++) {
+        input = inputs[i];
+        input.script = input.signature = input.witness = NULL;
+        input.scriptLen = input.sigLen = input.witLen = 0;
+        BRTxInputSetScript(&input, inputs[i].script, inputs[i].scriptLen);
+        BRTxInputSetSignature(&input, inputs[i].signature, inputs[i].sigLen);
+        BRTxInputSetWitness(&input, inputs[i].witness, inputs[i].witLen);
+        array_add(tx->inputs, input);
+    }
+
+    for (size_t i = 0; i < tx->outCount; i++) {
+        output = BR_TX_OUTPUT_NONE;
+        output.amount = outputs[i].amount;
+        BRTxOutputSetScript(&output, outputs[i].script, outputs[i].scriptLen);
+        array_add(tx->outputs, output);
+    }
+
+    free(tx->compact);
+    tx->compact = NULL;
+}
+
+// walks a serialized tx the same way BRTransactionParse() does without copying anything, setting the number of inputs
+// and outputs and the total length of their scripts, signatures and witnesses
+// returns false if buf is too short to hold the tx
+static int _BRTransactionMeasure(const uint8_t *buf, size_t bufLen, size_t *inCount, size_t *outCount, size_t *dataLen)
+{
+    int witnessFlag = 0;
+    size_t i, j, off = sizeof(uint32_t), sLen = 0, len = 0, count;
+
+    *dataLen = 0;
+    *inCount = (size_t)BRVarInt(&buf[off], (off <= bufLen ? bufLen - off : 0), &len);
+    off += len;
+    if (*inCount == 0 && off + 1 <= bufLen) witnessFlag = buf[off++];
+
+    if (witnessFlag) {
+        *inCount = (size_t)BRVarInt(&buf[off], (off <= bufLen ? bufLen - off : 0), &len);
+        off += len;
+    }
+
+    for (i = 0; off <= bufLen && i < *inCount; i++) {
+        off += sizeof(UInt256) + sizeof(uint32_t);
+        sLen = (size_t)BRVarInt(&buf[off], (off <= bufLen ? bufLen - off : 0), &len);
+        off += len;
+        if (off > bufLen || sLen > bufLen - off) return 0;
+        if (BRScriptPubKeyIsValid(&buf[off], sLen)) off += sizeof(uint64_t);
+        off += sLen + sizeof(uint32_t);
+        *dataLen += sLen;
+    }
+
+    *outCount = (size_t)BRVarInt(&buf[off], (off <= bufLen ? bufLen - off : 0), &len);
+    off += len;
+
+    for (i = 0; off <= bufLen && i < *outCount; i++) {
+        off += sizeof(uint64_t);
+        sLen = (size_t)BRVarInt(&buf[off], (off <= bufLen ? bufLen - off : 0), &len);
+        off += len;
+        if (off > bufLen || sLen > bufLen - off) return 0;
+        off += sLen;
+        *dataLen += sLen;
+    }
+
+    for (i = 0; witnessFlag && off <= bufLen && i < *inCount; i++) {
+        count = (size_t)BRVarInt(&buf[off], (off <= bufLen ? bufLen - off : 0), &len);
+        off += len;
+
+        for (j = 0, sLen = 0; j < count && off + sLen < bufLen; j++) { // each witness item is at least one byte
+            sLen += (size_t)BRVarInt(&buf[off + sLen], bufLen - (off + sLen), &len);
+            sLen += len;
+        }
+
+        if (j < count || off > bufLen || sLen > bufLen - off) return 0;
+        off += sLen;
+        *dataLen += sLen;
+    }
+
+    return (off <= bufLen && sizeof(uint32_t) <= bufLen - off);
+}
+
 // returns a newly allocated empty transaction that must be freed by calling BRTransactionFree()
 BRTransaction *BRTransactionNew(void)
 {
@@ -365,47 +528,60 @@ BRTransaction *BRTransactionNew(void)
     return tx;
 }
 
-// returns a deep copy of tx and that must be freed by calling BRTransactionFree()
+// returns a compact deep copy of tx and that must be freed by calling BRTransactionFree()
 BRTransaction *BRTransactionCopy(const BRTransaction *tx)
 {
-    BRTransaction *cpy = BRTransactionNew();
-    BRTxInput *inputs = cpy->inputs;
-    BRTxOutput *outputs = cpy->outputs;
-    
+    BRTransaction *cpy;
+    size_t size;
+
     assert(tx != NULL);
+    if (! tx->compact) return _BRTransactionCompact(tx);
+    size = _BRTransactionCompactSize(tx);
+    cpy = malloc(sizeof(*cpy));
+    assert(cpy != NULL);
     *cpy = *tx;
-    cpy->inputs = inputs;
-    cpy->outputs = outputs;
-    cpy->inCount = cpy->outCount = 0;
+    cpy->compact = malloc(size + 1); // one spare byte, as in _BRTransactionCompact()
+    assert(cpy->compact != NULL);
+    memcpy(cpy->compact, tx->compact, size);
+    cpy->inputs = _BRTransactionRebase(tx, cpy, tx->inputs);
+    cpy->outputs = _BRTransactionRebase(tx, cpy, tx->outputs);
 
-    for (size_t i = 0; i < tx->inCount; i++) {
-        BRTransactionAddInput(cpy, tx->inputs[i].txHash, tx->inputs[i].index, tx->inputs[i].amount,
-                              tx->inputs[i].script, tx->inputs[i].scriptLen,
-                              tx->inputs[i].signature, tx->inputs[i].sigLen,
-                              tx->inputs[i].witness, tx->inputs[i].witLen, tx->inputs[i].sequence);
+    for (size_t i = 0; i < cpy->inCount; i++) {
+        cpy->inputs[i].script = _BRTransactionRebase(tx, cpy, tx->inputs[i].script);
+        cpy->inputs[i].signature = _BRTransactionRebase(tx, cpy, tx->inputs[i].signature);
+        cpy->inputs[i].witness = _BRTransactionRebase(tx, cpy, tx->inputs[i].witness);
     }
-    
-    for (size_t i = 0; i < tx->outCount; i++) {
-        BRTransactionAddOutput(cpy, tx->outputs[i].amount, tx->outputs[i].script, tx->outputs[i].scriptLen);
+
+    for (size_t i = 0; i < cpy->outCount; i++) {
+        cpy->outputs[i].script = _BRTransactionRebase(tx, cpy, tx->outputs[i].script);
     }
 
     return cpy;
 }
 
 // buf must contain a serialized tx
-// retruns a transaction that must be freed by calling BRTransactionFree()
+// retruns a compact transaction that must be freed by calling BRTransactionFree()
 BRTransaction *BRTransactionParse(const uint8_t *buf, size_t bufLen)
 {
     assert(buf != NULL || bufLen == 0);
     if (! buf) return NULL;
     
     int isSigned = 1, witnessFlag = 0;
-    uint8_t *sBuf;
-    size_t i, j, off = 0, witnessOff = 0, sLen = 0, len = 0, count;
-    BRTransaction *tx = BRTransactionNew();
+    uint8_t *sBuf, *data;
+    size_t i, j, off = 0, witnessOff = 0, sLen = 0, len = 0, count, inCount, outCount, dataLen;
+    BRTransaction *tx;
     BRTxInput *input;
     BRTxOutput *output;
     
+    if (! _BRTransactionMeasure(buf, bufLen, &inCount, &outCount, &dataLen) || inCount == 0) return NULL;
+    tx = calloc(1, sizeof(*tx));
+    assert(tx != NULL);
+    tx->compact = calloc(1, inCount*sizeof(*input) + outCount*sizeof(*output) + dataLen);
+    assert(tx->compact != NULL);
+    tx->inputs = (BRTxInput *)tx->compact;
+    tx->outputs = (BRTxOutput *)&tx->inputs[inCount];
+    data = (uint8_t *)&tx->outputs[outCount];
+    tx->blockHeight = TX_UNCONFIRMED;
     tx->version = (off + sizeof(uint32_t) <= bufLen) ? UInt32GetLE(&buf[off]) : 0;
     off += sizeof(uint32_t);
     tx->inCount = (size_t)BRVarInt(&buf[off], (off <= bufLen ? bufLen - off : 0), &len);
@@ -417,8 +593,6 @@ BRTransaction *BRTransactionParse(const uint8_t *buf, size_t bufLen)
         off += len;
     }
 
-    array_set_count(tx->inputs, tx->inCount);
-    
     for (i = 0; off <= bufLen && i < tx->inCount; i++) {
         input = &tx->inputs[i];
         input->txHash = (off + sizeof(UInt256) <= bufLen) ? UInt256Get(&buf[off]) : UINT256_ZERO;
@@ -429,22 +603,21 @@ BRTransaction *BRTransactionParse(const uint8_t *buf, size_t bufLen)
         off += len;
         
         if (off + sLen <= bufLen && BRScriptPubKeyIsValid(&buf[off], sLen)) {
-            BRTxInputSetScript(input, &buf[off], sLen);
+            input->script = _BRTxDataAdd(&data, &buf[off], sLen), input->scriptLen = sLen;
             input->amount = (off + sLen + sizeof(uint64_t) <= bufLen) ? UInt64GetLE(&buf[off + sLen]) : 0;
             off += sizeof(uint64_t);
             isSigned = 0;
         }
-        else if (off + sLen <= bufLen) BRTxInputSetSignature(input, &buf[off], sLen);
+        else if (off + sLen <= bufLen) input->signature = _BRTxDataAdd(&data, &buf[off], sLen), input->sigLen = sLen;
         
         off += sLen;
-        if (! witnessFlag) BRTxInputSetWitness(input, &buf[off], 0); // set witness to empty byte array
+        if (! witnessFlag) input->witness = _BRTxDataAdd(&data, &buf[off], 0); // set witness to empty byte array
         input->sequence = (off + sizeof(uint32_t) <= bufLen) ? UInt32GetLE(&buf[off]) : 0;
         off += sizeof(uint32_t);
     }
     
     tx->outCount = (size_t)BRVarInt(&buf[off], (off <= bufLen ? bufLen - off : 0), &len);
     off += len;
-    array_set_count(tx->outputs, tx->outCount);
     
     for (i = 0; off <= bufLen && i < tx->outCount; i++) {
         output = &tx->outputs[i];
@@ -452,7 +625,7 @@ BRTransaction *BRTransactionParse(const uint8_t *buf, size_t bufLen)
         off += sizeof(uint64_t);
         sLen = (size_t)BRVarInt(&buf[off], (off <= bufLen ? bufLen - off : 0), &len);
         off += len;
-        if (off + sLen <= bufLen) BRTxOutputSetScript(output, &buf[off], sLen);
+        if (off + sLen <= bufLen) output->script = _BRTxDataAdd(&data, &buf[off], sLen), output->scriptLen = sLen;
         off += sLen;
     }
     
@@ -466,7 +639,7 @@ BRTransaction *BRTransactionParse(const uint8_t *buf, size_t bufLen)
             sLen += len;
         }
         
-        if (off + sLen <= bufLen) BRTxInputSetWitness(input, &buf[off], sLen);
+        if (off + sLen <= bufLen) input->witness = _BRTxDataAdd(&data, &buf[off], sLen), input->witLen = sLen;
         off += sLen;
     }
     
@@ -516,6 +689,7 @@ void BRTransactionAddInput(BRTransaction *tx, UInt256 txHash, uint32_t index, ui
     assert(witness != NULL || witLen == 0);
     
     if (tx) {
+        _BRTransactionExpand(tx);
         if (script) BRTxInputSetScript(&input, script, scriptLen);
         if (signature) BRTxInputSetSignature(&input, signature, sigLen);
         if (witness) BRTxInputSetWitness(&input, witness, witLen);
@@ -533,6 +707,7 @@ void BRTransactionAddOutput(BRTransaction *tx, uint64_t amount, const uint8_t *s
     assert(script != NULL || scriptLen == 0);
     
     if (tx) {
+        _BRTransactionExpand(tx);
         BRTxOutputSetScript(&output, script, scriptLen);
         array_add(tx->outputs, output);
         tx->outCount = array_count(tx->outputs);
@@ -637,75 +812,197 @@ int BRTransactionIsSigned(const BRTransaction *tx)
     return (tx) ? 1 : 0;
 }
 
+typedef struct {
+    UInt160 hash; // hash160 of pubKey
+    size_t index; // position of the key in keys[], so the first of several keys with the same hash160 is used
+    size_t pkLen;
+    uint8_t pubKey[65];
+} _BRSignKey;
+
+typedef struct {
+    const _BRSignKey *key; // NULL if the input can't be signed with any of the keys
+    int isWitness; // true if script is the witness of a pay-to-witness-pubkey-hash input, otherwise it's the scriptSig
+    size_t scriptLen;
+    uint8_t script[1 + 73 + 1 + 65];
+} _BRInputSig;
+
+typedef struct {
+    const BRTransaction *tx;
+    int forkId;
+    BRKey *keys;
+    _BRInputSig *sigs;
+    const size_t *inputs; // indexes of the inputs to sign
+    size_t count, next; // number of inputs to sign, and the first that hasn't been claimed
+    pthread_mutex_t lock;
+} _BRSignContext;
+
+static int _BRSignKeyCompare(const void *a, const void *b)
+{
+    const _BRSignKey *k1 = a, *k2 = b;
+    int r = memcmp(k1->hash.u8, k2->hash.u8, sizeof(UInt160));
+
+    return (r != 0) ? r : (k1->index < k2->index) ? -1 : (k1->index > k2->index) ? 1 : 0;
+}
+
+// returns the first key in table, sorted with _BRSignKeyCompare(), whose hash160 is hash, or NULL if there isn't one
+static const _BRSignKey *_BRSignKeyFind(const _BRSignKey table[], size_t count, const uint8_t *hash)
+{
+    size_t lo = 0, hi = count, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo)/2;
+        if (memcmp(table[mid].hash.u8, hash, sizeof(UInt160)) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+
+    return (lo < count && memcmp(table[lo].hash.u8, hash, sizeof(UInt160)) == 0) ? &table[lo] : NULL;
+}
+
+// writes to sig the scriptSig, or the witness if the input is pay-to-witness-pubkey-hash, that signs the tx input at
+// index with key, tx is only read so inputs can be signed on several threads at once
+static void _BRTransactionInputSign(const BRTransaction *tx, size_t index, int forkId, const BRKey *key,
+                                    _BRInputSig *sig)
+{
+    const BRTxInput *input = &tx->inputs[index];
+    const uint8_t *elems[BRScriptElements(NULL, 0, input->script, input->scriptLen)];
+    size_t elemsCount = BRScriptElements(elems, sizeof(elems)/sizeof(*elems), input->script, input->scriptLen);
+    uint8_t s[73];
+    size_t sLen, dataLen;
+    UInt256 md = UINT256_ZERO;
+
+    sig->isWitness = (elemsCount == 2 && *elems[0] == OP_0 && *elems[1] == 20); // pay-to-witness-pubkey-hash
+    dataLen = (sig->isWitness) ? _BRTransactionWitnessData(tx, NULL, 0, index, forkId | SIGHASH_ALL) :
+              _BRTransactionData(tx, NULL, 0, index, forkId | SIGHASH_ALL);
+
+    uint8_t _data[0x1000], *data = (dataLen <= sizeof(_data)) ? _data : malloc(dataLen);
+
+    assert(data != NULL);
+    dataLen = (sig->isWitness) ? _BRTransactionWitnessData(tx, data, dataLen, index, forkId | SIGHASH_ALL) :
+              _BRTransactionData(tx, data, dataLen, index, forkId | SIGHASH_ALL);
+    BRSHA256_2(&md, data, dataLen);
+    if (data != _data) free(data);
+    sLen = BRKeySign(key, s, sizeof(s) - 1, md);
+    s[sLen++] = forkId | SIGHASH_ALL;
+    sig->scriptLen = BRScriptPushData(sig->script, sizeof(sig->script), s, sLen);
+
+    // pay-to-witness-pubkey-hash and pay-to-pubkey-hash inputs also push the pubKey, pay-to-pubkey inputs don't
+    if (sig->isWitness || (elemsCount >= 2 && *elems[elemsCount - 2] == OP_EQUALVERIFY)) {
+        sig->scriptLen += BRScriptPushData(&sig->script[sig->scriptLen], sizeof(sig->script) - sig->scriptLen,
+                                           sig->key->pubKey, sig->key->pkLen);
+    }
+}
+
+static void *_BRTransactionSignRoutine(void *arg)
+{
+    _BRSignContext *ctx = arg;
+    size_t i, end;
+
+    pthread_mutex_lock(&ctx->lock);
+
+    while (ctx->next < ctx->count) {
+        i = ctx->next;
+        end = (ctx->count - i > TX_SIGN_CHUNK) ? i + TX_SIGN_CHUNK : ctx->count;
+        ctx->next = end;
+        pthread_mutex_unlock(&ctx->lock);
+
+        for (; i < end; i++) {
+            _BRInputSig *sig = &ctx->sigs[ctx->inputs[i]];
+
+            _BRTransactionInputSign(ctx->tx, ctx->inputs[i], ctx->forkId, &ctx->keys[sig->key->index], sig);
+        }
+
+        pthread_mutex_lock(&ctx->lock);
+    }
+
+    pthread_mutex_unlock(&ctx->lock);
+    return NULL;
+}
+
 // adds signatures to any inputs with NULL signatures that can be signed with any keys
 // forkId is 0 for bitcoin, 0x40 for b-cash, 0x4f for b-gold
 // returns true if tx is signed
 int BRTransactionSign(BRTransaction *tx, int forkId, BRKey keys[], size_t keysCount)
 {
-    UInt160 pkh[keysCount];
-    size_t i, j;
-    
+    return BRTransactionSignParallel(tx, forkId, keys, keysCount, 1);
+}
+
+// like BRTransactionSign(), but the inputs are signed on threadCount threads, counting the calling thread, or one per
+// cpu if threadCount is 0, the signatures are the same as BRTransactionSign() gives
+// returns true if tx is signed
+int BRTransactionSignParallel(BRTransaction *tx, int forkId, BRKey keys[], size_t keysCount, size_t threadCount)
+{
+    _BRSignKey *table;
+    _BRInputSig *sigs;
+    size_t *inputs, i, count = 0, workerCount = 0;
+    const uint8_t *hash;
+    _BRSignContext ctx;
+    pthread_attr_t attr;
+
     assert(tx != NULL);
     assert(keys != NULL || keysCount == 0);
-    
-    for (i = 0; tx && i < keysCount; i++) {
-        pkh[i] = BRKeyHash160(&keys[i]);
+    if (! tx) return 0;
+    _BRTransactionExpand(tx);
+    table = calloc(keysCount + 1, sizeof(*table));
+    sigs = calloc(tx->inCount + 1, sizeof(*sigs));
+    inputs = calloc(tx->inCount + 1, sizeof(*inputs));
+    assert(table != NULL && sigs != NULL && inputs != NULL);
+
+    for (i = 0; i < keysCount; i++) { // hash160 and pubKey of each key, computed once rather than for every input
+        table[i].hash = BRKeyHash160(&keys[i]);
+        table[i].index = i;
+        table[i].pkLen = BRKeyPubKey(&keys[i], table[i].pubKey, sizeof(table[i].pubKey));
     }
-    
-    for (i = 0; tx && i < tx->inCount; i++) {
-        BRTxInput *input = &tx->inputs[i];
-        const uint8_t *hash = BRScriptPKH(input->script, input->scriptLen);
-        
-        j = 0;
-        while (j < keysCount && (! hash || ! UInt160Eq(pkh[j], UInt160Get(hash)))) j++;
-        if (j >= keysCount) continue;
-        
-        const uint8_t *elems[BRScriptElements(NULL, 0, input->script, input->scriptLen)];
-        size_t elemsCount = BRScriptElements(elems, sizeof(elems)/sizeof(*elems), input->script, input->scriptLen);
-        uint8_t pubKey[BRKeyPubKey(&keys[j], NULL, 0)];
-        size_t pkLen = BRKeyPubKey(&keys[j], pubKey, sizeof(pubKey));
-        uint8_t sig[73], script[1 + sizeof(sig) + 1 + sizeof(pubKey)];
-        size_t sigLen, scriptLen;
-        UInt256 md = UINT256_ZERO;
-        
-        if (elemsCount == 2 && *elems[0] == OP_0 && *elems[1] == 20) { // pay-to-witness-pubkey-hash
-            uint8_t data[_BRTransactionWitnessData(tx, NULL, 0, i, forkId | SIGHASH_ALL)];
-            size_t dataLen = _BRTransactionWitnessData(tx, data, sizeof(data), i, forkId | SIGHASH_ALL);
-            
-            BRSHA256_2(&md, data, dataLen);
-            sigLen = BRKeySign(&keys[j], sig, sizeof(sig) - 1, md);
-            sig[sigLen++] = forkId | SIGHASH_ALL;
-            scriptLen = BRScriptPushData(script, sizeof(script), sig, sigLen);
-            scriptLen += BRScriptPushData(&script[scriptLen], sizeof(script) - scriptLen, pubKey, pkLen);
-            BRTxInputSetSignature(input, script, 0);
-            BRTxInputSetWitness(input, script, scriptLen);
-        }
-        else if (elemsCount >= 2 && *elems[elemsCount - 2] == OP_EQUALVERIFY) { // pay-to-pubkey-hash
-            uint8_t data[_BRTransactionData(tx, NULL, 0, i, forkId | SIGHASH_ALL)];
-            size_t dataLen = _BRTransactionData(tx, data, sizeof(data), i, forkId | SIGHASH_ALL);
-            
-            BRSHA256_2(&md, data, dataLen);
-            sigLen = BRKeySign(&keys[j], sig, sizeof(sig) - 1, md);
-            sig[sigLen++] = forkId | SIGHASH_ALL;
-            scriptLen = BRScriptPushData(script, sizeof(script), sig, sigLen);
-            scriptLen += BRScriptPushData(&script[scriptLen], sizeof(script) - scriptLen, pubKey, pkLen);
-            BRTxInputSetSignature(input, script, scriptLen);
-            BRTxInputSetWitness(input, script, 0);
-        }
-        else { // pay-to-pubkey
-            uint8_t data[_BRTransactionData(tx, NULL, 0, i, forkId | SIGHASH_ALL)];
-            size_t dataLen = _BRTransactionData(tx, data, sizeof(data), i, forkId | SIGHASH_ALL);
-
-            BRSHA256_2(&md, data, dataLen);
-            sigLen = BRKeySign(&keys[j], sig, sizeof(sig) - 1, md);
-            sig[sigLen++] = forkId | SIGHASH_ALL;
-            scriptLen = BRScriptPushData(script, sizeof(script), sig, sigLen);
-            BRTxInputSetSignature(input, script, scriptLen);
-            BRTxInputSetWitness(input, script, 0);
+
+    qsort(table, keysCount, sizeof(*table), _BRSignKeyCompare);
+
+    for (i = 0; i < tx->inCount; i++) {
+        hash = BRScriptPKH(tx->inputs[i].script, tx->inputs[i].scriptLen);
+        sigs[i].key = (hash) ? _BRSignKeyFind(table, keysCount, hash) : NULL;
+        if (sigs[i].key) inputs[count++] = i;
+    }
+
+    if (threadCount == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+        threadCount = (cpus > 1) ? (size_t)cpus : 1;
+    }
+
+    if (threadCount > TX_SIGN_MAX_THREADS) threadCount = TX_SIGN_MAX_THREADS;
+    if (threadCount > (count + TX_SIGN_CHUNK - 1)/TX_SIGN_CHUNK) { // no more threads than chunks of inputs
+        threadCount = (count + TX_SIGN_CHUNK - 1)/TX_SIGN_CHUNK;
+    }
+
+    ctx = (_BRSignContext) { tx, forkId, keys, sigs, inputs, count, 0 };
+    pthread_mutex_init(&ctx.lock, NULL);
+
+    pthread_t threads[(threadCount > 1) ? threadCount - 1 : 1];
+
+    if (threadCount > 1 && pthread_attr_init(&attr) == 0) {
+        if (pthread_attr_setstacksize(&attr, TX_SIGN_STACK_SIZE) == 0) {
+            while (workerCount + 1 < threadCount &&
+                   pthread_create(&threads[workerCount], &attr, _BRTransactionSignRoutine, &ctx) == 0) workerCount++;
         }
+
+        pthread_attr_destroy(&attr);
     }
-    
-    if (tx && BRTransactionIsSigned(tx)) {
+
+    _BRTransactionSignRoutine(&ctx); // the calling thread signs alongside the workers
+    for (i = 0; i < workerCount; i++) pthread_join(threads[i], NULL);
+    pthread_mutex_destroy(&ctx.lock);
+
+    for (i = 0; i < count; i++) { // set the signatures in input order once every input has been signed
+        BRTxInput *input = &tx->inputs[inputs[i]];
+        _BRInputSig *sig = &sigs[inputs[i]];
+
+        BRTxInputSetSignature(input, sig->script, (sig->isWitness) ? 0 : sig->scriptLen);
+        BRTxInputSetWitness(input, sig->script, (sig->isWitness) ? sig->scriptLen : 0);
+    }
+
+    free(inputs);
+    free(sigs);
+    free(table);
+
+    if (BRTransactionIsSigned(tx)) {
         uint8_t data[BRTransactionSerialize(tx, NULL, 0)];
         size_t len = BRTransactionSerialize(tx, data, sizeof(data));
         BRTransaction *t = BRTransactionParse(data, len);
@@ -732,7 +1029,11 @@ void BRTransactionFree(BRTransaction *tx)
 {
     assert(tx != NULL);
     
-    if (tx) {
+    if (tx && tx->compact) {
+        free(tx->compact);
+        free(tx);
+    }
+    else if (tx) {
         for (size_t i = 0; i < tx->inCount; i++) {
             BRTxInputSetScript(&tx->inputs[i], NULL, 0);
             BRTxInputSetSignature(&tx->inputs[i], NULL, 0);
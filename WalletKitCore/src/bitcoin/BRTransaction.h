@@ -91,16 +91,23 @@ typedef struct {
     uint32_t lockTime;
     uint32_t blockHeight;
     uint32_t timestamp; // time interval since unix epoch
+    uint8_t *compact; // single allocation holding the inputs and outputs of a compact tx, or NULL (owned by the tx)
 } BRTransaction;
 
+// BRTransactionParse() and BRTransactionCopy() return compact transactions, whose inputs and outputs are stored as
+// fixed size records in a single allocation, followed by all their scripts, signatures and witnesses, and pointed to by
+// the compact field. BRTransactionAddInput(), BRTransactionAddOutput() and BRTransactionSign() move the inputs and
+// outputs of a compact tx back to separate allocations, and free the compact one, before changing it. The
+// BRTxInputSet*() and BRTxOutputSet*() functions must not be called directly on the inputs and outputs of a compact tx
+
 // returns a newly allocated empty transaction that must be freed by calling BRTransactionFree()
 BRTransaction *BRTransactionNew(void);
 
-// returns a deep copy of tx and that must be freed by calling BRTransactionFree()
+// returns a compact deep copy of tx and that must be freed by calling BRTransactionFree()
 BRTransaction *BRTransactionCopy(const BRTransaction *tx);
 
 // buf must contain a serialized tx
-// retruns a transaction that must be freed by calling BRTransactionFree()
+// retruns a compact transaction that must be freed by calling BRTransactionFree()
 BRTransaction *BRTransactionParse(const uint8_t *buf, size_t bufLen);
 
 // returns number of bytes written to buf, or total bufLen needed if buf is NULL
@@ -135,6 +142,11 @@ int BRTransactionIsSigned(const BRTransaction *tx);
 // returns true if tx is signed
 int BRTransactionSign(BRTransaction *tx, int forkId, BRKey keys[], size_t keysCount);
 
+// like BRTransactionSign(), but the inputs are signed on threadCount threads, counting the calling thread, or one per
+// cpu if threadCount is 0, the signatures are the same as BRTransactionSign() gives
+// returns true if tx is signed
+int BRTransactionSignParallel(BRTransaction *tx, int forkId, BRKey keys[], size_t keysCount, size_t threadCount);
+
 // true if tx meets IsStandard() rules: https://bitcoin.org/en/developer-guide#standard-transactions
 int BRTransactionIsStandard(const BRTransaction *tx);
 
@@ -0,0 +1,262 @@
+//
+//  BRTxPeerMap.c
+//
+//  Copyright (c) 2026 breadwallet LLC.
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include "BRTxPeerMap.h"
+#include "support/BRSet.h"
+#include "support/BRArray.h"
+#include <stdlib.h>
+#include <time.h>
+#include <assert.h>
+
+#define TX_PEER_MAP_EXPIRE_INTERVAL(ttl) ((ttl)/4) // how often entries are checked for expiry as peers are added
+
+typedef struct {
+    UInt256 txHash;
+    uint32_t peers; // bitset of peer slots
+    double time; // time a peer was last added
+} BRTxPeerEntry;
+
+struct BRTxPeerMapStruct {
+    BRSet *entries;
+    BRTxPeerEntry **unused; // removed entries, reused before allocating new ones
+    BRPeer slots[TX_PEER_MAP_MAX_PEERS];
+    double slotTimes[TX_PEER_MAP_MAX_PEERS]; // time each slot was last used
+    uint32_t usedSlots; // bitset of slots that hold a peer
+    double ttl, expireTime;
+    void *info;
+    int (*keep)(void *info, UInt256 txHash);
+};
+
+inline static size_t _BRTxPeerEntryHash(const void *entry)
+{
+    return (size_t)((const BRTxPeerEntry *)entry)->txHash.u32[0];
+}
+
+inline static int _BRTxPeerEntryEq(const void *entry, const void *otherEntry)
+{
+    return (entry == otherEntry ||
+            UInt256Eq(((const BRTxPeerEntry *)entry)->txHash, ((const BRTxPeerEntry *)otherEntry)->txHash));
+}
+
+inline static size_t _BRTxPeerBitCount(uint32_t bits)
+{
+    size_t count = 0;
+    
+    for (; bits; bits &= bits - 1) count++;
+    return count;
+}
+
+// slot holding peer, or -1 if peer has no slot
+static int _BRTxPeerMapSlot(const BRTxPeerMap *map, const BRPeer *peer)
+{
+    for (int i = 0; i < TX_PEER_MAP_MAX_PEERS; i++) {
+        if ((map->usedSlots & (1u << i)) && BRPeerEq(&map->slots[i], peer)) return i;
+    }
+    
+    return -1;
+}
+
+static void _BRTxPeerMapRemoveEntry(BRTxPeerMap *map, BRTxPeerEntry *entry)
+{
+    BRSetRemove(map->entries, entry);
+    array_add(map->unused, entry);
+}
+
+// clears slot from every entry and frees it for another peer
+static void _BRTxPeerMapReleaseSlot(BRTxPeerMap *map, int slot)
+{
+    BRTxPeerEntry *entry, **empty;
+    
+    array_new(empty, 10);
+    
+    for (entry = BRSetIterate(map->entries, NULL); entry; entry = BRSetIterate(map->entries, entry)) {
+        entry->peers &= ~(1u << slot);
+        if (entry->peers == 0) array_add(empty, entry);
+    }
+    
+    for (size_t i = 0; i < array_count(empty); i++) _BRTxPeerMapRemoveEntry(map, empty[i]);
+    array_free(empty);
+    map->usedSlots &= ~(1u << slot);
+}
+
+// returns a newly allocated empty map that must be freed by calling BRTxPeerMapFree()
+// int keep(void *, UInt256) returns true if the entry for txHash should be kept past its ttl, and may be NULL
+BRTxPeerMap *BRTxPeerMapNew(double ttl, void *info, int (*keep)(void *info, UInt256 txHash))
+{
+    BRTxPeerMap *map = calloc(1, sizeof(*map));
+    
+    assert(map != NULL);
+    assert(ttl > 0);
+    map->entries = BRSetNew(_BRTxPeerEntryHash, _BRTxPeerEntryEq, 100);
+    array_new(map->unused, 100);
+    map->ttl = ttl;
+    map->expireTime = time(NULL) + TX_PEER_MAP_EXPIRE_INTERVAL(ttl);
+    map->info = info;
+    map->keep = keep;
+    return map;
+}
+
+// true if peer is one of the peers associated with txHash
+int BRTxPeerMapHasPeer(const BRTxPeerMap *map, UInt256 txHash, const BRPeer *peer)
+{
+    const BRTxPeerEntry *entry;
+    int slot;
+    
+    assert(map != NULL);
+    assert(peer != NULL);
+    entry = BRSetGet(map->entries, &txHash);
+    slot = (entry) ? _BRTxPeerMapSlot(map, peer) : -1;
+    return (slot >= 0 && (entry->peers & (1u << slot))) ? 1 : 0;
+}
+
+// number of peers associated with txHash
+size_t BRTxPeerMapCount(const BRTxPeerMap *map, UInt256 txHash)
+{
+    const BRTxPeerEntry *entry;
+    
+    assert(map != NULL);
+    entry = BRSetGet(map->entries, &txHash);
+    return (entry) ? _BRTxPeerBitCount(entry->peers) : 0;
+}
+
+// adds peer to the peers associated with txHash and returns the new total number of peers
+size_t BRTxPeerMapAddPeer(BRTxPeerMap *map, UInt256 txHash, const BRPeer *peer)
+{
+    BRTxPeerEntry *entry;
+    double now = time(NULL);
+    int slot;
+    
+    assert(map != NULL);
+    assert(peer != NULL);
+    if (now >= map->expireTime) BRTxPeerMapExpire(map, now);
+    slot = _BRTxPeerMapSlot(map, peer);
+    
+    for (int i = 0; slot < 0 && i < TX_PEER_MAP_MAX_PEERS; i++) { // peer isn't in a slot yet, so find a free one
+        if ((map->usedSlots & (1u << i)) == 0) slot = i, map->slots[i] = *peer, map->usedSlots |= (1u << i);
+    }
+    
+    if (slot < 0) { // all slots are taken, reuse the least recently used one
+        slot = 0;
+        
+        for (int i = 1; i < TX_PEER_MAP_MAX_PEERS; i++) {
+            if (map->slotTimes[i] < map->slotTimes[slot]) slot = i;
+        }
+        
+        _BRTxPeerMapReleaseSlot(map, slot);
+        map->slots[slot] = *peer;
+        map->usedSlots |= (1u << slot);
+    }
+    
+    map->slotTimes[slot] = now;
+    entry = BRSetGet(map->entries, &txHash);
+    
+    if (! entry) {
+        if (array_count(map->unused) > 0) {
+            entry = map->unused[array_count(map->unused) - 1];
+            array_rm_last(map->unused);
+        }
+        else entry = malloc(sizeof(*entry));
+        
+        assert(entry != NULL);
+        entry->txHash = txHash;
+        entry->peers = 0;
+        BRSetAdd(map->entries, entry);
+    }
+    
+    entry->peers |= (1u << slot);
+    entry->time = now;
+    return _BRTxPeerBitCount(entry->peers);
+}
+
+// removes peer from the peers associated with txHash, returns true if peer was found
+int BRTxPeerMapRemovePeer(BRTxPeerMap *map, UInt256 txHash, const BRPeer *peer)
+{
+    BRTxPeerEntry *entry;
+    int slot;
+    
+    assert(map != NULL);
+    assert(peer != NULL);
+    entry = BRSetGet(map->entries, &txHash);
+    slot = (entry) ? _BRTxPeerMapSlot(map, peer) : -1;
+    if (slot < 0 || (entry->peers & (1u << slot)) == 0) return 0;
+    entry->peers &= ~(1u << slot);
+    if (entry->peers == 0) _BRTxPeerMapRemoveEntry(map, entry);
+    return 1;
+}
+
+// removes peer from the peers associated with every tx hash
+void BRTxPeerMapRemovePeerAll(BRTxPeerMap *map, const BRPeer *peer)
+{
+    int slot;
+    
+    assert(map != NULL);
+    assert(peer != NULL);
+    slot = _BRTxPeerMapSlot(map, peer);
+    if (slot >= 0) _BRTxPeerMapReleaseSlot(map, slot);
+}
+
+// removes entries last added to more than ttl seconds before now, returns the number removed
+size_t BRTxPeerMapExpire(BRTxPeerMap *map, double now)
+{
+    BRTxPeerEntry *entry, **expired;
+    size_t count;
+    
+    assert(map != NULL);
+    array_new(expired, 100);
+    
+    for (entry = BRSetIterate(map->entries, NULL); entry; entry = BRSetIterate(map->entries, entry)) {
+        if (entry->time + map->ttl > now) continue;
+        
+        if (map->keep && map->keep(map->info, entry->txHash)) entry->time = now; // check again in another ttl
+        else array_add(expired, entry);
+    }
+    
+    count = array_count(expired);
+    for (size_t i = 0; i < count; i++) _BRTxPeerMapRemoveEntry(map, expired[i]);
+    array_free(expired);
+    map->expireTime = now + TX_PEER_MAP_EXPIRE_INTERVAL(map->ttl);
+    return count;
+}
+
+// number of tx hashes with at least one associated peer
+size_t BRTxPeerMapTxCount(const BRTxPeerMap *map)
+{
+    assert(map != NULL);
+    return BRSetCount(map->entries);
+}
+
+static void _setApplyFreeEntry(void *info, void *entry)
+{
+    free(entry);
+}
+
+// frees memory allocated for map
+void BRTxPeerMapFree(BRTxPeerMap *map)
+{
+    assert(map != NULL);
+    BRSetApply(map->entries, NULL, _setApplyFreeEntry);
+    BRSetFree(map->entries);
+    for (size_t i = array_count(map->unused); i > 0; i--) free(map->unused[i - 1]);
+    array_free(map->unused);
+    free(map);
+}
@@ -0,0 +1,78 @@
+//
+//  BRTxPeerMap.h
+//
+//  Copyright (c) 2026 breadwallet LLC.
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#ifndef BRTxPeerMap_h
+#define BRTxPeerMap_h
+
+#include "BRPeer.h"
+#include "support/BRInt.h"
+#include <stddef.h>
+#include <inttypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// a tx peer map tracks which peers have relayed, or have been asked for, each of a set of transactions
+// each tx hash maps to a bitset of peer slots, and entries that haven't been added to in ttl seconds are expired unless
+// the keep callback says otherwise
+
+#define TX_PEER_MAP_MAX_PEERS 32           // peers tracked at once, the least recently used peer's slot is reused
+#define TX_PEER_MAP_TTL       (2*60*60.0)  // default seconds an entry is kept after a peer was last added to it
+
+typedef struct BRTxPeerMapStruct BRTxPeerMap;
+
+// returns a newly allocated empty map that must be freed by calling BRTxPeerMapFree()
+// int keep(void *, UInt256) returns true if the entry for txHash should be kept past its ttl, and may be NULL
+BRTxPeerMap *BRTxPeerMapNew(double ttl, void *info, int (*keep)(void *info, UInt256 txHash));
+
+// true if peer is one of the peers associated with txHash
+int BRTxPeerMapHasPeer(const BRTxPeerMap *map, UInt256 txHash, const BRPeer *peer);
+
+// number of peers associated with txHash
+size_t BRTxPeerMapCount(const BRTxPeerMap *map, UInt256 txHash);
+
+// adds peer to the peers associated with txHash and returns the new total number of peers
+size_t BRTxPeerMapAddPeer(BRTxPeerMap *map, UInt256 txHash, const BRPeer *peer);
+
+// removes peer from the peers associated with txHash, returns true if peer was found
+int BRTxPeerMapRemovePeer(BRTxPeerMap *map, UInt256 txHash, const BRPeer *peer);
+
+// removes peer from the peers associated with every tx hash
+void BRTxPeerMapRemovePeerAll(BRTxPeerMap *map, const BRPeer *peer);
+
+// removes entries last added to more than ttl seconds before now, returns the number removed
+// this is done automatically as peers are added, so only needs to be called to expire entries at a specific time
+size_t BRTxPeerMapExpire(BRTxPeerMap *map, double now);
+
+// number of tx hashes with at least one associated peer
+size_t BRTxPeerMapTxCount(const BRTxPeerMap *map);
+
+// frees memory allocated for map
+void BRTxPeerMapFree(BRTxPeerMap *map);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BRTxPeerMap_h
@@ -23,9 +23,11 @@
 //  THE SOFTWARE.
 
 #include "BRWallet.h"
+#include "BRBloomFilter.h"
 #include "support/BRSet.h"
 #include "support/BRAddress.h"
 #include "support/BRArray.h"
+#include "support/BRCrypto.h"
 #include <stdlib.h>
 #include <inttypes.h>
 #include <limits.h>
@@ -33,6 +35,11 @@
 #include <pthread.h>
 #include <assert.h>
 
+#define WALLET_PKH_FILTER_FP_RATE 0.01 // false positive rate of the local filter checked before allPKH
+#define WALLET_SNAPSHOT_VERSION    1
+#define WALLET_SNAPSHOT_TX_INVALID 1 // tx status in a snapshot, 0 if neither invalid nor pending
+#define WALLET_SNAPSHOT_TX_PENDING 2
+
 inline static size_t _pkhHash(const void *pkh)
 {
     return (size_t)UInt32GetLE(pkh);
@@ -75,6 +82,9 @@ struct BRWalletStruct {
     BRAddressParams addrParams;
     UInt160 *internalChain, *externalChain;
     BRSet *allTx, *invalidTx, *pendingTx, *spentOutputs, *usedPKH, *allPKH;
+    BRBloomFilter *pkhFilter; // local filter of allPKH, rules out most foreign scripts without a set lookup
+    size_t pkhFilterCapacity;
+    int isRestored; // true if the wallet state was restored from a snapshot instead of rebuilt
     void *callbackInfo;
     void (*balanceChanged)(void *info, uint64_t balance);
     void (*txAdded)(void *info, BRTransaction *tx);
@@ -131,6 +141,61 @@ inline static void _BRWalletInsertTx(BRWallet *wallet, BRTransaction *tx)
     wallet->transactions[i] = tx;
 }
 
+static int _BRWalletUInt64Compare(const void *a, const void *b)
+{
+    return (*(const uint64_t *)a < *(const uint64_t *)b) ? -1 : (*(const uint64_t *)a > *(const uint64_t *)b);
+}
+
+// sorts wallet->transactions by date, oldest first, after all of them have been added to wallet->allTx at once
+// a stable sort by block height leaves only tx in the same block to be ordered, each is then inserted in front of the
+// first tx in its block that must come after it, so unlike _BRWalletInsertTx() a tx can't be left in front of one it
+// spends just because an unrelated tx was next to it
+static void _BRWalletSortTx(BRWallet *wallet)
+{
+    size_t i, j, start, count = array_count(wallet->transactions);
+    BRTransaction *tx, **txs = malloc(count*sizeof(*txs));
+    uint64_t *keys = malloc(count*sizeof(*keys));
+
+    assert(txs != NULL || count == 0);
+    assert(keys != NULL || count == 0);
+    assert(count <= UINT32_MAX);
+    if (count > 0) memcpy(txs, wallet->transactions, count*sizeof(*txs));
+    for (i = 0; i < count; i++) keys[i] = ((uint64_t)txs[i]->blockHeight << 32) | i; // height, then position added
+    if (count > 0) qsort(keys, count, sizeof(*keys), _BRWalletUInt64Compare);
+    for (i = 0; i < count; i++) wallet->transactions[i] = txs[(uint32_t)keys[i]];
+    free(keys);
+    free(txs);
+
+    for (i = 0, start = 0; i < count; i++) {
+        tx = wallet->transactions[i];
+        if (tx->blockHeight != wallet->transactions[start]->blockHeight) start = i;
+        j = start;
+        while (j < i && _BRWalletTxCompare(wallet, wallet->transactions[j], tx) <= 0) j++;
+        memmove(&wallet->transactions[j + 1], &wallet->transactions[j], (i - j)*sizeof(*wallet->transactions));
+        wallet->transactions[j] = tx;
+    }
+}
+
+static void _setApplyInsertPKH(void *info, void *pkh)
+{
+    BRBloomFilterInsertData(info, pkh, sizeof(UInt160));
+}
+
+// rebuilds pkhFilter from allPKH, with room for as many more elements as are already in it
+static void _BRWalletRebuildPKHFilter(BRWallet *wallet)
+{
+    if (wallet->pkhFilter) BRBloomFilterFree(wallet->pkhFilter);
+    wallet->pkhFilterCapacity = BRSetCount(wallet->allPKH)*2 + 100;
+    wallet->pkhFilter = BRBloomFilterNewLocal(WALLET_PKH_FILTER_FP_RATE, wallet->pkhFilterCapacity);
+    BRSetApply(wallet->allPKH, wallet->pkhFilter, _setApplyInsertPKH);
+}
+
+// true if pkh is in allPKH
+inline static int _BRWalletContainsPKH(BRWallet *wallet, const uint8_t *pkh)
+{
+    return (BRBloomFilterContainsData(wallet->pkhFilter, pkh, sizeof(UInt160)) && BRSetContains(wallet->allPKH, pkh));
+}
+
 // non-threadsafe version of BRWalletContainsTransaction()
 static int _BRWalletContainsTx(BRWallet *wallet, const BRTransaction *tx)
 {
@@ -140,7 +205,7 @@ static int _BRWalletContainsTx(BRWallet *wallet, const BRTransaction *tx)
     
     for (size_t i = 0; ! r && i < tx->outCount; i++) {
         pkh = BRScriptPKH(tx->outputs[i].script, tx->outputs[i].scriptLen);
-        if (pkh && BRSetContains(wallet->allPKH, pkh)) r = 1;
+        if (pkh && _BRWalletContainsPKH(wallet, pkh)) r = 1;
     }
     
     for (size_t i = 0; ! r && i < tx->inCount; i++) {
@@ -148,14 +213,14 @@ static int _BRWalletContainsTx(BRWallet *wallet, const BRTransaction *tx)
         uint32_t n = tx->inputs[i].index;
         
         pkh = (t && n < t->outCount) ? BRScriptPKH(t->outputs[n].script, t->outputs[n].scriptLen) : NULL;
-        if (pkh && BRSetContains(wallet->allPKH, pkh)) r = 1;
+        if (pkh && _BRWalletContainsPKH(wallet, pkh)) r = 1;
     }
     
     for (size_t i = 0; ! r && i < tx->inCount; i++) {
         size_t l = (tx->inputs[i].witLen > 0) ? BRWitnessPKH(hash.u8, tx->inputs[i].witness, tx->inputs[i].witLen)
                                               : BRSignaturePKH(hash.u8, tx->inputs[i].signature, tx->inputs[i].sigLen);
 
-        if (l > 0 && BRSetContains(wallet->allPKH, &hash)) r = 1;
+        if (l > 0 && _BRWalletContainsPKH(wallet, hash.u8)) r = 1;
     }
 
     return r;
@@ -166,10 +231,16 @@ static void _BRWalletUpdateBalance(BRWallet *wallet)
     int isInvalid, isPending;
     uint64_t balance = 0, prevBalance = 0;
     time_t now = time(NULL);
-    size_t i, j;
+    size_t i, j, k, last = 0, outCount = 0;
     BRTransaction *tx, *t;
+    BRUTXO *o;
+    BRSet *unspent;
     const uint8_t *pkh;
     
+    // utxos won't grow past the total output count, so pointers into it stay valid for the unspent set below
+    for (i = 0; i < array_count(wallet->transactions); i++) outCount += wallet->transactions[i]->outCount;
+    if (array_capacity(wallet->utxos) < outCount) array_set_capacity(wallet->utxos, outCount);
+    unspent = BRSetNew(BRUTXOHash, BRUTXOEq, outCount);
     array_clear(wallet->utxos);
     array_clear(wallet->balanceHist);
     BRSetClear(wallet->spentOutputs);
@@ -229,22 +300,35 @@ static void _BRWalletUpdateBalance(BRWallet *wallet)
         // TODO: don't add outputs below TX_MIN_OUTPUT_AMOUNT
         // TODO: don't add coin generation outputs < 100 blocks deep
         // NOTE: balance/UTXOs will then need to be recalculated when last block changes
+        // transaction ordering is not guaranteed, so new outputs are checked against the entire spent output set
         for (j = 0; j < tx->outCount; j++) {
             pkh = BRScriptPKH(tx->outputs[j].script, tx->outputs[j].scriptLen);
 
             if (pkh && BRSetContains(wallet->allPKH, pkh)) {
                 BRSetAdd(wallet->usedPKH, (void *)pkh);
                 array_add(wallet->utxos, ((const BRUTXO) { tx->txHash, (uint32_t)j }));
-                balance += tx->outputs[j].amount;
+                if (BRSetContains(wallet->spentOutputs, &wallet->utxos[array_count(wallet->utxos) - 1])) {
+                    array_rm_last(wallet->utxos);
+                }
+                else {
+                    BRSetAdd(unspent, &wallet->utxos[array_count(wallet->utxos) - 1]);
+                    balance += tx->outputs[j].amount;
+                }
             }
         }
 
-        // transaction ordering is not guaranteed, so check the entire UTXO set against the entire spent output set
-        for (j = array_count(wallet->utxos); j > 0; j--) {
-            if (! BRSetContains(wallet->spentOutputs, &wallet->utxos[j - 1])) continue;
-            t = BRSetGet(wallet->allTx, &wallet->utxos[j - 1].hash);
-            balance -= t->outputs[wallet->utxos[j - 1].n].amount;
-            array_rm(wallet->utxos, j - 1);
+        // the rest of the UTXO set was already checked, so only inputs spent since the last check can remove from it,
+        // spent UTXOs are zeroed and dropped from the array once all transactions are done to keep it in order
+        for (; last <= i; last++) {
+            t = wallet->transactions[last];
+            if (BRSetContains(wallet->invalidTx, t)) continue;
+
+            for (k = 0; k < t->inCount; k++) {
+                o = BRSetRemove(unspent, &t->inputs[k]);
+                if (! o) continue;
+                balance -= ((BRTransaction *)BRSetGet(wallet->allTx, &o->hash))->outputs[o->n].amount;
+                *o = (const BRUTXO) { UINT256_ZERO, 0 };
+            }
         }
         
         if (prevBalance < balance) wallet->totalReceived += balance - prevBalance;
@@ -253,12 +337,214 @@ static void _BRWalletUpdateBalance(BRWallet *wallet)
         prevBalance = balance;
     }
 
+    for (i = 0, j = 0; i < array_count(wallet->utxos); i++) {
+        if (! UInt256IsZero(wallet->utxos[i].hash)) wallet->utxos[j++] = wallet->utxos[i];
+    }
+
+    array_set_count(wallet->utxos, j);
+    BRSetFree(unspent);
     assert(array_count(wallet->balanceHist) == array_count(wallet->transactions));
     wallet->balance = balance;
 }
 
+// hash of the master pubKey, the hash and block height of each tx in order, and the rest of the snapshot data, so the
+// wallet state in a snapshot is only used for the transactions it was derived from, and only if it isn't corrupted
+static UInt256 _BRWalletSnapshotHash(BRMasterPubKey mpk, BRTransaction *transactions[], size_t txCount,
+                                     const uint8_t *data, size_t dataLen)
+{
+    size_t i, off = 0, len = sizeof(uint32_t) + sizeof(UInt256) + sizeof(mpk.pubKey) +
+                             txCount*(sizeof(UInt256) + sizeof(uint32_t)) + dataLen;
+    uint8_t *buf = malloc(len);
+    UInt256 md;
+
+    assert(buf != NULL);
+    UInt32SetLE(&buf[off], mpk.fingerPrint);
+    off += sizeof(uint32_t);
+    UInt256Set(&buf[off], mpk.chainCode);
+    off += sizeof(UInt256);
+    memcpy(&buf[off], mpk.pubKey, sizeof(mpk.pubKey));
+    off += sizeof(mpk.pubKey);
+
+    for (i = 0; i < txCount; i++) {
+        UInt256Set(&buf[off], transactions[i]->txHash);
+        off += sizeof(UInt256);
+        UInt32SetLE(&buf[off], transactions[i]->blockHeight);
+        off += sizeof(uint32_t);
+    }
+
+    if (dataLen > 0) memcpy(&buf[off], data, dataLen);
+    BRSHA256(&md, buf, len);
+    free(buf);
+    return md;
+}
+
+// restores the tx order, addresses, UTXOs and balance history from snapshot, returns false and leaves the wallet as it
+// was if snapshot doesn't match wallet->transactions and masterPubKey
+static int _BRWalletRestoreSnapshot(BRWallet *wallet, const uint8_t *snapshot, size_t snapshotLen)
+{
+    size_t i, j, off = 0, txCount = array_count(wallet->transactions), histOff, statusOff, utxoOff, usedOff, extOff,
+           intOff, utxoCount = 0, usedCount = 0, extCount = 0, intCount = 0;
+    BRTransaction *tx, **txs;
+    BRSet *restored;
+    UInt256 hash;
+    uint32_t n;
+    int r = 1, needsUpdate = 0;
+
+    if (sizeof(uint32_t) + sizeof(UInt256) + sizeof(uint32_t) > snapshotLen) return 0;
+    if (UInt32GetLE(&snapshot[off]) != WALLET_SNAPSHOT_VERSION) return 0;
+    off += sizeof(uint32_t) + sizeof(UInt256);
+    if (UInt32GetLE(&snapshot[off]) != txCount) return 0;
+    off += sizeof(uint32_t);
+    if (off + txCount*(sizeof(UInt256) + sizeof(uint64_t) + 1) + sizeof(uint64_t)*3 > snapshotLen) return 0;
+    txs = malloc(txCount*sizeof(*txs));
+    restored = BRSetNew(BRTransactionHash, BRTransactionEq, txCount);
+    assert(txs != NULL || txCount == 0);
+
+    for (i = 0; r && i < txCount; i++) { // each tx must be in the wallet exactly once
+        hash = UInt256Get(&snapshot[off + i*sizeof(UInt256)]);
+        tx = BRSetGet(wallet->allTx, &hash);
+        if (! tx || BRSetAdd(restored, tx) != NULL) r = 0;
+        txs[i] = tx;
+    }
+
+    BRSetFree(restored);
+    off += txCount*sizeof(UInt256);
+    if (r) {
+        hash = _BRWalletSnapshotHash(wallet->masterPubKey, txs, txCount, &snapshot[sizeof(uint32_t) + sizeof(UInt256)],
+                                     snapshotLen - sizeof(uint32_t) - sizeof(UInt256));
+        if (! UInt256Eq(UInt256Get(&snapshot[sizeof(uint32_t)]), hash)) r = 0;
+    }
+
+    histOff = off;
+    off += txCount*sizeof(uint64_t);
+    statusOff = off;
+    off += txCount + sizeof(uint64_t)*3;
+
+    for (i = 0; r && i < txCount; i++) {
+        if (snapshot[statusOff + i] > WALLET_SNAPSHOT_TX_PENDING) r = 0;
+    }
+
+    if (r && off + sizeof(uint32_t) <= snapshotLen) utxoCount = UInt32GetLE(&snapshot[off]), off += sizeof(uint32_t);
+    else r = 0;
+    utxoOff = off;
+    off += utxoCount*(sizeof(UInt256) + sizeof(uint32_t));
+    if (off > snapshotLen) r = 0;
+
+    for (i = 0; r && i < utxoCount; i++) { // each UTXO must be an output of a wallet tx
+        hash = UInt256Get(&snapshot[utxoOff + i*(sizeof(UInt256) + sizeof(uint32_t))]);
+        n = UInt32GetLE(&snapshot[utxoOff + i*(sizeof(UInt256) + sizeof(uint32_t)) + sizeof(UInt256)]);
+        tx = BRSetGet(wallet->allTx, &hash);
+        if (! tx || n >= tx->outCount) r = 0;
+    }
+
+    if (r && off + sizeof(uint32_t) <= snapshotLen) usedCount = UInt32GetLE(&snapshot[off]), off += sizeof(uint32_t);
+    else r = 0;
+    usedOff = off;
+    off += usedCount*sizeof(uint32_t)*2;
+    if (off > snapshotLen) r = 0;
+
+    for (i = 0; r && i < usedCount; i++) { // each used pkh is given as the tx and output it's in
+        j = UInt32GetLE(&snapshot[usedOff + i*sizeof(uint32_t)*2]);
+        n = UInt32GetLE(&snapshot[usedOff + i*sizeof(uint32_t)*2 + sizeof(uint32_t)]);
+        if (j >= txCount || n >= txs[j]->outCount ||
+            ! BRScriptPKH(txs[j]->outputs[n].script, txs[j]->outputs[n].scriptLen)) r = 0;
+    }
+
+    if (r && off + sizeof(uint32_t) <= snapshotLen) extCount = UInt32GetLE(&snapshot[off]), off += sizeof(uint32_t);
+    else r = 0;
+    extOff = off;
+    off += extCount*sizeof(UInt160);
+    if (r && off + sizeof(uint32_t) <= snapshotLen) intCount = UInt32GetLE(&snapshot[off]), off += sizeof(uint32_t);
+    else r = 0;
+    intOff = off;
+    off += intCount*sizeof(UInt160);
+    if (off != snapshotLen) r = 0;
+
+    if (r) {
+        if (txCount > 0) memcpy(wallet->transactions, txs, txCount*sizeof(*txs));
+        for (i = 0; i < extCount; i++) {
+            array_add(wallet->externalChain, UInt160Get(&snapshot[extOff + i*sizeof(UInt160)]));
+        }
+
+        for (i = 0; i < intCount; i++) {
+            array_add(wallet->internalChain, UInt160Get(&snapshot[intOff + i*sizeof(UInt160)]));
+        }
+
+        for (i = 0; i < extCount; i++) BRSetAdd(wallet->allPKH, &wallet->externalChain[i]);
+        for (i = 0; i < intCount; i++) BRSetAdd(wallet->allPKH, &wallet->internalChain[i]);
+        _BRWalletRebuildPKHFilter(wallet);
+
+        // the snapshot balance is stale if the gap limit adds an address that a wallet tx pays to, usedPKH still has
+        // the pkh of every wallet tx output
+        BRWalletUnusedAddrs(wallet, NULL, SEQUENCE_GAP_LIMIT_EXTERNAL_EXTENDED, SEQUENCE_EXTERNAL_CHAIN);
+        BRWalletUnusedAddrs(wallet, NULL, SEQUENCE_GAP_LIMIT_INTERNAL_EXTENDED, SEQUENCE_INTERNAL_CHAIN);
+
+        for (i = extCount; ! needsUpdate && i < array_count(wallet->externalChain); i++) {
+            if (BRSetContains(wallet->usedPKH, &wallet->externalChain[i])) needsUpdate = 1;
+        }
+
+        for (i = intCount; ! needsUpdate && i < array_count(wallet->internalChain); i++) {
+            if (BRSetContains(wallet->usedPKH, &wallet->internalChain[i])) needsUpdate = 1;
+        }
+
+        // whether a tx with a lockTime is pending depends on the current block height and time
+        for (i = 0; ! needsUpdate && i < txCount; i++) {
+            if (txs[i]->blockHeight != TX_UNCONFIRMED || txs[i]->lockTime == 0) continue;
+
+            for (j = 0; j < txs[i]->inCount; j++) {
+                if (txs[i]->inputs[j].sequence < UINT32_MAX) needsUpdate = 1;
+            }
+        }
+    }
+
+    if (r && needsUpdate) _BRWalletUpdateBalance(wallet);
+    else if (r) {
+        BRSetClear(wallet->usedPKH);
+
+        for (i = 0; i < txCount; i++) {
+            array_add(wallet->balanceHist, UInt64GetLE(&snapshot[histOff + i*sizeof(uint64_t)]));
+            if (snapshot[statusOff + i] == WALLET_SNAPSHOT_TX_INVALID) BRSetAdd(wallet->invalidTx, txs[i]);
+            if (snapshot[statusOff + i] == WALLET_SNAPSHOT_TX_INVALID) continue;
+            if (snapshot[statusOff + i] == WALLET_SNAPSHOT_TX_PENDING) BRSetAdd(wallet->pendingTx, txs[i]);
+
+            for (j = 0; j < txs[i]->inCount; j++) {
+                BRSetAdd(wallet->spentOutputs, &txs[i]->inputs[j]);
+            }
+        }
+
+        wallet->balance = UInt64GetLE(&snapshot[statusOff + txCount]);
+        wallet->totalSent = UInt64GetLE(&snapshot[statusOff + txCount + sizeof(uint64_t)]);
+        wallet->totalReceived = UInt64GetLE(&snapshot[statusOff + txCount + sizeof(uint64_t)*2]);
+
+        for (i = 0; i < utxoCount; i++) {
+            array_add(wallet->utxos, ((const BRUTXO) {
+                UInt256Get(&snapshot[utxoOff + i*(sizeof(UInt256) + sizeof(uint32_t))]),
+                UInt32GetLE(&snapshot[utxoOff + i*(sizeof(UInt256) + sizeof(uint32_t)) + sizeof(UInt256)])
+            }));
+        }
+
+        for (i = 0; i < usedCount; i++) {
+            tx = txs[UInt32GetLE(&snapshot[usedOff + i*sizeof(uint32_t)*2])];
+            n = UInt32GetLE(&snapshot[usedOff + i*sizeof(uint32_t)*2 + sizeof(uint32_t)]);
+            BRSetAdd(wallet->usedPKH, (void *)BRScriptPKH(tx->outputs[n].script, tx->outputs[n].scriptLen));
+        }
+    }
+
+    free(txs);
+    return r;
+}
+
 // allocates and populates a BRWallet struct which must be freed by calling BRWalletFree()
 BRWallet *BRWalletNew(BRAddressParams addrParams, BRTransaction *transactions[], size_t txCount, BRMasterPubKey mpk)
+{
+    return BRWalletNewWithSnapshot(addrParams, transactions, txCount, mpk, NULL, 0);
+}
+
+// like BRWalletNew(), but if snapshot was made by BRWalletSnapshot() from the same master pubKey and transactions at
+// the same block heights, the transaction order, addresses, UTXOs and balance history are restored from it instead of
+// being rebuilt, otherwise the wallet is rebuilt in full
+BRWallet *BRWalletNewWithSnapshot(BRAddressParams addrParams, BRTransaction *transactions[], size_t txCount,
+                                  BRMasterPubKey mpk, const uint8_t *snapshot, size_t snapshotLen)
 {
     BRWallet *wallet = NULL;
     BRTransaction *tx;
@@ -281,24 +567,29 @@ BRWallet *BRWalletNew(BRAddressParams addrParams, BRTransaction *transactions[],
     wallet->spentOutputs = BRSetNew(BRUTXOHash, BRUTXOEq, txCount + 100);
     wallet->usedPKH = BRSetNew(_pkhHash, _pkhEq, txCount + 100);
     wallet->allPKH = BRSetNew(_pkhHash, _pkhEq, txCount + 100);
+    _BRWalletRebuildPKHFilter(wallet);
     pthread_mutex_init(&wallet->lock, NULL);
 
     for (size_t i = 0; transactions && i < txCount; i++) {
         tx = transactions[i];
         if (! BRTransactionIsSigned(tx) || BRSetContains(wallet->allTx, tx)) continue;
         BRSetAdd(wallet->allTx, tx);
-        _BRWalletInsertTx(wallet, tx);
+        array_add(wallet->transactions, tx);
 
         for (size_t j = 0; j < tx->outCount; j++) {
             pkh = BRScriptPKH(tx->outputs[j].script, tx->outputs[j].scriptLen);
             if (pkh) BRSetAdd(wallet->usedPKH, (void *)pkh);
         }
     }
-    
-    BRWalletUnusedAddrs(wallet, NULL, SEQUENCE_GAP_LIMIT_EXTERNAL_EXTENDED, SEQUENCE_EXTERNAL_CHAIN);
-    BRWalletUnusedAddrs(wallet, NULL, SEQUENCE_GAP_LIMIT_INTERNAL_EXTENDED, SEQUENCE_INTERNAL_CHAIN);
 
-    _BRWalletUpdateBalance(wallet);
+    wallet->isRestored = (snapshot && _BRWalletRestoreSnapshot(wallet, snapshot, snapshotLen));
+
+    if (! wallet->isRestored) {
+        _BRWalletSortTx(wallet);
+        BRWalletUnusedAddrs(wallet, NULL, SEQUENCE_GAP_LIMIT_EXTERNAL_EXTENDED, SEQUENCE_EXTERNAL_CHAIN);
+        BRWalletUnusedAddrs(wallet, NULL, SEQUENCE_GAP_LIMIT_INTERNAL_EXTENDED, SEQUENCE_INTERNAL_CHAIN);
+        _BRWalletUpdateBalance(wallet);
+    }
 
     if (txCount > 0 && ! _BRWalletContainsTx(wallet, transactions[0])) { // verify transactions match master pubKey
         BRWalletFree(wallet);
@@ -375,7 +666,10 @@ size_t BRWalletUnusedAddrs(BRWallet *wallet, BRAddress addrs[], uint32_t gapLimi
     if (chain == origChain) {
         for (i = startCount; i < count; i++) {
             BRSetAdd(wallet->allPKH, &chain[i]);
+            BRBloomFilterInsertData(wallet->pkhFilter, chain[i].u8, sizeof(UInt160));
         }
+        
+        if (wallet->pkhFilter->elemCount > wallet->pkhFilterCapacity) _BRWalletRebuildPKHFilter(wallet);
     }
     else {
         if (internal == SEQUENCE_EXTERNAL_CHAIN) wallet->externalChain = chain;
@@ -390,6 +684,8 @@ size_t BRWalletUnusedAddrs(BRWallet *wallet, BRAddress addrs[], uint32_t gapLimi
         for (i = array_count(wallet->externalChain); i > 0; i--) {
             BRSetAdd(wallet->allPKH, &wallet->externalChain[i - 1]);
         }
+        
+        _BRWalletRebuildPKHFilter(wallet);
     }
 
     pthread_mutex_unlock(&wallet->lock);
@@ -760,7 +1056,7 @@ int BRWalletSignTransaction(BRWallet *wallet, BRTransaction *tx, uint8_t forkId,
         BRBIP32PrivKeyList(&keys[internalCount], externalCount, seed, seedLen, SEQUENCE_EXTERNAL_CHAIN, externalIdx);
         // TODO: XXX wipe seed callback
         seed = NULL;
-        if (tx) r = BRTransactionSign(tx, forkId, keys, internalCount + externalCount);
+        if (tx) r = BRTransactionSignParallel(tx, forkId, keys, internalCount + externalCount, 0);
         for (i = 0; i < internalCount + externalCount; i++) BRKeyClean(&keys[i]);
     }
     else r = -1; // user canceled authentication
@@ -1320,6 +1616,120 @@ uint64_t BRWalletMaxOutputAmountWithFeePerKb(BRWallet *wallet, uint64_t feePerKb
     return (amount > fee) ? amount - fee : 0;
 }
 
+// writes a snapshot of the wallet state derived from its transactions to buf, to be passed to BRWalletNewWithSnapshot()
+// returns number of bytes written, or buf length needed if buf is NULL
+size_t BRWalletSnapshot(BRWallet *wallet, uint8_t *buf, size_t bufLen)
+{
+    size_t i, j, off = 0, len, txCount, usedCount = 0;
+    BRTransaction *tx;
+    const uint8_t *pkh;
+
+    assert(wallet != NULL);
+    pthread_mutex_lock(&wallet->lock);
+    txCount = array_count(wallet->transactions);
+
+    for (i = 0; i < txCount; i++) { // usedPKH points into the scripts of the outputs that first paid to each address
+        tx = wallet->transactions[i];
+
+        for (j = 0; j < tx->outCount; j++) {
+            pkh = BRScriptPKH(tx->outputs[j].script, tx->outputs[j].scriptLen);
+            if (pkh && BRSetGet(wallet->usedPKH, pkh) == pkh) usedCount++;
+        }
+    }
+
+    len = sizeof(uint32_t) + sizeof(UInt256) + sizeof(uint32_t) + txCount*(sizeof(UInt256) + sizeof(uint64_t) + 1) +
+          sizeof(uint64_t)*3 + sizeof(uint32_t) + array_count(wallet->utxos)*(sizeof(UInt256) + sizeof(uint32_t)) +
+          sizeof(uint32_t) + usedCount*sizeof(uint32_t)*2 + sizeof(uint32_t) +
+          array_count(wallet->externalChain)*sizeof(UInt160) + sizeof(uint32_t) +
+          array_count(wallet->internalChain)*sizeof(UInt160);
+
+    if (buf && len <= bufLen) {
+        UInt32SetLE(&buf[off], WALLET_SNAPSHOT_VERSION);
+        off += sizeof(uint32_t) + sizeof(UInt256); // hash is set last, once the data it covers is written
+        UInt32SetLE(&buf[off], (uint32_t)txCount);
+        off += sizeof(uint32_t);
+
+        for (i = 0; i < txCount; i++) {
+            UInt256Set(&buf[off], wallet->transactions[i]->txHash);
+            off += sizeof(UInt256);
+        }
+
+        for (i = 0; i < txCount; i++) {
+            UInt64SetLE(&buf[off], wallet->balanceHist[i]);
+            off += sizeof(uint64_t);
+        }
+
+        for (i = 0; i < txCount; i++) {
+            tx = wallet->transactions[i];
+            buf[off++] = (BRSetContains(wallet->invalidTx, tx)) ? WALLET_SNAPSHOT_TX_INVALID :
+                         (BRSetContains(wallet->pendingTx, tx)) ? WALLET_SNAPSHOT_TX_PENDING : 0;
+        }
+
+        UInt64SetLE(&buf[off], wallet->balance);
+        off += sizeof(uint64_t);
+        UInt64SetLE(&buf[off], wallet->totalSent);
+        off += sizeof(uint64_t);
+        UInt64SetLE(&buf[off], wallet->totalReceived);
+        off += sizeof(uint64_t);
+        UInt32SetLE(&buf[off], (uint32_t)array_count(wallet->utxos));
+        off += sizeof(uint32_t);
+
+        for (i = 0; i < array_count(wallet->utxos); i++) {
+            UInt256Set(&buf[off], wallet->utxos[i].hash);
+            off += sizeof(UInt256);
+            UInt32SetLE(&buf[off], wallet->utxos[i].n);
+            off += sizeof(uint32_t);
+        }
+
+        UInt32SetLE(&buf[off], (uint32_t)usedCount);
+        off += sizeof(uint32_t);
+
+        for (i = 0; i < txCount; i++) {
+            tx = wallet->transactions[i];
+
+            for (j = 0; j < tx->outCount; j++) {
+                pkh = BRScriptPKH(tx->outputs[j].script, tx->outputs[j].scriptLen);
+                if (! pkh || BRSetGet(wallet->usedPKH, pkh) != pkh) continue;
+                UInt32SetLE(&buf[off], (uint32_t)i);
+                off += sizeof(uint32_t);
+                UInt32SetLE(&buf[off], (uint32_t)j);
+                off += sizeof(uint32_t);
+            }
+        }
+
+        UInt32SetLE(&buf[off], (uint32_t)array_count(wallet->externalChain));
+        off += sizeof(uint32_t);
+
+        for (i = 0; i < array_count(wallet->externalChain); i++) {
+            UInt160Set(&buf[off], wallet->externalChain[i]);
+            off += sizeof(UInt160);
+        }
+
+        UInt32SetLE(&buf[off], (uint32_t)array_count(wallet->internalChain));
+        off += sizeof(uint32_t);
+
+        for (i = 0; i < array_count(wallet->internalChain); i++) {
+            UInt160Set(&buf[off], wallet->internalChain[i]);
+            off += sizeof(UInt160);
+        }
+
+        assert(off == len);
+        off = sizeof(uint32_t) + sizeof(UInt256);
+        UInt256Set(&buf[sizeof(uint32_t)], _BRWalletSnapshotHash(wallet->masterPubKey, wallet->transactions, txCount,
+                                                                 &buf[off], len - off));
+    }
+
+    pthread_mutex_unlock(&wallet->lock);
+    return (! buf || len <= bufLen) ? len : 0;
+}
+
+// true if the wallet state was restored from the snapshot passed to BRWalletNewWithSnapshot(), false if it was rebuilt
+int BRWalletIsRestoredFromSnapshot(BRWallet *wallet)
+{
+    assert(wallet != NULL);
+    return wallet->isRestored;
+}
+
 static void _setApplyFreeTx(void *info, void *tx)
 {
     BRTransactionFree(tx);
@@ -1331,6 +1741,7 @@ void BRWalletFree(BRWallet *wallet)
     assert(wallet != NULL);
     pthread_mutex_lock(&wallet->lock);
     BRSetFree(wallet->allPKH);
+    BRBloomFilterFree(wallet->pkhFilter);
     BRSetFree(wallet->usedPKH);
     BRSetFree(wallet->invalidTx);
     BRSetFree(wallet->pendingTx);
@@ -61,6 +61,19 @@ typedef struct BRWalletStruct BRWallet;
 // allocates and populates a BRWallet struct that must be freed by calling BRWalletFree()
 BRWallet *BRWalletNew(BRAddressParams addrParams, BRTransaction *transactions[], size_t txCount, BRMasterPubKey mpk);
 
+// like BRWalletNew(), but if snapshot was made by BRWalletSnapshot() from the same master pubKey and transactions at
+// the same block heights, the transaction order, addresses, UTXOs and balance history are restored from it instead of
+// being rebuilt, otherwise the wallet is rebuilt in full
+BRWallet *BRWalletNewWithSnapshot(BRAddressParams addrParams, BRTransaction *transactions[], size_t txCount,
+                                  BRMasterPubKey mpk, const uint8_t *snapshot, size_t snapshotLen);
+
+// writes a snapshot of the wallet state derived from its transactions to buf, to be passed to BRWalletNewWithSnapshot()
+// returns number of bytes written, or buf length needed if buf is NULL
+size_t BRWalletSnapshot(BRWallet *wallet, uint8_t *buf, size_t bufLen);
+
+// true if the wallet state was restored from the snapshot passed to BRWalletNewWithSnapshot(), false if it was rebuilt
+int BRWalletIsRestoredFromSnapshot(BRWallet *wallet);
+
 // not thread-safe, set callbacks once after BRWalletNew(), before calling other BRWallet functions
 // info is a void pointer that will be passed along with each callback call
 // void balanceChanged(void *, uint64_t) - called when the wallet balance changes
@@ -86,22 +86,25 @@ static const BRCheckPoint BRBSVCheckpoints[] = {
     // 685440
 };
 
-static const BRMerkleBlock *_medianBlock(const BRMerkleBlock *b, const BRSet *blockSet)
+#define DAA_WINDOW 147 // ancestors the difficulty adjustment algorithm reads, the last 144 and two more for each median
+
+// returns the index of the block with the median timestamp of the three at i, i + 1 and i + 2 in timestamps[]
+static size_t _medianIndex(const uint32_t timestamps[], size_t i)
 {
-    const BRMerkleBlock *b0 = NULL, *b1 = NULL, *b2 = b;
-
-    b1 = (b2) ? BRSetGet(blockSet, &b2->prevBlock) : NULL;
-    b0 = (b1) ? BRSetGet(blockSet, &b1->prevBlock) : NULL;
-    if (b0 && b2 && b0->timestamp > b2->timestamp) b = b0, b0 = b2, b2 = b;
-    if (b0 && b1 && b0->timestamp > b1->timestamp) b = b0, b0 = b1, b1 = b;
-    if (b1 && b2 && b1->timestamp > b2->timestamp) b = b1, b1 = b2, b2 = b;
-    return (b0 && b1 && b2) ? b1 : NULL;
+    size_t b, b0 = i + 2, b1 = i + 1, b2 = i;
+
+    if (timestamps[b0] > timestamps[b2]) b = b0, b0 = b2, b2 = b;
+    if (timestamps[b0] > timestamps[b1]) b = b0, b0 = b1, b1 = b;
+    if (timestamps[b1] > timestamps[b2]) b = b1, b1 = b2, b2 = b;
+    return b1;
 }
 
-static int BRBSVVerifyDifficulty(const BRMerkleBlock *block, const BRSet *blockSet)
+static int BRBSVVerifyDifficulty(const BRMerkleBlock *block, const BRSet *blockSet, const BRHeaderChain *chain)
 {
-    const BRMerkleBlock *b, *first, *last;
-    int i, sz, size = 0x1d;
+    const BRMerkleBlock *b;
+    uint32_t timestamps[DAA_WINDOW], targets[DAA_WINDOW]; // timestamps[i] and targets[i] are of block->height - 1 - i
+    size_t i, first, last;
+    int sz, size = 0x1d;
     uint64_t t, target, w, work = 0;
     int64_t timespan;
 
@@ -109,24 +112,27 @@ static int BRBSVVerifyDifficulty(const BRMerkleBlock *block, const BRSet *blockS
     assert(blockSet != NULL);
 
     if (block && block->height >= 504032) { // D601 hard fork height: https://reviews.bitcoinabc.org/D601
-        last = BRSetGet(blockSet, &block->prevBlock);
-        last = _medianBlock(last, blockSet);
-
-        for (i = 0, first = block; first && i <= 144; i++) {
-            first = BRSetGet(blockSet, &first->prevBlock);
+        // the ancestors are read from the header chain when block connects to it, and only looked up by hash otherwise
+        if (! chain || ! BRHeaderChainWindow(chain, block->height - 1, block->prevBlock, timestamps, targets,
+                                             DAA_WINDOW)) {
+            for (i = 0, b = BRSetGet(blockSet, &block->prevBlock); b && i < DAA_WINDOW; i++) {
+                timestamps[i] = b->timestamp, targets[i] = b->target;
+                b = BRSetGet(blockSet, &b->prevBlock);
+            }
+
+            if (i < DAA_WINDOW) return 1;
         }
 
-        first = _medianBlock(first, blockSet);
-
-        if (! first) return 1;
-        timespan = (int64_t)last->timestamp - first->timestamp;
+        last = _medianIndex(timestamps, 0);
+        first = _medianIndex(timestamps, DAA_WINDOW - 3);
+        timespan = (int64_t)timestamps[last] - timestamps[first];
         if (timespan > 288*10*60) timespan = 288*10*60;
         if (timespan < 72*10*60) timespan = 72*10*60;
 
-        for (b = last; b != first;) {
+        for (i = last; i != first; i++) {
             // target is in "compact" format, where the most significant byte is the size of the value in bytes, next
             // bit is the sign, and the last 23 bits is the value after having been right shifted by (size - 3)*8 bits
-            sz = b->target >> 24, t = b->target & 0x007fffff;
+            sz = targets[i] >> 24, t = targets[i] & 0x007fffff;
 
             // work += 2^256/(target + 1)
             w = (t) ? ~0ULL/t : ~0ULL;
@@ -134,8 +140,6 @@ static int BRBSVVerifyDifficulty(const BRMerkleBlock *block, const BRSet *blockS
             while (size < sz) w >>= 8, sz--;
             while (work + w < w) w >>= 8, work >>= 8, size--;
             work += w;
-
-            b = BRSetGet(blockSet, &b->prevBlock);
         }
 
         // work = work*10*60/timespan
@@ -156,7 +160,7 @@ static int BRBSVVerifyDifficulty(const BRMerkleBlock *block, const BRSet *blockS
     return 1;
 }
 
-static int BRBSVTestNetVerifyDifficulty(const BRMerkleBlock *block, const BRSet *blockSet)
+static int BRBSVTestNetVerifyDifficulty(const BRMerkleBlock *block, const BRSet *blockSet, const BRHeaderChain *chain)
 {
     return 1; // XXX skip testnet difficulty check for now
 }
@@ -43,14 +43,14 @@ cryptoFileServiceTypeTransferV1Reader (BRFileServiceContext context,
                                  uint32_t bytesCount) {
     BRCryptoWalletManager manager = (BRCryptoWalletManager) context; (void) manager;
 
-    BRRlpCoder coder = rlpCoderCreate();
+    BRRlpCoder coder = rlpCoderCreateFromPool();
     BRRlpData  data  = (BRRlpData) { bytesCount, bytes };
     BRRlpItem  item  = rlpDataGetItem (coder, data);
 
     BRCryptoClientTransferBundle bundle = cryptoClientTransferBundleRlpDecode(item, coder);
 
     rlpItemRelease (coder, item);
-    rlpCoderRelease(coder);
+    rlpCoderReleaseToPool (coder);
 
     return bundle;
 }
@@ -63,12 +63,12 @@ cryptoFileServiceTypeTransferV1Writer (BRFileServiceContext context,
     BRCryptoWalletManager        manager = (BRCryptoWalletManager) context; (void) manager;
     BRCryptoClientTransferBundle bundle  = (BRCryptoClientTransferBundle) entity;
 
-    BRRlpCoder coder = rlpCoderCreate();
+    BRRlpCoder coder = rlpCoderCreateFromPool();
     BRRlpItem  item  = cryptoClientTransferBundleRlpEncode (bundle, coder);
     BRRlpData  data  = rlpItemGetData (coder, item);
 
     rlpItemRelease  (coder, item);
-    rlpCoderRelease (coder);
+    rlpCoderReleaseToPool (coder);
 
     *bytesCount = (uint32_t) data.bytesCount;
     return data.bytes;
@@ -98,14 +98,14 @@ cryptoFileServiceTypeTransactionV1Reader (BRFileServiceContext context,
     BRCryptoWalletManager manager = (BRCryptoWalletManager) context;
     (void) manager;
 
-    BRRlpCoder coder = rlpCoderCreate();
+    BRRlpCoder coder = rlpCoderCreateFromPool();
     BRRlpData  data  = (BRRlpData) { bytesCount, bytes };
     BRRlpItem  item  = rlpDataGetItem (coder, data);
 
     BRCryptoClientTransactionBundle bundle = cryptoClientTransactionBundleRlpDecode(item, coder);
 
     rlpItemRelease (coder, item);
-    rlpCoderRelease(coder);
+    rlpCoderReleaseToPool (coder);
 
     return bundle;
 }
@@ -118,12 +118,12 @@ cryptoFileServiceTypeTransactionV1Writer (BRFileServiceContext context,
     BRCryptoWalletManager           manager = (BRCryptoWalletManager) context; (void) manager;
     BRCryptoClientTransactionBundle bundle  = (BRCryptoClientTransactionBundle) entity;
 
-    BRRlpCoder coder = rlpCoderCreate();
+    BRRlpCoder coder = rlpCoderCreateFromPool();
     BRRlpItem  item  = cryptoClientTransactionBundleRlpEncode (bundle, coder);
     BRRlpData  data  = rlpItemGetData (coder, item);
 
     rlpItemRelease  (coder, item);
-    rlpCoderRelease (coder);
+    rlpCoderReleaseToPool (coder);
 
     *bytesCount = (uint32_t) data.bytesCount;
     return data.bytes;
@@ -125,14 +125,14 @@ fileServiceTypeCurrencyBundleV1Reader (BRFileServiceContext context,
                                     uint32_t bytesCount) {
     BRCryptoSystem system = (BRCryptoSystem) context; (void) system;
 
-    BRRlpCoder coder = rlpCoderCreate();
+    BRRlpCoder coder = rlpCoderCreateFromPool();
     BRRlpData  data  = (BRRlpData) { bytesCount, bytes };
     BRRlpItem  item  = rlpDataGetItem (coder, data);
 
     BRCryptoClientCurrencyBundle bundle = cryptoClientCurrencyBundleRlpDecode(item, coder);
 
     rlpItemRelease (coder, item);
-    rlpCoderRelease(coder);
+    rlpCoderReleaseToPool (coder);
 
     return bundle;
 }
@@ -145,12 +145,12 @@ fileServiceTypeCurrencyBundleV1Writer (BRFileServiceContext context,
     BRCryptoSystem system = (BRCryptoSystem) context; (void) system;
     const BRCryptoClientCurrencyBundle bundle = (const BRCryptoClientCurrencyBundle) entity;
 
-    BRRlpCoder coder = rlpCoderCreate();
+    BRRlpCoder coder = rlpCoderCreateFromPool();
     BRRlpItem  item  = cryptoClientCurrencyBundleRlpEncode (bundle, coder);
     BRRlpData  data  = rlpItemGetData (coder, item);
 
     rlpItemRelease  (coder, item);
-    rlpCoderRelease (coder);
+    rlpCoderReleaseToPool (coder);
 
     *bytesCount = (uint32_t) data.bytesCount;
     return data.bytes;
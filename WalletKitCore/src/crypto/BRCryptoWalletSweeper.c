@@ -86,6 +86,50 @@ cryptoWalletSweeperCreateTransferForWalletSweep (BRCryptoWalletSweeper sweeper,
     return transfer;
 }
 
+extern BRCryptoWalletSweeperStatus
+cryptoWalletSweeperEstimateBatchForWalletSweep (BRCryptoWalletSweeper sweeper,
+                                                BRCryptoWalletManager cwm,
+                                                BRCryptoWallet wallet,
+                                                BRCryptoNetworkFee fee,
+                                                size_t *transferCount,
+                                                BRCryptoFeeBasis *feeBasis) {
+    *transferCount = 0;
+    *feeBasis      = NULL;
+
+    if (NULL == sweeper->handlers->estimateBatch)
+        return CRYPTO_WALLET_SWEEPER_ILLEGAL_OPERATION;
+
+    return sweeper->handlers->estimateBatch (cwm, wallet, sweeper, fee, transferCount, feeBasis);
+}
+
+extern BRCryptoWalletSweeperStatus
+cryptoWalletSweeperCreateTransfersForWalletSweep (BRCryptoWalletSweeper sweeper,
+                                                  BRCryptoWalletManager cwm,
+                                                  BRCryptoWallet wallet,
+                                                  BRCryptoFeeBasis estimatedFeeBasis,
+                                                  BRCryptoTransfer **transfers,
+                                                  size_t *transfersCount) {
+    *transfers      = NULL;
+    *transfersCount = 0;
+
+    if (NULL == sweeper->handlers->createTransfers)
+        return CRYPTO_WALLET_SWEEPER_ILLEGAL_OPERATION;
+
+    BRCryptoWalletSweeperStatus status = sweeper->handlers->createTransfers (cwm,
+                                                                             wallet,
+                                                                             sweeper,
+                                                                             estimatedFeeBasis,
+                                                                             transfers,
+                                                                             transfersCount);
+
+    for (size_t index = 0; index < *transfersCount; index++)
+        cryptoTransferGenerateEvent ((*transfers)[index], (BRCryptoTransferEvent) {
+            CRYPTO_TRANSFER_EVENT_CREATED
+        });
+
+    return status;
+}
+
 extern BRCryptoKey
 cryptoWalletSweeperGetKey (BRCryptoWalletSweeper sweeper) {
     return cryptoKeyTake (sweeper->key);
@@ -48,6 +48,22 @@ typedef BRCryptoTransfer
 typedef BRCryptoWalletSweeperStatus
 (*BRCryptoWalletSweeperValidateHandler) (BRCryptoWalletSweeper sweeper);
 
+typedef BRCryptoWalletSweeperStatus
+(*BRCryptoWalletSweeperEstimateBatchHandler) (BRCryptoWalletManager cwm,
+                                              BRCryptoWallet wallet,
+                                              BRCryptoWalletSweeper sweeper,
+                                              BRCryptoNetworkFee fee,
+                                              size_t *transferCount,
+                                              BRCryptoFeeBasis *feeBasis);
+
+typedef BRCryptoWalletSweeperStatus
+(*BRCryptoWalletSweeperCreateTransfersHandler) (BRCryptoWalletManager cwm,
+                                                BRCryptoWallet wallet,
+                                                BRCryptoWalletSweeper sweeper,
+                                                BRCryptoFeeBasis estimatedFeeBasis,
+                                                BRCryptoTransfer **transfers,
+                                                size_t *transfersCount);
+
 typedef struct {
     BRCryptoWalletSweeperReleaseHandler release;
     BRCryptoWalletSweeperGetAddressHandler getAddress;
@@ -56,6 +72,8 @@ typedef struct {
     BRCryptoWalletSweeperEstimateFeeBasisHandler estimateFeeBasis;
     BRCryptoWalletSweeperCreateTransferHandler createTransfer;
     BRCryptoWalletSweeperValidateHandler validate;
+    BRCryptoWalletSweeperEstimateBatchHandler estimateBatch;        // optional
+    BRCryptoWalletSweeperCreateTransfersHandler createTransfers;    // optional
 } BRCryptoWalletSweeperHandlers;
 
 // MARK: - Sweeper
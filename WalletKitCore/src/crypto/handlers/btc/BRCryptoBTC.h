@@ -21,6 +21,7 @@
 #include "bitcoin/BRWallet.h"
 #include "bitcoin/BRTransaction.h"
 #include "bitcoin/BRChainParams.h"
+#include "bitcoin/BRHeaderStore.h"
 #include "bitcoin/BRPaymentProtocol.h"
 
 #ifdef __cplusplus
@@ -182,6 +183,9 @@ typedef struct BRCryptoWalletSweeperBTCRecord {
     uint8_t isSegwit;
     char * sourceAddress;
     BRArrayOf(BRTransaction *) txns;
+    BRSetOf(BRWalletSweeperUTXO *) utxos;   // outputs to sourceAddress not spent by any of txns
+    BRSetOf(BRUTXO *) spent;                // outpoints spent by sourceAddress in txns
+    uint64_t balance;                       // sum of utxos
 } *BRCryptoWalletSweeperBTC;
 
 // MARK: - Payment Protocol
@@ -243,6 +247,7 @@ cryptoHashCreateAsBTC (UInt256 btc);
 extern const char *fileServiceTypeTransactionsBTC;
 extern const char *fileServiceTypeBlocksBTC;
 extern const char *fileServiceTypePeersBTC;
+extern const char *fileServiceTypeWalletSnapshotsBTC;
 
 extern size_t fileServiceSpecificationsCountBTC;
 extern BRFileServiceTypeSpecification *fileServiceSpecificationsBTC;
@@ -250,9 +255,16 @@ extern BRFileServiceTypeSpecification *fileServiceSpecificationsBTC;
 extern BRArrayOf(BRTransaction*) initialTransactionsLoadBTC (BRCryptoWalletManager manager);
 extern BRArrayOf(BRPeer)         initialPeersLoadBTC        (BRCryptoWalletManager manager);
 extern BRArrayOf(BRMerkleBlock*) initialBlocksLoadBTC       (BRCryptoWalletManager manager);
+extern BRHeaderStore *           initialHeaderStoreOpenBTC  (BRCryptoWalletManager manager);
+extern uint8_t *                 initialWalletSnapshotLoadBTC (BRCryptoWalletManager manager, size_t *snapshotCount);
+
+extern void walletSnapshotSaveBTC (BRCryptoWalletManager manager, BRWallet *wallet);
+extern void walletSnapshotSignalSaveBTC (BRCryptoWalletManager manager);
 
 // MARK: - Events
 
+extern BREventType walletSnapshotSaveEventTypeBTC;
+
 extern const BREventType *eventTypesBTC[];
 extern const unsigned int eventTypesCountBTC;
 
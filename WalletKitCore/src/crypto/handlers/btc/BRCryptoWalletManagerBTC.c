@@ -179,16 +179,25 @@ cryptoWalletManagerCreateWalletBTC (BRCryptoWalletManager manager,
 
     BRArrayOf(BRTransaction*) transactions = initialTransactionsLoadBTC(manager);
 
+    // The snapshot saved after the last sync, if any; it is only used if it was derived from
+    // exactly these transactions, otherwise the wallet is rebuilt from them.
+    size_t   snapshotCount = 0;
+    uint8_t *snapshot      = initialWalletSnapshotLoadBTC (manager, &snapshotCount);
+
     // Create the BTC wallet
     //
     // Since the BRWallet callbacks are not set, none of these transactions generate callbacks.
     // And, in fact, looking at BRWalletNew(), there is not even an attempt to generate callbacks
     // even if they could have been specified.
-    BRWallet *btcWallet = BRWalletNew (btcChainParams->addrParams, transactions, array_count(transactions), btcMPK);
+    BRWallet *btcWallet = BRWalletNewWithSnapshot (btcChainParams->addrParams,
+                                                   transactions, array_count(transactions),
+                                                   btcMPK,
+                                                   snapshot, snapshotCount);
     assert (NULL != btcWallet);
 
     // The btcWallet now should include *all* the transactions
     array_free (transactions);
+    if (NULL != snapshot) free (snapshot);
 
     // Set the callbacks
     BRWalletSetCallbacks (btcWallet,
@@ -408,6 +417,9 @@ cryptoWalletManagerCreateWalletSweeperBTC (BRCryptoWalletManager cwm,
     sweeperBTC->isSegwit = CRYPTO_ADDRESS_SCHEME_BTC_SEGWIT == cwm->addressScheme;
     sweeperBTC->sourceAddress = address;
     array_new (sweeperBTC->txns, 100);
+    sweeperBTC->utxos = BRSetNew (BRUTXOHash, BRUTXOEq, 100);
+    sweeperBTC->spent = BRSetNew (BRUTXOHash, BRUTXOEq, 100);
+    sweeperBTC->balance = 0;
 
     cryptoUnitGive (unit);
     cryptoCurrencyGive (currency);
@@ -642,6 +654,7 @@ static void cryptoWalletManagerBTCTxDeleted (void *info, UInt256 hash, int notif
 }
 
 const BREventType *eventTypesBTC[] = {
+    &walletSnapshotSaveEventTypeBTC
 };
 
 const unsigned int
@@ -34,6 +34,10 @@ typedef struct BRCryptoClientP2PManagerRecordBTC {
     BRCryptoWalletManagerBTC manager;
     BRPeerManager *btcPeerManager;
 
+    // The memory mapped main chain headers, which the BRPeerManager restores its chain from.  May be NULL
+    // if the store could not be opened, in which case blocks are restored from the file service.
+    BRHeaderStore *btcHeaderStore;
+
     // The begining and end blockheight for an ongoing sync.  The end block height will be increased
     // a the blockchain is extended.  The begining block height is used to compute the completion
     // percentage.  These will have values of BLOCK_HEIGHT_UNBOUND when a sync is inactive.
@@ -69,6 +73,7 @@ static void
 cryptoClientP2PManagerReleaseBTC (BRCryptoClientP2PManager baseManager) {
     BRCryptoClientP2PManagerBTC manager = cryptoClientP2PManagerCoerce (baseManager);
     BRPeerManagerFree (manager->btcPeerManager);
+    if (NULL != manager->btcHeaderStore) BRHeaderStoreClose (manager->btcHeaderStore);
 }
 
 static void
@@ -282,6 +287,12 @@ static void cryptoWalletManagerBTCSyncStopped (void *info, int reason) {
 
     pthread_mutex_unlock (&p2p->base.lock);
 
+    // A completed sync is a checkpoint for the wallet state; save a snapshot of it so that the
+    // next start need not rebuild the wallet from every transaction.  The save is posted to the
+    // wallet manager's event handler rather than written here, inside a peer manager callback.
+    if (syncCompleted && 0 == reason && NULL != manager->base.wallet)
+        walletSnapshotSignalSaveBTC (&manager->base);
+
     if (needStop) {
         BRCryptoSyncStoppedReason stopReason = (reason
                                                 ? cryptoSyncStoppedReasonPosix(reason)
@@ -439,7 +450,14 @@ cryptoWalletManagerCreateP2PManagerBTC (BRCryptoWalletManager manager) {
     BRWallet *btcWallet = cryptoWalletAsBTC(manager->wallet);
     uint32_t btcEarliestKeyTime = (uint32_t) cryptoAccountGetTimestamp(manager->account);
 
-    BRArrayOf(BRMerkleBlock*) blocks = initialBlocksLoadBTC (manager);
+    p2pManagerBTC->btcHeaderStore = initialHeaderStoreOpenBTC (manager);
+
+    // A header store that already has a last block replaces decoding every saved block; the peer manager
+    // restores its chain from the headers up to that block and pages older ones in as needed.
+    bool btcHeaderStoreIsEmpty = (NULL == p2pManagerBTC->btcHeaderStore ||
+                                  BLOCK_UNKNOWN_HEIGHT == BRHeaderStoreLastBlockHeight (p2pManagerBTC->btcHeaderStore));
+
+    BRArrayOf(BRMerkleBlock*) blocks = (btcHeaderStoreIsEmpty ? initialBlocksLoadBTC (manager) : NULL);
     BRArrayOf(BRPeer)         peers  = initialPeersLoadBTC  (manager);
 
     p2pManagerBTC->begBlockHeight = BLOCK_HEIGHT_UNBOUND;
@@ -455,6 +473,9 @@ cryptoWalletManagerCreateP2PManagerBTC (BRCryptoWalletManager manager) {
 
     assert (NULL != p2pManagerBTC->btcPeerManager);
 
+    if (NULL != p2pManagerBTC->btcHeaderStore)
+        BRPeerManagerSetHeaderStore (p2pManagerBTC->btcPeerManager, p2pManagerBTC->btcHeaderStore);
+
     BRPeerManagerSetCallbacks (p2pManagerBTC->btcPeerManager,
                                cryptoWalletManagerCoerceBTC (manager, p2pManager->type),
                                cryptoWalletManagerBTCSyncStarted,
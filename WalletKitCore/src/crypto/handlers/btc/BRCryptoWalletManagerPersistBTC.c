@@ -10,6 +10,7 @@
 //
 #include "BRCryptoBTC.h"
 #include "crypto/BRCryptoFileService.h"
+#include <unistd.h>
 
 
 /// MARK: - Transaction File Service
@@ -80,7 +81,13 @@ fileServiceTypeTransactionV1Reader (BRFileServiceContext context,
 extern BRArrayOf(BRTransaction*)
 initialTransactionsLoadBTC (BRCryptoWalletManager manager) {
     BRSetOf(BRTransaction*) transactionSet = BRSetNew(BRTransactionHash, BRTransactionEq, 100);
-    if (1 != fileServiceLoad (manager->fileService, transactionSet, FILE_SERVICE_TYPE_TRANSACTION, 1)) {
+
+    // Parsing is the bulk of the load for a large wallet and BRTransactionParse() is safe to call
+    // concurrently, so read transactions on as many threads as there are processors.
+    long processorsCount = sysconf (_SC_NPROCESSORS_ONLN);
+
+    if (1 != fileServiceLoadConcurrently (manager->fileService, transactionSet, FILE_SERVICE_TYPE_TRANSACTION, 1,
+                                          (processorsCount > 1 ? (size_t) processorsCount : 1))) {
         BRSetFreeAll(transactionSet, (void (*) (void*)) BRTransactionFree);
         _peer_log ("BWM: failed to load transactions");
         return NULL;
@@ -101,6 +108,150 @@ initialTransactionsLoadBTC (BRCryptoWalletManager manager) {
     return transactions;
 }
 
+/// MARK: - Wallet Snapshot File Service
+
+#define FILE_SERVICE_TYPE_WALLET_SNAPSHOT     "wallet_snapshots"
+
+enum {
+    FILE_SERVICE_TYPE_WALLET_SNAPSHOT_VERSION_1
+};
+
+typedef struct {
+    uint8_t *bytes;
+    size_t   bytesCount;
+} BRWalletSnapshotBTC;
+
+static size_t
+walletSnapshotHashBTC (const void *snapshot) {
+    return 0;   // There is only ever one snapshot
+}
+
+static int
+walletSnapshotEqBTC (const void *snapshot1, const void *snapshot2) {
+    return snapshot1 == snapshot2;
+}
+
+static void
+walletSnapshotFreeBTC (void *snapshot) {
+    free (((BRWalletSnapshotBTC *) snapshot)->bytes);
+    free (snapshot);
+}
+
+static UInt256
+fileServiceTypeWalletSnapshotV1Identifier (BRFileServiceContext context,
+                                           BRFileService fs,
+                                           const void *entity) {
+    // Each save replaces the one snapshot
+    UInt256 hash;
+    BRSHA256 (&hash, FILE_SERVICE_TYPE_WALLET_SNAPSHOT, strlen (FILE_SERVICE_TYPE_WALLET_SNAPSHOT));
+    return hash;
+}
+
+static uint8_t *
+fileServiceTypeWalletSnapshotV1Writer (BRFileServiceContext context,
+                                       BRFileService fs,
+                                       const void* entity,
+                                       uint32_t *bytesCount) {
+    const BRWalletSnapshotBTC *snapshot = entity;
+
+    *bytesCount = (uint32_t) snapshot->bytesCount;
+
+    uint8_t *bytes = malloc (*bytesCount);
+    memcpy (bytes, snapshot->bytes, *bytesCount);
+
+    return bytes;
+}
+
+static void *
+fileServiceTypeWalletSnapshotV1Reader (BRFileServiceContext context,
+                                       BRFileService fs,
+                                       uint8_t *bytes,
+                                       uint32_t bytesCount) {
+    BRWalletSnapshotBTC *snapshot = malloc (sizeof (BRWalletSnapshotBTC));
+
+    snapshot->bytesCount = bytesCount;
+    snapshot->bytes      = malloc (bytesCount);
+    memcpy (snapshot->bytes, bytes, bytesCount);
+
+    return snapshot;
+}
+
+extern uint8_t *
+initialWalletSnapshotLoadBTC (BRCryptoWalletManager manager,
+                              size_t *snapshotCount) {
+    BRSetOf(BRWalletSnapshotBTC*) snapshotSet = BRSetNew(walletSnapshotHashBTC, walletSnapshotEqBTC, 1);
+    uint8_t *bytes = NULL;
+
+    *snapshotCount = 0;
+
+    if (1 != fileServiceLoad (manager->fileService, snapshotSet, FILE_SERVICE_TYPE_WALLET_SNAPSHOT, 1)) {
+        BRSetFreeAll(snapshotSet, walletSnapshotFreeBTC);
+        _peer_log ("BWM: %4s: failed to load wallet snapshot\n",
+                   cryptoBlockChainTypeGetCurrencyCode (manager->type));
+        return NULL;
+    }
+
+    // Take the snapshot's bytes; a missing snapshot means the wallet is rebuilt in full
+    BRWalletSnapshotBTC *snapshot = BRSetIterate (snapshotSet, NULL);
+    if (NULL != snapshot) {
+        bytes          = snapshot->bytes;
+        *snapshotCount = snapshot->bytesCount;
+        free (snapshot);
+    }
+    BRSetFree(snapshotSet);
+
+    _peer_log ("BWM: %4s: loaded %4zu bytes of wallet snapshot\n",
+               cryptoBlockChainTypeGetCurrencyCode (manager->type),
+               *snapshotCount);
+    return bytes;
+}
+
+extern void
+walletSnapshotSaveBTC (BRCryptoWalletManager manager,
+                       BRWallet *wallet) {
+    BRWalletSnapshotBTC snapshot;
+
+    snapshot.bytesCount = BRWalletSnapshot (wallet, NULL, 0);
+    snapshot.bytes      = malloc (snapshot.bytesCount);
+
+    // If the wallet changed since it was sized, skip this save; the next one will catch up.
+    if (snapshot.bytesCount == BRWalletSnapshot (wallet, snapshot.bytes, snapshot.bytesCount))
+        fileServiceSave (manager->fileService, FILE_SERVICE_TYPE_WALLET_SNAPSHOT, &snapshot);
+
+    free (snapshot.bytes);
+}
+
+// The snapshot save is handled on the wallet manager's event handler thread, so that the P2P
+// callback that asks for it does not write the whole snapshot itself.  The manager owns its
+// handler, and stops it before being released, so the event need not hold a reference.
+
+typedef struct {
+    BREvent base;
+    BRCryptoWalletManager manager;
+} BRWalletSnapshotSaveEventBTC;
+
+static void
+walletSnapshotSaveEventDispatcherBTC (BREventHandler ignore,
+                                      BRWalletSnapshotSaveEventBTC *event) {
+    if (NULL != event->manager->wallet)
+        walletSnapshotSaveBTC (event->manager, cryptoWalletAsBTC (event->manager->wallet));
+}
+
+BREventType walletSnapshotSaveEventTypeBTC = {
+    "CWM: BTC Save Wallet Snapshot Event",
+    sizeof (BRWalletSnapshotSaveEventBTC),
+    (BREventDispatcher) walletSnapshotSaveEventDispatcherBTC
+};
+
+extern void
+walletSnapshotSignalSaveBTC (BRCryptoWalletManager manager) {
+    BRWalletSnapshotSaveEventBTC event =
+    { { NULL, &walletSnapshotSaveEventTypeBTC },
+        manager };
+
+    eventHandlerSignalEvent (manager->handler, (BREvent *) &event);
+}
+
 /// MARK: - Block File Service
 
 #define FILE_SERVICE_TYPE_BLOCK         "blocks"
@@ -190,6 +341,28 @@ initialBlocksLoadBTC (BRCryptoWalletManager manager) {
     return blocks;
 }
 
+/// MARK: - Header Store
+
+extern BRHeaderStore *
+initialHeaderStoreOpenBTC (BRCryptoWalletManager manager) {
+    char *path = fileServiceCreateHeadersPath (manager->path,
+                                               cryptoBlockChainTypeGetCurrencyCode (manager->type),
+                                               cryptoNetworkGetDesc (manager->network));
+    BRHeaderStore *store = BRHeaderStoreOpen (path);
+    free (path);
+
+    if (NULL == store) {
+        _peer_log ("BWM: %4s: failed to open header store\n",
+                   cryptoBlockChainTypeGetCurrencyCode (manager->type));
+        return NULL;
+    }
+
+    _peer_log ("BWM: %4s: opened header store with %u last block height\n",
+               cryptoBlockChainTypeGetCurrencyCode (manager->type),
+               BRHeaderStoreLastBlockHeight (store));
+    return store;
+}
+
 /// MARK: - Peer File Service
 
 #define FILE_SERVICE_TYPE_PEER        "peers"
@@ -342,12 +515,27 @@ static BRFileServiceTypeSpecification fileServiceSpecificationsArrayBTC[] = {
                 fileServiceTypePeerV1Writer
             }
         }
+    },
+
+    {
+        FILE_SERVICE_TYPE_WALLET_SNAPSHOT,
+        FILE_SERVICE_TYPE_WALLET_SNAPSHOT_VERSION_1,
+        1,
+        {
+            {
+                FILE_SERVICE_TYPE_WALLET_SNAPSHOT_VERSION_1,
+                fileServiceTypeWalletSnapshotV1Identifier,
+                fileServiceTypeWalletSnapshotV1Reader,
+                fileServiceTypeWalletSnapshotV1Writer
+            }
+        }
     }
 };
 
 const char *fileServiceTypeTransactionsBTC = FILE_SERVICE_TYPE_TRANSACTION;
 const char *fileServiceTypeBlocksBTC       = FILE_SERVICE_TYPE_BLOCK;
 const char *fileServiceTypePeersBTC        = FILE_SERVICE_TYPE_PEER;
+const char *fileServiceTypeWalletSnapshotsBTC = FILE_SERVICE_TYPE_WALLET_SNAPSHOT;
 
 size_t fileServiceSpecificationsCountBTC = sizeof(fileServiceSpecificationsArrayBTC)/sizeof(BRFileServiceTypeSpecification);
 BRFileServiceTypeSpecification *fileServiceSpecificationsBTC = fileServiceSpecificationsArrayBTC;
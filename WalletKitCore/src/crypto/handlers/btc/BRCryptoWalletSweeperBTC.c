@@ -11,7 +11,10 @@
 #include "BRCryptoBTC.h"
 #include "crypto/BRCryptoWalletSweeperP.h"
 #include "crypto/BRCryptoAmountP.h"
+#include "crypto/BRCryptoKeyP.h"
 #include "ethereum/util/BRUtilMath.h"
+#include <pthread.h>
+#include <unistd.h>
 
 // MARK: Forward Declarations
 
@@ -30,6 +33,24 @@ BRWalletSweeperCreateTransaction (BRCryptoWalletSweeperBTC sweeper,
 static uint64_t
 BRWalletSweeperGetBalance (BRCryptoWalletSweeperBTC sweeper);
 
+static void
+BRWalletSweeperAddTransaction (BRCryptoWalletSweeperBTC sweeper,
+                               BRTransaction *txn);
+
+static BRCryptoWalletSweeperStatus
+BRWalletSweeperBuildBatch (BRCryptoWalletSweeperBTC sweeper,
+                           BRWallet * wallet,
+                           uint64_t feePerKb,
+                           BRArrayOf(BRTransaction *) *transactions,
+                           size_t *countOut,
+                           uint64_t *feeAmountOut,
+                           size_t *sizeOut);
+
+static int
+BRWalletSweeperSignBatch (BRArrayOf(BRTransaction *) transactions,
+                          int forkId,
+                          BRKey *key);
+
 // MARK: - Handlers
 
 static BRCryptoWalletSweeperBTC
@@ -74,6 +95,7 @@ cryptoWalletSweeperAddTransactionFromBundleBTC (BRCryptoWalletSweeper sweeper,
     BRTransaction * txn = BRTransactionParse (bundle->serialization, bundle->serializationCount);
     if (NULL != txn) {
         array_add (sweeperBTC->txns, txn);
+        BRWalletSweeperAddTransaction (sweeperBTC, txn);
     } else {
         status = CRYPTO_WALLET_SWEEPER_INVALID_TRANSACTION;
     }
@@ -117,6 +139,7 @@ cryptoWalletSweeperTransactionForSweepAsBTC (BRCryptoWalletManager manager,
     BRTransaction *transaction = NULL;
     BRWalletSweeperCreateTransaction (sweeper, wallet, feePerKb, &transaction);
 
+    pthread_mutex_unlock (&manager->lock);
     return transaction;
 }
 
@@ -147,6 +170,91 @@ cryptoWalletSweeperCreateTransferForWalletSweepBTC (BRCryptoWalletManager cwm,
             : NULL);
 }
 
+private_extern BRCryptoWalletSweeperStatus
+cryptoWalletSweeperEstimateBatchForWalletSweepBTC (BRCryptoWalletManager cwm,
+                                                   BRCryptoWallet wallet,
+                                                   BRCryptoWalletSweeper sweeper,
+                                                   BRCryptoNetworkFee networkFee,
+                                                   size_t *transferCount,
+                                                   BRCryptoFeeBasis *feeBasis) {
+    BRWallet *wid = cryptoWalletAsBTC (wallet);
+
+    BRCryptoWalletSweeperBTC sweeperBTC = cryptoWalletSweeperCoerce (sweeper);
+
+    uint64_t feePerKb = 1000 * cryptoNetworkFeeAsBTC (networkFee);
+
+    uint64_t fee  = 0;
+    size_t   size = 0;
+
+    pthread_mutex_lock (&cwm->lock);
+    BRCryptoWalletSweeperStatus status = BRWalletSweeperBuildBatch (sweeperBTC, wid, feePerKb, NULL,
+                                                                    transferCount, &fee, &size);
+    pthread_mutex_unlock (&cwm->lock);
+
+    *feeBasis = (CRYPTO_WALLET_SWEEPER_SUCCESS == status
+                 ? cryptoFeeBasisCreateAsBTC (wallet->unitForFee, fee, feePerKb, (uint32_t) size)
+                 : NULL);
+
+    return status;
+}
+
+private_extern BRCryptoWalletSweeperStatus
+cryptoWalletSweeperCreateTransfersForWalletSweepBTC (BRCryptoWalletManager cwm,
+                                                     BRCryptoWallet wallet,
+                                                     BRCryptoWalletSweeper sweeper,
+                                                     BRCryptoFeeBasis estimatedFeeBasis,
+                                                     BRCryptoTransfer **transfers,
+                                                     size_t *transfersCount) {
+    BRCryptoUnit unit       = cryptoWalletGetUnit (wallet);
+    BRCryptoUnit unitForFee = cryptoWalletGetUnitForFee(wallet);
+
+    BRCryptoWalletBTC walletBTC = (BRCryptoWalletBTC) wallet;
+    BRWallet *wid = walletBTC->wid;
+    assert (wid == cryptoWalletAsBTC (cwm->wallet));
+
+    BRCryptoWalletSweeperBTC sweeperBTC = cryptoWalletSweeperCoerce (sweeper);
+    const BRChainParams *btcParams = cryptoNetworkAsBTC (cwm->network);
+
+    BRArrayOf(BRTransaction *) tids;
+    array_new (tids, 10);
+
+    pthread_mutex_lock (&cwm->lock);
+    BRCryptoWalletSweeperStatus status = BRWalletSweeperBuildBatch (sweeperBTC, wid,
+                                                                    cryptoFeeBasisAsBTC (estimatedFeeBasis),
+                                                                    &tids, NULL, NULL, NULL);
+    pthread_mutex_unlock (&cwm->lock);
+
+    if (CRYPTO_WALLET_SWEEPER_SUCCESS == status &&
+        !BRWalletSweeperSignBatch (tids, btcParams->forkId, cryptoKeyGetCore (sweeper->key)))
+        status = CRYPTO_WALLET_SWEEPER_UNABLE_TO_SWEEP;
+
+    *transfers      = NULL;
+    *transfersCount = 0;
+
+    if (CRYPTO_WALLET_SWEEPER_SUCCESS == status) {
+        *transfers      = calloc (array_count (tids), sizeof (BRCryptoTransfer));
+        *transfersCount = array_count (tids);
+
+        for (size_t index = 0; index < array_count (tids); index++)
+            (*transfers)[index] = cryptoTransferCreateAsBTC (wallet->listenerTransfer,
+                                                             unit,
+                                                             unitForFee,
+                                                             wid,
+                                                             tids[index],
+                                                             cwm->type);
+    }
+    else {
+        for (size_t index = 0; index < array_count (tids); index++)
+            BRTransactionFree (tids[index]);
+    }
+
+    array_free (tids);
+    cryptoUnitGive (unitForFee);
+    cryptoUnitGive (unit);
+
+    return status;
+}
+
 private_extern BRCryptoWalletSweeperStatus
 cryptoWalletSweeperValidateBTC (BRCryptoWalletSweeper sweeper) {
     BRCryptoWalletSweeperBTC sweeperBTC = cryptoWalletSweeperCoerce (sweeper);
@@ -167,6 +275,8 @@ cryptoWalletSweeperReleaseBTC (BRCryptoWalletSweeper sweeper) {
     BRCryptoWalletSweeperBTC sweeperBTC = cryptoWalletSweeperCoerce (sweeper);
     
     free (sweeperBTC->sourceAddress);
+    BRSetFreeAll (sweeperBTC->utxos, free);
+    BRSetFreeAll (sweeperBTC->spent, free);
     for (size_t index = 0; index < array_count(sweeperBTC->txns); index++) {
         BRTransactionFree (sweeperBTC->txns[index]);
     }
@@ -176,26 +286,12 @@ cryptoWalletSweeperReleaseBTC (BRCryptoWalletSweeper sweeper) {
 // MARK: - Support
 
 typedef struct {
-    UInt256 txHash;
-    uint32_t utxoIndex;
+    BRUTXO outpoint; // first, so that the sweeper's sets can hash and compare with BRUTXOHash and BRUTXOEq
     uint8_t *script;
     size_t scriptLen;
     uint64_t amount;
 } BRWalletSweeperUTXO;
 
-inline static size_t BRWalletSweeperUTXOHash(const void *utxo)
-{
-    // (hash xor n)*FNV_PRIME, lifted from BRWallet's BRUTXOHash
-    return (size_t)((((const BRWalletSweeperUTXO *)utxo)->txHash.u32[0] ^ ((const BRWalletSweeperUTXO *)utxo)->utxoIndex)*0x01000193);
-}
-
-inline static int BRWalletSweeperUTXOEq(const void *utxo, const void *otherUtxo)
-{
-    // lifted from BRWallet's BRUTXOEq
-    return (utxo == otherUtxo || (UInt256Eq(((const BRWalletSweeperUTXO *)utxo)->txHash, ((const BRWalletSweeperUTXO *)otherUtxo)->txHash) &&
-                                  ((const BRWalletSweeperUTXO *)utxo)->utxoIndex == ((const BRWalletSweeperUTXO *)otherUtxo)->utxoIndex));
-}
-
 inline static uint64_t BRWalletSweeperCalculateFee(uint64_t feePerKb, size_t size)
 {
     // lifted from BRWallet's _txFee
@@ -212,6 +308,12 @@ inline static uint64_t BRWalletSweeperCalculateMinOutputAmount(uint64_t feePerKb
     return (amount > TX_MIN_OUTPUT_AMOUNT) ? amount : TX_MIN_OUTPUT_AMOUNT;
 }
 
+inline static size_t BRWalletSweeperCalculateSize(size_t inCount)
+{
+    // the size BRTransactionVSize() gives an unsigned sweep of inCount P2PKH inputs to a single output
+    return 8 + BRVarIntSize(inCount) + BRVarIntSize(1) + inCount*TX_INPUT_SIZE + TX_OUTPUT_SIZE;
+}
+
 inline static int BRWalletSweeperIsSourceInput(BRTxInput *input, BRAddressParams addrParams, char * sourceAddress) {
     size_t addressLength = BRTxInputAddress (input, NULL, 0, addrParams);
     char * address = malloc (addressLength + 1);
@@ -236,54 +338,77 @@ inline static int BRWalletSweeperIsSourceOutput(BRTxOutput *output, BRAddressPar
     return match;
 }
 
-static BRSetOf(BRWalletSweeperUTXO *)
-BRWalletSweeperGetUTXOs (BRCryptoWalletSweeperBTC sweeper) {
-    BRSet * utxos = BRSetNew(BRWalletSweeperUTXOHash, BRWalletSweeperUTXOEq, 100);
-
-    // TODO(fix): This is horrible; we should be building up this knowledge as transactions are added
-
-    // loop through and add all the unspent outputs
-    for (size_t index = 0; index < array_count (sweeper->txns); index++) {
-        BRTransaction *txn = sweeper->txns[index];
-
-        for (uint32_t i = 0; i < txn->outCount; i++) {
-            if (BRWalletSweeperIsSourceOutput (&txn->outputs[i], sweeper->addrParams, sweeper->sourceAddress)) {
-                BRWalletSweeperUTXO * utxo = malloc (sizeof(BRWalletSweeperUTXO));
-                utxo->txHash = txn->txHash;
-                utxo->utxoIndex = i;
-                utxo->amount = txn->outputs[i].amount;
-                utxo->script = txn->outputs[i].script;
-                utxo->scriptLen = txn->outputs[i].scriptLen;
-
-                utxo = BRSetAdd (utxos, utxo);
-                if (NULL != utxo) {
-                    free (utxo);
-                }
+static void
+BRWalletSweeperAddTransaction (BRCryptoWalletSweeperBTC sweeper,
+                               BRTransaction *txn) {
+    // Transactions arrive in no particular order, so an outpoint spent by the source address is
+    // remembered even if the transaction that created it has not been seen yet.
+    for (uint32_t i = 0; i < txn->inCount; i++) {
+        if (BRWalletSweeperIsSourceInput (&txn->inputs[i], sweeper->addrParams, sweeper->sourceAddress)) {
+            BRUTXO * outpoint = malloc (sizeof(BRUTXO));
+            outpoint->hash = txn->inputs[i].txHash;
+            outpoint->n    = txn->inputs[i].index;
+
+            BRWalletSweeperUTXO * utxo = BRSetRemove (sweeper->utxos, outpoint);
+            if (NULL != utxo) {
+                sweeper->balance -= utxo->amount;
+                free (utxo);
+            }
+
+            outpoint = BRSetAdd (sweeper->spent, outpoint);
+            if (NULL != outpoint) {
+                free (outpoint);
             }
         }
     }
 
-    // loop through and remove all the unspent outputs
-    for (size_t index = 0; index < array_count (sweeper->txns); index++) {
-        BRTransaction *txn = sweeper->txns[index];
-
-        for (uint32_t i = 0; i < txn->inCount; i++) {
-            if (BRWalletSweeperIsSourceInput (&txn->inputs[i], sweeper->addrParams, sweeper->sourceAddress)) {
-                BRWalletSweeperUTXO value = {0};
-                BRWalletSweeperUTXO * utxo = &value;
-                value.txHash = txn->inputs[i].txHash;
-                value.utxoIndex = txn->inputs[i].index;
-                // other values are not used during lookup
-
-                utxo = BRSetRemove (utxos, utxo);
-                if (NULL != utxo) {
-                    free (utxo);
-                }
-            }
+    for (uint32_t i = 0; i < txn->outCount; i++) {
+        BRUTXO outpoint = { txn->txHash, i };
+
+        if (!BRSetContains (sweeper->spent, &outpoint) &&
+            !BRSetContains (sweeper->utxos, &outpoint) &&
+            BRWalletSweeperIsSourceOutput (&txn->outputs[i], sweeper->addrParams, sweeper->sourceAddress)) {
+            BRWalletSweeperUTXO * utxo = malloc (sizeof(BRWalletSweeperUTXO));
+            utxo->outpoint = outpoint;
+            utxo->amount = txn->outputs[i].amount;
+            utxo->script = txn->outputs[i].script;
+            utxo->scriptLen = txn->outputs[i].scriptLen;
+
+            BRSetAdd (sweeper->utxos, utxo);
+            sweeper->balance += utxo->amount;
         }
     }
+}
+
+static BRTransaction *
+BRWalletSweeperCreateTransactionForUTXOs (BRCryptoWalletSweeperBTC sweeper,
+                                          BRWallet * wallet,
+                                          BRWalletSweeperUTXO **utxos,
+                                          size_t utxosCount,
+                                          uint64_t amount) {
+    BRTransaction *transaction = BRTransactionNew ();
 
-    return utxos;
+    for (size_t index = 0; index < utxosCount; index++) {
+        BRTransactionAddInput(transaction,
+                              utxos[index]->outpoint.hash,
+                              utxos[index]->outpoint.n,
+                              utxos[index]->amount,
+                              utxos[index]->script,
+                              utxos[index]->scriptLen,
+                              NULL,
+                              0,
+                              NULL,
+                              0,
+                              TXIN_SEQUENCE);
+    }
+
+    BRAddress addr = sweeper->isSegwit ? BRWalletReceiveAddress(wallet) : BRWalletLegacyAddress (wallet);
+    BRTxOutput o = BR_TX_OUTPUT_NONE;
+    BRTxOutputSetAddress(&o, sweeper->addrParams, addr.s);
+    BRTransactionAddOutput (transaction, amount, o.script, o.scriptLen);
+    BRTxOutputSetScript (&o, NULL, 0);
+
+    return transaction;
 }
 
 static BRCryptoWalletSweeperStatus
@@ -293,31 +418,12 @@ BRWalletSweeperBuildTransaction (BRCryptoWalletSweeperBTC sweeper,
                                  BRTransaction **transactionOut,
                                  uint64_t *feeAmountOut,
                                  uint64_t *balanceAmountOut) {
-    uint64_t balanceAmount = 0;
-    BRTransaction *transaction = BRTransactionNew ();
+    uint64_t balanceAmount = sweeper->balance;
 
     // based on BRWallet's BRWalletCreateTxForOutputs
 
-    BRSetOf(BRWalletSweeperUTXO *) outputs = BRWalletSweeperGetUTXOs (sweeper);
-    FOR_SET (BRWalletSweeperUTXO *, utxo, outputs) {
-        BRTransactionAddInput(transaction,
-                              utxo->txHash,
-                              utxo->utxoIndex,
-                              utxo->amount,
-                              utxo->script,
-                              utxo->scriptLen,
-                              NULL,
-                              0,
-                              NULL,
-                              0,
-                              TXIN_SEQUENCE);
-        balanceAmount += utxo->amount;
-    }
-    BRSetFreeAll (outputs, free);
-
-    size_t txnSize = BRTransactionVSize(transaction) + TX_OUTPUT_SIZE;
+    size_t txnSize = BRWalletSweeperCalculateSize (BRSetCount (sweeper->utxos));
     if (txnSize > TX_MAX_SIZE) {
-        BRTransactionFree (transaction);
         if (transactionOut) *transactionOut = NULL;
         if (feeAmountOut) *feeAmountOut = 0;
         if (balanceAmountOut) *balanceAmountOut = 0;
@@ -325,7 +431,6 @@ BRWalletSweeperBuildTransaction (BRCryptoWalletSweeperBTC sweeper,
     }
 
     if (0 == balanceAmount) {
-        BRTransactionFree (transaction);
         if (transactionOut) *transactionOut = NULL;
         if (feeAmountOut) *feeAmountOut = 0;
         if (balanceAmountOut) *balanceAmountOut = 0;
@@ -335,22 +440,20 @@ BRWalletSweeperBuildTransaction (BRCryptoWalletSweeperBTC sweeper,
     uint64_t feeAmount = BRWalletSweeperCalculateFee(feePerKb, txnSize);
     uint64_t minAmount = BRWalletSweeperCalculateMinOutputAmount(feePerKb);
     if ((feeAmount + minAmount) > balanceAmount) {
-        BRTransactionFree (transaction);
         if (transactionOut) *transactionOut = NULL;
         if (feeAmountOut) *feeAmountOut = 0;
         if (balanceAmountOut) *balanceAmountOut = 0;
         return CRYPTO_WALLET_SWEEPER_INSUFFICIENT_FUNDS;
     }
 
-    BRAddress addr = sweeper->isSegwit ? BRWalletReceiveAddress(wallet) : BRWalletLegacyAddress (wallet);
-    BRTxOutput o = BR_TX_OUTPUT_NONE;
-    BRTxOutputSetAddress(&o, sweeper->addrParams, addr.s);
-    BRTransactionAddOutput (transaction, balanceAmount - feeAmount, o.script, o.scriptLen);
-
     if (transactionOut) {
-        *transactionOut = transaction;
-    } else {
-        BRTransactionFree (transaction);
+        size_t utxosCount = BRSetCount (sweeper->utxos);
+        BRWalletSweeperUTXO **utxos = calloc (utxosCount, sizeof (BRWalletSweeperUTXO *));
+        BRSetAll (sweeper->utxos, (void **) utxos, utxosCount);
+
+        *transactionOut = BRWalletSweeperCreateTransactionForUTXOs (sweeper, wallet, utxos, utxosCount,
+                                                                    balanceAmount - feeAmount);
+        free (utxos);
     }
 
     if (feeAmountOut) {
@@ -382,17 +485,158 @@ BRWalletSweeperEstimateFee (BRCryptoWalletSweeperBTC sweeper,
 
 static uint64_t
 BRWalletSweeperGetBalance (BRCryptoWalletSweeperBTC sweeper) {
-    uint64_t balance = 0;
+    return sweeper->balance;
+}
+
+// MARK: - Batch
+
+static int
+BRWalletSweeperUTXOCompare (const void *utxo1, const void *utxo2) {
+    const BRWalletSweeperUTXO *u1 = *(const BRWalletSweeperUTXO **) utxo1;
+    const BRWalletSweeperUTXO *u2 = *(const BRWalletSweeperUTXO **) utxo2;
+
+    // largest amount first; ties in outpoint order so that a batch is the same every time it is built
+    if (u1->amount != u2->amount) return (u1->amount > u2->amount) ? -1 : 1;
+
+    int order = memcmp (u1->outpoint.hash.u8, u2->outpoint.hash.u8, sizeof (UInt256));
+    if (0 != order) return order;
+
+    return (u1->outpoint.n == u2->outpoint.n) ? 0 : ((u1->outpoint.n < u2->outpoint.n) ? -1 : 1);
+}
+
+///
+/// Split the sweep into transactions of at most TX_MAX_SIZE, filling each with the largest
+/// remaining UTXOs.  Sizes are accounted for one input at a time, so no transaction is built
+/// until its inputs are known.  A UTXO worth less than the fee for its own input is left out, as
+/// is a transaction that would not pay for its fee and a minimum output.
+///
+/// If `transactions` is not NULL, the unsigned transactions are appended to the array it refers
+/// to, in order.  The
+/// number of transactions, their total fee and their total size are returned in `countOut`,
+/// `feeAmountOut` and `sizeOut`, each of which may be NULL.
+///
+static BRCryptoWalletSweeperStatus
+BRWalletSweeperBuildBatch (BRCryptoWalletSweeperBTC sweeper,
+                           BRWallet * wallet,
+                           uint64_t feePerKb,
+                           BRArrayOf(BRTransaction *) *transactions,
+                           size_t *countOut,
+                           uint64_t *feeAmountOut,
+                           size_t *sizeOut) {
+    size_t   count     = 0;
+    uint64_t feeAmount = 0;
+    size_t   size      = 0;
+
+    size_t utxosCount = BRSetCount (sweeper->utxos);
+    BRWalletSweeperUTXO **utxos = calloc (utxosCount + 1, sizeof (BRWalletSweeperUTXO *));
+    BRSetAll (sweeper->utxos, (void **) utxos, utxosCount);
+    qsort (utxos, utxosCount, sizeof (BRWalletSweeperUTXO *), BRWalletSweeperUTXOCompare);
+
+    uint64_t inputFee  = BRWalletSweeperCalculateFee (feePerKb, TX_INPUT_SIZE);
+    uint64_t minAmount = BRWalletSweeperCalculateMinOutputAmount (feePerKb);
+
+    // sorted by amount, so the UTXOs worth sweeping come first
+    while (utxosCount > 0 && utxos[utxosCount - 1]->amount <= inputFee) utxosCount--;
+
+    for (size_t start = 0, end = 0; start < utxosCount; start = end) {
+        uint64_t amount = 0;
+
+        for (end = start;
+             end < utxosCount && BRWalletSweeperCalculateSize (end - start + 1) <= TX_MAX_SIZE;
+             end++)
+            amount += utxos[end]->amount;
+
+        size_t   txnSize = BRWalletSweeperCalculateSize (end - start);
+        uint64_t txnFee  = BRWalletSweeperCalculateFee (feePerKb, txnSize);
+        if (txnFee + minAmount > amount) continue;
+
+        if (NULL != transactions) {
+            BRTransaction *transaction = BRWalletSweeperCreateTransactionForUTXOs (sweeper, wallet,
+                                                                                   &utxos[start], end - start,
+                                                                                   amount - txnFee);
+            assert (BRTransactionVSize (transaction) <= txnSize);
+            array_add (*transactions, transaction);
+        }
 
-    BRSetOf(BRWalletSweeperUTXO *) outputs = BRWalletSweeperGetUTXOs (sweeper);
-    FOR_SET (BRWalletSweeperUTXO *, utxo, outputs) {
-        balance += utxo->amount;
+        count     += 1;
+        feeAmount += txnFee;
+        size      += txnSize;
     }
-    BRSetFreeAll (outputs, free);
 
-    return balance;
+    free (utxos);
+
+    if (countOut)     *countOut     = count;
+    if (feeAmountOut) *feeAmountOut = feeAmount;
+    if (sizeOut)      *sizeOut      = size;
+
+    return (0 == count ? CRYPTO_WALLET_SWEEPER_INSUFFICIENT_FUNDS : CRYPTO_WALLET_SWEEPER_SUCCESS);
+}
+
+typedef struct {
+    BRArrayOf(BRTransaction *) transactions;
+    int forkId;
+    BRKey *key;
+    size_t next;
+    int failed;
+    pthread_mutex_t lock;
+} BRWalletSweeperSignContext;
+
+static void *
+BRWalletSweeperSignThread (void *arg) {
+    BRWalletSweeperSignContext *context = arg;
+    BRKey key = *context->key; // BRKey caches its public key once asked for it, so each thread signs with a copy
+
+    while (1) {
+        pthread_mutex_lock (&context->lock);
+        size_t index = context->next++;
+        pthread_mutex_unlock (&context->lock);
+
+        if (index >= array_count (context->transactions)) break;
+
+        if (!BRTransactionSign (context->transactions[index], context->forkId, &key, 1)) {
+            pthread_mutex_lock (&context->lock);
+            context->failed = 1;
+            pthread_mutex_unlock (&context->lock);
+        }
+    }
+
+    BRKeyClean (&key);
+    return NULL;
 }
 
+///
+/// Sign every transaction in `transactions` with `key`, spreading the transactions over a thread
+/// per processor.  Returns true if all of them were signed.
+///
+static int
+BRWalletSweeperSignBatch (BRArrayOf(BRTransaction *) transactions,
+                          int forkId,
+                          BRKey *key) {
+    BRWalletSweeperSignContext context = { transactions, forkId, key, 0, 0 };
+    long processorsCount = sysconf (_SC_NPROCESSORS_ONLN);
+    size_t threadsCount = (processorsCount > 1 ? (size_t) processorsCount : 1);
+    if (threadsCount > array_count (transactions)) threadsCount = array_count (transactions);
+
+    pthread_t threads[threadsCount > 1 ? threadsCount - 1 : 1];
+    size_t started = 0;
+    pthread_attr_t attr;
+
+    pthread_mutex_init (&context.lock, NULL);
+
+    if (threadsCount > 1 && 0 == pthread_attr_init (&attr)) {
+        while (started + 1 < threadsCount &&
+               0 == pthread_create (&threads[started], &attr, BRWalletSweeperSignThread, &context))
+            started++;
+        pthread_attr_destroy (&attr);
+    }
+
+    BRWalletSweeperSignThread (&context); // the calling thread signs as well
+    for (size_t index = 0; index < started; index++)
+        pthread_join (threads[index], NULL);
+
+    pthread_mutex_destroy (&context.lock);
+    return !context.failed;
+}
 
 // MARK: -
 
@@ -403,7 +647,9 @@ BRCryptoWalletSweeperHandlers cryptoWalletSweeperHandlersBTC = {
     cryptoWalletSweeperAddTransactionFromBundleBTC,
     cryptoWalletSweeperEstimateFeeBasisForWalletSweepBTC,
     cryptoWalletSweeperCreateTransferForWalletSweepBTC,
-    cryptoWalletSweeperValidateBTC
+    cryptoWalletSweeperValidateBTC,
+    cryptoWalletSweeperEstimateBatchForWalletSweepBTC,
+    cryptoWalletSweeperCreateTransfersForWalletSweepBTC
 };
 
 BRCryptoWalletSweeperHandlers cryptoWalletSweeperHandlersBCH = {
@@ -413,7 +659,9 @@ BRCryptoWalletSweeperHandlers cryptoWalletSweeperHandlersBCH = {
     cryptoWalletSweeperAddTransactionFromBundleBTC,
     cryptoWalletSweeperEstimateFeeBasisForWalletSweepBTC,
     cryptoWalletSweeperCreateTransferForWalletSweepBTC,
-    cryptoWalletSweeperValidateBTC
+    cryptoWalletSweeperValidateBTC,
+    cryptoWalletSweeperEstimateBatchForWalletSweepBTC,
+    cryptoWalletSweeperCreateTransfersForWalletSweepBTC
 };
 
 BRCryptoWalletSweeperHandlers cryptoWalletSweeperHandlersBSV = {
@@ -423,5 +671,7 @@ BRCryptoWalletSweeperHandlers cryptoWalletSweeperHandlersBSV = {
     cryptoWalletSweeperAddTransactionFromBundleBTC,
     cryptoWalletSweeperEstimateFeeBasisForWalletSweepBTC,
     cryptoWalletSweeperCreateTransferForWalletSweepBTC,
-    cryptoWalletSweeperValidateBTC
+    cryptoWalletSweeperValidateBTC,
+    cryptoWalletSweeperEstimateBatchForWalletSweepBTC,
+    cryptoWalletSweeperCreateTransfersForWalletSweepBTC
 };
@@ -179,8 +179,6 @@ typedef struct BRCryptoWalletManagerETHRecord {
 
     BRSetOf(BREthereumToken) tokens;
 
-    BRRlpCoder coder;
-
 } *BRCryptoWalletManagerETH;
 
 extern BRCryptoWalletManagerETH
@@ -42,7 +42,6 @@ cryptoWalletManagerCoerceETH (BRCryptoWalletManager manager) {
 typedef struct {
     BREthereumNetwork network;
     BREthereumAccount account;
-    BRRlpCoder coder;
 } BRCryptoWalletManagerCreateContextETH;
 
 static void
@@ -53,7 +52,6 @@ cryptoWaleltMangerCreateCallbackETH (BRCryptoWalletManagerCreateContext context,
 
     managerETH->network = contextETH->network;
     managerETH->account = contextETH->account;
-    managerETH->coder   = contextETH->coder;
 }
 
 static BRCryptoWalletManager
@@ -66,8 +64,7 @@ cryptoWalletManagerCreateETH (BRCryptoWalletManagerListener listener,
                               const char *path) {
     BRCryptoWalletManagerCreateContextETH contextETH = {
         cryptoNetworkAsETH (network),
-        cryptoAccountAsETH (account),
-        rlpCoderCreate()
+        cryptoAccountAsETH (account)
     };
 
     BRCryptoWalletManager manager = cryptoWalletManagerAllocAndInit (sizeof (struct BRCryptoWalletManagerETHRecord),
@@ -121,7 +118,6 @@ static void
 cryptoWalletManagerReleaseETH (BRCryptoWalletManager manager) {
     BRCryptoWalletManagerETH managerETH = cryptoWalletManagerCoerceETH (manager);
 
-    rlpCoderRelease (managerETH->coder);
     if (NULL != managerETH->tokens)
         BRSetFreeAll(managerETH->tokens, (void (*) (void*)) ethTokenRelease);
 }
@@ -168,7 +164,7 @@ cryptoWalletManagerSignTransaction (BRCryptoWalletManager manager,
                              ethAccountGetThenIncrementAddressNonce (ethAccount, ethAddress));
 
     // RLP Encode the UNSIGNED transaction
-    BRRlpCoder coder = rlpCoderCreate();
+    BRRlpCoder coder = rlpCoderCreateFromPool();
     BRRlpItem item = transactionRlpEncode (ethTransaction,
                                            ethNetwork,
                                            RLP_TYPE_TRANSACTION_UNSIGNED,
@@ -197,7 +193,7 @@ cryptoWalletManagerSignTransaction (BRCryptoWalletManager manager,
                         ethHashCreateFromData (rlpItemGetDataSharedDontRelease (coder, item)));
 
     rlpItemRelease(coder, item);
-    rlpCoderRelease(coder);
+    rlpCoderReleaseToPool(coder);
 
     return CRYPTO_TRUE;
 }
@@ -698,13 +694,15 @@ cryptoWalletManagerRecoverLog (BRCryptoWalletManager manager,
     // log->data is assigned with rlpDecodeBytes(coder, items[2]); we'll need the same
     // thing, somehow
 
-    BRRlpItem  item  = rlpEncodeUInt256 (managerETH->coder, amount, 1);
+    BRRlpCoder coder = rlpCoderCreateFromPool();
+    BRRlpItem  item  = rlpEncodeUInt256 (coder, amount, 1);
 
     BREthereumLog log = logCreate (ethAddressCreate (contract),
                                    topicsCount,
                                    topics,
-                                   rlpItemGetDataSharedDontRelease (managerETH->coder, item));
-    rlpItemRelease (managerETH->coder, item);
+                                   rlpItemGetDataSharedDontRelease (coder, item));
+    rlpItemRelease (coder, item);
+    rlpCoderReleaseToPool (coder);
 
     // Given {hash,logIndex}, initialize the log's identifier
     assert (logIndex <= (uint64_t) SIZE_MAX);
@@ -447,9 +447,11 @@ ewmHandleLog (BREthereumBCSCallbackContext context,
     if (NULL == transferETH) {
 
         // Do we know that log->data is a number?
-        BRRlpItem  item  = rlpDataGetItem (managerETH->coder, logGetDataShared(log));
-        UInt256 amount = rlpDecodeUInt256 (managerETH->coder, item, 1);
-        rlpItemRelease (managerETH->coder, item);
+        BRRlpCoder coder = rlpCoderCreateFromPool();
+        BRRlpItem  item  = rlpDataGetItem (coder, logGetDataShared(log));
+        UInt256 amount = rlpDecodeUInt256 (coder, item, 1);
+        rlpItemRelease (coder, item);
+        rlpCoderReleaseToPool (coder);
 
         transferETH = (BRCryptoTransferETH) cryptoTransferCreateWithLogAsETH (walletETH->base.listenerTransfer,
                                                                               walletETH->base.unit,
@@ -43,9 +43,11 @@ fileServiceTypeTransactionV1Writer (BRFileServiceContext context,
     BRCryptoWalletManagerETH manager = context;
     BREthereumTransaction transaction = (BREthereumTransaction) entity;
 
-    BRRlpItem item = transactionRlpEncode(transaction, manager->network, RLP_TYPE_ARCHIVE, manager->coder);
-    BRRlpData data = rlpItemGetData (manager->coder, item);
-    rlpItemRelease (manager->coder, item);
+    BRRlpCoder coder = rlpCoderCreateFromPool();
+    BRRlpItem item = transactionRlpEncode(transaction, manager->network, RLP_TYPE_ARCHIVE, coder);
+    BRRlpData data = rlpItemGetData (coder, item);
+    rlpItemRelease (coder, item);
+    rlpCoderReleaseToPool (coder);
 
     *bytesCount = (uint32_t) data.bytesCount;
     return data.bytes;
@@ -58,11 +60,13 @@ fileServiceTypeTransactionV1Reader (BRFileServiceContext context,
                                     uint32_t bytesCount) {
     BRCryptoWalletManagerETH manager = context;
 
+    BRRlpCoder coder = rlpCoderCreateFromPool();
     BRRlpData data = { bytesCount, bytes };
-    BRRlpItem item = rlpDataGetItem (manager->coder, data);
+    BRRlpItem item = rlpDataGetItem (coder, data);
 
-    BREthereumTransaction transaction = transactionRlpDecode(item, manager->network, RLP_TYPE_ARCHIVE, manager->coder);
-    rlpItemRelease (manager->coder, item);
+    BREthereumTransaction transaction = transactionRlpDecode(item, manager->network, RLP_TYPE_ARCHIVE, coder);
+    rlpItemRelease (coder, item);
+    rlpCoderReleaseToPool (coder);
 
     return transaction;
 }
@@ -102,12 +106,14 @@ fileServiceTypeLogV1Writer (BRFileServiceContext context,
                             BRFileService fs,
                             const void* entity,
                             uint32_t *bytesCount) {
-    BRCryptoWalletManagerETH manager = context;
+    BRCryptoWalletManagerETH manager = context; (void) manager;
     BREthereumLog log = (BREthereumLog) entity;
 
-    BRRlpItem item = logRlpEncode (log, RLP_TYPE_ARCHIVE, manager->coder);
-    BRRlpData data = rlpItemGetData (manager->coder, item);
-    rlpItemRelease (manager->coder, item);
+    BRRlpCoder coder = rlpCoderCreateFromPool();
+    BRRlpItem item = logRlpEncode (log, RLP_TYPE_ARCHIVE, coder);
+    BRRlpData data = rlpItemGetData (coder, item);
+    rlpItemRelease (coder, item);
+    rlpCoderReleaseToPool (coder);
 
     *bytesCount = (uint32_t) data.bytesCount;
     return data.bytes;
@@ -118,13 +124,15 @@ fileServiceTypeLogV1Reader (BRFileServiceContext context,
                             BRFileService fs,
                             uint8_t *bytes,
                             uint32_t bytesCount) {
-    BRCryptoWalletManagerETH manager = context;
+    BRCryptoWalletManagerETH manager = context; (void) manager;
 
+    BRRlpCoder coder = rlpCoderCreateFromPool();
     BRRlpData data = { bytesCount, bytes };
-    BRRlpItem item = rlpDataGetItem (manager->coder, data);
+    BRRlpItem item = rlpDataGetItem (coder, data);
 
-    BREthereumLog log = logRlpDecode(item, RLP_TYPE_ARCHIVE, manager->coder);
-    rlpItemRelease (manager->coder, item);
+    BREthereumLog log = logRlpDecode(item, RLP_TYPE_ARCHIVE, coder);
+    rlpItemRelease (coder, item);
+    rlpCoderReleaseToPool (coder);
 
     return log;
 }
@@ -164,12 +172,14 @@ fileServiceTypeExchangeV1Writer (BRFileServiceContext context,
                                  BRFileService fs,
                                  const void* entity,
                                  uint32_t *bytesCount) {
-    BRCryptoWalletManagerETH manager = context;
+    BRCryptoWalletManagerETH manager = context; (void) manager;
     BREthereumExchange exchange = (BREthereumExchange) entity;
 
-    BRRlpItem item = ethExchangeRlpEncode (exchange, RLP_TYPE_ARCHIVE, manager->coder);
-    BRRlpData data = rlpItemGetData (manager->coder, item);
-    rlpItemRelease (manager->coder, item);
+    BRRlpCoder coder = rlpCoderCreateFromPool();
+    BRRlpItem item = ethExchangeRlpEncode (exchange, RLP_TYPE_ARCHIVE, coder);
+    BRRlpData data = rlpItemGetData (coder, item);
+    rlpItemRelease (coder, item);
+    rlpCoderReleaseToPool (coder);
 
     *bytesCount = (uint32_t) data.bytesCount;
     return data.bytes;
@@ -180,13 +190,15 @@ fileServiceTypeExchangeV1Reader (BRFileServiceContext context,
                                  BRFileService fs,
                                  uint8_t *bytes,
                                  uint32_t bytesCount) {
-    BRCryptoWalletManagerETH manager = context;
+    BRCryptoWalletManagerETH manager = context; (void) manager;
 
+    BRRlpCoder coder = rlpCoderCreateFromPool();
     BRRlpData data = { bytesCount, bytes };
-    BRRlpItem item = rlpDataGetItem (manager->coder, data);
+    BRRlpItem item = rlpDataGetItem (coder, data);
 
-    BREthereumExchange exchange = ethExchangeRlpDecode (item, RLP_TYPE_ARCHIVE, manager->coder);
-    rlpItemRelease (manager->coder, item);
+    BREthereumExchange exchange = ethExchangeRlpDecode (item, RLP_TYPE_ARCHIVE, coder);
+    rlpItemRelease (coder, item);
+    rlpCoderReleaseToPool (coder);
 
     return exchange;
 }
@@ -229,9 +241,11 @@ fileServiceTypeBlockV1Writer (BRFileServiceContext context,
     BRCryptoWalletManagerETH manager = context;
     BREthereumBlock block = (BREthereumBlock) entity;
 
-    BRRlpItem item = blockRlpEncode(block, manager->network, RLP_TYPE_ARCHIVE, manager->coder);
-    BRRlpData data = rlpItemGetData (manager->coder, item);
-    rlpItemRelease (manager->coder, item);
+    BRRlpCoder coder = rlpCoderCreateFromPool();
+    BRRlpItem item = blockRlpEncode(block, manager->network, RLP_TYPE_ARCHIVE, coder);
+    BRRlpData data = rlpItemGetData (coder, item);
+    rlpItemRelease (coder, item);
+    rlpCoderReleaseToPool (coder);
 
     *bytesCount = (uint32_t) data.bytesCount;
     return data.bytes;
@@ -244,11 +258,13 @@ fileServiceTypeBlockV1Reader (BRFileServiceContext context,
                               uint32_t bytesCount) {
     BRCryptoWalletManagerETH manager = context;
 
+    BRRlpCoder coder = rlpCoderCreateFromPool();
     BRRlpData data = { bytesCount, bytes };
-    BRRlpItem item = rlpDataGetItem (manager->coder, data);
+    BRRlpItem item = rlpDataGetItem (coder, data);
 
-    BREthereumBlock block = blockRlpDecode (item, manager->network, RLP_TYPE_ARCHIVE, manager->coder);
-    rlpItemRelease (manager->coder, item);
+    BREthereumBlock block = blockRlpDecode (item, manager->network, RLP_TYPE_ARCHIVE, coder);
+    rlpItemRelease (coder, item);
+    rlpCoderReleaseToPool (coder);
 
     return block;
 }
@@ -288,12 +304,14 @@ fileServiceTypeNodeV1Writer (BRFileServiceContext context,
                              BRFileService fs,
                              const void* entity,
                              uint32_t *bytesCount) {
-    BRCryptoWalletManagerETH manager = context;
+    BRCryptoWalletManagerETH manager = context; (void) manager;
     const BREthereumNodeConfig node = (BREthereumNodeConfig) entity;
 
-    BRRlpItem item = nodeConfigEncode (node, manager->coder);
-    BRRlpData data = rlpItemGetData (manager->coder, item);
-    rlpItemRelease (manager->coder, item);
+    BRRlpCoder coder = rlpCoderCreateFromPool();
+    BRRlpItem item = nodeConfigEncode (node, coder);
+    BRRlpData data = rlpItemGetData (coder, item);
+    rlpItemRelease (coder, item);
+    rlpCoderReleaseToPool (coder);
 
     *bytesCount = (uint32_t) data.bytesCount;
     return data.bytes;
@@ -304,13 +322,15 @@ fileServiceTypeNodeV1Reader (BRFileServiceContext context,
                              BRFileService fs,
                              uint8_t *bytes,
                              uint32_t bytesCount) {
-    BRCryptoWalletManagerETH manager = context;
+    BRCryptoWalletManagerETH manager = context; (void) manager;
 
+    BRRlpCoder coder = rlpCoderCreateFromPool();
     BRRlpData data = { bytesCount, bytes };
-    BRRlpItem item = rlpDataGetItem (manager->coder, data);
+    BRRlpItem item = rlpDataGetItem (coder, data);
 
-    BREthereumNodeConfig node = nodeConfigDecode (item, manager->coder);
-    rlpItemRelease (manager->coder, item);
+    BREthereumNodeConfig node = nodeConfigDecode (item, coder);
+    rlpItemRelease (coder, item);
+    rlpCoderReleaseToPool (coder);
 
     return node;
 }
@@ -350,12 +370,14 @@ fileServiceTypeTokenV1Writer (BRFileServiceContext context,
                                     BRFileService fs,
                                     const void* entity,
                                     uint32_t *bytesCount) {
-    BRCryptoWalletManagerETH manager = context;
+    BRCryptoWalletManagerETH manager = context; (void) manager;
     BREthereumToken token = (BREthereumToken) entity;
 
-    BRRlpItem item = ethTokenRlpEncode(token, manager->coder);
-    BRRlpData data = rlpItemGetData (manager->coder, item);
-    rlpItemRelease (manager->coder, item);
+    BRRlpCoder coder = rlpCoderCreateFromPool();
+    BRRlpItem item = ethTokenRlpEncode(token, coder);
+    BRRlpData data = rlpItemGetData (coder, item);
+    rlpItemRelease (coder, item);
+    rlpCoderReleaseToPool (coder);
 
     *bytesCount = (uint32_t) data.bytesCount;
     return data.bytes;
@@ -366,13 +388,15 @@ fileServiceTypeTokenV1Reader (BRFileServiceContext context,
                                     BRFileService fs,
                                     uint8_t *bytes,
                                     uint32_t bytesCount) {
-    BRCryptoWalletManagerETH manager = context;
+    BRCryptoWalletManagerETH manager = context; (void) manager;
 
+    BRRlpCoder coder = rlpCoderCreateFromPool();
     BRRlpData data = { bytesCount, bytes };
-    BRRlpItem item = rlpDataGetItem (manager->coder, data);
+    BRRlpItem item = rlpDataGetItem (coder, data);
 
-    BREthereumToken token = ethTokenRlpDecode(item, manager->coder);
-    rlpItemRelease (manager->coder, item);
+    BREthereumToken token = ethTokenRlpDecode(item, coder);
+    rlpItemRelease (coder, item);
+    rlpCoderReleaseToPool (coder);
 
     return token;
 }
@@ -415,9 +439,11 @@ fileServiceTypeWalletV1Writer (BRFileServiceContext context,
     BRCryptoWalletManagerETH manager = context;
     BREthereumWalletState state = (BREthereumWalletState) entity;
 
-    BRRlpItem item = walletStateEncode (state, manager->coder);
-    BRRlpData data = rlpItemGetData (manager->coder, item);
-    rlpItemRelease (manager->coder, item);
+    BRRlpCoder coder = rlpCoderCreateFromPool();
+    BRRlpItem item = walletStateEncode (state, coder);
+    BRRlpData data = rlpItemGetData (coder, item);
+    rlpItemRelease (coder, item);
+    rlpCoderReleaseToPool (coder);
 
     *bytesCount = (uint32_t) data.bytesCount;
     return data.bytes;
@@ -430,11 +456,13 @@ fileServiceTypeWalletV1Reader (BRFileServiceContext context,
                                uint32_t bytesCount) {
     BRCryptoWalletManagerETH manager = context;
 
+    BRRlpCoder coder = rlpCoderCreateFromPool();
     BRRlpData data = { bytesCount, bytes };
-    BRRlpItem item = rlpDataGetItem (manager->coder, data);
+    BRRlpItem item = rlpDataGetItem (coder, data);
 
-    BREthereumWalletState state = walletStateDecode(item, manager->coder);
-    rlpItemRelease (manager->coder, item);
+    BREthereumWalletState state = walletStateDecode(item, coder);
+    rlpItemRelease (coder, item);
+    rlpCoderReleaseToPool (coder);
 
     return state;
 }
@@ -494,12 +494,12 @@ extern BRRlpData
 transactionGetRlpData (BREthereumTransaction transaction,
                        BREthereumNetwork network,
                        BREthereumRlpType type) {
-    BRRlpCoder coder = rlpCoderCreate();
+    BRRlpCoder coder = rlpCoderCreateFromPool();
     BRRlpItem item   = transactionRlpEncode (transaction, network, type, coder);
     BRRlpData data   = rlpItemGetData (coder, item);
 
     rlpItemRelease  (coder, item);
-    rlpCoderRelease (coder);
+    rlpCoderReleaseToPool (coder);
 
     return data;
 }
@@ -511,7 +511,7 @@ transactionGetRlpHexEncoded (BREthereumTransaction transaction,
                              const char *prefix) {
     if (NULL == prefix) prefix = "";
 
-    BRRlpCoder coder = rlpCoderCreate();
+    BRRlpCoder coder = rlpCoderCreateFromPool();
     BRRlpItem item = transactionRlpEncode (transaction, network, type, coder);
     BRRlpData data = rlpItemGetDataSharedDontRelease(coder, item);
 
@@ -527,7 +527,7 @@ transactionGetRlpHexEncoded (BREthereumTransaction transaction,
     }
 
     rlpItemRelease(coder, item);
-    rlpCoderRelease(coder);
+    rlpCoderReleaseToPool (coder);
     return result;
 }
 
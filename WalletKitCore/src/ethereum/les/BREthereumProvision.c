@@ -332,7 +332,7 @@ provisionHandleMessageLES (BREthereumProvision *provisionMulti,
             if (0 == array_count(messageHeaders))
                 status = PROVISION_ERROR;
             else {
-                BRRlpCoder coder = rlpCoderCreate();
+                BRRlpCoder coder = rlpCoderCreateFromPool();
 
                 size_t offset = messageContentLimit * (identifier - messageIdBase);
                 for (size_t index = 0; index < array_count(messageHeaders); index++) {
@@ -368,7 +368,7 @@ provisionHandleMessageLES (BREthereumProvision *provisionMulti,
                     }
                     ethDataRelease(key);
                 }
-                rlpCoderRelease(coder);
+                rlpCoderReleaseToPool (coder);
             }
             mptNodePathsRelease(messagePaths);
             blockHeadersRelease(messageHeaders);
@@ -442,7 +442,7 @@ provisionHandleMessageLES (BREthereumProvision *provisionMulti,
                 // coder has network and perhaps other context - although that is not needed here.
                 //
                 // We could add a coder to the BREthereumProvisionAccounts... yes, probably should.
-                BRRlpCoder coder = rlpCoderCreate();
+                BRRlpCoder coder = rlpCoderCreateFromPool();
 
                 size_t offset = messageContentLimit * (identifier - messageIdBase);
                 for (size_t index = 0; index < array_count(messagePaths); index++) {
@@ -460,7 +460,7 @@ provisionHandleMessageLES (BREthereumProvision *provisionMulti,
                     else provisionAccounts[offset + index] = accountStateCreateEmpty();
                     rlpDataRelease(data);
                 }
-                rlpCoderRelease(coder);
+                rlpCoderReleaseToPool (coder);
             }
             mptNodePathsRelease(messagePaths);
             break;
@@ -797,7 +797,7 @@ provisionHandleMessagePIP (BREthereumProvision *provisionMulti,
             if (0 == array_count(outputs))
                 status = PROVISION_ERROR;
             else {
-                BRRlpCoder coder = rlpCoderCreate();
+                BRRlpCoder coder = rlpCoderCreateFromPool();
 
                 size_t offset = messageContentLimit * (identifier - messageIdBase);
                 for (size_t index = 0; index < array_count(outputs); index++) {
@@ -824,7 +824,7 @@ provisionHandleMessagePIP (BREthereumProvision *provisionMulti,
                     rlpItemRelease (coder, item);
                     mptNodePathRelease (path);
                 }
-                rlpCoderRelease(coder);
+                rlpCoderReleaseToPool (coder);
             }
             array_free (outputs);
            break;
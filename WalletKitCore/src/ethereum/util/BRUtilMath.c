@@ -16,6 +16,15 @@
 
 #define AS_UINT64(x)  ((uint64_t) (x))
 
+// Where the compiler provides a native 128-bit integer, multiply and divide on 64-bit limbs; a
+// UInt256 is then 4 limbs rather than 8.  Otherwise fall back to 32-bit limbs with 64-bit
+// intermediates (e.g. 32-bit ARM).
+#if defined (__SIZEOF_INT128__)
+#  define UINT256_NATIVE_UINT128
+typedef unsigned __int128 uint128_native_t;
+#  define AS_UINT128(x)  ((uint128_native_t) (x))
+#endif
+
 extern UInt256
 uint256Create (uint64_t value) {
     UInt256 result = { .u64 = { value, 0, 0, 0}};
@@ -148,7 +157,23 @@ extern UInt512
 uint256Mul (const UInt256 x, const UInt256 y) {
     //  assert (__LITTLE_ENDIAN__ == BYTE_ORDER);
     UInt512 z = UINT512_ZERO;
-    
+
+#if defined (UINT256_NATIVE_UINT128)
+    size_t count = sizeof (UInt256) / sizeof(uint64_t);
+
+    // Long multiplication in base 2^64; 16 64x64->128 bit multiplications.  Each partial
+    // `x * y + z + carry` is at most (2^64 - 1)^2 + 2 * (2^64 - 1) = 2^128 - 1; never overflows.
+    for (size_t xi = 0; xi < count; xi++) {
+        uint64_t carry = 0;
+        if (x.u64[xi] == 0) continue;
+        for (size_t yi = 0; yi < count; yi++) {
+            uint128_native_t total = AS_UINT128 (x.u64[xi]) * y.u64[yi] + z.u64[yi + xi] + carry;
+            carry = (uint64_t) (total >> 64);
+            z.u64[yi + xi] = (uint64_t) total;
+        }
+        z.u64[xi + count] = carry;
+    }
+#else
     size_t count = sizeof (UInt256) / sizeof(uint32_t);
     
     // Use 'grade school' long multiplication in base 32.  For UInt256 we'll have 8 32-bit value
@@ -165,12 +190,57 @@ uint256Mul (const UInt256 x, const UInt256 y) {
         }
         z.u32[xi + count] += carry;
     }
+#endif
     return z;
 }
 
 extern UInt256
 uint256Mul_Overflow (UInt256 x, UInt256 y, int *overflow) {
+#if defined (UINT256_NATIVE_UINT128)
+    assert (NULL != overflow);
+
+    UInt256 z = UINT256_ZERO;
+    size_t count = sizeof (UInt256) / sizeof(uint64_t);
+
+    // Only compute the low 256 bits.  Every partial product is non-negative, so we've overflowed
+    // if any partial product lands at or above 2^256 or if a carry leaves the top limb.
+    *overflow = 0;
+    for (size_t xi = 0; xi < count && !*overflow; xi++) {
+        uint64_t carry = 0;
+        if (x.u64[xi] == 0) continue;
+        for (size_t yi = 0; yi + xi < count; yi++) {
+            uint128_native_t total = AS_UINT128 (x.u64[xi]) * y.u64[yi] + z.u64[yi + xi] + carry;
+            carry = (uint64_t) (total >> 64);
+            z.u64[yi + xi] = (uint64_t) total;
+        }
+        *overflow = (0 != carry);
+        for (size_t yi = count - xi; yi < count; yi++)
+            *overflow |= (0 != y.u64[yi]);
+    }
+    return (*overflow ? UINT256_ZERO : z);
+#else
     return uint256Coerce (uint256Mul (x, y), overflow);
+#endif
+}
+
+extern UInt256
+uint256MulAdd_Small64 (UInt256 x, uint64_t y, uint64_t z, int *overflow) {
+    assert (NULL != overflow);
+#if defined (UINT256_NATIVE_UINT128)
+    UInt256 r;
+    uint64_t carry = z;
+
+    for (size_t index = 0; index < sizeof (UInt256) / sizeof(uint64_t); index++) {
+        uint128_native_t total = AS_UINT128 (x.u64[index]) * y + carry;
+        carry = (uint64_t) (total >> 64);
+        r.u64[index] = (uint64_t) total;
+    }
+    *overflow = (0 != carry);
+    return (*overflow ? UINT256_ZERO : r);
+#else
+    UInt256 r = uint256Mul_Overflow (x, uint256Create (y), overflow);
+    return (*overflow ? UINT256_ZERO : uint256Add_Overflow (r, uint256Create (z), overflow));
+#endif
 }
 
 extern UInt256
@@ -250,6 +320,44 @@ uint256Div_Small (UInt256 x, uint32_t y, uint32_t *rem) {
     return z;
 }
 
+extern UInt256
+uint256Div_Small64 (UInt256 x, uint64_t y, uint64_t *rem) {
+    assert (NULL != rem && 0 != y);
+#if defined (UINT256_NATIVE_UINT128)
+    UInt256 z = UINT256_ZERO;
+    uint64_t remainder = 0;
+    for (ssize_t i = 3; i >= 0; i--) {
+        uint128_native_t value = (AS_UINT128 (remainder) << 64) | x.u64[i];
+        z.u64[i] = (uint64_t) (value / y);
+        remainder = (uint64_t) (value % y);
+    }
+    *rem = remainder;
+    return z;
+#else
+    if (y <= UINT32_MAX) {
+        uint32_t remainder;
+        UInt256 z = uint256Div_Small (x, (uint32_t) y, &remainder);
+        *rem = remainder;
+        return z;
+    }
+
+    // Binary long division; `remainder` is always less than `y` before the shift, so the
+    // shifted-out high bit must be accounted for in the comparison.
+    UInt256 z = UINT256_ZERO;
+    uint64_t remainder = 0;
+    for (ssize_t bit = 255; bit >= 0; bit--) {
+        int high = (0 != (remainder >> 63));
+        remainder = (remainder << 1) | ((x.u64[bit / 64] >> (bit % 64)) & 1);
+        if (high || remainder >= y) {
+            remainder -= y;
+            z.u64[bit / 64] |= (AS_UINT64(1) << (bit % 64));
+        }
+    }
+    *rem = remainder;
+    return z;
+#endif
+}
+
 static int
 tooBigUInt256 (UInt512 x) {
     return (0 != x.u64[4]
@@ -124,6 +124,13 @@ uint256Mul_Overflow (UInt256 x, UInt256 y, int *overflow);
 extern UInt256
 uint256Mul_Small (UInt256 x, uint32_t y, int *overflow);
 
+/**
+ * Multiply and add as `x * y + z`.  If the result is too big then overflow is set to 1 and
+ * zero is returned.
+ */
+extern UInt256
+uint256MulAdd_Small64 (UInt256 x, uint64_t y, uint64_t z, int *overflow);
+
 /**
  * Multiply as `x * y` where `y` is a postive double.  If `y` is negative, then this function
  * sets *negative to 1 and performs `x * -y`.  If the result is too big then overflow is set to 1
@@ -138,6 +145,12 @@ uint256Mul_Double (UInt256 x, double y, int *overflow, int *negative, double *re
 extern UInt256
 uint256Div_Small (UInt256 x, uint32_t y, uint32_t *rem);
 
+/**
+ * Divide as `x / y` where `y` is a non-zero uint64_t, filling `rem` with the remainder.
+ */
+extern UInt256
+uint256Div_Small64 (UInt256 x, uint64_t y, uint64_t *rem);
+
 /**
  * Coerce `x`, a UInt512, to a UInt256.  If `x` is too big then overflow is set to 1 and
  * zero is returned.
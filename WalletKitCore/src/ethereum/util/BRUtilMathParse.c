@@ -13,7 +13,6 @@
 #include <assert.h>
 #include <string.h>
 #include <ctype.h>
-#include <errno.h>
 #include "support/BRAssert.h"
 #include "BRUtil.h"
 
@@ -122,32 +121,8 @@ uint256CreateParseDecimal (const char *string, int decimals, BRCoreParseStatus *
 }
 
 
-//    > max064
-//    18446744073709551615
-//    > (number->string max064 2)
-//    "1111111111111111111111111111111111111111111111111111111111111111"
-//    > (string-length (number->string max064 2))
-//    64
-//    > (number->string max064 10)
-//    "18446744073709551615"
-//    > (string-length (number->string max064 10))
-//    20
-//    >(number->string max064 16)
-//    "FFFFFFFFFFFFFFFF"
-//    > (string-length (number->string max064 16))
-//    16
-
-// The maximum digits allowed in a string so as to prevent overflow in uint64_t
-static size_t
-parseMaximumDigitsForUInt64InBase (int base) {
-    switch (base) {
-        case 2:  return 64;
-        case 10: return 19;
-        case 16: return 16;
-        default: BRFail();
-    }
-}
-
+// The maximum digits allowed in a string so as to prevent overflow in UInt256.  Note that, for
+// base 10, a string of 78 digits might still overflow.
 static size_t
 parseMaximumDigitsForUInt256InBase (int base) {
     switch (base) {
@@ -158,55 +133,71 @@ parseMaximumDigitsForUInt256InBase (int base) {
     }
 }
 
-// Compute (expt base power)
+// Decimal strings are parsed, and produced, in chunks of this many digits; (expt 10 19) is the
+// largest power of 10 that fits in a uint64_t.
+#define DECIMAL_CHUNK_DIGITS    (19)
+
+static const uint64_t decimalPowers [DECIMAL_CHUNK_DIGITS + 1] = {
+    1ull,
+    10ull,
+    100ull,
+    1000ull,
+    10000ull,
+    100000ull,
+    1000000ull,
+    10000000ull,
+    100000000ull,
+    1000000000ull,
+    10000000000ull,
+    100000000000ull,
+    1000000000000ull,
+    10000000000000ull,
+    100000000000000ull,
+    1000000000000000ull,
+    10000000000000000ull,
+    100000000000000000ull,
+    1000000000000000000ull,
+    10000000000000000000ull
+};
+
 static UInt256
-parseUInt256Power (int base, int power, int *overflow) {
-    size_t maxPower = parseMaximumDigitsForUInt64InBase(base);
-    
-    if (power > maxPower) {
-        *overflow = 1;
-        return UINT256_ZERO;
-    }
-    
-    uint64_t value = 1;
-    while (power-- > 0)
-        value *= (uint64_t) base;  // slow, but yeah.
-    
-    // Reality is that this can overflow for 16^16 = 2^64 (one too many).  We'll handle it.
-    //  Probably also for 2^256... can't handle that one similarly.
-    *overflow = 0;
-    if (value == 0) {
-        UInt256 result = UINT256_ZERO;
-        result.u64[1] = 1;
-        return result;
+parseUInt256InBase10 (const char *string, size_t length, BRCoreParseStatus *status) {
+    UInt256 value = UINT256_ZERO;
+
+    // Size the first chunk so that all following chunks hold exactly DECIMAL_CHUNK_DIGITS.  For
+    // a string like "123.45", the character at index 0 is '1'; by parsing chunks with ascending
+    // index, we naturally treat `string` as big endian.
+    size_t chunkDigits = 1 + (length - 1) % DECIMAL_CHUNK_DIGITS;
+
+    for (size_t index = 0; index < length; index += chunkDigits, chunkDigits = DECIMAL_CHUNK_DIGITS) {
+        uint64_t chunk = 0;
+        for (size_t digit = 0; digit < chunkDigits; digit++)
+            chunk = 10 * chunk + (uint64_t) (string[index + digit] - '0');
+
+        int overflow = 0;
+        value = uint256MulAdd_Small64 (value, decimalPowers[chunkDigits], chunk, &overflow);
+        if (overflow) {
+            *status = CORE_PARSE_OVERFLOW;
+            return UINT256_ZERO;
+        }
     }
-    else return uint256Create(value);
-}
 
-// Compute (* value (expt base power))
-static UInt256
-parseUInt256ScaleByPower (UInt256 value, int base, int power, int *overflow) {
-    UInt256 scale = parseUInt256Power(base, power, overflow);
-    return (*overflow
-            ? UINT256_ZERO
-            : uint256Mul_Overflow(value, scale, overflow));
+    *status = CORE_PARSE_OK;
+    return value;
 }
 
+// For base 2 and 16 each digit is a fixed number of bits; fill the value from the least
+// significant (last) digit.  The caller has limited `length` so this can't overflow.
 static UInt256
-parseUInt64 (const char *string, int digits, int base) {
-    size_t maxDigits = parseMaximumDigitsForUInt64InBase(base);
-    assert (digits <= maxDigits );
-    
-    //
-    char number[1 + maxDigits], *numberEnd;
-    strncpy (number, string, maxDigits);
-    number[maxDigits] = '\0';
-
-    errno = 0;
-    uint64_t value = strtoull (number, &numberEnd, base);
-    if (0 == errno && (*number == '\0' || numberEnd == NULL || *numberEnd != '\0'))
-        errno = EINVAL;
-    return uint256Create (value);
+parseUInt256InBasePower2 (const char *string, size_t length, unsigned int bitsPerDigit) {
+    UInt256 value = UINT256_ZERO;
+
+    for (size_t index = 0; index < length; index++) {
+        uint64_t digit = (uint64_t) _hexu (string[length - 1 - index]);
+        size_t   bit   = index * bitsPerDigit;
+        value.u64[bit / 64] |= (digit << (bit % 64));
+    }
+    return value;
 }
 
 extern UInt256
@@ -254,58 +245,11 @@ uint256CreateParse (const char *string, int base, BRCoreParseStatus *status) {
         return UINT256_ZERO;
     }
     
-    // We'll process this many digits in `string`.
-    size_t stringChunks = parseMaximumDigitsForUInt64InBase(base);
-
-    // Fill this in.
-    UInt256 value = UINT256_ZERO;
+    if (10 == base)
+        return parseUInt256InBase10 (string, length, status);
 
-    // For parsing a string like "123.45", the character at index 0 is '1'.  So by parsing chunks
-    // with ascending index, we naturally treat `string` as big endian - no matter the base.
-    // Eventually, when `parseUInt64()` calls `strtoull` we'll still be using big endian.
-    for (size_t index = 0; index < length; index += stringChunks) {
-        // On the first time through, get an initial value
-        if (index == 0) {
-            value = parseUInt64(string, (int) stringChunks, base);
-            if (errno != 0) {
-                *status = CORE_PARSE_STRANGE_DIGITS;
-                return UINT256_ZERO;
-            }
-        }
-        
-        // Otherwise, we'll scale value and add in the next chunk.
-        else {
-            // This many remain - if more than stringChunks, we'll scale by just stringChunks
-            int remainingDigits = (int) (length - index);
-            int scalingDigits = remainingDigits >= stringChunks ? (int) stringChunks : remainingDigits;
-            
-            int scaleOverflow = 0, addOverflow = 0;
-            
-            // Scale (aka shift the value by scalingDigits)
-            value = parseUInt256ScaleByPower(value, base, scalingDigits, &scaleOverflow);
-            
-            // Add in the next chuck.
-            value = uint256Add_Overflow(value, parseUInt64(&string[index], (int) stringChunks, base), &addOverflow);
-            if (scaleOverflow || addOverflow) {
-                *status = CORE_PARSE_OVERFLOW;
-                return UINT256_ZERO;
-            }
-        }
-    }
     *status = CORE_PARSE_OK;
-    return value;
-}
-
-//
-//
-//
-static char *
-coerceReverseString (const char *s) {
-    size_t len = strlen(s);
-    char *t = calloc (1 + len, 1);
-    for (size_t i = 0; i < len; i++)
-        t[len - i - 1] = s[i];
-    return t;
+    return parseUInt256InBasePower2 (string, length, (16 == base ? 4 : 1));
 }
 
 extern char *
@@ -333,16 +277,25 @@ uint256CoerceString (UInt256 x, int base) {
             return hexEncodeCreate (NULL, &xr.u8[xrIndex], sizeof (xr.u8) - xrIndex);
         }
             
-            // Repeatedly divide by 10; append the result with the remainder.
+            // Repeatedly divide by (expt 10 19); fill the result, from the end, with the
+            // DECIMAL_CHUNK_DIGITS digits of each remainder.  Only the most significant chunk
+            // omits leading zeros.
         case 10: {
-            char r[257];
-            memset (r, 0, 257);
-            for (int i = 0; i < 256 && !uint256EQL(x, UINT256_ZERO); i++) {
-                uint32_t rem;
-                x = uint256Div_Small(x, (uint32_t) base, &rem);
-                r[i] = '0' + rem;
+            char r[DECIMAL_CHUNK_DIGITS * (1 + 78 / DECIMAL_CHUNK_DIGITS) + 1];
+            char *digits = &r[sizeof (r) - 1];
+            *digits = '\0';
+
+            while (!uint256EQL(x, UINT256_ZERO)) {
+                uint64_t rem;
+                x = uint256Div_Small64 (x, decimalPowers[DECIMAL_CHUNK_DIGITS], &rem);
+
+                int isMostSignificant = uint256EQL (x, UINT256_ZERO);
+                for (size_t digit = 0; digit < DECIMAL_CHUNK_DIGITS && (!isMostSignificant || 0 != rem); digit++) {
+                    *--digits = (char) ('0' + rem % 10);
+                    rem /= 10;
+                }
             }
-            return coerceReverseString(r);
+            return strdup (digits);
         }
             
             // Get the base 16 result and then swap hex values for binary strings.
@@ -135,3 +135,34 @@ void BRBIP39DeriveKey(void *key64, const char *phrase, const char *passphrase)
         mem_clean(salt, sizeof(salt));
     }
 }
+
+// keys64 must hold count*64 bytes, the key for phrases[i] is written to offset i*64, passphrase applies to all phrases
+// derivation runs several phrases at once and is considerably faster than calling BRBIP39DeriveKey() in a loop
+void BRBIP39DeriveKeys(void *keys64, const char *phrases[], const char *passphrase, size_t count)
+{
+    char salt[strlen("mnemonic") + (passphrase ? strlen(passphrase) : 0) + 1];
+    void *dk[16];
+    const void *pw[16], *salts[16];
+    size_t pwLen[16], saltLen[16];
+
+    assert(keys64 != NULL || count == 0);
+    assert(phrases != NULL || count == 0);
+    
+    strcpy(salt, "mnemonic");
+    if (passphrase) strcpy(salt + strlen("mnemonic"), passphrase);
+    
+    for (size_t i = 0; i < count; i += sizeof(dk)/sizeof(*dk)) {
+        size_t n = (count - i < sizeof(dk)/sizeof(*dk)) ? count - i : sizeof(dk)/sizeof(*dk);
+        
+        for (size_t j = 0; j < n; j++) {
+            assert(phrases[i + j] != NULL);
+            dk[j] = (uint8_t *)keys64 + (i + j)*64;
+            pw[j] = phrases[i + j], pwLen[j] = strlen(phrases[i + j]);
+            salts[j] = salt, saltLen[j] = strlen(salt);
+        }
+        
+        BRPBKDF2SHA512Batch(dk, 64, pw, pwLen, salts, saltLen, 2048, n);
+    }
+    
+    mem_clean(salt, sizeof(salt));
+}
@@ -52,6 +52,9 @@ int BRBIP39PhraseIsValid(const char *wordList[], const char *phrase);
 // BUG: does not currently support passphrases containing NULL characters
 void BRBIP39DeriveKey(void *key64, const char *phrase, const char *passphrase);
 
+// derives keys for count phrases that share a passphrase, keys64 must hold count*64 bytes
+void BRBIP39DeriveKeys(void *keys64, const char *phrases[], const char *passphrase, size_t count);
+
 #ifdef __cplusplus
 }
 #endif
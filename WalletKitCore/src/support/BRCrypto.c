@@ -26,6 +26,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 // endian swapping
 #if __BIG_ENDIAN__ || (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
@@ -211,27 +217,27 @@ void BRSHA256_2(void *md32, const void *data, size_t dataLen)
 #define S2(x) (ror64((x), 1) ^ ror64((x), 8) ^ ((x) >> 7))
 #define S3(x) (ror64((x), 19) ^ ror64((x), 61) ^ ((x) >> 6))
 
+static const uint64_t _sha512k[] = {
+    0x428a2f98d728ae22, 0x7137449123ef65cd, 0xb5c0fbcfec4d3b2f, 0xe9b5dba58189dbbc, 0x3956c25bf348b538,
+    0x59f111f1b605d019, 0x923f82a4af194f9b, 0xab1c5ed5da6d8118, 0xd807aa98a3030242, 0x12835b0145706fbe,
+    0x243185be4ee4b28c, 0x550c7dc3d5ffb4e2, 0x72be5d74f27b896f, 0x80deb1fe3b1696b1, 0x9bdc06a725c71235,
+    0xc19bf174cf692694, 0xe49b69c19ef14ad2, 0xefbe4786384f25e3, 0x0fc19dc68b8cd5b5, 0x240ca1cc77ac9c65,
+    0x2de92c6f592b0275, 0x4a7484aa6ea6e483, 0x5cb0a9dcbd41fbd4, 0x76f988da831153b5, 0x983e5152ee66dfab,
+    0xa831c66d2db43210, 0xb00327c898fb213f, 0xbf597fc7beef0ee4, 0xc6e00bf33da88fc2, 0xd5a79147930aa725,
+    0x06ca6351e003826f, 0x142929670a0e6e70, 0x27b70a8546d22ffc, 0x2e1b21385c26c926, 0x4d2c6dfc5ac42aed,
+    0x53380d139d95b3df, 0x650a73548baf63de, 0x766a0abb3c77b2a8, 0x81c2c92e47edaee6, 0x92722c851482353b,
+    0xa2bfe8a14cf10364, 0xa81a664bbc423001, 0xc24b8b70d0f89791, 0xc76c51a30654be30, 0xd192e819d6ef5218,
+    0xd69906245565a910, 0xf40e35855771202a, 0x106aa07032bbd1b8, 0x19a4c116b8d2d0c8, 0x1e376c085141ab53,
+    0x2748774cdf8eeb99, 0x34b0bcb5e19b48a8, 0x391c0cb3c5c95a63, 0x4ed8aa4ae3418acb, 0x5b9cca4f7763e373,
+    0x682e6ff3d6b2b8a3, 0x748f82ee5defb2fc, 0x78a5636f43172f60, 0x84c87814a1f0ab72, 0x8cc702081a6439ec,
+    0x90befffa23631e28, 0xa4506cebde82bde9, 0xbef9a3f7b2c67915, 0xc67178f2e372532b, 0xca273eceea26619c,
+    0xd186b8c721c0c207, 0xeada7dd6cde0eb1e, 0xf57d4f7fee6ed178, 0x06f067aa72176fba, 0x0a637dc5a2c898a6,
+    0x113f9804bef90dae, 0x1b710b35131c471b, 0x28db77f523047d84, 0x32caab7b40c72493, 0x3c9ebe0a15c9bebc,
+    0x431d67c49c100d4c, 0x4cc5d4becb3e42b6, 0x597f299cfc657e2a, 0x5fcb6fab3ad6faec, 0x6c44198c4a475817
+};
+
 static void _BRSHA512Compress(uint64_t *r, const uint64_t *x)
 {
-    static const uint64_t k[] = {
-        0x428a2f98d728ae22, 0x7137449123ef65cd, 0xb5c0fbcfec4d3b2f, 0xe9b5dba58189dbbc, 0x3956c25bf348b538,
-        0x59f111f1b605d019, 0x923f82a4af194f9b, 0xab1c5ed5da6d8118, 0xd807aa98a3030242, 0x12835b0145706fbe,
-        0x243185be4ee4b28c, 0x550c7dc3d5ffb4e2, 0x72be5d74f27b896f, 0x80deb1fe3b1696b1, 0x9bdc06a725c71235,
-        0xc19bf174cf692694, 0xe49b69c19ef14ad2, 0xefbe4786384f25e3, 0x0fc19dc68b8cd5b5, 0x240ca1cc77ac9c65,
-        0x2de92c6f592b0275, 0x4a7484aa6ea6e483, 0x5cb0a9dcbd41fbd4, 0x76f988da831153b5, 0x983e5152ee66dfab,
-        0xa831c66d2db43210, 0xb00327c898fb213f, 0xbf597fc7beef0ee4, 0xc6e00bf33da88fc2, 0xd5a79147930aa725,
-        0x06ca6351e003826f, 0x142929670a0e6e70, 0x27b70a8546d22ffc, 0x2e1b21385c26c926, 0x4d2c6dfc5ac42aed,
-        0x53380d139d95b3df, 0x650a73548baf63de, 0x766a0abb3c77b2a8, 0x81c2c92e47edaee6, 0x92722c851482353b,
-        0xa2bfe8a14cf10364, 0xa81a664bbc423001, 0xc24b8b70d0f89791, 0xc76c51a30654be30, 0xd192e819d6ef5218,
-        0xd69906245565a910, 0xf40e35855771202a, 0x106aa07032bbd1b8, 0x19a4c116b8d2d0c8, 0x1e376c085141ab53,
-        0x2748774cdf8eeb99, 0x34b0bcb5e19b48a8, 0x391c0cb3c5c95a63, 0x4ed8aa4ae3418acb, 0x5b9cca4f7763e373,
-        0x682e6ff3d6b2b8a3, 0x748f82ee5defb2fc, 0x78a5636f43172f60, 0x84c87814a1f0ab72, 0x8cc702081a6439ec,
-        0x90befffa23631e28, 0xa4506cebde82bde9, 0xbef9a3f7b2c67915, 0xc67178f2e372532b, 0xca273eceea26619c,
-        0xd186b8c721c0c207, 0xeada7dd6cde0eb1e, 0xf57d4f7fee6ed178, 0x06f067aa72176fba, 0x0a637dc5a2c898a6,
-        0x113f9804bef90dae, 0x1b710b35131c471b, 0x28db77f523047d84, 0x32caab7b40c72493, 0x3c9ebe0a15c9bebc,
-        0x431d67c49c100d4c, 0x4cc5d4becb3e42b6, 0x597f299cfc657e2a, 0x5fcb6fab3ad6faec, 0x6c44198c4a475817
-    };
-    
     int i;
     uint64_t a = r[0], b = r[1], c = r[2], d = r[3], e = r[4], f = r[5], g = r[6], h = r[7], t1, t2, w[80];
     
@@ -239,7 +245,7 @@ static void _BRSHA512Compress(uint64_t *r, const uint64_t *x)
     for (; i < 80; i++) w[i] = S3(w[i - 2]) + w[i - 7] + S2(w[i - 15]) + w[i - 16];
     
     for (i = 0; i < 80; i++) {
-        t1 = h + S1(e) + ch(e, f, g) + k[i] + w[i];
+        t1 = h + S1(e) + ch(e, f, g) + _sha512k[i] + w[i];
         t2 = S0(a) + maj(a, b, c);
         h = g, g = f, f = e, e = d + t1, d = c, c = b, b = a, a = t1 + t2;
     }
@@ -597,6 +603,42 @@ uint32_t BRMurmur3_32(const void *data, size_t dataLen, uint32_t seed)
     return h;
 }
 
+// murmurHash3 (x86_32) of data for each of seedCount seeds, computed in a single pass over data - the per block mixing
+// doesn't depend on the seed, so it's shared by every hash, and the seed lanes are updated in a loop with no cross-lane
+// dependency that the compiler can vectorize
+void BRMurmur3_32Seeds(uint32_t hashes[], const void *data, size_t dataLen, const uint32_t seeds[], size_t seedCount)
+{
+    const uint8_t *d = data;
+    uint32_t k = 0;
+    size_t i, j, count = dataLen/4;
+    
+    assert(hashes != NULL || seedCount == 0);
+    assert(seeds != NULL || seedCount == 0);
+    assert(data != NULL || dataLen == 0);
+    
+    for (j = 0; j < seedCount; j++) hashes[j] = seeds[j];
+    
+    for (i = 0; i < count*4; i += 4) {
+        k = (((uint32_t)d[i + 3] << 24) | ((uint32_t)d[i + 2] << 16) |
+             ((uint32_t)d[i + 1] <<  8) | ((uint32_t)d[i]))*C1;
+        k = rol32(k, 15)*C2;
+        for (j = 0; j < seedCount; j++) hashes[j] = rol32(hashes[j] ^ k, 13)*5 + 0xe6546b64;
+    }
+    
+    k = 0;
+    
+    switch (dataLen & 3) {
+        case 3: k ^= d[i + 2] << 16; // fall through
+        case 2: k ^= d[i + 1] << 8;  // fall through
+        case 1: k ^= d[i], k *= C1, k = rol32(k, 15)*C2;
+    }
+    
+    for (j = 0; j < seedCount; j++) {
+        hashes[j] ^= k ^ (uint32_t)dataLen;
+        fmix32(hashes[j]);
+    }
+}
+
 #define sipround(a, b, c, d) a += b, b = rol64(b, 13) ^ a, a = rol64(a, 32), c += d, d = rol64(d, 16) ^ c,\
                              a += d, d = rol64(d, 21) ^ a, c += b, b = rol64(b, 17) ^ c, c = rol64(c, 32)
 
@@ -705,11 +747,85 @@ void BRHMACDRBG(void *out, size_t outLen, void *K, void *V, void (*hash)(void *,
     }
 }
 
-static void _BRPoly1305Compress(uint32_t h[5], const void *key32, const void *data, size_t dataLen, int final)
+#if defined(__SIZEOF_INT128__)
+// poly1305 with h and r in 44, 44 and 42 bit limbs, the accumulator is kept in h between calls, mac16 is written to
+// after the last block if not NULL: https://github.com/floodyberry/poly1305-donna
+static void _BRPoly1305Compress(uint64_t h[3], const void *key32, const void *data, size_t dataLen, void *mac16)
 {
-    uint32_t x[4], b, t0, t1, t2, t3, t4, r0, r1, r2, r3, r4;
+    uint64_t x[2], c, g0, g1, g2, t0, t1, r0, r1, r2, s1, s2, h0 = h[0], h1 = h[1], h2 = h[2];
+    unsigned __int128 d0, d1, d2;
+    
+    // r &= 0xffffffc0ffffffc0ffffffc0fffffff
+    memcpy(x, key32, 16);
+    t0 = le64(x[0]), t1 = le64(x[1]);
+    r0 = t0 & 0xffc0fffffff, r1 = ((t0 >> 44) | (t1 << 20)) & 0xfffffc0ffff, r2 = (t1 >> 24) & 0x00ffffffc0f;
+    s1 = r1*(5 << 2), s2 = r2*(5 << 2);
+    
+    for (size_t i = 0; i < dataLen; i += 16) { // process data in 16 byte blocks
+        if (i + 16 > dataLen) {
+            memcpy(x, (const uint8_t *)data + i, dataLen - i);
+            memset((uint8_t *)x + (dataLen - i), 0, 16 - (dataLen - i)); // clear remainder of x
+            ((uint8_t *)x)[dataLen - i] = 1; // append padding
+        }
+        else memcpy(x, (const uint8_t *)data + i, 16);
+        
+        // h += x
+        t0 = le64(x[0]), t1 = le64(x[1]);
+        h0 += t0 & 0xfffffffffff, h1 += ((t0 >> 44) | (t1 << 20)) & 0xfffffffffff;
+        h2 += ((t1 >> 24) & 0x3ffffffffff) | ((i + 16 <= dataLen) ? ((uint64_t)1 << 40) : 0);
+        
+        // h *= r
+        d0 = (unsigned __int128)h0*r0 + (unsigned __int128)h1*s2 + (unsigned __int128)h2*s1;
+        d1 = (unsigned __int128)h0*r1 + (unsigned __int128)h1*r0 + (unsigned __int128)h2*s2;
+        d2 = (unsigned __int128)h0*r2 + (unsigned __int128)h1*r1 + (unsigned __int128)h2*r0;
+        
+        // (partial) h %= p
+        c = (uint64_t)(d0 >> 44), h0 = (uint64_t)d0 & 0xfffffffffff;
+        d1 += c, c = (uint64_t)(d1 >> 44), h1 = (uint64_t)d1 & 0xfffffffffff;
+        d2 += c, c = (uint64_t)(d2 >> 42), h2 = (uint64_t)d2 & 0x3ffffffffff;
+        h0 += c*5, c = h0 >> 44, h0 &= 0xfffffffffff, h1 += c;
+    }
+    
+    if (mac16) {
+        // fully carry h
+        c = h1 >> 44, h1 &= 0xfffffffffff, h2 += c, c = h2 >> 42, h2 &= 0x3ffffffffff, h0 += c*5;
+        c = h0 >> 44, h0 &= 0xfffffffffff, h1 += c, c = h1 >> 44, h1 &= 0xfffffffffff, h2 += c;
+        c = h2 >> 42, h2 &= 0x3ffffffffff, h0 += c*5, c = h0 >> 44, h0 &= 0xfffffffffff, h1 += c;
+        
+        // compute h + -p
+        g0 = h0 + 5, c = g0 >> 44, g0 &= 0xfffffffffff, g1 = h1 + c, c = g1 >> 44, g1 &= 0xfffffffffff;
+        g2 = h2 + c - ((uint64_t)1 << 42);
+        
+        // select h if h < p, or h + -p if h >= p
+        c = (g2 >> 63) - 1, g0 &= c, g1 &= c, g2 &= c, c = ~c;
+        h0 = (h0 & c) | g0, h1 = (h1 & c) | g1, h2 = (h2 & c) | g2;
+        
+        // mac = (h + pad) % (2^128)
+        memcpy(x, (const uint8_t *)key32 + 16, 16);
+        t0 = le64(x[0]), t1 = le64(x[1]);
+        h0 += t0 & 0xfffffffffff, c = h0 >> 44, h0 &= 0xfffffffffff;
+        h1 += (((t0 >> 44) | (t1 << 20)) & 0xfffffffffff) + c, c = h1 >> 44, h1 &= 0xfffffffffff;
+        h2 += ((t1 >> 24) & 0x3ffffffffff) + c, h2 &= 0x3ffffffffff;
+        x[0] = le64(h0 | (h1 << 44)), x[1] = le64((h1 >> 20) | (h2 << 24));
+        memcpy(mac16, x, 16);
+    }
+    
+    h[0] = h0, h[1] = h1, h[2] = h2;
+    var_clean(&d0, &d1, &d2);
+    mem_clean(x, sizeof(x));
+    var_clean(&c, &g0, &g1, &g2, &t0, &t1, &r0, &r1, &r2, &s1, &s2, &h0, &h1, &h2);
+}
+#else
+// poly1305 with h and r in 26 bit limbs, the accumulator is kept in h between calls, packed two limbs per word, mac16
+// is written to after the last block if not NULL
+static void _BRPoly1305Compress(uint64_t acc[3], const void *key32, const void *data, size_t dataLen, void *mac16)
+{
+    uint32_t x[4], h[5], b, t0, t1, t2, t3, t4, r0, r1, r2, r3, r4;
     uint64_t d0, d1, d2, d3, d4;
 
+    h[0] = (uint32_t)acc[0], h[1] = (uint32_t)(acc[0] >> 32), h[2] = (uint32_t)acc[1];
+    h[3] = (uint32_t)(acc[1] >> 32), h[4] = (uint32_t)acc[2];
+    
     // r &= 0xffffffc0ffffffc0ffffffc0fffffff
     memcpy(x, key32, 16);
     t0 = le32(x[0]), t1 = le32(x[1]), t2 = le32(x[2]), t3 = le32(x[3]);
@@ -743,7 +859,7 @@ static void _BRPoly1305Compress(uint32_t h[5], const void *key32, const void *da
         h[0] = (d0 & 0x03ffffff) + (uint32_t)(d4 >> 26)*5, h[1] += h[0] >> 26, h[0] &= 0x03ffffff;
     }
     
-    if (final) {
+    if (mac16) {
         // fully carry h
         h[2] += h[1] >> 26, h[1] &= 0x03ffffff, h[3] += h[2] >> 26, h[2] &= 0x03ffffff, h[4] += h[3] >> 26;
         h[3] &= 0x03ffffff, h[0] += (h[4] >> 26)*5, h[4] &= 0x03ffffff, h[1] += h[0] >> 26, h[0] &= 0x03ffffff;
@@ -764,26 +880,30 @@ static void _BRPoly1305Compress(uint32_t h[5], const void *key32, const void *da
         memcpy(x, (const uint8_t *)key32 + 16, 16);
         d0 = (uint64_t)h[0] + le32(x[0]), d1 = (uint64_t)h[1] + le32(x[1]) + (d0 >> 32);
         d2 = (uint64_t)h[2] + le32(x[2]) + (d1 >> 32), d3 = (uint64_t)h[3] + le32(x[3]) + (d2 >> 32);
-        h[0] = le32((uint32_t)d0), h[1] = le32((uint32_t)d1), h[2] = le32((uint32_t)d2), h[3] = le32((uint32_t)d3);
+        x[0] = le32((uint32_t)d0), x[1] = le32((uint32_t)d1), x[2] = le32((uint32_t)d2), x[3] = le32((uint32_t)d3);
+        memcpy(mac16, x, 16);
     }
     
+    acc[0] = h[0] | ((uint64_t)h[1] << 32), acc[1] = h[2] | ((uint64_t)h[3] << 32), acc[2] = h[4];
+    
     var_clean(&d0, &d1, &d2, &d3, &d4);
     mem_clean(x, sizeof(x));
+    mem_clean(h, sizeof(h));
     var_clean(&b, &t0, &t1, &t2, &t3, &t4, &r0, &r1, &r2, &r3, &r4);
 }
+#endif
 
 // poly1305 authenticator: https://tools.ietf.org/html/rfc7539
 // NOTE: must use constant time mem comparison when verifying mac to defend against timing attacks
 void BRPoly1305(void *mac16, const void *key32, const void *data, size_t dataLen)
 {
-    uint32_t h[5] = { 0, 0, 0, 0, 0 };
+    uint64_t h[3] = { 0, 0, 0 };
     
     assert(mac16 != NULL);
     assert(data != NULL || dataLen == 0);
     assert(key32 != NULL);
     
-    _BRPoly1305Compress(h, key32, data, dataLen, 1);
-    memcpy(mac16, h, 16);
+    _BRPoly1305Compress(h, key32, data, dataLen, mac16);
     mem_clean(h, sizeof(h));
 }
 
@@ -791,12 +911,79 @@ void BRPoly1305(void *mac16, const void *key32, const void *data, size_t dataLen
 #define qr(a, b, c, d) ((a) += (b), (d) = rol32((d) ^ (a), 16), (c) += (d), (b) = rol32((b) ^ (c), 12),\
                         (a) += (b), (d) = rol32((d) ^ (a), 8), (c) += (d), (b) = rol32((b) ^ (c), 7))
 
+#if defined(__GNUC__) && (defined(__SSE2__) || defined(__ARM_NEON))
+#define CHACHA20_BLOCKS 8
+
+typedef uint32_t _v32x8_t __attribute__((vector_size(32)));
+
+// xors 8 consecutive chacha20 keystream blocks with 512 bytes of data, one block per vector lane, and advances the
+// block counter in s[12..13], the vector operations lower to pairs of 128bit instructions without avx2
+static inline __attribute__((always_inline)) void _BRChacha20Blocks(uint8_t *out, const uint8_t *data, uint32_t s[16])
+{
+    _v32x8_t x[16], t[16], zero = { 0 };
+    uint32_t b[16][CHACHA20_BLOCKS], w;
+    
+    for (int i = 0; i < 16; i++) x[i] = zero + s[i];
+    x[12] += (_v32x8_t) { 0, 1, 2, 3, 4, 5, 6, 7 };
+    x[13] -= (_v32x8_t)(x[12] < s[12]); // carry into the high word of the counter
+    memcpy(t, x, sizeof(t));
+    
+    for (int i = 0; i < 10; i++) {
+        qr(x[0], x[4], x[8], x[12]), qr(x[1], x[5], x[9], x[13]), qr(x[2], x[6], x[10], x[14]);
+        qr(x[3], x[7], x[11], x[15]), qr(x[0], x[5], x[10], x[15]), qr(x[1], x[6], x[11], x[12]);
+        qr(x[2], x[7], x[8], x[13]), qr(x[3], x[4], x[9], x[14]);
+    }
+    
+    for (int i = 0; i < 16; i++) x[i] += t[i];
+    memcpy(b, x, sizeof(b));
+    
+    for (int j = 0; j < CHACHA20_BLOCKS; j++) {
+        for (int i = 0; i < 16; i++) {
+            memcpy(&w, &data[j*64 + i*4], sizeof(w));
+            w ^= le32(b[i][j]);
+            memcpy(&out[j*64 + i*4], &w, sizeof(w));
+        }
+    }
+    
+    s[12] += CHACHA20_BLOCKS;
+    if (s[12] < CHACHA20_BLOCKS) s[13]++;
+    mem_clean(x, sizeof(x));
+    mem_clean(t, sizeof(t));
+    mem_clean(b, sizeof(b));
+    var_clean(&w);
+}
+
+static void _BRChacha20BlocksDefault(uint8_t *out, const uint8_t *data, uint32_t s[16])
+{
+    _BRChacha20Blocks(out, data, s);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static void _BRChacha20BlocksAVX2(uint8_t *out, const uint8_t *data, uint32_t s[16])
+{
+    _BRChacha20Blocks(out, data, s);
+}
+#endif
+
+static void (*_BRChacha20BlocksFn)(uint8_t *out, const uint8_t *data, uint32_t s[16]) = _BRChacha20BlocksDefault;
+static pthread_once_t _chacha20_once = PTHREAD_ONCE_INIT;
+
+static void _chacha20_init(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) _BRChacha20BlocksFn = _BRChacha20BlocksAVX2;
+#endif
+}
+#endif
+
 // chacha20 stream cipher: https://cr.yp.to/chacha.html
 void BRChacha20(void *out, const void *key32, const void *iv8, const void *data, size_t dataLen, uint64_t counter)
 {
     static const char sigma[16] = "expand 32-byte k";
     uint32_t b[16], s[16], x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15;
-    size_t i, j;
+    size_t i = 0, j;
     
     assert(out != NULL || dataLen == 0);
     assert(data != NULL || dataLen == 0);
@@ -809,8 +996,17 @@ void BRChacha20(void *out, const void *key32, const void *iv8, const void *data,
     s[13] = le32(counter >> 32);
     memcpy(&s[14], iv8, 8);
     for (i = 0; i < 16; i++) s[i] = le32(s[i]);
+    i = 0;
+    
+#if CHACHA20_BLOCKS
+    if (dataLen >= 64*CHACHA20_BLOCKS) pthread_once(&_chacha20_once, _chacha20_init);
+    
+    for (; i + 64*CHACHA20_BLOCKS <= dataLen; i += 64*CHACHA20_BLOCKS) { // data is in place safe, one word at a time
+        _BRChacha20BlocksFn((uint8_t *)out + i, (const uint8_t *)data + i, s);
+    }
+#endif
 
-    for (i = 0; i < dataLen; i++) {
+    for (; i < dataLen; i++) {
         if (i % 64 == 0) {
             x0 = s[0], x1 = s[1], x2 = s[2], x3 = s[3], x4 = s[4], x5 = s[5], x6 = s[6], x7 = s[7];
             x8 = s[8], x9 = s[9], x10 = s[10], x11 = s[11], x12 = s[12], x13 = s[13], x14 = s[14], x15 = s[15];
@@ -837,13 +1033,133 @@ void BRChacha20(void *out, const void *key32, const void *iv8, const void *data,
     mem_clean(b, sizeof(b));
 }
 
+// poly1305 over data in arbitrary pieces, whole 16 byte blocks are compressed right away and the rest is buffered
+static void _BRChacha20Poly1305StreamMac(BRChacha20Poly1305Stream *stream, const void *data, size_t dataLen)
+{
+    size_t n;
+    
+    if (stream->bufLen > 0) {
+        n = (dataLen < 16 - stream->bufLen) ? dataLen : 16 - stream->bufLen;
+        memcpy(&stream->buf[stream->bufLen], data, n);
+        stream->bufLen += n, data = (const uint8_t *)data + n, dataLen -= n;
+        if (stream->bufLen < 16) return;
+        _BRPoly1305Compress(stream->h, stream->macKey, stream->buf, 16, NULL);
+        stream->bufLen = 0;
+    }
+    
+    _BRPoly1305Compress(stream->h, stream->macKey, data, (dataLen/16)*16, NULL);
+    if (dataLen % 16) memcpy(stream->buf, (const uint8_t *)data + (dataLen/16)*16, dataLen % 16);
+    stream->bufLen = dataLen % 16;
+}
+
+// pads the mac input to a 16 byte boundary, as done after the associated data and after the message
+static void _BRChacha20Poly1305StreamMacPad(BRChacha20Poly1305Stream *stream)
+{
+    if (stream->bufLen == 0) return;
+    memset(&stream->buf[stream->bufLen], 0, 16 - stream->bufLen);
+    _BRPoly1305Compress(stream->h, stream->macKey, stream->buf, 16, NULL);
+    stream->bufLen = 0;
+}
+
+// chacha20 over data in arbitrary pieces, keystream left over from a partial block is used by the next piece
+static void _BRChacha20Poly1305StreamXor(BRChacha20Poly1305Stream *stream, void *out, const void *data, size_t dataLen)
+{
+    size_t i = 0, n;
+    
+    for (; i < dataLen && stream->ksLen > 0; i++, stream->ksLen--) {
+        ((uint8_t *)out)[i] = ((const uint8_t *)data)[i] ^ stream->ks[64 - stream->ksLen];
+    }
+    
+    n = ((dataLen - i)/64)*64;
+    BRChacha20((uint8_t *)out + i, stream->key, stream->iv, (const uint8_t *)data + i, n, stream->counter);
+    stream->counter += n/64, i += n;
+    
+    if (i < dataLen) {
+        memset(stream->ks, 0, sizeof(stream->ks));
+        BRChacha20(stream->ks, stream->key, stream->iv, stream->ks, sizeof(stream->ks), stream->counter++);
+        stream->ksLen = 64;
+        
+        for (; i < dataLen; i++, stream->ksLen--) {
+            ((uint8_t *)out)[i] = ((const uint8_t *)data)[i] ^ stream->ks[64 - stream->ksLen];
+        }
+    }
+    
+    stream->dataLen += dataLen;
+}
+
+// writes the poly1305 mac over ad, data and their lengths to mac16 and clears the stream
+static void _BRChacha20Poly1305StreamFinish(BRChacha20Poly1305Stream *stream, void *mac16)
+{
+    uint64_t pad[2];
+    
+    _BRChacha20Poly1305StreamMacPad(stream);
+    pad[0] = le64(stream->adLen);
+    pad[1] = le64(stream->dataLen);
+    _BRPoly1305Compress(stream->h, stream->macKey, pad, 16, mac16);
+    mem_clean(stream, sizeof(*stream));
+}
+
+void BRChacha20Poly1305StreamInit(BRChacha20Poly1305Stream *stream, const void *key32, const void *nonce12,
+                                  const void *ad, size_t adLen)
+{
+    uint64_t counter = 0;
+    
+    assert(stream != NULL);
+    assert(key32 != NULL);
+    assert(nonce12 != NULL);
+    assert(ad != NULL || adLen == 0);
+    
+    memset(stream, 0, sizeof(*stream));
+    memcpy(stream->key, key32, sizeof(stream->key));
+    memcpy(stream->iv, (const uint8_t *)nonce12 + 4, sizeof(stream->iv));
+    memcpy(&((uint32_t *)&counter)[1], nonce12, sizeof(uint32_t));
+    stream->counter = le64(counter);
+    BRChacha20(stream->macKey, stream->key, stream->iv, stream->macKey, sizeof(stream->macKey), stream->counter++);
+    _BRChacha20Poly1305StreamMac(stream, ad, adLen);
+    _BRChacha20Poly1305StreamMacPad(stream);
+    stream->adLen = adLen;
+}
+
+void BRChacha20Poly1305StreamEncrypt(BRChacha20Poly1305Stream *stream, void *buf, size_t bufLen)
+{
+    assert(stream != NULL);
+    assert(buf != NULL || bufLen == 0);
+    _BRChacha20Poly1305StreamXor(stream, buf, buf, bufLen);
+    _BRChacha20Poly1305StreamMac(stream, buf, bufLen);
+}
+
+void BRChacha20Poly1305StreamDecrypt(BRChacha20Poly1305Stream *stream, void *buf, size_t bufLen)
+{
+    assert(stream != NULL);
+    assert(buf != NULL || bufLen == 0);
+    _BRChacha20Poly1305StreamMac(stream, buf, bufLen);
+    _BRChacha20Poly1305StreamXor(stream, buf, buf, bufLen);
+}
+
+void BRChacha20Poly1305StreamFinal(BRChacha20Poly1305Stream *stream, void *mac16)
+{
+    assert(stream != NULL);
+    assert(mac16 != NULL);
+    _BRChacha20Poly1305StreamFinish(stream, mac16);
+}
+
+int BRChacha20Poly1305StreamVerify(BRChacha20Poly1305Stream *stream, const void *mac16)
+{
+    uint8_t mac[16], d = 0;
+    
+    assert(stream != NULL);
+    assert(mac16 != NULL);
+    _BRChacha20Poly1305StreamFinish(stream, mac);
+    for (int i = 0; i < sizeof(mac); i++) d |= mac[i] ^ ((const uint8_t *)mac16)[i]; // constant time compare
+    mem_clean(mac, sizeof(mac));
+    return (d == 0);
+}
+
 // chacha20-poly1305 authenticated encryption with associated data (AEAD): https://tools.ietf.org/html/rfc7539
 size_t BRChacha20Poly1305AEADEncrypt(void *out, size_t outLen, const void *key32, const void *nonce12,
                                      const void *data, size_t dataLen, const void *ad, size_t adLen)
 {
-    const void *iv = (const uint8_t *)nonce12 + 4;
-    uint64_t counter = 0, macKey[4] = { 0, 0, 0, 0 }, pad[2] = { 0, 0 };
-    uint32_t h[5] = { 0, 0, 0, 0, 0 };
+    BRChacha20Poly1305Stream stream;
 
     if (! out) return dataLen + 16;
     if (outLen < dataLen + 16 || dataLen/64 >= UINT32_MAX) return 0;
@@ -853,30 +1169,18 @@ size_t BRChacha20Poly1305AEADEncrypt(void *out, size_t outLen, const void *key32
     assert(data != NULL || dataLen == 0);
     assert(ad != NULL || adLen == 0);
     
-    memcpy(&((uint32_t *)&counter)[1], nonce12, sizeof(uint32_t));    
-    BRChacha20(macKey, key32, iv, macKey, sizeof(macKey), le64(counter));
-    _BRPoly1305Compress(h, macKey, ad, (adLen/16)*16, 0);
-    memcpy(pad, (const uint8_t *)ad + (adLen/16)*16, adLen % 16);
-    if (adLen % 16) _BRPoly1305Compress(h, macKey, pad, 16, 0);
-    BRChacha20(out, key32, iv, data, dataLen, le64(counter) + 1);
-    _BRPoly1305Compress(h, macKey, out, (dataLen/16)*16, 0);
-    pad[0] = pad[1] = 0;
-    memcpy(pad, (const uint8_t *)out + (dataLen/16)*16, dataLen % 16);
-    if (dataLen % 16) _BRPoly1305Compress(h, macKey, pad, 16, 0);
-    pad[0] = le64(adLen);
-    pad[1] = le64(dataLen);
-    _BRPoly1305Compress(h, macKey, pad, 16, 1);
-    mem_clean(macKey, sizeof(macKey));
-    memcpy((uint8_t *)out + dataLen, h, 16);
+    BRChacha20Poly1305StreamInit(&stream, key32, nonce12, ad, adLen);
+    _BRChacha20Poly1305StreamXor(&stream, out, data, dataLen); // out may be the same as data
+    _BRChacha20Poly1305StreamMac(&stream, out, dataLen);
+    _BRChacha20Poly1305StreamFinish(&stream, (uint8_t *)out + dataLen);
     return dataLen + 16;
 }
 
 size_t BRChacha20Poly1305AEADDecrypt(void *out, size_t outLen, const void *key32, const void *nonce12,
                                      const void *data, size_t dataLen, const void *ad, size_t adLen)
 {
-    const void *iv = (const uint8_t *)nonce12 + 4;
-    uint64_t counter = 0, macKey[4] = { 0, 0, 0, 0 }, pad[2] = { 0, 0 };
-    uint32_t h[5] = { 0, 0, 0, 0, 0 }, mac[4];
+    BRChacha20Poly1305Stream stream;
+    uint64_t counter;
     
     if (! out) return (dataLen < 16) ? 0 : dataLen - 16;
     if (dataLen < 16 || (dataLen - 16)/64 >= UINT32_MAX || outLen + 16 < dataLen) return 0;
@@ -887,22 +1191,12 @@ size_t BRChacha20Poly1305AEADDecrypt(void *out, size_t outLen, const void *key32
     assert(ad != NULL || adLen == 0);
 
     outLen = dataLen - 16;
-    memcpy(&((uint32_t *)&counter)[1], nonce12, sizeof(uint32_t));
-    BRChacha20(macKey, key32, iv, macKey, sizeof(macKey), le64(counter));
-    _BRPoly1305Compress(h, macKey, ad, (adLen/16)*16, 0);
-    memcpy(pad, (const uint8_t *)ad + (adLen/16)*16, adLen % 16);
-    if (adLen % 16) _BRPoly1305Compress(h, macKey, pad, 16, 0);
-    _BRPoly1305Compress(h, macKey, data, (outLen/16)*16, 0);
-    pad[0] = pad[1] = 0;
-    memcpy(pad, (const uint8_t *)data + (outLen/16)*16, outLen % 16);
-    if (outLen % 16) _BRPoly1305Compress(h, macKey, pad, 16, 0);
-    pad[0] = le64(adLen);
-    pad[1] = le64(outLen);
-    _BRPoly1305Compress(h, macKey, pad, 16, 1);
-    mem_clean(macKey, sizeof(macKey));
-    memcpy(mac, (const uint8_t *)data + outLen, 16);
-    if ((mac[0] ^ h[0]) | (mac[1] ^ h[1]) | (mac[2] ^ h[2]) | (mac[3] ^ h[3]) != 0) outLen = 0; // constant time compare
-    BRChacha20(out, key32, iv, data, outLen, le64(counter) + 1);
+    BRChacha20Poly1305StreamInit(&stream, key32, nonce12, ad, adLen);
+    counter = stream.counter;
+    _BRChacha20Poly1305StreamMac(&stream, data, outLen);
+    stream.dataLen = outLen;
+    if (! BRChacha20Poly1305StreamVerify(&stream, (const uint8_t *)data + outLen)) return 0;
+    BRChacha20(out, key32, (const uint8_t *)nonce12 + 4, data, outLen, counter); // out may be the same as data
     return outLen;
 }
 
@@ -1117,6 +1411,11 @@ void BRPBKDF2(void *dk, size_t dkLen, void (*hash)(void *, const void *, size_t)
     assert(salt != NULL || saltLen == 0);
     assert(rounds > 0);
     
+    if (hash == BRSHA512 && hashLen == 512/8) { // use precomputed hmac key states
+        BRPBKDF2SHA512Batch(&dk, dkLen, &pw, &pwLen, &salt, &saltLen, rounds, 1);
+        return;
+    }
+    
     memcpy(s, salt, saltLen);
     
     for (i = 0; i < (dkLen + hashLen - 1)/hashLen; i++) {
@@ -1139,6 +1438,299 @@ void BRPBKDF2(void *dk, size_t dkLen, void (*hash)(void *, const void *, size_t)
     mem_clean(T, sizeof(T));
 }
 
+// hmac-sha512 key state, the sha512 states after compressing (key xor ipad) and (key xor opad) are computed once per
+// key so that hmac over a short message costs two compressions instead of four
+typedef struct {
+    uint64_t istate[8], ostate[8];
+} _BRHMACSHA512Ctx;
+
+static void _BRHMACSHA512Init(_BRHMACSHA512Ctx *ctx, const void *key, size_t keyLen)
+{
+    static const uint64_t iv[] = { 0x6a09e667f3bcc908, 0xbb67ae8584caa73b, 0x3c6ef372fe94f82b, 0xa54ff53a5f1d36f1,
+                                   0x510e527fade682d1, 0x9b05688c2b3e6c1f, 0x1f83d9abfb41bd6b, 0x5be0cd19137e2179 };
+    uint64_t k[16], x[16];
+    
+    memset(k, 0, sizeof(k));
+    if (keyLen > sizeof(k)) BRSHA512(k, key, keyLen);
+    else if (keyLen > 0) memcpy(k, key, keyLen);
+    
+    for (int i = 0; i < 16; i++) x[i] = k[i] ^ 0x3636363636363636;
+    memcpy(ctx->istate, iv, sizeof(iv));
+    _BRSHA512Compress(ctx->istate, x);
+    for (int i = 0; i < 16; i++) x[i] = k[i] ^ 0x5c5c5c5c5c5c5c5c;
+    memcpy(ctx->ostate, iv, sizeof(iv));
+    _BRSHA512Compress(ctx->ostate, x);
+    mem_clean(k, sizeof(k));
+    mem_clean(x, sizeof(x));
+}
+
+// finishes hmac-sha512 given the inner hash state u, returns mac in u as native endian words
+static void _BRHMACSHA512Outer(uint64_t u[8], const _BRHMACSHA512Ctx *ctx)
+{
+    uint64_t x[16] = { 0, 0, 0, 0, 0, 0, 0, 0, be64(0x8000000000000000), 0, 0, 0, 0, 0, 0, be64((uint64_t)(128 + 64)*8) };
+    
+    for (int i = 0; i < 8; i++) x[i] = be64(u[i]);
+    memcpy(u, ctx->ostate, sizeof(ctx->ostate));
+    _BRSHA512Compress(u, x);
+    mem_clean(x, sizeof(x));
+}
+
+// mac = hmac_sha512(key, data) as native endian words
+static void _BRHMACSHA512(uint64_t mac[8], const _BRHMACSHA512Ctx *ctx, const void *data, size_t dataLen)
+{
+    size_t i;
+    uint64_t x[16];
+    
+    memcpy(mac, ctx->istate, sizeof(ctx->istate));
+    
+    for (i = 0; i + 128 <= dataLen; i += 128) { // process data in 128 byte blocks
+        memcpy(x, (const uint8_t *)data + i, 128);
+        _BRSHA512Compress(mac, x);
+    }
+    
+    memset(x, 0, sizeof(x));
+    if (dataLen > i) memcpy(x, (const uint8_t *)data + i, dataLen - i);
+    ((uint8_t *)x)[dataLen - i] = 0x80; // append padding
+    if (dataLen - i >= 112) _BRSHA512Compress(mac, x), memset(x, 0, 128); // length goes to next block
+    x[15] = be64((uint64_t)(128 + dataLen)*8); // append length in bits, including the key block
+    _BRSHA512Compress(mac, x);
+    _BRHMACSHA512Outer(mac, ctx);
+    mem_clean(x, sizeof(x));
+}
+
+// u = hmac_sha512(key, u), where u is a 64 byte message held as native endian words
+static void _BRHMACSHA512Round(uint64_t u[8], const _BRHMACSHA512Ctx *ctx)
+{
+    uint64_t x[16] = { 0, 0, 0, 0, 0, 0, 0, 0, be64(0x8000000000000000), 0, 0, 0, 0, 0, 0, be64((uint64_t)(128 + 64)*8) };
+    
+    for (int i = 0; i < 8; i++) x[i] = be64(u[i]);
+    memcpy(u, ctx->istate, sizeof(ctx->istate));
+    _BRSHA512Compress(u, x);
+    _BRHMACSHA512Outer(u, ctx);
+    mem_clean(x, sizeof(x));
+}
+
+// with simd support, independent pbkdf2 derivations run side by side, one per vector lane
+#if defined(__GNUC__) && defined(__AVX512F__)
+#define SHA512_LANES 8
+#elif defined(__GNUC__) && defined(__AVX2__)
+#define SHA512_LANES 4
+#elif defined(__GNUC__) && (defined(__SSE2__) || defined(__ARM_NEON))
+#define SHA512_LANES 2
+#else
+#define SHA512_LANES 1
+#endif
+
+#if SHA512_LANES > 1
+typedef uint64_t _v64x_t __attribute__((vector_size(SHA512_LANES*sizeof(uint64_t))));
+
+// sha512 compression of SHA512_LANES independent blocks, block words are native endian
+static void _BRSHA512CompressLanes(_v64x_t *r, const _v64x_t *x)
+{
+    int i;
+    _v64x_t a = r[0], b = r[1], c = r[2], d = r[3], e = r[4], f = r[5], g = r[6], h = r[7], t1, t2, w[80];
+    
+    for (i = 0; i < 16; i++) w[i] = x[i];
+    for (; i < 80; i++) w[i] = S3(w[i - 2]) + w[i - 7] + S2(w[i - 15]) + w[i - 16];
+    
+    for (i = 0; i < 80; i++) {
+        t1 = h + S1(e) + ch(e, f, g) + _sha512k[i] + w[i];
+        t2 = S0(a) + maj(a, b, c);
+        h = g, g = f, f = e, e = d + t1, d = c, c = b, b = a, a = t1 + t2;
+    }
+    
+    r[0] += a, r[1] += b, r[2] += c, r[3] += d, r[4] += e, r[5] += f, r[6] += g, r[7] += h;
+    var_clean(&a, &b, &c, &d, &e, &f, &g, &h, &t1, &t2);
+    mem_clean(w, sizeof(w));
+}
+#endif
+
+// runs pbkdf2 rounds 2..rounds for the first lanes entries of U, T, and ctx, where U holds U1 on entry and T holds
+// the resulting Ti, all as native endian words
+static void _BRPBKDF2SHA512Lanes(uint64_t T[][8], uint64_t U[][8], const _BRHMACSHA512Ctx ctx[], size_t lanes,
+                                 unsigned rounds)
+{
+#if SHA512_LANES > 1
+    if (lanes > 1) {
+        _v64x_t is[8], os[8], u[8], t[8], s[8], x[16], zero = { 0 };
+        
+        for (int j = 0; j < 8; j++) {
+            for (size_t l = 0; l < SHA512_LANES; l++) { // unused lanes repeat lane 0, their results are discarded
+                is[j][l] = ctx[(l < lanes) ? l : 0].istate[j];
+                os[j][l] = ctx[(l < lanes) ? l : 0].ostate[j];
+                u[j][l] = U[(l < lanes) ? l : 0][j];
+            }
+            
+            t[j] = u[j];
+        }
+        
+        x[8] = zero + 0x8000000000000000, x[15] = zero + (128 + 64)*8; // padding and length of a 64 byte message
+        for (int j = 9; j < 15; j++) x[j] = zero;
+        
+        for (unsigned r = 1; r < rounds; r++) {
+            memcpy(x, u, sizeof(u));
+            memcpy(s, is, sizeof(s));
+            _BRSHA512CompressLanes(s, x); // inner hash
+            memcpy(x, s, sizeof(s));
+            memcpy(u, os, sizeof(u));
+            _BRSHA512CompressLanes(u, x); // outer hash
+            for (int j = 0; j < 8; j++) t[j] ^= u[j]; // Ti = U1 ^ U2 ^ ... ^ Urounds
+        }
+        
+        for (size_t l = 0; l < lanes; l++) {
+            for (int j = 0; j < 8; j++) T[l][j] = t[j][l];
+        }
+        
+        mem_clean(is, sizeof(is));
+        mem_clean(os, sizeof(os));
+        mem_clean(u, sizeof(u));
+        mem_clean(t, sizeof(t));
+        mem_clean(s, sizeof(s));
+        mem_clean(x, sizeof(x));
+        return;
+    }
+#endif
+    
+    for (size_t l = 0; l < lanes; l++) {
+        memcpy(T[l], U[l], sizeof(T[l]));
+        
+        for (unsigned r = 1; r < rounds; r++) {
+            _BRHMACSHA512Round(U[l], &ctx[l]); // Urounds = hmac_hash(pw, Urounds-1)
+            for (int j = 0; j < 8; j++) T[l][j] ^= U[l][j]; // Ti = U1 ^ U2 ^ ... ^ Urounds
+        }
+    }
+}
+
+// pbkdf2-hmac-sha512 over count independent passwords: dk[i] = pbkdf2(sha512, pw[i], salt[i], rounds, dkLen)
+// the hmac key pads are hashed once per password, and passwords are processed SHA512_LANES at a time when simd is
+// available, so bulk derivation is several times faster than calling BRPBKDF2() repeatedly
+void BRPBKDF2SHA512Batch(void *dk[], size_t dkLen, const void *pw[], const size_t pwLen[], const void *salt[],
+                         const size_t saltLen[], unsigned rounds, size_t count)
+{
+    _BRHMACSHA512Ctx ctx[SHA512_LANES];
+    uint64_t U[SHA512_LANES][8], T[SHA512_LANES][8];
+    uint32_t i, be;
+    
+    assert(dk != NULL || count == 0);
+    assert(pw != NULL || count == 0);
+    assert(pwLen != NULL || count == 0);
+    assert(salt != NULL || count == 0);
+    assert(saltLen != NULL || count == 0);
+    assert(rounds > 0);
+    
+    for (size_t n = 0; n < count; n += SHA512_LANES) {
+        size_t lanes = (count - n < SHA512_LANES) ? count - n : SHA512_LANES;
+        
+        for (size_t l = 0; l < lanes; l++) {
+            assert(dk[n + l] != NULL || dkLen == 0);
+            assert(pw[n + l] != NULL || pwLen[n + l] == 0);
+            assert(salt[n + l] != NULL || saltLen[n + l] == 0);
+            _BRHMACSHA512Init(&ctx[l], pw[n + l], pwLen[n + l]);
+        }
+        
+        for (i = 0; i < (dkLen + 64 - 1)/64; i++) {
+            for (size_t l = 0; l < lanes; l++) {
+                uint8_t s[saltLen[n + l] + sizeof(uint32_t)];
+                
+                be = be32(i + 1);
+                if (saltLen[n + l] > 0) memcpy(s, salt[n + l], saltLen[n + l]);
+                memcpy(s + saltLen[n + l], &be, sizeof(be));
+                _BRHMACSHA512(U[l], &ctx[l], s, sizeof(s)); // U1 = hmac_hash(pw, salt || be32(i))
+                mem_clean(s, sizeof(s));
+            }
+            
+            _BRPBKDF2SHA512Lanes(T, U, ctx, lanes, rounds);
+            
+            for (size_t l = 0; l < lanes; l++) { // dk = T1 || T2 || ... || Tdklen/hlen
+                for (int j = 0; j < 8; j++) U[l][j] = be64(T[l][j]);
+                memcpy((uint8_t *)dk[n + l] + i*64, U[l], (i*64 + 64 <= dkLen) ? 64 : dkLen % 64);
+            }
+        }
+    }
+    
+    mem_clean(ctx, sizeof(ctx));
+    mem_clean(U, sizeof(U));
+    mem_clean(T, sizeof(T));
+}
+
+#if defined(__SSE2__)
+#define _mm_rol_epi32(x, n) _mm_xor_si128(_mm_slli_epi32((x), (n)), _mm_srli_epi32((x), 32 - (n)))
+
+// salsa20/8 with the block stored as diagonals, b[i/4][i%4] = x[i*5 % 16], so that each step of a quarter round
+// operates on four words at once and rows become columns with a word rotation of b[1..3]
+static void _salsa20_8_sse2(__m128i b[4])
+{
+    __m128i x0 = b[0], x1 = b[1], x2 = b[2], x3 = b[3], t;
+    
+    for (unsigned i = 0; i < 8; i += 2) {
+        // operate on columns
+        t = _mm_add_epi32(x0, x3), x1 = _mm_xor_si128(x1, _mm_rol_epi32(t, 7));
+        t = _mm_add_epi32(x1, x0), x2 = _mm_xor_si128(x2, _mm_rol_epi32(t, 9));
+        t = _mm_add_epi32(x2, x1), x3 = _mm_xor_si128(x3, _mm_rol_epi32(t, 13));
+        t = _mm_add_epi32(x3, x2), x0 = _mm_xor_si128(x0, _mm_rol_epi32(t, 18));
+        x1 = _mm_shuffle_epi32(x1, 0x93), x2 = _mm_shuffle_epi32(x2, 0x4e), x3 = _mm_shuffle_epi32(x3, 0x39);
+        
+        // operate on rows
+        t = _mm_add_epi32(x0, x1), x3 = _mm_xor_si128(x3, _mm_rol_epi32(t, 7));
+        t = _mm_add_epi32(x3, x0), x2 = _mm_xor_si128(x2, _mm_rol_epi32(t, 9));
+        t = _mm_add_epi32(x2, x3), x1 = _mm_xor_si128(x1, _mm_rol_epi32(t, 13));
+        t = _mm_add_epi32(x1, x2), x0 = _mm_xor_si128(x0, _mm_rol_epi32(t, 18));
+        x1 = _mm_shuffle_epi32(x1, 0x39), x2 = _mm_shuffle_epi32(x2, 0x4e), x3 = _mm_shuffle_epi32(x3, 0x93);
+    }
+    
+    b[0] = _mm_add_epi32(b[0], x0), b[1] = _mm_add_epi32(b[1], x1);
+    b[2] = _mm_add_epi32(b[2], x2), b[3] = _mm_add_epi32(b[3], x3);
+}
+
+static void _blockmix_salsa8_sse2(__m128i *dest, const __m128i *src, __m128i *b, unsigned r)
+{
+    memcpy(b, &src[(2*r - 1)*4], 64);
+    
+    for (unsigned i = 0; i < 2*r; i += 2) {
+        for (unsigned j = 0; j < 4; j++) b[j] = _mm_xor_si128(b[j], src[i*4 + j]);
+        _salsa20_8_sse2(b);
+        memcpy(&dest[i*2], b, 64);
+        for (unsigned j = 0; j < 4; j++) b[j] = _mm_xor_si128(b[j], src[i*4 + 4 + j]);
+        _salsa20_8_sse2(b);
+        memcpy(&dest[i*2 + r*4], b, 64);
+    }
+}
+
+// scrypt romix of a single 128*r byte lane b in place, v must be 16 byte aligned and hold 128*r*n bytes
+static void _scrypt_romix(uint32_t *b, void *v, unsigned n, unsigned r)
+{
+    __m128i x[8*r], y[8*r], z[4], *w = v;
+    uint32_t m;
+    
+    for (unsigned k = 0; k < 2*r; k++) { // store each 64 byte block as diagonals
+        for (unsigned j = 0; j < 16; j++) ((uint32_t *)x)[k*16 + j] = le32(b[k*16 + j*5 % 16]);
+    }
+    
+    for (unsigned j = 0; j < n; j += 2) {
+        memcpy(&w[j*(8*r)], x, 128*r);
+        _blockmix_salsa8_sse2(y, x, z, r);
+        memcpy(&w[(j + 1)*(8*r)], y, 128*r);
+        _blockmix_salsa8_sse2(x, y, z, r);
+    }
+    
+    for (unsigned j = 0; j < n; j += 2) { // word 0 of each block stays in place, so integerify reads it directly
+        m = (uint32_t)_mm_cvtsi128_si32(x[(2*r - 1)*4]) & (n - 1);
+        for (unsigned k = 0; k < 8*r; k++) x[k] = _mm_xor_si128(x[k], w[m*(8*r) + k]);
+        _blockmix_salsa8_sse2(y, x, z, r);
+        m = (uint32_t)_mm_cvtsi128_si32(y[(2*r - 1)*4]) & (n - 1);
+        for (unsigned k = 0; k < 8*r; k++) y[k] = _mm_xor_si128(y[k], w[m*(8*r) + k]);
+        _blockmix_salsa8_sse2(x, y, z, r);
+    }
+    
+    for (unsigned k = 0; k < 2*r; k++) {
+        for (unsigned j = 0; j < 16; j++) b[k*16 + j*5 % 16] = le32(((uint32_t *)x)[k*16 + j]);
+    }
+    
+    mem_clean(x, sizeof(x));
+    mem_clean(y, sizeof(y));
+    mem_clean(z, sizeof(z));
+}
+#else
 // salsa20/8 stream cipher: http://cr.yp.to/snuffle.html
 static void _salsa20_8(uint32_t b[16])
 {
@@ -1177,14 +1769,76 @@ static void _blockmix_salsa8(uint64_t *dest, const uint64_t *src, uint64_t *b, u
     }
 }
 
+// scrypt romix of a single 128*r byte lane b in place, v must hold 128*r*n bytes
+static void _scrypt_romix(uint32_t *b, void *v, unsigned n, unsigned r)
+{
+    uint64_t x[16*r], y[16*r], z[8], *w = v, m;
+    
+    for (unsigned j = 0; j < 32*r; j++) ((uint32_t *)x)[j] = le32(b[j]);
+    
+    for (unsigned j = 0; j < n; j += 2) {
+        memcpy(&w[j*(16*r)], x, 128*r);
+        _blockmix_salsa8(y, x, z, r);
+        memcpy(&w[(j + 1)*(16*r)], y, 128*r);
+        _blockmix_salsa8(x, y, z, r);
+    }
+    
+    for (unsigned j = 0; j < n; j += 2) {
+        m = le64(x[(2*r - 1)*8]) & (n - 1);
+        for (unsigned k = 0; k < 16*r; k++) x[k] ^= w[m*(16*r) + k];
+        _blockmix_salsa8(y, x, z, r);
+        m = le64(y[(2*r - 1)*8]) & (n - 1);
+        for (unsigned k = 0; k < 16*r; k++) y[k] ^= w[m*(16*r) + k];
+        _blockmix_salsa8(x, y, z, r);
+    }
+    
+    for (unsigned j = 0; j < 32*r; j++) b[j] = le32(((uint32_t *)x)[j]);
+    mem_clean(x, sizeof(x));
+    mem_clean(y, sizeof(y));
+    mem_clean(z, sizeof(z));
+}
+#endif
+
+// a share of the p scrypt lanes: first, first + step, first + 2*step, ...
+typedef struct {
+    uint32_t *b;
+    unsigned n, r, p, first, step;
+    int done; // false if the scratch buffer couldn't be allocated, so none of the lanes were run
+} _BRScryptLanes;
+
+static void *_BRScryptLanesRoutine(void *arg)
+{
+    _BRScryptLanes *lanes = arg;
+    size_t vLen = (size_t)128*lanes->r*lanes->n;
+    uint8_t *buf = malloc(vLen + 63);
+    void *v = (void *)(((uintptr_t)buf + 63) & ~(uintptr_t)63);
+    
+    lanes->done = (buf != NULL);
+    if (! buf) return NULL;
+    
+    for (unsigned i = lanes->first; i < lanes->p; i += lanes->step) {
+        _scrypt_romix(&lanes->b[i*32*lanes->r], v, lanes->n, lanes->r);
+    }
+    
+    mem_clean(v, vLen);
+    free(buf);
+    return NULL;
+}
+
 // scrypt key derivation: http://www.tarsnap.com/scrypt.html
-void BRScrypt(void *dk, size_t dkLen, const void *pw, size_t pwLen, const void *salt, size_t saltLen,
-              unsigned n, unsigned r, unsigned p)
+// the p lanes are independent and are spread over up to SCRYPT_THREADS_MAX threads, each using 128*r*n bytes
+// returns false, with dk zeroed, if not even one 128*r*n byte scratch buffer could be allocated
+int BRScrypt(void *dk, size_t dkLen, const void *pw, size_t pwLen, const void *salt, size_t saltLen,
+             unsigned n, unsigned r, unsigned p)
 {
-    uint64_t x[16*r], y[16*r], z[8], *v = malloc(128*r*n), m;
     uint32_t b[32*r*p];
+    _BRScryptLanes lanes[SCRYPT_THREADS_MAX];
+    pthread_t threads[SCRYPT_THREADS_MAX];
+    pthread_attr_t attr;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned i, count = (p < SCRYPT_THREADS_MAX) ? p : SCRYPT_THREADS_MAX, started = 1;
+    int ok = 1;
     
-    assert(v != NULL);
     assert(dk != NULL || dkLen == 0);
     assert(pw != NULL || pwLen == 0);
     assert(salt != NULL || saltLen == 0);
@@ -1192,35 +1846,30 @@ void BRScrypt(void *dk, size_t dkLen, const void *pw, size_t pwLen, const void *
     assert(r > 0);
     assert(p > 0);
     
+    if (cpus > 0 && count > cpus) count = (unsigned)cpus;
+    if (count == 0) count = 1;
+    
     BRPBKDF2(b, sizeof(b), BRSHA256, 256/8, pw, pwLen, salt, saltLen, 1);
+    for (i = 0; i < count; i++) lanes[i] = (_BRScryptLanes) { b, n, r, p, i, count, 0 };
     
-    for (int i = 0; i < p; i++) {
-        for (unsigned j = 0; j < 32*r; j++) ((uint32_t *)x)[j] = le32(b[i*32*r + j]);
-        
-        for (unsigned j = 0; j < n; j += 2) {
-            memcpy(&v[j*(16*r)], x, 128*r);
-            _blockmix_salsa8(y, x, z, r);
-            memcpy(&v[(j + 1)*(16*r)], y, 128*r);
-            _blockmix_salsa8(x, y, z, r);
-        }
-        
-        for (unsigned j = 0; j < n; j += 2) {
-            m = le64(x[(2*r - 1)*8]) & (n - 1);
-            for (unsigned k = 0; k < 16*r; k++) x[k] ^= v[m*(16*r) + k];
-            _blockmix_salsa8(y, x, z, r);
-            m = le64(y[(2*r - 1)*8]) & (n - 1);
-            for (unsigned k = 0; k < 16*r; k++) y[k] ^= v[m*(16*r) + k];
-            _blockmix_salsa8(x, y, z, r);
-        }
-        
-        for (unsigned j = 0; j < 32*r; j++) b[i*32*r + j] = le32(((uint32_t *)x)[j]);
+    if (count > 1 && pthread_attr_init(&attr) == 0) {
+        while (started < count &&
+               pthread_create(&threads[started], &attr, _BRScryptLanesRoutine, &lanes[started]) == 0) started++;
+        pthread_attr_destroy(&attr);
     }
     
-    BRPBKDF2(dk, dkLen, BRSHA256, 256/8, pw, pwLen, b, sizeof(b), 1);
+    for (i = started; i < count; i++) _BRScryptLanesRoutine(&lanes[i]); // threads that couldn't be created
+    _BRScryptLanesRoutine(&lanes[0]);
+    for (i = 1; i < started; i++) pthread_join(threads[i], NULL);
+    
+    // lanes whose scratch buffer couldn't be allocated are retried one at a time, now that the other buffers are freed
+    for (i = 0; ok && i < count; i++) {
+        if (! lanes[i].done) _BRScryptLanesRoutine(&lanes[i]);
+        ok = lanes[i].done;
+    }
+    
+    if (ok) BRPBKDF2(dk, dkLen, BRSHA256, 256/8, pw, pwLen, b, sizeof(b), 1);
+    else if (dkLen > 0) mem_clean(dk, dkLen);
     mem_clean(b, sizeof(b));
-    mem_clean(x, sizeof(x));
-    mem_clean(y, sizeof(y));
-    mem_clean(z, sizeof(z));
-    mem_clean(v, 128*r*n);
-    free(v);
+    return ok;
 }
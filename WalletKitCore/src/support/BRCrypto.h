@@ -66,6 +66,9 @@ void BRMD5(void *md16, const void *data, size_t dataLen);
 // murmurHash3 (x86_32): https://code.google.com/p/smhasher/ - for non cryptographic use only
 uint32_t BRMurmur3_32(const void *data, size_t dataLen, uint32_t seed);
 
+// sets hashes[i] to BRMurmur3_32(data, dataLen, seeds[i]) for each of seedCount seeds, reading data only once
+void BRMurmur3_32Seeds(uint32_t hashes[], const void *data, size_t dataLen, const uint32_t seeds[], size_t seedCount);
+
 // sipHash-64: https://131002.net/siphash
 uint64_t BRSip64(const void *key16, const void *data, size_t dataLen);
     
@@ -91,6 +94,29 @@ size_t BRChacha20Poly1305AEADEncrypt(void *out, size_t outLen, const void *key32
 
 size_t BRChacha20Poly1305AEADDecrypt(void *out, size_t outLen, const void *key32, const void *nonce12,
                                      const void *data, size_t dataLen, const void *ad, size_t adLen);
+
+// chacha20-poly1305 AEAD over a message supplied in pieces of any size, encrypted or decrypted in place
+// the resulting ciphertext and mac are the same as BRChacha20Poly1305AEADEncrypt() over the whole message
+typedef struct {
+    uint64_t h[3], macKey[4], counter, adLen, dataLen;
+    uint8_t key[32], iv[8], ks[64], buf[16];
+    size_t ksLen, bufLen;
+} BRChacha20Poly1305Stream;
+
+void BRChacha20Poly1305StreamInit(BRChacha20Poly1305Stream *stream, const void *key32, const void *nonce12,
+                                  const void *ad, size_t adLen);
+
+void BRChacha20Poly1305StreamEncrypt(BRChacha20Poly1305Stream *stream, void *buf, size_t bufLen);
+
+// NOTE: decrypted data must not be used until BRChacha20Poly1305StreamVerify() returns true
+void BRChacha20Poly1305StreamDecrypt(BRChacha20Poly1305Stream *stream, void *buf, size_t bufLen);
+
+// writes the 16 byte mac after the last BRChacha20Poly1305StreamEncrypt() and clears stream
+void BRChacha20Poly1305StreamFinal(BRChacha20Poly1305Stream *stream, void *mac16);
+
+// returns true if mac16 matches the data passed to BRChacha20Poly1305StreamDecrypt(), compared in constant time, and
+// clears stream
+int BRChacha20Poly1305StreamVerify(BRChacha20Poly1305Stream *stream, const void *mac16);
     
 // aes-ecb block cipher
 void BRAESECBEncrypt(void *buf16, const void *key, size_t keyLen);
@@ -104,9 +130,17 @@ void BRAESCTR_OFFSET(void *out, size_t outLen, const void *key, size_t keyLen, v
 void BRPBKDF2(void *dk, size_t dkLen, void (*hash)(void *, const void *, size_t), size_t hashLen,
               const void *pw, size_t pwLen, const void *salt, size_t saltLen, unsigned rounds);
 
+// pbkdf2-hmac-sha512 over count independent passwords: dk[i] = pbkdf2(sha512, pw[i], salt[i], rounds, dkLen)
+void BRPBKDF2SHA512Batch(void *dk[], size_t dkLen, const void *pw[], const size_t pwLen[], const void *salt[],
+                         const size_t saltLen[], unsigned rounds, size_t count);
+
+#define SCRYPT_THREADS_MAX 4 // BRScrypt() spreads its p lanes over at most this many threads
+
 // scrypt key derivation: http://www.tarsnap.com/scrypt.html
-void BRScrypt(void *dk, size_t dkLen, const void *pw, size_t pwLen, const void *salt, size_t saltLen,
-              unsigned n, unsigned r, unsigned p);
+// the p lanes are independent and are spread over up to SCRYPT_THREADS_MAX threads, each using 128*r*n bytes
+// returns false, with dk zeroed, if not even one 128*r*n byte scratch buffer could be allocated
+int BRScrypt(void *dk, size_t dkLen, const void *pw, size_t pwLen, const void *salt, size_t saltLen,
+             unsigned n, unsigned r, unsigned p);
 
 // zeros out memory in a way that can't be optimized out by the compiler
 inline static void mem_clean(void *ptr, size_t len)
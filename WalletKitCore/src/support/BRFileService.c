@@ -41,6 +41,7 @@ typedef int sqlite3_status_code;
 #define FILE_SERVICE_INITIAL_HANDLER_COUNT    (2)
 
 #define FILE_SERVICE_SDB_FILENAME      "entities.db"
+#define FILE_SERVICE_HEADERS_FILENAME  "headers"
 
 #define FILE_SERVICE_SDB_ENTITY_TABLE     \
 "CREATE TABLE IF NOT EXISTS Entity(     \n\
@@ -224,6 +225,13 @@ fileServiceCreateFilePath (const char *basePath,
     return sdbPath;
 }
 
+extern char *
+fileServiceCreateHeadersPath (const char *basePath,
+                              const char *currency,
+                              const char *network) {
+    return fileServiceCreateFilePath (basePath, currency, network, FILE_SERVICE_HEADERS_FILENAME);
+}
+
 extern BRFileService
 fileServiceCreate (const char *basePath,
                    const char *currency,
@@ -646,6 +654,70 @@ fileServiceSave (BRFileService fs,
 
 /// MARK: - Load
 
+#define FILE_SERVICE_LOAD_BUFFER_COUNT          (8196)
+
+typedef struct {
+    char *data;                 // the hex-encoded `data`, copied from the query row
+    void *entity;               // the entity read from `data`, or NULL if `reason` is set
+    BRFileServiceVersion version;
+    BRFileServiceHeaderFormatVersion headerVersion;
+    const char *reason;
+    int isEntityFailure;        // `reason` is from the entity reader, not the implementation
+} BRFileServiceRow;
+
+// Decode the hex-encoded `data` of a query row, into `buffer` if it is large enough, and read its
+// entity into `row`.  On failure `row->entity` is NULL and `row->reason` is set.  This touches
+// nothing shared but the entity type's handlers, which are not changed during a load, so rows
+// can be read on any thread.
+static void
+fileServiceReadRow (BRFileService fs,
+                    BRFileServiceEntityType *entityType,
+                    const char *data,
+                    uint8_t *buffer,
+                    size_t bufferCount,
+                    BRFileServiceRow *row) {
+    size_t dataCount = strlen (data);
+    assert (0 == dataCount % 2);  // Surely 'even'
+
+    size_t   dataBytesCount = dataCount/2;
+    uint8_t *dataBytes      = (dataBytesCount <= bufferCount ? buffer : malloc (dataBytesCount));
+    hexDecode (dataBytes, dataBytesCount, data, dataCount);
+
+    size_t offset = 0;
+    uint32_t entityBytesCount = 0;
+
+    if (dataBytesCount >= 1 + 1 + sizeof (uint32_t)) {
+        row->headerVersion = dataBytes[offset];
+        offset += 1;
+
+        switch (row->headerVersion) {
+            case HEADER_FORMAT_1:
+                row->version = dataBytes[offset];
+                offset += 1;
+
+                entityBytesCount = UInt32GetBE (&dataBytes[offset]);
+                offset += sizeof (uint32_t);
+                break;
+        }
+    }
+
+    BRFileServiceEntityHandler *handler = fileServiceEntityTypeLookupHandler (entityType, row->version);
+
+    // Assert entityBytesCount remain in dataBytes
+    if (0 == offset || offset + entityBytesCount > dataBytesCount) {
+        assert (0); // In DEBUG builds.
+        row->reason = "missed bytes count";
+    }
+    else if (NULL == handler)
+        row->reason = "missed type handler";
+    else if (NULL == (row->entity = handler->reader (handler->context, fs, &dataBytes[offset], entityBytesCount))) {
+        row->reason = "reader";
+        row->isEntityFailure = 1;
+    }
+
+    if (dataBytes != buffer) free (dataBytes);
+}
+
 extern int
 fileServiceLoad (BRFileService fs,
                  BRSet *results,
@@ -671,105 +743,202 @@ fileServiceLoad (BRFileService fs,
     if (SQLITE_OK != status)
         return fileServiceFailedSDB (fs, 1, status);
 
-    uint8_t  dataBytesBuffer[8196];
-    uint8_t *dataBytes = dataBytesBuffer;
-    size_t   dataBytesCount = 8196;
-
-    // Zero out the dataByte memory to avoid subsequent Clang Static Analysis errors releted
-    // to dereferencing uninitialized memory.  We accept this minimal, extraneous function call.
-    memset(dataBytes, 0, dataBytesCount);
+    uint8_t dataBytesBuffer[FILE_SERVICE_LOAD_BUFFER_COUNT];
 
     while (SQLITE_ROW == sqlite3_step(fs->sdbSelectAllStmt)) {
         const char *hash = (const char *) sqlite3_column_text (fs->sdbSelectAllStmt, 0);
         const char *data = (const char *) sqlite3_column_text (fs->sdbSelectAllStmt, 1);
 
         if (NULL == hash || NULL == data)
-            return fileServiceFailedImpl (fs, 1, (dataBytes == dataBytesBuffer ? NULL : dataBytes), NULL,
-                                          "missed query `hash` or `data`");
+            return fileServiceFailedImpl (fs, 1, NULL, NULL, "missed query `hash` or `data`");
 
         assert (64 == strlen (hash));
-        
-        // Ensure `dataBytes` is large enough for hex-decoded `data`
-        size_t dataCount = strlen (data);
-        assert (0 == dataCount % 2);  // Surely 'even'
-        if ((dataCount/2) > dataBytesCount) {
-            if (dataBytes != dataBytesBuffer) free (dataBytes);
-            dataBytesCount = dataCount/2;
-            dataBytes = malloc (dataBytesCount);
-        }
 
-        // Actually decode `data` into `dataBytes`
-        hexDecode (dataBytes, dataCount/2, data, dataCount);
+        BRFileServiceRow row = { NULL, NULL, 0, 0, NULL, 0 };
+        fileServiceReadRow (fs, entityType, data, dataBytesBuffer, sizeof (dataBytesBuffer), &row);
 
-        size_t offset = 0;
-        BRFileServiceVersion version;
-        uint32_t  entityBytesCount;
-        uint8_t  *entityBytes;
-
-        BRFileServiceHeaderFormatVersion headerVersion = dataBytes[offset];
-        offset += 1;
-
-        switch (headerVersion) {
-            case HEADER_FORMAT_1:
-                version = dataBytes[offset];
-                offset += 1;
-
-                entityBytesCount = UInt32GetBE (&dataBytes[offset]);
-                offset += sizeof (uint32_t);
-
-                break;
-        }
-
-        // Assert entityBytesCount remain in dataBytes
-        if (offset + entityBytesCount > dataBytesCount) {
-            assert (0); // In DEBUG builds.
-            return fileServiceFailedImpl (fs, 1, (dataBytes == dataBytesBuffer ? NULL : dataBytes), NULL,
-                                          "missed bytes count");
-        }
-
-        entityBytes = &dataBytes[offset];
-
-        switch (headerVersion) {
-            case HEADER_FORMAT_1:
-                // compute then compare checksum
-                break;
-        }
-
-        // Look up the entity handler
-        BRFileServiceEntityHandler *handler = fileServiceEntityTypeLookupHandler(entityType, version);
-        if (NULL == handler)
-            return fileServiceFailedImpl (fs, 1, (dataBytes == dataBytesBuffer ? NULL : dataBytes), NULL,
-                                          "missed type handler");
-
-        // Read the entity from buffer and add to results.
-        void *entity = handler->reader (handler->context, fs, entityBytes, entityBytesCount);
-        if (NULL == entity)
-            return fileServiceFailedEntity (fs, 1, (dataBytes == dataBytesBuffer ? NULL : dataBytes), NULL,
-                                            type, "reader");
+        if (NULL == row.entity)
+            return (row.isEntityFailure
+                    ? fileServiceFailedEntity (fs, 1, NULL, NULL, type, row.reason)
+                    : fileServiceFailedImpl   (fs, 1, NULL, NULL, row.reason));
 
         // Update restuls with the newly restored entity
-        void *oldEntity = BRSetAdd (results, entity);
+        void *oldEntity = BRSetAdd (results, row.entity);
         assert (NULL == oldEntity);  // DEBUG builds
         if (NULL != oldEntity)
-            return fileServiceFailedEntity (fs, 1, (dataBytes == dataBytesBuffer ? NULL : dataBytes), NULL,
-                                            type, "duplicate set entry");
+            return fileServiceFailedEntity (fs, 1, NULL, NULL, type, "duplicate set entry");
 
         // If the read version is not the current version, update
         if (updateVersion &&
-            (version != entityType->currentVersion ||
-             headerVersion != currentHeaderFormatVersion))
+            (row.version != entityType->currentVersion ||
+             row.headerVersion != currentHeaderFormatVersion))
             // This could signal an error.  Perhaps we should test the return result and
             // if `0` skip out here?  We won't - we couldn't save the entity in the new format
             // but we'll continue and will try next time we load it.
-            _fileServiceSave (fs, type, entity, 0);
+            _fileServiceSave (fs, type, row.entity, 0);
     }
 
     // Ensure the 'implicit DB transaction' is committed.
     sqlite3_reset (fs->sdbSelectAllStmt);
 
     pthread_mutex_unlock (&fs->lock);
+#endif // !defined(NEUTER_FILE_SERVICE)
+
+    return 1;
+}
+
+/// MARK: - Load Concurrently
+
+#define FILE_SERVICE_LOAD_BATCH_COUNT           (4096)
+#define FILE_SERVICE_LOAD_ROWS_PER_THREAD_MIN   (64)
 
-    if (dataBytes != dataBytesBuffer) free (dataBytes);
+typedef struct {
+    BRFileService fs;
+    BRFileServiceEntityType *entityType;
+    BRFileServiceRow *rows;
+    size_t rowsCount;
+} BRFileServiceRowsSlice;
+
+static void *
+fileServiceReadRowsThread (void *info) {
+    BRFileServiceRowsSlice *slice = info;
+    uint8_t buffer[FILE_SERVICE_LOAD_BUFFER_COUNT];
+
+    for (size_t index = 0; index < slice->rowsCount; index++) {
+        BRFileServiceRow *row = &slice->rows[index];
+
+        fileServiceReadRow (slice->fs, slice->entityType, row->data, buffer, sizeof (buffer), row);
+        free (row->data);
+        row->data = NULL;
+    }
+
+    return NULL;
+}
+
+// Read `rows` split into contiguous slices, one per thread, with the calling thread reading the
+// first slice.  Falls back to reading every row on the calling thread if threads can't be created.
+static void
+fileServiceReadRows (BRFileService fs,
+                     BRFileServiceEntityType *entityType,
+                     BRFileServiceRow *rows,
+                     size_t rowsCount,
+                     size_t threadsCount) {
+    if (threadsCount > rowsCount / FILE_SERVICE_LOAD_ROWS_PER_THREAD_MIN)
+        threadsCount = rowsCount / FILE_SERVICE_LOAD_ROWS_PER_THREAD_MIN;
+    if (threadsCount < 1) threadsCount = 1;
+
+    BRFileServiceRowsSlice slices[threadsCount];
+    pthread_t threads[threadsCount];
+    size_t threadsStarted = 1;
+
+    for (size_t index = 0; index < threadsCount; index++) {
+        size_t start = index * rowsCount / threadsCount, end = (index + 1) * rowsCount / threadsCount;
+        slices[index] = (BRFileServiceRowsSlice) { fs, entityType, &rows[start], end - start };
+    }
+
+    while (threadsStarted < threadsCount &&
+           0 == pthread_create (&threads[threadsStarted], NULL, fileServiceReadRowsThread, &slices[threadsStarted]))
+        threadsStarted++;
+
+    fileServiceReadRowsThread (&slices[0]);
+
+    for (size_t index = 1; index < threadsStarted; index++)
+        pthread_join (threads[index], NULL);
+
+    for (size_t index = threadsStarted; index < threadsCount; index++)
+        fileServiceReadRowsThread (&slices[index]);
+}
+
+extern int
+fileServiceLoadConcurrently (BRFileService fs,
+                             BRSet *results,
+                             const char *type,
+                             int updateVersion,
+                             size_t threadsCount) {
+    BRFileServiceEntityType *entityType = fileServiceLookupType (fs, type);
+    if (NULL == entityType) return fileServiceFailedImpl (fs, 0, NULL, NULL, "missed type");
+
+    BRFileServiceEntityHandler *entityHandlerCurrent = fileServiceEntityTypeLookupHandler(entityType, entityType->currentVersion);
+    if (NULL == entityHandlerCurrent) return fileServiceFailedImpl (fs,  0, NULL, NULL, "missed type handler");
+
+#if !defined(NEUTER_FILE_SERVICE)
+    sqlite3_status_code status;
+
+    pthread_mutex_lock (&fs->lock);
+    if (fs->sdbClosed)
+        return fileServiceFailedImpl (fs, 1, NULL, NULL, "closed");
+
+    sqlite3_reset (fs->sdbSelectAllStmt);
+    sqlite3_clear_bindings (fs->sdbSelectAllStmt);
+
+    status = sqlite3_bind_text (fs->sdbSelectAllStmt, 1, type, -1, SQLITE_STATIC);
+    if (SQLITE_OK != status)
+        return fileServiceFailedSDB (fs, 1, status);
+
+    // The query rows are stepped through on this thread, a batch at a time, as SQLite requires;
+    // the rows of each batch are then decoded and read concurrently and added to `results` in
+    // order, just as `fileServiceLoad()` would have added them.
+    BRFileServiceRow *rows = calloc (FILE_SERVICE_LOAD_BATCH_COUNT, sizeof (BRFileServiceRow));
+    size_t rowsCount;
+    int    rowsDone = 0;
+
+    while (!rowsDone) {
+        for (rowsCount = 0; rowsCount < FILE_SERVICE_LOAD_BATCH_COUNT; rowsCount++) {
+            if (SQLITE_ROW != sqlite3_step (fs->sdbSelectAllStmt)) { rowsDone = 1; break; }
+
+            const char *hash = (const char *) sqlite3_column_text (fs->sdbSelectAllStmt, 0);
+            const char *data = (const char *) sqlite3_column_text (fs->sdbSelectAllStmt, 1);
+
+            if (NULL == hash || NULL == data) {
+                for (size_t index = 0; index < rowsCount; index++) free (rows[index].data);
+                return fileServiceFailedImpl (fs, 1, rows, NULL, "missed query `hash` or `data`");
+            }
+
+            assert (64 == strlen (hash));
+            rows[rowsCount] = (BRFileServiceRow) { strdup (data), NULL, 0, 0, NULL, 0 };
+        }
+
+        if (0 == rowsCount) break;
+        fileServiceReadRows (fs, entityType, rows, rowsCount, threadsCount);
+
+        for (size_t index = 0; index < rowsCount; index++) {
+            BRFileServiceRow *row = &rows[index];
+
+            if (NULL == row->entity) {
+                // Entities already read in this batch are handed to `results` so that the
+                // caller frees them along with everything loaded before the failure.
+                for (size_t other = index + 1; other < rowsCount; other++)
+                    if (NULL != rows[other].entity) BRSetAdd (results, rows[other].entity);
+
+                return (row->isEntityFailure
+                        ? fileServiceFailedEntity (fs, 1, rows, NULL, type, row->reason)
+                        : fileServiceFailedImpl   (fs, 1, rows, NULL, row->reason));
+            }
+
+            // Update restuls with the newly restored entity
+            void *oldEntity = BRSetAdd (results, row->entity);
+            assert (NULL == oldEntity);  // DEBUG builds
+            if (NULL != oldEntity) {
+                for (size_t other = index + 1; other < rowsCount; other++)
+                    if (NULL != rows[other].entity) BRSetAdd (results, rows[other].entity);
+
+                return fileServiceFailedEntity (fs, 1, rows, NULL, type, "duplicate set entry");
+            }
+
+            // If the read version is not the current version, update
+            if (updateVersion &&
+                (row->version != entityType->currentVersion ||
+                 row->headerVersion != currentHeaderFormatVersion))
+                _fileServiceSave (fs, type, row->entity, 0);
+        }
+    }
+
+    free (rows);
+
+    // Ensure the 'implicit DB transaction' is committed.
+    sqlite3_reset (fs->sdbSelectAllStmt);
+
+    pthread_mutex_unlock (&fs->lock);
 #endif // !defined(NEUTER_FILE_SERVICE)
 
     return 1;
@@ -936,6 +1105,13 @@ fileServiceWipe (const char *basePath,
     // Remove it.
     result  = (0 == remove (sdbPath) ? 0 : errno);
     free (sdbPath);
+
+    // Locate the header store, which only some currencies have
+    char *headersPath = fileServiceCreateFilePath (basePath, currency, network, FILE_SERVICE_HEADERS_FILENAME);
+
+    // Remove it, if it exists
+    if (0 != remove (headersPath) && ENOENT != errno && 0 == result) result = errno;
+    free (headersPath);
 #endif
 
     return result;
@@ -129,6 +129,26 @@ fileServiceLoad (BRFileService fs,
                  const char *type,   /* blocks, peers, transactions, logs, ... */
                  int updateVersion);
 
+/**
+ * Load all entities of `type` adding each to `results`, as `fileServiceLoad()` does, but with the
+ * decoding and reading of the stored entities spread over up to `threadsCount` threads.  The
+ * type's reader for every stored version must be safe to call concurrently.
+ *
+ * @param fs The fileServie
+ * @param results A BRSet within which to store the results.
+ * @param type The type to restore
+ * @param updateVersion If true (1) update old versions with newer ones.
+ * @param threadsCount The maximum number of threads, including the calling thread, to read with
+ *
+ * @return true (1) if success, false (0) otherwise;
+ */
+extern int
+fileServiceLoadConcurrently (BRFileService fs,
+                             BRSet *results,
+                             const char *type,
+                             int updateVersion,
+                             size_t threadsCount);
+
 extern int  // 1 -> success, 0 -> failure
 fileServiceSave (BRFileService fs,
                  const char *type,  /* block, peers, transactions, logs, ... */
@@ -244,6 +264,22 @@ fileServiceCreateFromTypeSpecifications(const char *basePath,
                                         size_t specificationsCount,
                                         BRFileServiceTypeSpecification *specfications);
 
+///
+/// Returns the path of the memory mapped header store kept alongside the file service data for
+/// `currency` and `network`.  The header store is not managed by the file service, but it is
+/// deleted along with the file service data by `fileServiceWipe()`.
+///
+/// @param basePath
+/// @param currency
+/// @param network
+///
+/// @return the path, which the caller must free
+///
+extern char *
+fileServiceCreateHeadersPath (const char *basePath,
+                              const char *currency,
+                              const char *network);
+
 ///
 /// Deletes file system data
 ///
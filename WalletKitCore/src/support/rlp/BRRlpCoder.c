@@ -39,6 +39,21 @@ encodeLengthIntoBytes (uint64_t length, uint8_t baseline, uint8_t *bytes9, uint8
 
 #define CODER_DEFAULT_ITEMS     (2000)
 
+/**
+ * Busy item tracking.  When enabled, every coder keeps a doubly-linked list of acquired items,
+ * protected by `coder->lock`, and asserts in rlpCoderRelease() that every item was returned.  It
+ * is purely a leak check and is enabled by default in DEBUG builds only; release builds neither
+ * track busy items nor lock - a coder must not be used by two threads at once.  Use
+ * rlpCoderCreateFromPool() to get a coder owned by the calling thread.
+ */
+#if !defined (RLP_CODER_TRACK_BUSY)
+#  if defined (DEBUG)
+#    define RLP_CODER_TRACK_BUSY    (1)
+#  else
+#    define RLP_CODER_TRACK_BUSY    (0)
+#  endif
+#endif
+
 /**
  * An RLP Encoding is comprised of two types: an ITEM and a LIST (of ITEM).
  *
@@ -48,7 +63,9 @@ typedef enum {
     CODER_LIST,
 } BRRlpItemType;
 
-#define ITEM_DEFAULT_BYTES_COUNT  1024
+// Sized to hold, with the RLP length prefix, a UInt256, a hash or an address.  Anything larger
+// is malloc'd in itemEnsureBytes().
+#define ITEM_DEFAULT_BYTES_COUNT    40
 #define ITEM_DEFAULT_ITEMS_COUNT    15
 
 struct  BRRlpItemRecord {
@@ -57,15 +74,19 @@ struct  BRRlpItemRecord {
     // The encoding
     size_t bytesCount;
     uint8_t *bytes;
-    uint8_t  bytesArray [ITEM_DEFAULT_BYTES_COUNT];
 
     // If CODER_LIST, then reference the component items.
     size_t itemsCount;
     BRRlpItem *items;
-    BRRlpItem  itemsArray [ITEM_DEFAULT_ITEMS_COUNT];
 
-    // double linked-list of free/busy items.
-    BRRlpItem next, prev;
+    // Singly-linked list of free items; with RLP_CODER_TRACK_BUSY, doubly-linked list of busy items.
+    BRRlpItem next;
+#if RLP_CODER_TRACK_BUSY
+    BRRlpItem prev;
+#endif
+
+    uint8_t    bytesArray [ITEM_DEFAULT_BYTES_COUNT];
+    BRRlpItem  itemsArray [ITEM_DEFAULT_ITEMS_COUNT];
 };
 
 static void
@@ -90,7 +111,9 @@ struct BRRlpCoderRecord {
      * the RLP item and then add it to `free`.
      */
     BRRlpItem free;
+    size_t freeCount;
 
+#if RLP_CODER_TRACK_BUSY
     /**
      * A doubly-linked list of busy RLP items.  Fact is, we don't need to keep this list - you
      * acquire an item and you best be sure to release it and if you don't you've leaked memory.
@@ -111,16 +134,34 @@ struct BRRlpCoderRecord {
      * are only used in one thread.  However, that use my not be generally true - so lock/unlock.
      */
     pthread_mutex_t lock;
+#endif
+
+    /**
+     * The next coder in a per-thread pool; see rlpCoderCreateFromPool()
+     */
+    BRRlpCoder poolNext;
 };
 
+#if RLP_CODER_TRACK_BUSY
+#  define rlpCoderLock(coder)       pthread_mutex_lock   (&(coder)->lock)
+#  define rlpCoderUnlock(coder)     pthread_mutex_unlock (&(coder)->lock)
+#else
+#  define rlpCoderLock(coder)       ((void) (coder))
+#  define rlpCoderUnlock(coder)     ((void) (coder))
+#endif
+
 extern BRRlpCoder
 rlpCoderCreate (void) {
     BRRlpCoder coder = malloc (sizeof (struct BRRlpCoderRecord));
     coder->failed = 0;
     coder->free = NULL;
-    coder->busy = NULL;
+    coder->freeCount = 0;
+    coder->poolNext = NULL;
 
+#if RLP_CODER_TRACK_BUSY
+    coder->busy = NULL;
     pthread_mutex_init_brd (&coder->lock, PTHREAD_MUTEX_NORMAL);
+#endif
 
     return coder;
 }
@@ -135,28 +176,118 @@ _rlpCoderReclaimInternal (BRRlpCoder coder) {
         item = next;
     }
     coder->free = NULL;
+    coder->freeCount = 0;
 }
 
 extern void
 rlpCoderReclaim (BRRlpCoder coder) {
-    pthread_mutex_lock(&coder->lock);
+    rlpCoderLock (coder);
     _rlpCoderReclaimInternal (coder);
-    pthread_mutex_unlock(&coder->lock);
+    rlpCoderUnlock (coder);
 }
 
 extern void
 rlpCoderRelease (BRRlpCoder coder) {
-    pthread_mutex_lock(&coder->lock);
+    rlpCoderLock (coder);
 
+#if RLP_CODER_TRACK_BUSY
     // Every single Item must be returned!
     assert (NULL == coder->busy);
+#endif
     _rlpCoderReclaimInternal (coder);
 
-    pthread_mutex_unlock(&coder->lock);
+    rlpCoderUnlock (coder);
+#if RLP_CODER_TRACK_BUSY
     pthread_mutex_destroy(&coder->lock);
+#endif
     free (coder);
 }
 
+//
+// Per-Thread Coder Pool
+//
+
+// The maximum number of idle coders held by one thread.
+#define CODER_POOL_COUNT_LIMIT          (4)
+
+// A coder returned to the pool holding more free items than this is reclaimed first; an
+// occasional huge decode (e.g. a LES block bodies message) shouldn't pin memory forever.
+#define CODER_POOL_FREE_ITEMS_LIMIT     CODER_DEFAULT_ITEMS
+
+typedef struct {
+    BRRlpCoder coders;
+    size_t     codersCount;
+} BRRlpCoderPool;
+
+static pthread_key_t  rlpCoderPoolKey;
+static pthread_once_t rlpCoderPoolOnce = PTHREAD_ONCE_INIT;
+
+static void
+rlpCoderPoolRelease (void *context) {
+    BRRlpCoderPool *pool = context;
+
+    while (NULL != pool->coders) {
+        BRRlpCoder coder = pool->coders;
+        pool->coders = coder->poolNext;
+        rlpCoderRelease (coder);
+    }
+    free (pool);
+}
+
+static void
+rlpCoderPoolKeyCreate (void) {
+    pthread_key_create (&rlpCoderPoolKey, rlpCoderPoolRelease);
+}
+
+static BRRlpCoderPool *
+rlpCoderPoolGet (void) {
+    pthread_once (&rlpCoderPoolOnce, rlpCoderPoolKeyCreate);
+
+    BRRlpCoderPool *pool = pthread_getspecific (rlpCoderPoolKey);
+    if (NULL == pool) {
+        pool = calloc (1, sizeof (BRRlpCoderPool));
+        pthread_setspecific (rlpCoderPoolKey, pool);
+    }
+    return pool;
+}
+
+extern BRRlpCoder
+rlpCoderCreateFromPool (void) {
+    BRRlpCoderPool *pool = rlpCoderPoolGet();
+
+    if (NULL == pool->coders) return rlpCoderCreate();
+
+    BRRlpCoder coder = pool->coders;
+    pool->coders = coder->poolNext;
+    pool->codersCount -= 1;
+
+    coder->poolNext = NULL;
+    return coder;
+}
+
+extern void
+rlpCoderReleaseToPool (BRRlpCoder coder) {
+    BRRlpCoderPool *pool = rlpCoderPoolGet();
+
+    if (pool->codersCount >= CODER_POOL_COUNT_LIMIT) {
+        rlpCoderRelease (coder);
+        return;
+    }
+
+#if RLP_CODER_TRACK_BUSY
+    // Every single Item must be returned!
+    assert (NULL == coder->busy);
+#endif
+    if (coder->freeCount > CODER_POOL_FREE_ITEMS_LIMIT)
+        _rlpCoderReclaimInternal (coder);
+
+    coder->failed = 0;
+    coder->poolNext = pool->coders;
+
+    pool->coders = coder;
+    pool->codersCount += 1;
+}
+
 static BRRlpItem
 _rlpCoderAcquireItemInternal (BRRlpCoder coder) {
     BRRlpItem item = NULL;
@@ -165,36 +296,44 @@ _rlpCoderAcquireItemInternal (BRRlpCoder coder) {
     if (NULL != coder->free) {
         item = coder->free;
         coder->free = item->next;
+        coder->freeCount -= 1;
         item->next = NULL;
     }
     else item = calloc (1, sizeof (struct BRRlpItemRecord));
 
-    assert (NULL == item->next       && NULL == item->prev &&
+    assert (NULL == item->next       &&
             0    == item->bytesCount && 0    == item->itemsCount);
 
+#if RLP_CODER_TRACK_BUSY
+    assert (NULL == item->prev);
+
     // Doubly-link `item` to `busy`
     if (NULL != coder->busy) coder->busy->prev = item;
     item->next = coder->busy;
 
     // Update `coder` to show `item` as busy.
     coder->busy = item;
+#endif
 
     return item;
 }
 
 static BRRlpItem
 rlpCoderAcquireItem (BRRlpCoder coder) {
-    pthread_mutex_lock(&coder->lock);
+    rlpCoderLock (coder);
     BRRlpItem item = _rlpCoderAcquireItemInternal (coder);
-    pthread_mutex_unlock(&coder->lock);
+    rlpCoderUnlock (coder);
     return item;
 }
 
 static void
 _rlpCoderReturnItemInternal (BRRlpCoder coder, BRRlpItem prev, BRRlpItem item, BRRlpItem next) {
-    assert (NULL == item->next       && NULL == item->prev &&
+    assert (NULL == item->next       &&
             0    == item->bytesCount && 0    == item->itemsCount);
 
+#if RLP_CODER_TRACK_BUSY
+    assert (NULL == item->prev);
+
     // If `item` is a the head of our `busy` list, then just move `busy`
     if (item == coder->busy)
         coder->busy = next;
@@ -205,13 +344,14 @@ _rlpCoderReturnItemInternal (BRRlpCoder coder, BRRlpItem prev, BRRlpItem item, B
         if (NULL != prev) prev->next = next;
         if (NULL != next) next->prev = prev;
     }
+#endif
 
     // The `item` is no longer busy.  Singlely link to `free`.
-    item->prev = NULL;
     item->next = coder->free;
 
     // Update `coder` to show `item` as free.
     coder->free = item;
+    coder->freeCount += 1;
 }
 
 static void
@@ -220,8 +360,13 @@ _rlpCoderReleaseItemInternal (BRRlpCoder coder, BRRlpItem item) {
         _rlpCoderReleaseItemInternal (coder, item->items[index]);
 
     // Surely get these before itemReleaseMemory() blows them away.
+#if RLP_CODER_TRACK_BUSY
     BRRlpItem prev = item->prev;
     BRRlpItem next = item->next;
+#else
+    BRRlpItem prev = NULL;
+    BRRlpItem next = NULL;
+#endif
 
     itemReleaseMemory(item);
     _rlpCoderReturnItemInternal (coder, prev, item, next);
@@ -229,9 +374,9 @@ _rlpCoderReleaseItemInternal (BRRlpCoder coder, BRRlpItem item) {
 
 static void
 rlpCoderReleaseItem (BRRlpCoder coder, BRRlpItem item) {
-    pthread_mutex_lock(&coder->lock);
+    rlpCoderLock (coder);
     _rlpCoderReleaseItemInternal (coder, item);
-    pthread_mutex_unlock(&coder->lock);
+    rlpCoderUnlock (coder);
 }
 
 static int
@@ -1021,10 +1166,11 @@ rlpItemShow (BRRlpCoder coder, BRRlpItem item, const char *topic) {
 
 extern void
 rlpDataShow (BRRlpData data, const char *topic) {
-    BRRlpCoder coder = rlpCoderCreate();
+    BRRlpCoder coder = rlpCoderCreateFromPool();
     BRRlpItem item = rlpDataGetItem(coder, data);
     rlpItemShow (coder, item, topic);
     rlpItemRelease(coder, item);
+    rlpCoderReleaseToPool (coder);
 }
 
 /*
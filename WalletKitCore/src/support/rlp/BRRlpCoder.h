@@ -30,6 +30,23 @@ rlpCoderCreate (void);
 extern void
 rlpCoderRelease (BRRlpCoder coder);
 
+/**
+ * Get a coder from the calling thread's pool, creating one if the pool is empty.  Use this for
+ * short-lived coders, such as in a single file-service read or write, to reuse coder memory
+ * across calls.  Return the coder with rlpCoderReleaseToPool(), after releasing every item.
+ *
+ * A coder does not lock in release builds; a pooled coder is only ever used by one thread at a
+ * time and is thus safe to use without locking.
+ */
+extern BRRlpCoder
+rlpCoderCreateFromPool (void);
+
+/**
+ * Return `coder` to the calling thread's pool.  The coder's failed state is cleared.
+ */
+extern void
+rlpCoderReleaseToPool (BRRlpCoder coder);
+
 /**
  * Reclaim coder memory. A coder can hold memory to avoid repeated free/malloc calls.  If
  * desired one can reclaim coder memory that is unused.